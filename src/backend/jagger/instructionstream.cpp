@@ -57,6 +57,11 @@
 
 #include "types.h"
 #include "interface.h"
+#include "base/Trace.h"
+#include <algorithm>
+#include <cstdlib>
+#include <atomic>
+#include <thread>
 #include <vector>
 
 using namespace clang::threadSafety::til;
@@ -72,6 +77,16 @@ static int lowIndex(unsigned x) {
   return (int)a;
 }
 
+static int lowBit64(unsigned long long x) {
+#ifdef _MSC_VER
+  unsigned long a;
+  _BitScanForward64(&a, x);
+  return (int)a;
+#else
+  return __builtin_ctzll(x);
+#endif
+}
+
 template <typename Type>
 struct RangeAdaptor {
   RangeAdaptor(Type* data, size_t size) : _begin(data), _end(data + size) {}
@@ -128,9 +143,139 @@ namespace Jagger {
 Instruction countedMarker;
 }  // namespace Jagger
 
+// Per-block liveness bitsets, one bit per value (values are identified
+// by the index of their defining instruction, so a set is one word per
+// 64 instructions).  defs holds the values a block defines, uses the
+// values it references but does not define, and liveIn/liveOut come
+// from a single backward sweep over the linearized stream with
+// word-wide OR/AND: liveOut[b] = liveIn[b + 1], liveIn[b] =
+// (liveOut[b] & ~defs[b]) | uses[b].  Treating the stream linearly is
+// a conservative superset of the header-skipping walk: regions the
+// walk would skip keep their bits, which can only add interference.
+struct Liveness {
+  size_t numWords;
+  std::vector<uint64_t> defs, uses, liveIn, liveOut;
+  std::vector<unsigned> blockOf;  // Block index of each instruction.
+
+  bool test(const std::vector<uint64_t>& set, size_t block,
+            size_t value) const {
+    return (set[block * numWords + value / 64] >> (value % 64)) & 1;
+  }
+  bool isDefinedIn(size_t block, size_t value) const {
+    return test(defs, block, value);
+  }
+  bool isLiveIn(size_t block, size_t value) const {
+    return test(liveIn, block, value);
+  }
+  bool isLiveOut(size_t block, size_t value) const {
+    return test(liveOut, block, value);
+  }
+
+  void compute(const Block* blocks, size_t numBlocks,
+               const Instruction* instrs, size_t numInstrs,
+               const unsigned char* opcodes) {
+    numWords = (numInstrs + 63) / 64;
+    defs.assign(numBlocks * numWords, 0);
+    uses.assign(numBlocks * numWords, 0);
+    liveIn.assign(numBlocks * numWords, 0);
+    liveOut.assign(numBlocks * numWords, 0);
+    blockOf.resize(numInstrs);
+
+    for (size_t b = 0; b < numBlocks; b++) {
+      uint64_t* defRow = &defs[b * numWords];
+      uint64_t* useRow = &uses[b * numWords];
+      size_t first = blocks[b].firstInstr;
+      size_t last = first + blocks[b].numInstrs;
+      for (size_t i = first; i < last; i++) {
+        blockOf[i] = (unsigned)b;
+        if (opcodes[i] == Opcode::HEADER) continue;
+        const Instruction& instr = instrs[i];
+        if (instr.opcode.hasResult) defRow[i / 64] |= 1ull << (i % 64);
+        if (instr.arg0) {
+          size_t value = i + instr.arg0;
+          if (value < first || value >= last)
+            useRow[value / 64] |= 1ull << (value % 64);
+        }
+        if (instr.arg1) {
+          size_t value = i + instr.arg1;
+          if (value < first || value >= last)
+            useRow[value / 64] |= 1ull << (value % 64);
+        }
+      }
+    }
+
+    // Information only flows toward earlier blocks, so one descending
+    // sweep reaches the fixpoint.
+    for (size_t b = numBlocks; b-- > 0;) {
+      uint64_t* in = &liveIn[b * numWords];
+      const uint64_t* out = &liveOut[b * numWords];
+      const uint64_t* defRow = &defs[b * numWords];
+      const uint64_t* useRow = &uses[b * numWords];
+      for (size_t w = 0; w < numWords; w++)
+        in[w] = (out[w] & ~defRow[w]) | useRow[w];
+      if (b > 0) {
+        uint64_t* predOut = &liveOut[(b - 1) * numWords];
+        for (size_t w = 0; w < numWords; w++) predOut[w] |= in[w];
+      }
+    }
+  }
+};
+
+// Slab allocator backing the stream's block and instruction arrays.
+// Slabs grow geometrically and reset() retains them, so a stream that
+// is reused across functions stops asking the system for memory once
+// the largest function has been seen.  All records are placed at
+// Alignment-byte boundaries, which covers Block, Instruction and the
+// future Object/Use/Value layouts.
+struct Pool {
+  enum : size_t { FirstSlabSize = 0x10000, Alignment = 16 };
+
+  ~Pool() {
+    for (auto& slab : slabs) free(slab.data);
+  }
+
+  template <typename T>
+  T* allocate(size_t quantity) {
+    size_t bytes = (sizeof(T) * quantity + Alignment - 1) & ~(Alignment - 1);
+    while (current < slabs.size() && offset + bytes > slabs[current].size) {
+      current++;
+      offset = 0;
+    }
+    if (current == slabs.size()) {
+      Slab slab;
+      slab.size = slabs.empty() ? FirstSlabSize : slabs.back().size * 2;
+      while (slab.size < bytes) slab.size *= 2;
+      slab.data = (char*)malloc(slab.size);
+      slabs.push_back(slab);
+      offset = 0;
+    }
+    char* result = slabs[current].data + offset;
+    offset += bytes;
+    return (T*)result;
+  }
+
+  // Recycle all slabs; previously allocated records become invalid.
+  void reset() {
+    current = 0;
+    offset = 0;
+  }
+
+ private:
+  struct Slab {
+    char* data;
+    size_t size;
+  };
+  std::vector<Slab> slabs;
+  size_t current = 0;
+  size_t offset = 0;
+};
+
 //namespace {
 struct InstructionStream {
-  void encode(SCFG* const* cfg, size_t numCFGs);
+  void encode(SCFG* const* cfg, size_t numCFGs, size_t numWorkers = 1);
+
+  size_t countCFG(SCFG* cfg, Block* nextBlock);
+  void emitCFG(SCFG* cfg, Block* nextBlock);
 
   static size_t countInstrs(SExpr* expr);
   Instruction* emitBlockHeader(Instruction* nextInstr, Block* block);
@@ -139,108 +284,141 @@ struct InstructionStream {
   Instruction* emitTerminator(Instruction* nextInstr, Terminator* term, BasicBlock* basicBlock);
 
   void traverse(Instruction* use, Instruction* def);
+  void buildOpcodePlane();
+  void allocateRegisters();
 
   Block* blocks;
   Instruction* instrs;
+  // Structure-of-arrays plane of the opcode codes, parallel to instrs.
+  // Scanning passes that only dispatch on the opcode loop over this
+  // byte plane instead of striding the full records, which keeps them
+  // in one cache line per 64 instructions and open to vectorization.
+  unsigned char* opcodes;
   size_t numBlocks;
   size_t numInstrs;
+  Liveness liveness;
+  Pool pool;
   std::vector<std::pair<int, int>> interactions;
 };
 //}  // namespace
 
+// (Re)build the opcode plane from the current instruction array; must
+// run again whenever the stream is rewritten.
+void InstructionStream::buildOpcodePlane() {
+  opcodes = pool.allocate<unsigned char>(numInstrs);
+  for (size_t i = 0; i < numInstrs; i++)
+    opcodes[i] = (unsigned char)instrs[i].opcode.code;
+}
+
 void InstructionStream::traverse(Instruction* use, Instruction* def) {
-  Instruction* skipUntil = use;
   auto defIndex = (int)(def - instrs);
+  auto useIndex = (int)(use - instrs);
   auto keyIndex = defIndex + def->key;
-#if 0
-  for (Instruction* i = use - 1; i > def; --i) {
-    if (i->opcode.code == Opcode::HEADER) {
-      if (i->opcode.flags)
-        skipUntil = i + i->arg1;
-      else if (i <= skipUntil)
-        i = i + i->arg1;
-      continue;
-    }
-    if (!i->opcode.hasResult) continue;
-    if (def->key == i->key) continue;
+
+  auto interact = [&](Instruction* i) {
+    if (!i->opcode.hasResult) return;
+    if (def->key == i->key) return;
     auto iKeyIndex = (int)(i->getKey() - instrs);
     interactions.push_back(std::make_pair(std::min(keyIndex, iKeyIndex),
                                           std::max(keyIndex, iKeyIndex)));
+  };
+
+  size_t defBlock = liveness.blockOf[defIndex];
+  size_t useBlock = liveness.blockOf[useIndex];
+  if (defBlock == useBlock) {
+    for (Instruction* i = use - 1; i > def; --i) interact(i);
+    return;
   }
-#else
-  for (auto instr : LiveRange(def, use)) {
-    if (!instr.opcode.hasResult) continue;
-    if (def->key == instr.key) continue;
-    auto iKeyIndex = (int)(instr.getKey() - instrs);
-    interactions.push_back(std::make_pair(std::min(keyIndex, iKeyIndex),
-                                          std::max(keyIndex, iKeyIndex)));
+
+  // Walk instructions only in the partial blocks at the range's ends;
+  // every block fully inside the range contributes the set bits of its
+  // def bitset, scanned a word (64 values) at a time.
+  Instruction* defBlockEnd =
+      instrs + blocks[defBlock].firstInstr + blocks[defBlock].numInstrs;
+  for (Instruction* i = defBlockEnd - 1; i > def; --i) interact(i);
+  for (Instruction* i = use - 1,
+                  * e = instrs + blocks[useBlock].firstInstr;
+       i >= e; --i)
+    interact(i);
+
+  for (size_t b = defBlock + 1; b < useBlock; b++) {
+    size_t first = blocks[b].firstInstr;
+    size_t last = first + blocks[b].numInstrs;
+    const uint64_t* defRow = &liveness.defs[b * liveness.numWords];
+    for (size_t w = first / 64; w * 64 < last; w++) {
+      uint64_t bits = defRow[w];
+      while (bits) {
+        size_t value = w * 64 + lowBit64(bits);
+        bits &= bits - 1;
+        interact(instrs + value);
+      }
+    }
   }
-#endif
 }
 
-void InstructionStream::encode(SCFG* const* cfgs, size_t numCFGs) {
+// Workers claim whole CFGs off a shared cursor; function sizes vary
+// wildly, so dynamic claiming beats a static split.
+template <typename Body>
+static void forEachCFG(size_t numCFGs, size_t numWorkers, Body body) {
+  if (numWorkers <= 1 || numCFGs <= 1) {
+    for (size_t i = 0; i < numCFGs; i++) body(i);
+    return;
+  }
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t < numWorkers; t++)
+    workers.emplace_back([&]() {
+      for (size_t i = next++; i < numCFGs; i = next++) body(i);
+    });
+  for (auto& worker : workers) worker.join();
+}
+
+void InstructionStream::encode(SCFG* const* cfgs, size_t numCFGs,
+                               size_t numWorkers) {
+  OHMU_TRACE_SCOPE("jagger-encode");
   if (!numCFGs) return;
 
-  {
-    // Count the blocks.
-    size_t numBlocks = 0;
-    for (auto cfg : AdaptRange(cfgs, numCFGs))
-      numBlocks += cfg->numBlocks();
-    this->numBlocks = numBlocks;
-  }
+  // Recycle the previous encode's slabs; in steady state a reused
+  // stream performs no system allocation here.
+  pool.reset();
+  interactions.clear();
+
+  // Count the blocks and assign each CFG its slice of the block array.
+  std::vector<size_t> firstBlock(numCFGs + 1, 0);
+  for (size_t i = 0; i < numCFGs; i++)
+    firstBlock[i + 1] = firstBlock[i] + cfgs[i]->numBlocks();
+  numBlocks = firstBlock[numCFGs];
 
   assert(numBlocks);
-  blocks = new Block[numBlocks];
-
-  {
-    // Initialize blocks and count instructions.
-    Block* nextBlock = blocks;
-    size_t numInstrs = 0;
-    for (auto cfg : AdaptRange(cfgs, numCFGs))
-      for (auto basicBlock : *cfg) {
-        basicBlock->setBackendID(nextBlock);
-        nextBlock->dominator = nullptr;
-        nextBlock->head = nextBlock;
-        size_t size = 0;
-        if (BasicBlock* parent = basicBlock->parent()) {
-          size++;  // block header
-          nextBlock->dominator = (Block*)parent->getBackendID();
-          if (basicBlock->PostDominates(*parent) ||
-              nextBlock->dominator + 1 == nextBlock)
-            nextBlock->head = nextBlock->dominator->head;
-        }
-        for (auto arg : basicBlock->arguments()) size += countInstrs(arg);
-        for (auto instr : basicBlock->instructions())
-          size += countInstrs(instr);
-        size += countInstrs(basicBlock->terminator());
-        nextBlock->firstInstr = numInstrs;
-        nextBlock->numInstrs = size;
-        numInstrs += size;
-        nextBlock++;
-      }
-    this->numInstrs = numInstrs;
-  }
+  blocks = pool.allocate<Block>(numBlocks);
+
+  // Initialize blocks and count instructions, whole CFGs in parallel.
+  // CFGs are independent until final layout: a worker touches only its
+  // own CFG's blocks and backend IDs, and records instruction offsets
+  // relative to the start of its own segment.
+  std::vector<size_t> firstInstr(numCFGs + 1, 0);
+  forEachCFG(numCFGs, numWorkers, [&](size_t i) {
+    firstInstr[i + 1] = countCFG(cfgs[i], blocks + firstBlock[i]);
+  });
+
+  // Concatenate the segments: turn the per-CFG instruction counts into
+  // stream offsets and rebase each block's instruction range.
+  for (size_t i = 0; i < numCFGs; i++) firstInstr[i + 1] += firstInstr[i];
+  numInstrs = firstInstr[numCFGs];
+  for (size_t i = 0; i < numCFGs; i++)
+    for (size_t b = firstBlock[i]; b < firstBlock[i + 1]; b++)
+      blocks[b].firstInstr += firstInstr[i];
 
   assert(numInstrs);
-  instrs = new Instruction[numInstrs];
-
-  {
-    // Emit instructions.
-    Instruction* nextInstr = instrs;
-    Block* nextBlock = blocks;
-    for (auto cfg : AdaptRange(cfgs, numCFGs))
-      for (auto basicBlock : *cfg) {
-        nextInstr = emitBlockHeader(nextInstr, nextBlock);
-        for (auto arg : basicBlock->arguments())
-          nextInstr = emitArgument(nextInstr, cast<Phi>(arg));
-        for (auto instr : basicBlock->instructions())
-          nextInstr = emitInstrs(nextInstr, instr);
-        nextInstr =
-            emitTerminator(nextInstr, basicBlock->terminator(), basicBlock);
-        assert(nextInstr == nextBlock->instrs + nextBlock->numInstrs);
-        nextBlock++;
-      }
-  }
+  instrs = pool.allocate<Instruction>(numInstrs);
+
+  // Emit instructions, again whole CFGs in parallel.  Instruction fields
+  // are self-relative (key/arg0/arg1 store distances) and no reference
+  // crosses a CFG boundary, so segments emitted concurrently into the
+  // shared array need no further fixup.
+  forEachCFG(numCFGs, numWorkers, [&](size_t i) {
+    emitCFG(cfgs[i], blocks + firstBlock[i]);
+  });
 
   // Determine last uses.
   for (auto uses : AdaptRange(instrs, numInstrs)) {
@@ -273,97 +451,42 @@ void InstructionStream::encode(SCFG* const* cfgs, size_t numCFGs) {
   }
 #endif
 
+  buildOpcodePlane();
+
   //
-  for (auto instr : AdaptRange(instrs, numInstrs)) {
-    if (instr.opcode.code == Opcode::COPY)
-      if (instr.opcode.isArg0NotLastUse) instr.key = 0;
+  for (size_t i = 0; i < numInstrs; i++) {
+    if (opcodes[i] == Opcode::COPY)
+      if (instrs[i].opcode.isArg0NotLastUse) instrs[i].key = 0;
   }
 
   // Finalize the keys.
   for (Instruction* i = instrs, *e = instrs + numInstrs; i != e; ++i)
     i->updateKey();
 
-  for (Instruction* i = instrs, *e = instrs + numInstrs; i != e; ++i) {
-    if (i->opcode == &globalOpcodes.phi)
-      continue;
-    if (i->opcode->hasArg0 && !i->arg0Live) traverse(i, i->arg0);
-    if (i->opcode->hasArg1 && !i->arg1Live) traverse(i, i->arg1);
+  // Block-level liveness, used by traverse below and by the register
+  // allocator for O(1) live-in/live-out queries.
+  liveness.compute(blocks, numBlocks, instrs, numInstrs, opcodes);
+
+  for (size_t i = 0; i < numInstrs; i++) {
+    if (opcodes[i] == Opcode::PHI || opcodes[i] == Opcode::HEADER) continue;
+    Instruction* instr = instrs + i;
+    if (instr->arg0 && !instr->opcode.isArg0NotLastUse)
+      traverse(instr, instr->getArg0());
+    if (instr->arg1 && !instr->opcode.isArg1NotLastUse)
+      traverse(instr, instr->getArg1());
   }
 
-  assert(!interactions.empty());
-  // We should really just return in this case.
-
+  // Each interference edge bumps both endpoints' pressure, which print()
+  // reports and the allocator's spill heuristic consults.
   std::sort(interactions.begin(), interactions.end());
-  std::vector<std::pair<int, int>> uniqued;
-  uniqued.push_back(*interactions.begin());
-  for (auto i = interactions.begin() + 1, e = interactions.end(); i != e; ++i)
-    if (*i != i[-1]) uniqued.push_back(*i);
-  for (auto i : uniqued) printf("> %d, %d\n", i.first, i.second);
-  for (auto i : uniqued) {
+  interactions.erase(std::unique(interactions.begin(), interactions.end()),
+                     interactions.end());
+  for (auto i : interactions) {
     instrs[i.first].pressure++;
     instrs[i.second].pressure++;
   }
 
-  std::vector<std::<int, int>> shared;
-  for (Instruction* i = instrs, *e = instrs + numInstrs; i != e; ++i)
-    if (i->opcode == &globalOpcodes.add || i->opcode == &globalOpcodes.mul ||
-        i->opcode == &globalOpcodes.cmpeq) {
-    shared.push_back(std::make_pair());
-    }
-
-  std::vector<Instruction*> work;
-  for (auto i = instrs, e = instrs + numInstrs; i != e; ++i) work.push_back(i);
-  std::sort(work.begin(), work.end(), [](Instruction* a, Instruction* b) {
-    return a->pressure < b->pressure || a->pressure == b->pressure && a < b;
-  });
-  for (auto i : work) printf("%d : %d\n", i - instrs, i->pressure);
-
-  for (auto& i : uniqued)
-    if (instrs[i.first].pressure > instrs[i.second].pressure ||
-        instrs[i.first].pressure == instrs[i.second].pressure &&
-            i.first > i.second) {
-      i = std::make_pair(i.second, i.first);
-      printf("*");
-    } else
-      printf(".");
-  printf("\n");
-
-  // for (auto i : uniqued) printf("> %d, %d\n", i.first, i.second);
-  // printf("\n");
-  std::sort(uniqued.begin(), uniqued.end(),
-            [&](std::pair<int, int> a, std::pair<int, int> b) {
-    return instrs[a.first].pressure < instrs[b.first].pressure ||
-           instrs[a.first].pressure == instrs[b.first].pressure &&
-               a.first < b.first;
-  });
-  for (auto i : uniqued) printf("> %d, %d\n", i.first, i.second);
-
-  auto interaction = uniqued.begin();
-  for (auto i : work) {
-    i->reg = ~i->invalidRegs & -~i->invalidRegs;
-    while (interaction != uniqued.end() && instrs + interaction->first == i)
-      instrs[interaction++->second].invalidRegs |= i->reg;
-  }
-
-#if 1
-      // for debugging
-      std::vector<std::pair<int, int>> ranges;
-  auto point = uniqued.begin();
-  for (auto i = uniqued.begin() + 1, e = uniqued.end(); i != e; ++i)
-    if (i->first != i[-1].first) {
-      ranges.push_back(
-          std::make_pair(point - uniqued.begin(), i - uniqued.begin()));
-      point = i;
-    }
-  ranges.push_back(std::make_pair(point - uniqued.begin(), uniqued.size()));
-  for (auto i : ranges) printf("[%d, %d) : %d : %d\n", i.first, i.second, uniqued[i.first].first, i.second - i.first);
-#endif
-
-  printf("blocks = %d\ninstrs = %d\n", (int)numBlocks, (int)numInstrs);
-  for (size_t i = 0; i < numBlocks; i++)
-    printf("block%d\n  parent = %d\n  first = %d\n  instrs = %d\n", (int)i,
-           blocks[i].dominator ? (int)(blocks[i].dominator - blocks) : -1,
-           (int)(blocks[i].instrs - instrs), (int)blocks[i].numInstrs);
+  allocateRegisters();
 
 #if 0
   // Patch up all of the jump targets.
@@ -384,6 +507,258 @@ void InstructionStream::encode(SCFG* const* cfgs, size_t numCFGs) {
 #endif
 }
 
+// The successor most likely to execute next: the unconditional target
+// of a goto, or the then arm of a branch.  Without profile data the
+// then arm is the best static guess.
+static BasicBlock* likelySuccessor(BasicBlock* basicBlock) {
+  Terminator* term = basicBlock->terminator();
+  if (!term) return nullptr;
+  switch (term->opcode()) {
+    case COP_Goto:
+      return cast<Goto>(term)->targetBlock();
+    case COP_Branch:
+      return cast<Branch>(term)->thenBlock();
+    default:
+      return nullptr;
+  }
+}
+
+// Block layout, Pettis-Hansen style chaining restricted to the tree
+// order the stream needs: walk each unplaced block's likely-successor
+// chain so hot edges become fallthroughs, seeding chains in CFG order.
+// A block only joins a chain once its immediate dominator is placed,
+// which keeps every header and key reference pointing backward.  The
+// pass is deterministic, so countCFG and emitCFG recompute the same
+// order independently.
+static void layoutBlocks(SCFG* cfg, std::vector<BasicBlock*>* order) {
+  order->clear();
+  order->reserve(cfg->numBlocks());
+  std::vector<char> placed(cfg->numBlocks(), 0);
+  auto canPlace = [&](BasicBlock* b) {
+    if (!b || placed[b->blockID()]) return false;
+    BasicBlock* parent = b->parent();
+    return !parent || placed[parent->blockID()];
+  };
+  for (auto seed : *cfg) {
+    for (BasicBlock* b = seed; canPlace(b);) {
+      placed[b->blockID()] = 1;
+      order->push_back(b);
+      BasicBlock* next = likelySuccessor(b);
+      if (!canPlace(next) && b->terminator() &&
+          b->terminator()->opcode() == COP_Branch)
+        next = cast<Branch>(b->terminator())->elseBlock();
+      b = next;
+    }
+  }
+}
+
+size_t InstructionStream::countCFG(SCFG* cfg, Block* nextBlock) {
+  std::vector<BasicBlock*> layout;
+  layoutBlocks(cfg, &layout);
+  size_t numInstrs = 0;
+  for (auto basicBlock : layout) {
+    basicBlock->setBackendID(nextBlock);
+    nextBlock->dominator = nullptr;
+    nextBlock->head = nextBlock;
+    size_t size = 0;
+    if (BasicBlock* parent = basicBlock->parent()) {
+      size++;  // block header
+      nextBlock->dominator = (Block*)parent->getBackendID();
+      if (basicBlock->PostDominates(*parent) ||
+          nextBlock->dominator + 1 == nextBlock)
+        nextBlock->head = nextBlock->dominator->head;
+    }
+    for (auto arg : basicBlock->arguments()) size += countInstrs(arg);
+    for (auto instr : basicBlock->instructions()) size += countInstrs(instr);
+    size += countInstrs(basicBlock->terminator());
+    nextBlock->firstInstr = numInstrs;
+    nextBlock->numInstrs = size;
+    numInstrs += size;
+    nextBlock++;
+  }
+  return numInstrs;
+}
+
+void InstructionStream::emitCFG(SCFG* cfg, Block* nextBlock) {
+  std::vector<BasicBlock*> layout;
+  layoutBlocks(cfg, &layout);
+  Instruction* nextInstr = instrs + nextBlock->firstInstr;
+  for (auto basicBlock : layout) {
+    nextInstr = emitBlockHeader(nextInstr, nextBlock);
+    for (auto arg : basicBlock->arguments())
+      nextInstr = emitArgument(nextInstr, cast<Phi>(arg));
+    for (auto instr : basicBlock->instructions())
+      nextInstr = emitInstrs(nextInstr, instr);
+    nextInstr =
+        emitTerminator(nextInstr, basicBlock->terminator(), basicBlock);
+    assert(nextInstr == instrs + nextBlock->firstInstr + nextBlock->numInstrs);
+    nextBlock++;
+  }
+}
+
+// Linear-scan register allocation over the flattened stream.  Values
+// sharing a key (phi/copy webs) form one interval, from the class's
+// first definition to its last reference, extended to the end of any
+// block that has the value live-out (per the liveness bitsets).
+// Intervals are visited in start order; an expired interval returns its
+// register, and when none is free the active interval with the furthest
+// end is spilled to a stack slot, preferring to evict lower-pressure
+// values on ties.  Spilled values execute in reserved scratch
+// registers: a store is emitted after each definition and a load before
+// each use, directly into the stream, and all self-relative offsets are
+// rebuilt for x64builder consumption.
+void InstructionStream::allocateRegisters() {
+  // Twelve allocatable GP registers (see the table in codegen.cpp); the
+  // top two are reserved as scratch for spill code.
+  enum : unsigned { NumRegs = 12, NumScratch = 2 };
+  const unsigned scratch0 = 1u << (NumRegs - 2);
+  const unsigned scratch1 = 1u << (NumRegs - 1);
+  const unsigned allRegs = (1u << (NumRegs - NumScratch)) - 1;
+
+  // Interval per key class, indexed by the class representative.
+  std::vector<int> endOf(numInstrs, -1);
+  auto keyOf = [&](size_t i) { return (int)(instrs[i].getKey() - instrs); };
+  auto extend = [&](size_t i, int to) {
+    int k = keyOf(i);
+    if (endOf[k] < to) endOf[k] = to;
+  };
+  std::vector<int> starts;  // Class representatives in start order.
+  for (size_t i = 0; i < numInstrs; i++) {
+    if (opcodes[i] == Opcode::HEADER) continue;
+    Instruction& instr = instrs[i];
+    if (instr.opcode.hasResult) {
+      if (keyOf(i) == (int)i) starts.push_back((int)i);
+      extend(i, (int)i);
+    }
+    if (instr.arg0) extend(i + instr.arg0, (int)i);
+    if (instr.arg1) extend(i + instr.arg1, (int)i);
+  }
+  for (size_t b = 0; b < numBlocks; b++) {
+    int blockEnd = (int)(blocks[b].firstInstr + blocks[b].numInstrs) - 1;
+    const uint64_t* out = &liveness.liveOut[b * liveness.numWords];
+    for (size_t w = 0; w < liveness.numWords; w++) {
+      uint64_t bits = out[w];
+      while (bits) {
+        extend(w * 64 + lowBit64(bits), blockEnd);
+        bits &= bits - 1;
+      }
+    }
+  }
+
+  // The scan.  Representatives are already in start (definition) order.
+  unsigned freeRegs = allRegs;
+  int numSlots = 0;
+  std::vector<int> active;  // Representatives holding a register.
+  for (int rep : starts) {
+    for (size_t a = 0; a < active.size();)
+      if (endOf[active[a]] < rep) {
+        freeRegs |= instrs[active[a]].reg;
+        active[a] = active.back();
+        active.pop_back();
+      } else
+        a++;
+
+    unsigned candidates = freeRegs & ~instrs[rep].invalidRegs;
+    if (candidates) {
+      instrs[rep].reg = candidates & -candidates;
+      freeRegs &= ~instrs[rep].reg;
+      active.push_back(rep);
+      continue;
+    }
+    // Spill the interval reaching furthest; ties evict lower pressure.
+    int victim = rep;
+    for (int a : active)
+      if (endOf[a] > endOf[victim] ||
+          (endOf[a] == endOf[victim] &&
+           instrs[a].pressure < instrs[victim].pressure))
+        victim = a;
+    if (victim != rep) {
+      instrs[rep].reg = instrs[victim].reg;
+      instrs[victim].reg = 0;
+      *std::find(active.begin(), active.end(), victim) = rep;
+    }
+    instrs[victim].spillSlot = numSlots++;
+  }
+
+  // Propagate the representative's assignment to its class.
+  for (size_t i = 0; i < numInstrs; i++)
+    if (opcodes[i] != Opcode::HEADER && instrs[i].opcode.hasResult) {
+      instrs[i].reg = instrs[keyOf(i)].reg;
+      instrs[i].spillSlot = instrs[keyOf(i)].spillSlot;
+    }
+  if (!numSlots) return;
+
+  // Rewrite the stream with spill code.  Defs and uses only reference
+  // earlier instructions, so one forward pass can remap every
+  // self-relative offset as it copies.
+  auto spilled = [&](int i) { return instrs[i].spillSlot >= 0; };
+  std::vector<Instruction> out;
+  out.reserve(numInstrs + numInstrs / 4);
+  std::vector<int> newPos(numInstrs);
+  for (size_t b = 0; b < numBlocks; b++) {
+    size_t first = blocks[b].firstInstr;
+    size_t last = first + blocks[b].numInstrs;
+    size_t newFirst = out.size();
+    for (size_t i = first; i < last; i++) {
+      Instruction instr = instrs[i];
+      int loadPos0 = -1, loadPos1 = -1;
+      if (opcodes[i] != Opcode::HEADER) {
+        if (instr.arg0 && spilled((int)i + instr.arg0)) {
+          loadPos0 = (int)out.size();
+          out.emplace_back();
+          out.back().init(Opcodes::load);
+          out.back().arg0 = newPos[i + instr.arg0] - loadPos0;
+          out.back().reg = scratch0;
+          out.back().spillSlot = instrs[i + instr.arg0].spillSlot;
+        }
+        if (instr.arg1 && spilled((int)i + instr.arg1)) {
+          if (instr.arg1 == instr.arg0) {
+            loadPos1 = loadPos0;
+          } else {
+            loadPos1 = (int)out.size();
+            out.emplace_back();
+            out.back().init(Opcodes::load);
+            out.back().arg0 = newPos[i + instr.arg1] - loadPos1;
+            out.back().reg = scratch1;
+            out.back().spillSlot = instrs[i + instr.arg1].spillSlot;
+          }
+        }
+      }
+      int myPos = (int)out.size();
+      newPos[i] = myPos;
+      if (instr.opcode.hasResult && spilled((int)i)) instr.reg = scratch0;
+      if (instr.key) instr.key = newPos[i + instr.key] - myPos;
+      if (instr.arg0)
+        instr.arg0 =
+            (loadPos0 >= 0 ? loadPos0 : newPos[i + instr.arg0]) - myPos;
+      if (instr.arg1)
+        instr.arg1 =
+            (loadPos1 >= 0 ? loadPos1 : newPos[i + instr.arg1]) - myPos;
+      out.push_back(instr);
+      if (opcodes[i] != Opcode::HEADER && instr.opcode.hasResult &&
+          spilled((int)i)) {
+        int storePos = (int)out.size();
+        out.emplace_back();
+        out.back().init(Opcodes::store);
+        out.back().arg0 = myPos - storePos;
+        out.back().spillSlot = instrs[i].spillSlot;
+      }
+    }
+    blocks[b].firstInstr = newFirst;
+    blocks[b].numInstrs = out.size() - newFirst;
+  }
+
+  // The old array stays in the pool until the next reset().
+  numInstrs = out.size();
+  instrs = pool.allocate<Instruction>(numInstrs);
+  std::copy(out.begin(), out.end(), instrs);
+
+  // The opcode plane and liveness sets index the old stream; rebuild
+  // both for later passes.
+  buildOpcodePlane();
+  liveness.compute(blocks, numBlocks, instrs, numInstrs, opcodes);
+}
+
 size_t InstructionStream::countInstrs(SExpr* expr) {
   if (expr->getBackendID()) return 0;
   expr->setBackendID(&countedMarker);
@@ -417,10 +792,12 @@ Instruction* InstructionStream::emitBlockHeader(Instruction* nextInstr,
                                                 Block* block) {
   if (!block->dominator) return nextInstr;
   if (block->head != block)
-    nextInstr->init(Opcodes::headerDominates, 0, block->head->instrs);
+    nextInstr->init(Opcodes::headerDominates, 0,
+                    instrs + block->head->firstInstr);
   else
     nextInstr->init(Opcodes::header, 0,
-                    block->dominator->instrs + block->dominator->numInstrs);
+                    instrs + block->dominator->firstInstr +
+                        block->dominator->numInstrs);
   return ++nextInstr;
 }
 
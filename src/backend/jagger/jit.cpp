@@ -0,0 +1,103 @@
+//===- jit.cpp -------------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+
+#include "jit.h"
+#include "x64builder/x64builder.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace Jagger;
+
+namespace {
+
+size_t roundUpToPages(size_t bytes) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  size_t pageSize = info.dwPageSize;
+#else
+  size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+  return (bytes + pageSize - 1) & ~(pageSize - 1);
+}
+
+char* mapWritable(size_t size) {
+#ifdef _WIN32
+  return (char*)VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE,
+                             PAGE_READWRITE);
+#else
+  void* base = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  return base == MAP_FAILED ? nullptr : (char*)base;
+#endif
+}
+
+bool makeExecutable(char* base, size_t size) {
+#ifdef _WIN32
+  DWORD old;
+  return VirtualProtect(base, size, PAGE_EXECUTE_READ, &old) != 0;
+#else
+  return mprotect(base, size, PROT_READ | PROT_EXEC) == 0;
+#endif
+}
+
+void unmap(char* base, size_t size) {
+#ifdef _WIN32
+  (void)size;
+  VirtualFree(base, 0, MEM_RELEASE);
+#else
+  munmap(base, size);
+#endif
+}
+
+}  // namespace
+
+CodeArena::~CodeArena() {
+  for (auto& region : regions) unmap(region.base, region.size);
+}
+
+void* CodeArena::emit(const X64Builder& builder) {
+  size_t worst = builder.MaxBytes();
+  if (!worst) return nullptr;
+  size_t size = roundUpToPages(worst);
+  char* base = mapWritable(size);
+  if (!base) return nullptr;
+
+  // Encode resolves label references and relaxes jumps as it writes.
+  unsigned char* end = builder.Encode((unsigned char*)base);
+  if (end == (unsigned char*)base || !makeExecutable(base, size)) {
+    unmap(base, size);
+    return nullptr;
+  }
+
+  Region region = {base, size};
+  regions.push_back(region);
+  return base;
+}
+
+void* JitCache::insert(const void* key, const X64Builder& builder) {
+  auto it = entries.find(key);
+  if (it != entries.end()) return it->second;
+  void* entry = arena.emit(builder);
+  if (entry) entries[key] = entry;
+  return entry;
+}
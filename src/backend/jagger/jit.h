@@ -0,0 +1,79 @@
+//===- jit.h ---------------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+// The runtime half of the backend: takes a finished X64Builder stream,
+// encodes it (labels and jump relaxation resolved by the builder) into
+// freshly mapped code memory, flips the pages from writable to
+// executable, and hands back a callable entry point.  JitCache keys the
+// entries by the IR object that was compiled so repeated requests for
+// the same function skip the encoder entirely.
+//===----------------------------------------------------------------------===//
+
+#pragma once
+#include <cstddef>
+#include <unordered_map>
+#include <vector>
+
+struct X64Builder;
+
+namespace Jagger {
+
+// Owns the process's jitted code pages.  Each emitted function gets its
+// own mapping, created writable for the encoder and re-protected
+// read-execute before the entry point is returned, so no page is ever
+// writable and executable at the same time.  All mappings are released
+// when the arena is destroyed; entry points must not outlive it.
+class CodeArena {
+ public:
+  CodeArena() {}
+  ~CodeArena();
+
+  // Encode the builder's stream into executable memory and return the
+  // entry point, or null if mapping or encoding fails.
+  void* emit(const X64Builder& builder);
+
+ private:
+  CodeArena(const CodeArena&);
+  CodeArena& operator=(const CodeArena&);
+
+  struct Region {
+    char* base;
+    size_t size;
+  };
+  std::vector<Region> regions;
+};
+
+// Cache of compiled entry points, keyed by the address of the IR object
+// (SCFG or any other stable identity) that produced them.  The jitted
+// code's signature is whatever the caller arranged for; cast the entry
+// to the matching function pointer type before calling it.
+class JitCache {
+ public:
+  void* lookup(const void* key) const {
+    auto it = entries.find(key);
+    return it == entries.end() ? nullptr : it->second;
+  }
+
+  // Encode the builder's stream and remember the entry under key.
+  // Returns the cached entry if one already exists.
+  void* insert(const void* key, const X64Builder& builder);
+
+ private:
+  CodeArena arena;
+  std::unordered_map<const void*, void*> entries;
+};
+
+}  // namespace Jagger
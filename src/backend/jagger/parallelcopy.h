@@ -0,0 +1,138 @@
+//===- parallelcopy.h ------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+namespace Jagger {
+
+// Resolves a parallel copy: a set of register moves that must appear to
+// happen simultaneously, as at call sites (shuffling arguments into
+// their ABI registers) and block boundaries (phi/echo moves).  Emitting
+// the moves naively can clobber a source before it is read; the
+// resolver orders them so nothing is clobbered, and emits the minimum
+// sequence: tree moves come out as plain copies in dependency order,
+// and each cycle of k registers becomes either k-1 swaps (xchg) or,
+// when a scratch register is supplied, k+1 copies through it.
+//
+// Usage: add() the moves of one parallel copy, resolve(), emit the ops
+// in order, clear() for the next site.  Self-moves are dropped.
+struct ParallelCopy {
+  struct Op {
+    enum Kind { COPY, SWAP };
+    Op(Kind kind, unsigned dst, unsigned src)
+        : kind(kind), dst(dst), src(src) {}
+    Kind kind;
+    unsigned dst, src;  // COPY: dst <- src.  SWAP: exchange dst and src.
+  };
+
+  void add(unsigned dst, unsigned src) {
+    if (dst == src)
+      return;
+    for (auto& move : moves)
+      assert(move.dst != dst && "Register assigned twice in parallel copy.");
+    moves.push_back(Op(Op::COPY, dst, src));
+  }
+
+  void clear() {
+    moves.clear();
+    ops.clear();
+  }
+
+  // Order the moves into ops.  scratch is a register free at this
+  // program point, used to break cycles with copies; pass NO_SCRATCH to
+  // break them with swaps instead.
+  static const unsigned NO_SCRATCH = ~0u;
+  void resolve(unsigned scratch = NO_SCRATCH) {
+    ops.clear();
+
+    // A register with no pending reads can be written; emitting its move
+    // may in turn free its source.  This peels the tree part of the
+    // dependency graph in dependency order.
+    std::vector<char> done(moves.size(), 0);
+    std::size_t remaining = moves.size();
+    bool progress = true;
+    while (progress) {
+      progress = false;
+      for (std::size_t i = 0; i < moves.size(); i++) {
+        if (done[i] || isPendingSource(moves[i].dst, done))
+          continue;
+        ops.push_back(moves[i]);
+        done[i] = 1;
+        remaining--;
+        progress = true;
+      }
+    }
+
+    // Whatever remains is disjoint cycles: every destination is also the
+    // source of exactly one pending move.
+    while (remaining) {
+      std::size_t first = 0;
+      while (done[first])
+        first++;
+
+      // Collect the cycle starting at moves[first].
+      std::vector<std::size_t> cycle;
+      std::size_t i = first;
+      do {
+        cycle.push_back(i);
+        done[i] = 1;
+        remaining--;
+        i = pendingMoveReading(moves[i].src, done);
+      } while (i != moves.size());
+
+      if (scratch != NO_SCRATCH) {
+        // Save the one value the chain clobbers before reading, then
+        // chain the copies and close the cycle out of scratch.
+        ops.push_back(Op(Op::COPY, scratch, moves[cycle.back()].src));
+        for (std::size_t k = 0; k + 1 < cycle.size(); k++)
+          ops.push_back(moves[cycle[k]]);
+        ops.push_back(Op(Op::COPY, moves[cycle.back()].dst, scratch));
+      } else {
+        // Each swap places one register; the last lands both.
+        for (std::size_t k = 0; k + 1 < cycle.size(); k++)
+          ops.push_back(Op(Op::SWAP, moves[cycle[k]].dst,
+                           moves[cycle[k]].src));
+      }
+    }
+  }
+
+  std::vector<Op> moves;  // The parallel copy, as added.
+  std::vector<Op> ops;    // The resolved sequence, in emission order.
+
+private:
+  bool isPendingSource(unsigned reg, const std::vector<char>& done) const {
+    for (std::size_t i = 0; i < moves.size(); i++)
+      if (!done[i] && moves[i].src == reg)
+        return true;
+    return false;
+  }
+
+  // Index of the pending move whose destination is reg, or moves.size().
+  std::size_t pendingMoveReading(unsigned reg,
+                                 const std::vector<char>& done) const {
+    for (std::size_t i = 0; i < moves.size(); i++)
+      if (!done[i] && moves[i].dst == reg)
+        return i;
+    return moves.size();
+  }
+};
+
+}  // namespace Jagger
@@ -96,6 +96,10 @@ struct Instruction {
     this->arg0 = arg0 - this;
     this->arg1 = arg1 - this;
     order = 0;
+    reg = 0;
+    invalidRegs = 0;
+    pressure = 0;
+    spillSlot = -1;
   }
 
   Instruction* getKey() { return this + key; }
@@ -120,6 +124,10 @@ struct Instruction {
   int arg0; // also literal
   int arg1; // jump target
   int order;
+  unsigned reg;         // one-hot register mask; 0 if unallocated/spilled
+  unsigned invalidRegs; // registers this value must not use
+  int pressure;         // number of interference edges on this value
+  int spillSlot;        // stack slot index, or -1
 };
 
 extern Instruction countedMarker;
@@ -185,6 +193,8 @@ namespace Opcodes {
   extern OpcodeEx intValue;
   extern OpcodeEx ret;
   extern OpcodeEx copy;
+  extern OpcodeEx load;  // reload of a spilled value
+  extern OpcodeEx store; // spill of a value to its stack slot
   extern OpcodeEx phi;
   extern OpcodeEx add;
   extern OpcodeEx mul;
@@ -19,7 +19,10 @@
 #include "clang/Analysis/Analyses/ThreadSafetyTraverse.h"
 
 
+#include <atomic>
 #include <cstddef>
+#include <thread>
+#include <unordered_map>
 
 
 namespace ohmu {
@@ -49,16 +52,28 @@ class LLVMReducer : public Traversal<LLVMReducer, LLVMReducerMap>,
                     public DefaultReducer<LLVMReducer, LLVMReducerMap>,
                     public DefaultScopeHandler<LLVMReducerMap> {
 public:
-  LLVMReducer() :  currentFunction_(nullptr), builder_(ctx()) {
+  LLVMReducer()
+      : context_(llvm::getGlobalContext()), currentFunction_(nullptr),
+        builder_(context_), ownsModule_(true), int32Ty_(nullptr),
+        voidFnTy_(nullptr) {
     // The module holds all of the llvm output.
-    outModule_ = new llvm::Module("ohmu_output", ctx());
+    outModule_ = new llvm::Module("ohmu_output", context_);
+  }
+
+  // Lower into an existing module; used by the sharded mode, where each
+  // worker owns a context and module pair.
+  LLVMReducer(llvm::LLVMContext& context, llvm::Module* module)
+      : context_(context), currentFunction_(nullptr), builder_(context),
+        ownsModule_(false), int32Ty_(nullptr), voidFnTy_(nullptr) {
+    outModule_ = module;
   }
 
   ~LLVMReducer() {
-     delete outModule_;
+     if (ownsModule_)
+       delete outModule_;
   }
 
-  static llvm::LLVMContext& ctx() { return llvm::getGlobalContext(); }
+  llvm::LLVMContext& ctx() { return context_; }
   llvm::Module* module() { return outModule_; }
 
 public:
@@ -108,10 +123,8 @@ public:
   llvm::Value* reduceLiteralT(LiteralT<T>& e) { return nullptr; }
 
   llvm::Value* reduceLiteralT(LiteralT<int32_t>& e) {
-    llvm::Constant* c =
-      llvm::ConstantInt::getSigned(llvm::Type::getInt32Ty(ctx()), e.value());
     // return builder_.Insert(c);
-    return c;
+    return int32Constant(e.value());
   }
 
   llvm::Value* reduceUnaryOp(UnaryOp& orig, llvm::Value* e0) {
@@ -171,8 +184,7 @@ public:
   }
 
   llvm::PHINode* reducePhiBegin(Phi& orig) {
-    llvm::Type* ty = llvm::Type::getInt32Ty(ctx());
-    llvm::PHINode* lph = builder_.CreatePHI(ty, orig.values().size());
+    llvm::PHINode* lph = builder_.CreatePHI(int32Ty(), orig.values().size());
     return lph;
   }
 
@@ -213,12 +225,9 @@ public:
     currentValues_.resize(orig.numInstructions(), nullptr);
 
     // Create a new function in outModule_
-    std::vector<llvm::Type*> argTypes;
-    llvm::FunctionType *ft =
-      llvm::FunctionType::get(llvm::Type::getVoidTy(ctx()), argTypes, false);
     currentFunction_ =
-      llvm::Function::Create(ft, llvm::Function::ExternalLinkage, "ohmu_main",
-                             outModule_);
+      llvm::Function::Create(voidFnTy(), llvm::Function::ExternalLinkage,
+                             "ohmu_main", outModule_);
 
     // The current CFG is implicit.
     return currentFunction_;
@@ -232,9 +241,39 @@ public:
 
 
 private:
+  // Per-module caches.  Types, function signatures and constants are
+  // all uniqued inside the LLVMContext, but every lookup there takes
+  // the context lock and the uniquing tables; caching the handles here
+  // keeps the per-instruction lowering path free of both.
+  llvm::Type* int32Ty() {
+    if (!int32Ty_)
+      int32Ty_ = llvm::Type::getInt32Ty(ctx());
+    return int32Ty_;
+  }
+
+  llvm::FunctionType* voidFnTy() {
+    if (!voidFnTy_)
+      voidFnTy_ = llvm::FunctionType::get(llvm::Type::getVoidTy(ctx()), false);
+    return voidFnTy_;
+  }
+
+  llvm::Constant* int32Constant(int32_t value) {
+    auto it = intConstants_.find(value);
+    if (it != intConstants_.end())
+      return it->second;
+    llvm::Constant* c = llvm::ConstantInt::getSigned(int32Ty(), value);
+    intConstants_[value] = c;
+    return c;
+  }
+
+  llvm::LLVMContext& context_;
   llvm::Module*     outModule_;
   llvm::Function*   currentFunction_;
   llvm::IRBuilder<> builder_;
+  bool              ownsModule_;
+  llvm::Type*       int32Ty_;
+  llvm::FunctionType* voidFnTy_;
+  std::unordered_map<int32_t, llvm::Constant*> intConstants_;
 
   std::vector<llvm::BasicBlock*> currentBlocks_;
   std::vector<llvm::Value*> currentValues_;
@@ -249,5 +288,48 @@ void generate_LLVM_IR(SExpr* E) {
 }
 
 
+llvm::Module* generate_LLVM_IR_module(SExpr* E) {
+  llvm::Module* module =
+      new llvm::Module("ohmu_output", llvm::getGlobalContext());
+  LLVMReducer Reducer(llvm::getGlobalContext(), module);
+  Reducer.traverseAll(E);
+  return module;
+}
+
+
+void generate_LLVM_IR_sharded(const std::vector<SExpr*>& roots,
+                              unsigned numWorkers,
+                              std::vector<std::unique_ptr<IRShard>>* shards) {
+  if (numWorkers == 0)
+    numWorkers = 1;
+  if (numWorkers > roots.size() && !roots.empty())
+    numWorkers = static_cast<unsigned>(roots.size());
+
+  shards->clear();
+  for (unsigned w = 0; w < numWorkers; w++) {
+    std::unique_ptr<IRShard> shard(new IRShard());
+    shard->module.reset(new llvm::Module("ohmu_output", shard->context));
+    shards->push_back(std::move(shard));
+  }
+
+  // Workers claim whole functions off a shared cursor; function sizes
+  // vary wildly, so dynamic claiming beats a static split.  Each
+  // worker's reducer lowers into its own context and module, so no
+  // llvm state is shared between threads.
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned w = 0; w < numWorkers; w++) {
+    IRShard* shard = (*shards)[w].get();
+    workers.emplace_back([&next, &roots, shard]() {
+      LLVMReducer reducer(shard->context, shard->module.get());
+      for (size_t i = next++; i < roots.size(); i = next++)
+        reducer.traverseAll(roots[i]);
+    });
+  }
+  for (auto& worker : workers)
+    worker.join();
+}
+
+
 }  // end namespace backend_llvm
 }  // end namespace ohmu
@@ -32,6 +32,9 @@
 #include "llvm/IR/Module.h"
 #include "llvm/Support/Casting.h"
 
+#include <memory>
+#include <vector>
+
 
 namespace ohmu {
 namespace backend_llvm {
@@ -40,6 +43,29 @@ using namespace clang::threadSafety::til;
 
 void generate_LLVM_IR(SExpr* E);
 
+// As generate_LLVM_IR, but hands the module (built in the global
+// context) to the caller instead of discarding it; used by the JIT
+// execution path.
+llvm::Module* generate_LLVM_IR_module(SExpr* E);
+
+// One shard of parallel IR generation: the module and the context it
+// was built in.  Modules cannot outlive their context, so both travel
+// together; the caller emits an object per shard (or links the shards)
+// and then drops them.
+struct IRShard {
+  llvm::LLVMContext context;
+  std::unique_ptr<llvm::Module> module;
+};
+
+// Parallel variant of generate_LLVM_IR: shards the top-level
+// expressions across numWorkers modules, one LLVMContext per worker,
+// and lowers them concurrently.  Workers claim whole functions off a
+// shared cursor since function sizes vary wildly.  The roots must not
+// share subexpressions across shards; lowering only reads the ohmu IR.
+void generate_LLVM_IR_sharded(const std::vector<SExpr*>& roots,
+                              unsigned numWorkers,
+                              std::vector<std::unique_ptr<IRShard>>* shards);
+
 }  // end namespace backend_llvm
 }  // end namespace ohmu
 
@@ -0,0 +1,51 @@
+//===- JIT.cpp -------------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+
+#include "backend/llvm/JIT.h"
+
+#include "llvm/ExecutionEngine/JIT.h"
+#include "llvm/Support/TargetSelect.h"
+
+namespace ohmu {
+namespace backend_llvm {
+
+JITEngine* JITEngine::create(llvm::Module* module, std::string* error) {
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+
+  llvm::EngineBuilder builder(module);
+  builder.setEngineKind(llvm::EngineKind::JIT);
+  builder.setErrorStr(error);
+  llvm::ExecutionEngine* engine = builder.create();
+  if (!engine)
+    return nullptr;
+
+  // Lazy materialization: a function is compiled the first time it is
+  // requested or called, not when the engine is built.
+  engine->DisableLazyCompilation(false);
+  return new JITEngine(engine);
+}
+
+void* JITEngine::getFunction(const std::string& name) {
+  llvm::Function* fn = engine_->FindFunctionNamed(name.c_str());
+  if (!fn)
+    return nullptr;
+  return engine_->getPointerToFunction(fn);
+}
+
+}  // end namespace backend_llvm
+}  // end namespace ohmu
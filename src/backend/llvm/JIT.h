@@ -0,0 +1,58 @@
+//===- JIT.h ---------------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// In-process execution of the LLVM backend's module output, for the
+// generate-run-measure loop.  Functions are materialized lazily, so a
+// module full of specializations only pays codegen cost for the
+// functions that are actually called.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_BACKEND_LLVM_JIT_H
+#define OHMU_BACKEND_LLVM_JIT_H
+
+#include "llvm/ExecutionEngine/ExecutionEngine.h"
+#include "llvm/IR/Module.h"
+
+#include <memory>
+#include <string>
+
+namespace ohmu {
+namespace backend_llvm {
+
+class JITEngine {
+public:
+  // Takes ownership of the module.  Returns null if no execution
+  // engine could be constructed for this target, with the reason in
+  // *error.
+  static JITEngine* create(llvm::Module* module, std::string* error);
+
+  // Address of the named function, compiling it (and whatever it
+  // references) on first request; null if the module has no such
+  // function.  Cast the result to the matching function pointer type.
+  void* getFunction(const std::string& name);
+
+private:
+  explicit JITEngine(llvm::ExecutionEngine* engine) : engine_(engine) {}
+
+  std::unique_ptr<llvm::ExecutionEngine> engine_;
+};
+
+}  // end namespace backend_llvm
+}  // end namespace ohmu
+
+#endif  // OHMU_BACKEND_LLVM_JIT_H
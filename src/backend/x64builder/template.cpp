@@ -20,10 +20,21 @@
 //===----------------------------------------------------------------------===//
 #pragma once
 #include <cassert>
+#include <cstddef>
+#include <cstdio>
 #include <vector>
 
 #include "instr.h"
 
+// MSVC spells forced inlining __forceinline; gcc and clang spell it
+// always_inline.  The encoders below are one-expression wrappers that
+// must vanish into their callers on every compiler.
+#if defined(_MSC_VER)
+#define X64_FORCEINLINE __forceinline
+#else
+#define X64_FORCEINLINE inline __attribute__((always_inline))
+#endif
+
 // The first 4 must be in this order because they are used as imm_size
 enum RegClass { GP8, GP16, GP32, GP64, MMX, XMM, YMM };
 
@@ -75,11 +86,13 @@ enum RipReg {
   RIP
 };
 
+//#include "tables.h"
+
 template<int>
 struct Mem {
   enum Segment {DEFAULT_SEGMENT, FS, GS};
   enum AddrSize {DEFAULT_SIZE, SIZE_OVERRIDE};
-  __forceinline Mem(
+  X64_FORCEINLINE Mem(
     BaseReg base,
     int disp = 0,
     IndexReg index = INDEX_NONE,
@@ -88,7 +101,7 @@ struct Mem {
     AddrSize addr_size = DEFAULT_SIZE)
     : instr(SET_BASEINDEX[index][base] | SET_SCALE[scale] | SET_SEGMENT[segment] | SET_ADDRESSOVERRIDE[addr_size])
     , disp(disp) {}
-  __forceinline Mem(RipReg, int disp)
+  X64_FORCEINLINE Mem(RipReg, int disp)
     : instr(SET_RIP), disp(disp) {}
   unsigned long long instr;
   int disp;
@@ -96,7 +109,7 @@ struct Mem {
 
 template<int>
 struct Disp64 {
-  __forceinline Disp64(long long disp)
+  X64_FORCEINLINE Disp64(long long disp)
     : disp(disp) {}
   long long disp;
 };
@@ -117,14 +130,12 @@ typedef Disp64<128> Disp64_128;
 typedef Disp64<256> Disp64_256;
 typedef Disp64<512> Disp64_512;
 
-//#include "tables.h"
-
 struct X64Builder {
   typedef unsigned char byte;
   struct Event {
     enum Kind : byte { CANDIDATE, ONEBYTE, LABEL, FOURBYTE };
     Event(unsigned target, char savings, unsigned relaxed, unsigned optimal, unsigned prefix, Kind kind)
-      : target(target), savings(savings), relaxed(relaxed), optimal(optimal), prefix(prefix), kind(kind) {}
+      : savings(savings), kind(kind), target(target), relaxed(relaxed), optimal(optimal), prefix(prefix) {}
     byte savings;
     Kind kind;
     unsigned target, relaxed, optimal, prefix;
@@ -138,7 +149,7 @@ struct X64Builder {
     return *this;
   }
 
-  __forceinline X64Builder& PushBack(const Instr& i) {
+  X64_FORCEINLINE X64Builder& PushBack(const Instr& i) {
     stream.push_back(i);
     return *this;
   }
@@ -149,6 +160,47 @@ struct X64Builder {
     return *this;
   }
 
+  // Upper bound on the encoded size of the stream; an x64 instruction
+  // never exceeds 15 bytes.  Callers allocating an output buffer for
+  // Encode/EncodeRelaxed can size it with this.
+  size_t MaxBytes() const { return stream.size() * 15; }
+
+  // Sliding-window peephole over the fixed-width stream, run before
+  // encoding: drops self-moves, drops a TEST r,r whose flags were just
+  // set by an ALU op targeting r, and reduces lea reg,[base] to a plain
+  // mov.  Redundant records are marked invalid (encode emits nothing
+  // for them) rather than erased, so label offsets into the stream stay
+  // valid; labels act as barriers since control can enter at them with
+  // different flags.
+  X64Builder& Peephole() {
+    size_t label = 0;
+    size_t prev = stream.size();  // no previous instruction yet
+    for (size_t i = 0, e = stream.size(); i != e; i++) {
+      while (label < label_offsets.size() && label_offsets[label] == i) {
+        prev = e;
+        label++;
+      }
+      Instr& instr = stream[i];
+      if (instr.invalid)
+        continue;
+      if (IsSelfMov(instr)) {
+        instr.invalid = 1;
+        continue;
+      }
+      if (IsLeaOfBase(instr)) {
+        // lea reg, [base] with no index, scale or displacement.
+        instr.opcode = 0x8b;  // mov reg, rm
+        instr.mod = 3;
+      }
+      if (prev != e && IsRegRegTest(instr) && SetsFlagsOf(stream[prev], instr)) {
+        instr.invalid = 1;
+        continue;
+      }
+      prev = i;
+    }
+    return *this;
+  }
+
   byte* EncodeNoRIP(byte* out) {
     if (stream.size() == 0)
       return out;
@@ -215,12 +267,124 @@ struct X64Builder {
     return out;
   }
 
+  // Two-pass emission, pass one: compute every instruction's exact
+  // encoded length and run the short/long jump fixpoint without writing
+  // any output.  Returns the exact number of bytes EncodePlanned will
+  // write, or 0 on error or an empty stream, so the caller can emit
+  // into a single buffer preallocated to the right size.
+  struct EncodingPlan {
+    std::vector<Event> events;
+    unsigned total;
+  };
+
+  size_t PlanEncode(EncodingPlan& plan) const {
+    plan.events.clear();
+    plan.total = 0;
+    if (stream.size() == 0)
+      return 0;
+    if (label_offsets.size() && label_offsets.back() == stream.size()) {
+      ErrorTrailingLabel(nullptr);
+      return 0;
+    }
+    unsigned relaxed = 0, optimal = 0;
+    unsigned rawOffset = 0, holdOffset = 0;
+    byte scratch[32];
+    auto& events = plan.events;
+    std::vector<unsigned> targets(label_offsets.size(), 0);
+    events.reserve(stream.size() + label_offsets.size());
+    for (size_t i = 0, e = stream.size(), l = 0, l_max = label_offsets.size(); i != e; i++) {
+      if (l < l_max && label_offsets[l] == i) {
+        for (auto x = targets[l]; x; ) {
+          auto& event = events[x];
+          x = event.target;
+          event.target = (unsigned)events.size();
+        }
+        targets[l] = (unsigned)events.size();
+        unsigned prefix = rawOffset - holdOffset;
+        relaxed += prefix;
+        optimal += prefix;
+        holdOffset = rawOffset;
+        events.push_back(Event(targets[l], 0, relaxed, optimal, prefix, Event::LABEL));
+        l++;
+      }
+      unsigned len = (unsigned)(stream[i].encode(scratch) - scratch);
+      rawOffset += len;
+      if (!stream[i].rip_addr)
+        continue;
+      auto target_index = ((unsigned*)(scratch + len))[-1];
+      if ((size_t)target_index >= label_offsets.size()) {
+        ErrorIndexOutOfRange(nullptr, target_index);
+        return 0;
+      }
+      unsigned prefix = rawOffset - holdOffset;
+      relaxed += prefix;
+      optimal += prefix;
+      holdOffset = rawOffset;
+      auto next = targets[target_index];
+      if (target_index >= l)
+        targets[target_index] = (unsigned)events.size();
+      byte savings = 0;
+      Event::Kind kind = Event::CANDIDATE;
+      if (stream[i].fixed_base)
+        kind = Event::FOURBYTE;
+      else {
+        savings = scratch[len - 5] == 0xe9 ? 3 : 4;
+        if (target_index < l && optimal - events[next].optimal > 128u + savings) {
+          kind = Event::FOURBYTE;
+          savings = 0;
+        } else {
+          optimal -= savings;
+          if (target_index < l && relaxed - events[next].relaxed <= 128u + savings) {
+            relaxed -= savings;
+            kind = Event::ONEBYTE;
+          }
+        }
+      }
+      events.push_back(Event(next, savings, relaxed, optimal, prefix, kind));
+    }
+    unsigned postfix = rawOffset - holdOffset;
+    Relax(events, relaxed, optimal);
+    plan.total = optimal + postfix;
+    return plan.total;
+  }
+
+  // Two-pass emission, pass two: write the bytes once, straight into a
+  // buffer of at least the size PlanEncode returned.  Every jump is
+  // emitted in its planned form, so nothing is re-encoded or moved.
+  byte* EncodePlanned(const EncodingPlan& plan, byte* out) const {
+    byte* dst = out;
+    for (size_t i = 0, e = stream.size(), l = 0, l_max = label_offsets.size(), ev = 0; i != e; i++) {
+      if (l < l_max && label_offsets[l] == i) {
+        l++;
+        ev++;
+      }
+      dst = stream[i].encode(dst);
+      if (!stream[i].rip_addr)
+        continue;
+      const Event& event = plan.events[ev++];
+      const Event& target = plan.events[event.target];
+      auto delta = (int)target.optimal - (int)event.optimal;
+      if (event.kind > Event::LABEL) {
+        ((int*)dst)[-1] = delta;
+        continue;
+      }
+      assert(delta == (char)delta);
+      dst -= event.savings;
+      if (event.savings == 3)
+        dst[-2] = 0xeb;
+      else
+        dst[-2] = dst[-1] - 0x10;
+      dst[-1] = (byte)delta;
+    }
+    return dst;
+  }
+
   byte* EncodeRelaxed(byte* const out) const {
     if (stream.size() == 0)
       return out;
     if (label_offsets.size() && label_offsets.back() == stream.size())
       return ErrorTrailingLabel(out);
-    unsigned relaxed, optimal, prior;
+    unsigned relaxed, optimal;
     byte* hold,* dst,* src;
     std::vector<Event> events;
     std::vector<unsigned> targets(label_offsets.size(), 0);
@@ -298,13 +462,49 @@ struct X64Builder {
     auto postfix = (unsigned)delta;
     if (postfix != delta)
       return ErrorCantEncodeDelta(out, delta);
-    // Perform relaxation.
+    Relax(events, relaxed, optimal);
+    dst = src = out;
+    for (size_t i = 0, e = events.size(); i != e; ++i) {
+      auto& event = events[i];
+      if (src == dst)
+        src = dst = out + event.optimal;
+      else
+        for (auto e = out + event.optimal; dst != e;)
+          *dst++ = *src++;
+      const auto& target = events[event.target];
+      auto delta = (int)target.optimal - (int)event.optimal;
+      if (event.kind == Event::LABEL)
+        continue;
+      if (event.kind > Event::LABEL) {
+        ((int*)dst)[-1] = (int)delta;
+        continue;
+      }
+      assert(delta == (char)delta);
+      if (event.savings == 3)
+        dst[-2] = 0xeb;
+      else
+        dst[-2] = dst[-1] - 0x10;
+      dst[-1] = (char)delta;
+      src += event.savings;
+    }
+    for (auto e = out + optimal + postfix; dst != e;)
+      *dst++ = *src++;
+    return dst;
+  }
+
+//#include "ops.h"
+
+private:
+  // The jump relaxation fixpoint shared by EncodeRelaxed and
+  // PlanEncode: repeatedly shrink candidate jumps whose planned
+  // distance fits a byte until no pass changes the outcome.
+  static void Relax(std::vector<Event>& events, unsigned& relaxed, unsigned& optimal) {
+    unsigned prior;
     do {
       // Set the initial conditional for a pass.
       prior = relaxed - optimal;
       relaxed = optimal = 0;
       // Execute a relaxation pass.
-      static const int EVENT_ID = 0;
       for (size_t i = 0, e = events.size(); i != e; ++i) {
         auto& event = events[i];
         optimal += event.prefix;
@@ -346,45 +546,64 @@ struct X64Builder {
         event.relaxed = relaxed;
       }
     } while (relaxed - optimal != prior);
-    dst = src = out;
-    for (size_t i = 0, e = events.size(); i != e; ++i) {
-      auto& event = events[i];
-      if (src == dst)
-        src = dst = out + event.optimal;
-      else
-        for (auto e = out + event.optimal; dst != e;)
-          *dst++ = *src++;
-      const auto& target = events[event.target];
-      auto delta = (int)target.optimal - (int)event.optimal;
-      if (event.kind == Event::LABEL)
-        continue;
-      if (event.kind > Event::LABEL) {
-        ((int*)dst)[-1] = (int)delta;
-        continue;
-      }
-      assert(delta == (char)delta);
-      if (event.savings == 3)
-        dst[-2] = 0xeb;
-      else
-        dst[-2] = dst[-1] - 0x10;
-      dst[-1] = (char)delta;
-      src += event.savings;
-    }
-    for (auto e = out + optimal + postfix; dst != e;)
-      *dst++ = *src++;
-    return dst;
   }
 
-//#include "ops.h"
+  // A one-byte-opcode modrm instruction with none of the addressing or
+  // prefix features that would complicate window matching.
+  static bool IsPlainModrm(const Instr& i) {
+    return !i.invalid && !i.use_vex && !i.code_map && i.has_modrm &&
+           !i.rip_addr && !i.fixed_base && !i.lock_rep;
+  }
+
+  static bool IsSelfMov(const Instr& i) {
+    return IsPlainModrm(i) && i.mod == 3 && !i.has_imm &&
+           (i.opcode & 0xfc) == 0x88 && i.reg == i.rm && i.r == i.b;
+  }
+
+  static bool IsRegRegTest(const Instr& i) {
+    return IsPlainModrm(i) && i.mod == 3 && !i.has_imm &&
+           (i.opcode & 0xfe) == 0x84 && i.reg == i.rm && i.r == i.b;
+  }
+
+  // rm values 4 and 5 with mod == 0 mean sib and disp32 respectively.
+  static bool IsLeaOfBase(const Instr& i) {
+    return IsPlainModrm(i) && i.opcode == 0x8d && i.mod == 0 &&
+           !i.has_sib && !i.force_disp && i.disp32 == 0 && i.rm != 4 &&
+           i.rm != 5;
+  }
+
+  // Does alu leave ZF/SF set exactly as TEST dst,dst would?  True for
+  // add/or/and/sub/xor (register and immediate forms) whose destination
+  // and operand size match the test's register.
+  static bool SetsFlagsOf(const Instr& alu, const Instr& test) {
+    if (!IsPlainModrm(alu) || alu.mod != 3) return false;
+    if (alu.w != test.w || alu.size_prefix != test.size_prefix ||
+        (alu.opcode & 1) != (test.opcode & 1))
+      return false;
+    byte base = alu.opcode & 0xfc;
+    if (base == 0x00 || base == 0x08 || base == 0x20 || base == 0x28 ||
+        base == 0x30) {
+      bool toReg = (alu.opcode & 2) != 0;
+      byte dst = toReg ? alu.reg : alu.rm;
+      byte dstRex = toReg ? alu.r : alu.b;
+      return dst == test.rm && dstRex == test.b;
+    }
+    if (base == 0x80 && alu.opcode != 0x82 && alu.has_imm &&
+        (alu.reg == 0 || alu.reg == 1 || alu.reg == 4 || alu.reg == 5 ||
+         alu.reg == 6))
+      return alu.rm == test.rm && alu.b == test.b;
+    return false;
+  }
 
-private:
   byte* ErrorIndexOutOfRange(byte* out, unsigned index) const {
-    fprintf(stderr, "Label index of %u is out of range [0, %Iu)\n", index, label_offsets.size());
+    fprintf(stderr, "Label index of %u is out of range [0, %llu)\n", index,
+            (unsigned long long)label_offsets.size());
     return out;
   }
 
   byte* ErrorCantEncodeDelta(byte* out, ptrdiff_t delta) const {
-    fprintf(stderr, "Can't encode delta (%I) with a 32-bit immediate.", delta);
+    fprintf(stderr, "Can't encode delta (%lld) with a 32-bit immediate.",
+            (long long)delta);
     return out;
   }
 
@@ -307,22 +307,29 @@ struct RegCode { int code; };
 int operator |(RegCode a, int b) { assert((unsigned)b <= 0xff); return a.code << 8 | b; };
 } // namespace {
 
-int main() {
+int main(int argc, char** argv) {
   //char buffer[4096];
   //size_t num_bytes;
-  FILE* template_cpp = fopen("template.cpp", "rb");
-  FILE* instr_h = fopen("instr.h", "rb");
-  FILE* f = fopen("x64builder.h", "wb");
+  // Paths may be passed explicitly so the build can run the generator
+  // from any directory; the defaults preserve the in-place workflow.
+  const char* template_path = argc > 1 ? argv[1] : "template.cpp";
+  const char* instr_path = argc > 2 ? argv[2] : "instr.h";
+  const char* output_path = argc > 3 ? argv[3] : "x64builder.h";
+  FILE* template_cpp = fopen(template_path, "rb");
+  FILE* instr_h = fopen(instr_path, "rb");
+  FILE* f = fopen(output_path, "wb");
   if (!instr_h || !template_cpp || !f) {
-    if (instr_h) fclose(instr_h); else fprintf(stderr, "Failed to open instr.h\n");
-    if (template_cpp) fclose(template_cpp); else fprintf(stderr, "Failed to open template.cpp\n");
-    if (f) fclose(f); else fprintf(stderr, "Failed to open x64builder.h\n");
+    if (instr_h) fclose(instr_h); else fprintf(stderr, "Failed to open %s\n", instr_path);
+    if (template_cpp) fclose(template_cpp); else fprintf(stderr, "Failed to open %s\n", template_path);
+    if (f) fclose(f); else fprintf(stderr, "Failed to open %s\n", output_path);
     return 1;
   }
 
   // Read template.cpp
   fseek(template_cpp, 0, SEEK_END);
-  auto template_size = ftell(template_cpp);
+  auto template_tell = ftell(template_cpp);
+  if (template_tell < 0) { fprintf(stderr, "Failed to get the size of template.cpp.\n"); return 1; }
+  auto template_size = (size_t)template_tell;
   fseek(template_cpp, 0, SEEK_SET);
   auto template_data = new char[template_size];
   if (fread(template_data, 1, template_size, template_cpp) != template_size) { fprintf(stderr, "Failed to read all of template.cpp in one call to fread.\n"); return 1; }
@@ -330,7 +337,9 @@ int main() {
 
   // Read instr.h
   fseek(instr_h, 0, SEEK_END);
-  auto instr_size = ftell(instr_h);
+  auto instr_tell = ftell(instr_h);
+  if (instr_tell < 0) { fprintf(stderr, "Failed to get the size of instr.h.\n"); return 1; }
+  auto instr_size = (size_t)instr_tell;
   fseek(instr_h, 0, SEEK_SET);
   auto instr_data = new char[instr_size];
   if (fread(instr_data, 1, instr_size, instr_h) != instr_size) { fprintf(stderr, "Failed to read all of instr.h in one call to fread.\n"); return 1; }
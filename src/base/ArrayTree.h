@@ -11,6 +11,7 @@
 #define OHMU_BASE_ARRAYTREE_H
 
 #include "MemRegion.h"
+#include "MutArrayRef.h"
 
 #include <cassert>
 #include <cstring>
@@ -84,6 +85,11 @@ public:
   template<class... Args>
   void resize(MemRegionRef A, unsigned Nsz, const Args&... args);
 
+  /// Append Num elements from Elems.  Leaves are filled a contiguous chunk
+  /// at a time, with a single capacity check, rather than one reserve and
+  /// leaf lookup per element.
+  void append(MemRegionRef A, const T* Elems, unsigned Num);
+
   /// drop last n elements from array
   void drop(unsigned Num) {
     assert(Size > Num);
@@ -194,12 +200,59 @@ public:
   ReverseAdaptor reverse() const { return ReverseAdaptor(*this); }
   ReverseAdaptor reverse()       { return ReverseAdaptor(*this); }
 
+
+  /// The number of leaves that currently hold elements.
+  unsigned numLeaves() const {
+    return rootIndex(Size) + (leafIndex(Size) > 0 ? 1 : 0);
+  }
+
+  /// Return the i'th leaf as a contiguous chunk of elements.  Every leaf
+  /// holds LeafSize elements, except possibly the last.
+  MutArrayRef<T> leaf(unsigned i) {
+    unsigned Begin = i << LeafSizeExponent;
+    unsigned Num   = ((Size - Begin) < LeafSize) ? (Size - Begin) : LeafSize;
+    return MutArrayRef<T>(Data[i], Num);
+  }
+
+  // An adaptor to iterate over the leaves of the tree.  Traversing leaf by
+  // leaf lets bulk operations work on contiguous memory, paying the root
+  // indirection once per LeafSize elements instead of once per element.
+  class LeafAdaptor {
+  public:
+    LeafAdaptor(ArrayTree &A) : ATree(A) {}
+
+    class Iterator {
+    public:
+      Iterator(ArrayTree &Atr, unsigned i) : ATree(Atr), Idx(i) { }
+
+      MutArrayRef<T> operator*() const { return ATree.leaf(Idx); }
+
+      const Iterator& operator++() { ++Idx; return *this; }
+
+      bool operator==(const Iterator& I) const { return Idx == I.Idx; }
+      bool operator!=(const Iterator& I) const { return Idx != I.Idx; }
+
+    private:
+      ArrayTree &ATree;
+      unsigned  Idx;    // Index of the leaf
+    };
+
+    Iterator begin() { return Iterator(ATree, 0); }
+    Iterator end()   { return Iterator(ATree, ATree.numLeaves()); }
+
+  private:
+    ArrayTree &ATree;
+  };
+
+  LeafAdaptor leaves() { return LeafAdaptor(*this); }
+
 private:
   static const unsigned MinusOne = static_cast<unsigned>(-1);
 
   // std::max is annoying here, because it requires a reference,
   // thus forcing InitialCapacity to be initialized outside the .h file.
   unsigned u_max(unsigned i, unsigned j) { return (i < j) ? j : i; }
+  unsigned u_min(unsigned i, unsigned j) { return (i < j) ? i : j; }
 
   static unsigned rootIndex(unsigned i) { return (i >> LeafSizeExponent); }
   static unsigned leafIndex(unsigned i) { return (i & (LeafSize - 1));    }
@@ -298,6 +351,29 @@ void ArrayTree<T, Exp>::resize(MemRegionRef A, unsigned Nsz,
 }
 
 
+template<class T, unsigned Exp>
+void ArrayTree<T, Exp>::append(MemRegionRef A, const T* Elems, unsigned Num) {
+  unsigned End = Size + Num;
+  if (End > Capacity)
+    reserve(A, u_max(u_max(DefaultInitialCapacity, Capacity*2), End));
+
+  unsigned i = Size;
+  while (i < End) {
+    unsigned Ri = rootIndex(i);
+    if (!Data[Ri])
+      Data[Ri] = A.allocateT<T>(LeafSize);
+
+    // Copy as many elements as fit in the current leaf.
+    unsigned Li    = leafIndex(i);
+    unsigned Chunk = u_min(LeafSize - Li, End - i);
+    for (unsigned j = 0; j < Chunk; ++j)
+      new (&Data[Ri][Li + j]) T(Elems[i - Size + j]);
+    i += Chunk;
+  }
+  Size = End;
+}
+
+
 }  // end namespace ohmu
 
 #endif  // OHMU_BASE_ARRAYTREE_H
@@ -0,0 +1,266 @@
+//===- DenseBitSet.h -------------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_BASE_DENSEBITSET_H
+#define OHMU_BASE_DENSEBITSET_H
+
+#include "MemRegion.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace ohmu {
+
+// A fixed-capacity set of small unsigned integers, stored one bit per
+// element in 64-bit words.  The capacity is chosen at creation and the
+// words come from an arena, so DenseBitSet works with bump-pointer
+// allocation like SimpleArray.  The bulk operations (|=, &=, andNot,
+// count) are plain word loops that compilers autovectorize; iteration
+// over set bits uses count-trailing-zeros, so sparse sets iterate in
+// time proportional to the number of set bits.
+//
+// Liveness and dataflow solvers should use unionWith(), which reports
+// whether the union added any bits, to detect their fixed point.
+class DenseBitSet {
+public:
+  typedef uint64_t Word;
+  static const unsigned BitsPerWord = 64;
+
+  DenseBitSet() : Words(nullptr), NumBits(0), NumWords(0) {}
+
+  // Create a set with capacity Nbits, all bits clear.
+  DenseBitSet(MemRegionRef A, unsigned Nbits)
+      : Words(Nbits == 0 ? nullptr : A.allocateT<Word>(numWords(Nbits))),
+        NumBits(Nbits), NumWords(numWords(Nbits)) {
+    clear();
+  }
+
+  DenseBitSet(DenseBitSet &&S)
+      : Words(S.Words), NumBits(S.NumBits), NumWords(S.NumWords) {
+    S.Words = nullptr;
+    S.NumBits = 0;
+    S.NumWords = 0;
+  }
+
+  DenseBitSet &operator=(DenseBitSet &&S) {
+    if (this != &S) {
+      Words = S.Words;
+      NumBits = S.NumBits;
+      NumWords = S.NumWords;
+      S.Words = nullptr;
+      S.NumBits = S.NumWords = 0;
+    }
+    return *this;
+  }
+
+  DenseBitSet(const DenseBitSet &) = delete;
+  void operator=(const DenseBitSet &) = delete;
+
+  // Return a copy of this set, allocated from A.
+  DenseBitSet clone(MemRegionRef A) const {
+    DenseBitSet S(A, NumBits);
+    for (unsigned i = 0; i < NumWords; ++i)
+      S.Words[i] = Words[i];
+    return S;
+  }
+
+  // Return the number of bits the set can hold.
+  unsigned capacity() const { return NumBits; }
+
+  bool test(unsigned i) const {
+    assert(i < NumBits && "Bit index out of range.");
+    return (Words[i / BitsPerWord] >> (i % BitsPerWord)) & 1;
+  }
+
+  void set(unsigned i) {
+    assert(i < NumBits && "Bit index out of range.");
+    Words[i / BitsPerWord] |= Word(1) << (i % BitsPerWord);
+  }
+
+  void reset(unsigned i) {
+    assert(i < NumBits && "Bit index out of range.");
+    Words[i / BitsPerWord] &= ~(Word(1) << (i % BitsPerWord));
+  }
+
+  // Set bit i, and return its previous value.
+  bool testAndSet(unsigned i) {
+    assert(i < NumBits && "Bit index out of range.");
+    Word &W = Words[i / BitsPerWord];
+    Word M = Word(1) << (i % BitsPerWord);
+    bool Old = W & M;
+    W |= M;
+    return Old;
+  }
+
+  // Clear every bit.
+  void clear() {
+    for (unsigned i = 0; i < NumWords; ++i)
+      Words[i] = 0;
+  }
+
+  // Set every bit.
+  void setAll() {
+    for (unsigned i = 0; i < NumWords; ++i)
+      Words[i] = ~Word(0);
+    clearPadding();
+  }
+
+  bool empty() const {
+    for (unsigned i = 0; i < NumWords; ++i)
+      if (Words[i] != 0)
+        return false;
+    return true;
+  }
+
+  // Return the number of set bits.
+  unsigned count() const {
+    unsigned N = 0;
+    for (unsigned i = 0; i < NumWords; ++i)
+      N += popCount(Words[i]);
+    return N;
+  }
+
+  // The word-parallel operations require both sets to have the same
+  // capacity.
+
+  void operator|=(const DenseBitSet &S) {
+    assert(NumBits == S.NumBits && "Capacity mismatch.");
+    for (unsigned i = 0; i < NumWords; ++i)
+      Words[i] |= S.Words[i];
+  }
+
+  void operator&=(const DenseBitSet &S) {
+    assert(NumBits == S.NumBits && "Capacity mismatch.");
+    for (unsigned i = 0; i < NumWords; ++i)
+      Words[i] &= S.Words[i];
+  }
+
+  // Remove every bit that is set in S.
+  void andNot(const DenseBitSet &S) {
+    assert(NumBits == S.NumBits && "Capacity mismatch.");
+    for (unsigned i = 0; i < NumWords; ++i)
+      Words[i] &= ~S.Words[i];
+  }
+
+  // Union S into this set, and return true if any bit was added.
+  bool unionWith(const DenseBitSet &S) {
+    assert(NumBits == S.NumBits && "Capacity mismatch.");
+    Word Changed = 0;
+    for (unsigned i = 0; i < NumWords; ++i) {
+      Word New = Words[i] | S.Words[i];
+      Changed |= New ^ Words[i];
+      Words[i] = New;
+    }
+    return Changed != 0;
+  }
+
+  // Return true if this set and S have a bit in common.
+  bool intersects(const DenseBitSet &S) const {
+    assert(NumBits == S.NumBits && "Capacity mismatch.");
+    for (unsigned i = 0; i < NumWords; ++i)
+      if (Words[i] & S.Words[i])
+        return true;
+    return false;
+  }
+
+  bool operator==(const DenseBitSet &S) const {
+    if (NumBits != S.NumBits)
+      return false;
+    for (unsigned i = 0; i < NumWords; ++i)
+      if (Words[i] != S.Words[i])
+        return false;
+    return true;
+  }
+  bool operator!=(const DenseBitSet &S) const { return !(*this == S); }
+
+  // Iterates over the indices of the set bits, in increasing order.
+  class iterator {
+  public:
+    unsigned operator*() const {
+      return Idx * BitsPerWord + countTrailingZeros(Cur);
+    }
+
+    iterator &operator++() {
+      Cur &= Cur - 1;  // Clear the lowest set bit.
+      advance();
+      return *this;
+    }
+
+    bool operator==(const iterator &I) const {
+      return Idx == I.Idx && Cur == I.Cur;
+    }
+    bool operator!=(const iterator &I) const { return !(*this == I); }
+
+  private:
+    friend class DenseBitSet;
+
+    iterator(const Word *Ws, unsigned Nw, unsigned I)
+        : Ws(Ws), Nw(Nw), Idx(I), Cur(I < Nw ? Ws[I] : 0) {
+      advance();
+    }
+
+    // Skip empty words until a set bit or the end is found.
+    void advance() {
+      while (Cur == 0 && ++Idx < Nw)
+        Cur = Ws[Idx];
+      if (Idx >= Nw) {
+        Idx = Nw;
+        Cur = 0;
+      }
+    }
+
+    const Word *Ws;
+    unsigned    Nw;
+    unsigned    Idx;
+    Word        Cur;
+  };
+
+  iterator begin() const { return iterator(Words, NumWords, 0); }
+  iterator end()   const { return iterator(Words, NumWords, NumWords); }
+
+private:
+  static unsigned numWords(unsigned Nbits) {
+    return (Nbits + BitsPerWord - 1) / BitsPerWord;
+  }
+
+  static unsigned countTrailingZeros(Word W) {
+#ifdef _MSC_VER
+    unsigned long A;
+    _BitScanForward64(&A, W);
+    return static_cast<unsigned>(A);
+#else
+    return __builtin_ctzll(W);
+#endif
+  }
+
+  static unsigned popCount(Word W) {
+#ifdef _MSC_VER
+    return static_cast<unsigned>(__popcnt64(W));
+#else
+    return __builtin_popcountll(W);
+#endif
+  }
+
+  // Clear the unused bits of the last word, so that count() and
+  // iteration never see bits past capacity().
+  void clearPadding() {
+    unsigned Rem = NumBits % BitsPerWord;
+    if (Rem != 0)
+      Words[NumWords - 1] &= (Word(1) << Rem) - 1;
+  }
+
+  Word*    Words;
+  unsigned NumBits;
+  unsigned NumWords;
+};
+
+}  // end namespace ohmu
+
+#endif  // OHMU_BASE_DENSEBITSET_H
@@ -25,6 +25,8 @@
 #include "LLVMDependencies.h"
 
 #include <ostream>
+#include <sstream>
+#include <vector>
 
 namespace ohmu {
 
@@ -85,22 +87,88 @@ private:
 
 /// This file defines a simple interface for publishing warnings and errors.
 /// The current methods are placeholders; they will be improved in the future.
+///
+/// By default diagnostics are written to std::cerr as they occur.  In
+/// deferred mode they are instead recorded in an in-memory buffer, which
+/// keeps stream formatting and locking off the hot path of clean compiles;
+/// callers flush the buffer at end of run, or when an error is detected.
 class DiagnosticEmitter {
 public:
-  DiagnosticEmitter() : dstream_(std::cerr) { }
+  enum Severity {
+    DS_Warning,
+    DS_Error
+  };
+
+  DiagnosticEmitter()
+      : dstream_(std::cerr), bufstream_(buffer_), deferred_(false),
+        numErrors_(0), numWarnings_(0)
+  { }
+
+  /// In deferred mode, diagnostics are buffered rather than written.
+  void setDeferred(bool b) { deferred_ = b; }
+
+  unsigned numErrors()   const { return numErrors_;   }
+  unsigned numWarnings() const { return numWarnings_; }
 
   DiagnosticStream& error(const char* msg) {
-    dstream_ << "\nerror: " << msg;
-    return dstream_;
+    ++numErrors_;
+    record(DS_Error);
+    DiagnosticStream& ds = stream();
+    ds << "\nerror: " << msg;
+    return ds;
   }
 
   DiagnosticStream& warning(const char* msg) {
-    dstream_ << "\nwarning: " << msg;
-    return dstream_;
+    ++numWarnings_;
+    record(DS_Warning);
+    DiagnosticStream& ds = stream();
+    ds << "\nwarning: " << msg;
+    return ds;
+  }
+
+  /// Write all buffered diagnostics to os, and clear the buffer.
+  /// Does nothing unless deferred mode is on.
+  void flush(std::ostream& os) {
+    if (records_.empty())
+      return;
+    os << buffer_.str();
+    buffer_.str("");
+    records_.clear();
+  }
+
+  /// Discard all buffered diagnostics (e.g. after a successful retry of
+  /// speculative work).
+  void discard() {
+    buffer_.str("");
+    records_.clear();
   }
 
 private:
-  DiagnosticStream dstream_;
+  /// A buffered diagnostic: severity, plus the offset of its preformatted
+  /// text in buffer_.
+  struct Record {
+    Severity severity;
+    size_t   offset;
+  };
+
+  DiagnosticStream& stream() {
+    return deferred_ ? bufstream_ : dstream_;
+  }
+
+  void record(Severity s) {
+    if (!deferred_)
+      return;
+    Record r = { s, static_cast<size_t>(buffer_.tellp()) };
+    records_.push_back(r);
+  }
+
+  std::ostringstream  buffer_;     // text of buffered diagnostics
+  DiagnosticStream    dstream_;    // immediate mode: write to std::cerr
+  DiagnosticStream    bufstream_;  // deferred mode: write to buffer_
+  bool                deferred_;
+  unsigned            numErrors_;
+  unsigned            numWarnings_;
+  std::vector<Record> records_;
 };
 
 
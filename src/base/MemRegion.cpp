@@ -17,20 +17,16 @@
 
 #include "MemRegion.h"
 
-namespace ohmu {
-
-MemRegion::MemRegion()
-    : currentBlock_(0), currentBlockEnd_(0), currentPosition_(0),
-      largeBlocks_(0) {
-  grabNewBlock();
-}
+#include <atomic>
+#include <cstring>
 
+namespace ohmu {
 
 inline void freeList(char* p) {
   while (p) {
     // std::cerr << ".";
-    // Each block has a pointer to the previous block at the start
-    char* np = *reinterpret_cast<char**>(p);
+    // Each block has a header with a pointer to the previous block
+    char* np = reinterpret_cast<MemRegion::BlockHeader*>(p)->next;
     free(p);
     p = np;  // pun intended.
   }
@@ -38,9 +34,87 @@ inline void freeList(char* p) {
 }
 
 
+namespace {
+
+// A free list of recycled bump allocation blocks.  Regions are created and
+// destroyed at a high rate (e.g. one per translated function), so rather than
+// handing blocks back to malloc, destroyed regions park them here and new
+// regions draw from the list.  The pool is per-thread, so no locking is
+// needed.  Only blocks of defaultBlockSize are recycled; large blocks are
+// freed immediately.
+class BlockPool {
+public:
+  // Maximum number of free blocks retained per thread.
+  static const unsigned maxFreeBlocks = 256;
+
+  BlockPool() : freeBlocks_(nullptr), numFreeBlocks_(0) { }
+
+  ~BlockPool() { freeList(freeBlocks_); }
+
+  // Grab a recycled block, or null if the pool is empty.
+  char* grab() {
+    if (!freeBlocks_)
+      return nullptr;
+    char* p = freeBlocks_;
+    freeBlocks_ = *reinterpret_cast<char**>(p);
+    --numFreeBlocks_;
+    return p;
+  }
+
+  // Take ownership of the block list rooted at p.  Blocks that are not
+  // defaultBlockSize, or that exceed the cap, are freed.
+  void recycle(char* p) {
+    while (p) {
+      MemRegion::BlockHeader* h = reinterpret_cast<MemRegion::BlockHeader*>(p);
+      char* np = h->next;
+      if (h->size == MemRegion::defaultBlockSize &&
+          numFreeBlocks_ < maxFreeBlocks) {
+        h->next = freeBlocks_;
+        freeBlocks_ = p;
+        ++numFreeBlocks_;
+      }
+      else {
+        free(p);
+      }
+      p = np;
+    }
+  }
+
+private:
+  char*    freeBlocks_;
+  unsigned numFreeBlocks_;
+};
+
+thread_local BlockPool blockPool;
+
+}  // end anonymous namespace
+
+
+unsigned MemRegion::nextId() {
+  static std::atomic<unsigned> counter(0);
+  return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+
+MemRegion::MemRegion(unsigned blockSize)
+    : id_(nextId()), blockSize_(blockSize), currentBlock_(0),
+      currentBlockEnd_(0), currentPosition_(0), largeBlocks_(0) {
+#ifdef OHMU_MEMREGION_STATS
+  bytesAllocated_ = 0;
+  liveBytes_      = 0;
+  highWaterMark_  = 0;
+  numBlocks_      = 0;
+  numLargeAllocs_ = 0;
+  numScopes_      = 0;
+  scopeDepth_     = 0;
+#endif
+  grabNewBlock();
+}
+
+
 MemRegion::~MemRegion() {
   // std::cerr << "\nfree[" << std::hex << reinterpret_cast<size_t>(this) << "]";
-  freeList(currentBlock_);
+  blockPool.recycle(currentBlock_);
   // std::cerr << "\nfree[]";
   freeList(largeBlocks_);
 }
@@ -50,13 +124,195 @@ void MemRegion::grabNewBlock() {
   // std::cerr << "\nallocBlock[" << std::hex << reinterpret_cast<size_t>(this) << "]";
 
   // FIXME: ideally, we'd like to allocate exact memory pages.
-  // If defaultBlockSize=4096, and malloc adds headers of its own, then we
+  // If blockSize_=4096, and malloc adds headers of its own, then we
   // may be over page size.
-  char* newBlock = reinterpret_cast<char*>(malloc(defaultBlockSize));
-  linkBack(currentBlock_, newBlock);
+  char* newBlock = nullptr;
+  if (blockSize_ == defaultBlockSize)
+    newBlock = blockPool.grab();
+  if (!newBlock)
+    newBlock = reinterpret_cast<char*>(malloc(blockSize_));
+  linkBack(currentBlock_, newBlock, blockSize_);
+#ifdef OHMU_MEMREGION_STATS
+  ++numBlocks_;
+#endif
+
+  currentPosition_ = newBlock + headerSize;
+  currentBlockEnd_ = newBlock + blockSize_;
+}
+
+
+void MemRegion::rollback(const Checkpoint& cp) {
+  // Release bump blocks grabbed since the checkpoint.  Blocks are linked
+  // newest-first, so everything before cp.block goes back to the pool.
+  char* p = currentBlock_;
+  while (p != cp.block) {
+    BlockHeader* h = reinterpret_cast<BlockHeader*>(p);
+    char* np = h->next;
+    h->next = nullptr;
+    blockPool.recycle(p);
+    p = np;
+  }
+  currentBlock_ = cp.block;
+
+  // Free large blocks allocated since the checkpoint.
+  p = largeBlocks_;
+  while (p != cp.largeBlocks) {
+    char* np = reinterpret_cast<BlockHeader*>(p)->next;
+    free(p);
+    p = np;
+  }
+  largeBlocks_ = cp.largeBlocks;
+
+  currentPosition_ = cp.position;
+  currentBlockEnd_ = cp.blockEnd;
+#ifdef OHMU_MEMREGION_STATS
+  liveBytes_ = cp.liveBytes;
+#endif
+}
+
+
+void MemRegion::deallocateAll() {
+  blockPool.recycle(currentBlock_);
+  freeList(largeBlocks_);
+  currentBlock_    = nullptr;
+  currentBlockEnd_ = nullptr;
+  currentPosition_ = nullptr;
+  largeBlocks_     = nullptr;
+#ifdef OHMU_MEMREGION_STATS
+  liveBytes_ = 0;
+#endif
+  grabNewBlock();
+}
+
+
+void MemRegion::Snapshot::capture(MemRegion& region) {
+  release();
+  region_ = &region;
+  cp_     = region.checkpoint();
+
+  // Count the live spans: the used part of the current bump block, the
+  // full body of every older bump block, and every large block.
+  numChunks_ = 0;
+  numBytes_  = 0;
+  for (char* p = region.currentBlock_; p; p = header(p)->next) {
+    ++numChunks_;
+    numBytes_ += (p == region.currentBlock_)
+        ? region.currentPosition_ - (p + headerSize)
+        : header(p)->size - headerSize;
+  }
+  for (char* p = region.largeBlocks_; p; p = header(p)->next) {
+    ++numChunks_;
+    numBytes_ += header(p)->size - headerSize;
+  }
+
+  chunks_ = reinterpret_cast<Chunk*>(malloc(numChunks_ * sizeof(Chunk)));
+  bytes_  = reinterpret_cast<char*>(malloc(numBytes_));
+
+  unsigned i = 0;
+  size_t offset = 0;
+  for (char* p = region.currentBlock_; p; p = header(p)->next) {
+    size_t sz = (p == region.currentBlock_)
+        ? region.currentPosition_ - (p + headerSize)
+        : header(p)->size - headerSize;
+    chunks_[i] = { p + headerSize, sz, offset };
+    memcpy(bytes_ + offset, p + headerSize, sz);
+    offset += sz;
+    ++i;
+  }
+  for (char* p = region.largeBlocks_; p; p = header(p)->next) {
+    size_t sz = header(p)->size - headerSize;
+    chunks_[i] = { p + headerSize, sz, offset };
+    memcpy(bytes_ + offset, p + headerSize, sz);
+    offset += sz;
+    ++i;
+  }
+}
+
+
+void MemRegion::Snapshot::restore() {
+  if (!region_)
+    return;
+  region_->rollback(cp_);
+  for (unsigned i = 0; i < numChunks_; ++i)
+    memcpy(chunks_[i].addr, bytes_ + chunks_[i].offset, chunks_[i].size);
+}
+
+
+void MemRegion::Snapshot::release() {
+  free(chunks_);
+  free(bytes_);
+  region_    = nullptr;
+  chunks_    = nullptr;
+  numChunks_ = 0;
+  bytes_     = nullptr;
+  numBytes_  = 0;
+}
+
+
+#ifdef OHMU_MEMREGION_STATS
+
+void MemRegion::pushScope(const char* name) {
+  if (scopeDepth_ >= maxScopes)
+    return;
+  // Reuse an existing entry for this name, so that repeated passes
+  // accumulate into one counter.
+  unsigned i = 0;
+  for (; i < numScopes_; ++i) {
+    if (scopes_[i].name == name)
+      break;
+  }
+  if (i == numScopes_) {
+    if (numScopes_ >= maxScopes)
+      return;
+    scopes_[i].name  = name;
+    scopes_[i].bytes = 0;
+    ++numScopes_;
+  }
+  scopeStack_[scopeDepth_++] = i;
+}
+
+
+void MemRegion::popScope() {
+  if (scopeDepth_ > 0)
+    --scopeDepth_;
+}
+
+
+void MemRegion::dumpStats(std::ostream& os) const {
+  os << "MemRegion stats:\n"
+     << "  bytes allocated: " << bytesAllocated_ << "\n"
+     << "  live bytes:      " << liveBytes_      << "\n"
+     << "  high-water mark: " << highWaterMark_  << "\n"
+     << "  bump blocks:     " << numBlocks_      << "\n"
+     << "  large allocs:    " << numLargeAllocs_ << "\n";
+  for (unsigned i = 0; i < numScopes_; ++i) {
+    os << "  scope " << scopes_[i].name << ": "
+       << scopes_[i].bytes << " bytes\n";
+  }
+}
+
+#else
+
+void MemRegion::pushScope(const char* name) { }
+void MemRegion::popScope() { }
+void MemRegion::dumpStats(std::ostream& os) const { }
+
+#endif  // OHMU_MEMREGION_STATS
+
+
+void MemRegion::reserve(size_t nbytes) {
+  size_t remaining = currentBlockEnd_ - currentPosition_;
+  if (remaining >= nbytes)
+    return;
+
+  // Grab a single slab big enough for nbytes, and make it the current
+  // bump allocation block.
+  size_t slabSize = nbytes + headerSize;
+  char* newBlock = reinterpret_cast<char*>(malloc(slabSize));
+  linkBack(currentBlock_, newBlock, slabSize);
 
   currentPosition_ = newBlock + headerSize;
-  currentBlockEnd_ = newBlock + defaultBlockSize;
+  currentBlockEnd_ = newBlock + slabSize;
 }
 
 
@@ -30,17 +30,137 @@
 #include <iostream>
 #include <iomanip>
 
+// Define OHMU_MEMREGION_STATS to compile in per-region allocation counters
+// and the scope tagging API.  When it is not defined, the statistics
+// interface remains callable but compiles away to nothing.
+
 namespace ohmu {
 
 
 class MemRegion {
 public:
-  // Create a new MemRegion
-  MemRegion();
+  static const unsigned defaultBlockSize  = 4096;  // 4kb blocks
+  static const unsigned maxBumpAllocSize  = 512;   // 8 allocs per block
+
+  // Each block begins with a header holding a link to the previous block,
+  // and the total size of the block (header included).
+  struct BlockHeader {
+    char*  next;
+    size_t size;
+  };
+
+  // Create a new MemRegion.  Bump allocation blocks are blockSize bytes;
+  // larger blocks reduce grabNewBlock() traffic for big regions.
+  explicit MemRegion(unsigned blockSize = defaultBlockSize);
 
   // Destroy a MemRegion, along with all data that was allocated in it.
   ~MemRegion();
 
+  // Set the size of subsequently allocated bump allocation blocks.
+  // Does not affect blocks that have already been allocated.
+  void setBlockSize(unsigned blockSize) { blockSize_ = blockSize; }
+
+  // A process-unique, nonzero id for this region.  Unlike the region's
+  // address, ids are never reused, so a cached id detects the case where
+  // a region is destroyed and a new one constructed at the same address.
+  unsigned id() const { return id_; }
+
+  // Pre-allocate a single contiguous slab with room for at least nbytes of
+  // bump allocation, so that subsequent small allocations do not span
+  // multiple blocks.  Does nothing if the current block already has room.
+  void reserve(size_t nbytes);
+
+  // A Checkpoint marks a position in a region, so that memory allocated
+  // after the mark can be reclaimed by rollback().
+  struct Checkpoint {
+    char* block;
+    char* position;
+    char* blockEnd;
+    char* largeBlocks;
+#ifdef OHMU_MEMREGION_STATS
+    size_t liveBytes;
+#endif
+  };
+
+  // Capture the current allocation position.
+  Checkpoint checkpoint() const {
+    Checkpoint cp = { currentBlock_, currentPosition_, currentBlockEnd_,
+                      largeBlocks_ };
+#ifdef OHMU_MEMREGION_STATS
+    cp.liveBytes = liveBytes_;
+#endif
+    return cp;
+  }
+
+  // Rewind the region to a previously captured checkpoint, releasing all
+  // memory allocated since.  Destructors are not run; objects allocated
+  // after the checkpoint must be trivially destructible or already dead.
+  // The checkpoint must have been captured from this region.
+  void rollback(const Checkpoint& cp);
+
+  // A Snapshot captures both the allocation position and the byte contents
+  // of a region, so that objects in the region can be mutated in place and
+  // the mutations later backed out.  restore() rolls the region back to
+  // the capture point and copies the saved bytes over the original
+  // addresses, so pointers between objects in the region stay valid with
+  // no fixup pass; the cost of a restore is a memcpy of the live bytes.
+  // As with rollback(), destructors are not run.
+  class Snapshot {
+  public:
+    Snapshot() : region_(nullptr), chunks_(nullptr), numChunks_(0),
+                 bytes_(nullptr), numBytes_(0) {}
+    ~Snapshot() { release(); }
+
+    // Save the contents of region, discarding any previous capture.  The
+    // blocks live at capture time must not be released (by rollback() past
+    // this point, deallocateAll(), or destruction) while the snapshot is
+    // in use.
+    void capture(MemRegion& region);
+
+    // Rewind the region to the capture point and restore the saved
+    // contents.  May be called repeatedly, e.g. once per speculative
+    // rewrite attempt.
+    void restore();
+
+    // Free the saved contents.
+    void release();
+
+    bool   captured()   const { return region_ != nullptr; }
+    size_t savedBytes() const { return numBytes_; }
+
+  private:
+    // One contiguous span of live bytes, at addr in the region and at
+    // offset in the bytes_ buffer.
+    struct Chunk {
+      char*  addr;
+      size_t size;
+      size_t offset;
+    };
+
+    MemRegion* region_;
+    Checkpoint cp_;
+    Chunk*     chunks_;
+    unsigned   numChunks_;
+    char*      bytes_;
+    size_t     numBytes_;
+  };
+
+  // Release every block in the region, returning it to its freshly
+  // constructed state.  As with rollback(), destructors are not run.
+  void deallocateAll();
+
+  // Begin attributing subsequent allocations to the named scope (e.g. the
+  // current pass).  Scopes nest; name must outlive the region.
+  void pushScope(const char* name);
+
+  // End the current allocation scope.
+  void popScope();
+
+  // Print allocation statistics (bytes allocated, block counts, high-water
+  // mark, and per-scope bytes) to os.  Prints nothing unless
+  // OHMU_MEMREGION_STATS is defined.
+  void dumpStats(std::ostream& os) const;
+
   // Pad sizes out to nearest 8 byte boundary.
   inline unsigned getAlignedSize(unsigned size) {
     if ((size & 0x7) == 0)
@@ -73,9 +193,26 @@ public:
   // No-op.
   void deallocate(void* ptr) { }
 
+  // Attempt to grow an existing allocation in place, from oldSize to
+  // newSize bytes.  Succeeds only if ptr is the most recent bump allocation
+  // and the current block has room, in which case the bump pointer is
+  // simply advanced.  Returns false otherwise; the caller must then
+  // allocate a new buffer and copy.
+  inline bool tryGrowInPlace(void* ptr, size_t oldSize, size_t newSize) {
+    char* p = reinterpret_cast<char*>(ptr);
+    if (p + getAlignedSize(oldSize) != currentPosition_)
+      return false;
+    char* newEnd = p + getAlignedSize(newSize);
+    if (newEnd >= currentBlockEnd_)
+      return false;
+    currentPosition_ = newEnd;
+    return true;
+  }
+
   inline void* allocateSmall(size_t size) {
     if (currentPosition_ + size >= currentBlockEnd_)
       grabNewBlock();
+    recordAlloc(size);
 
     void* result = currentPosition_;
     currentPosition_ += size;
@@ -85,27 +222,73 @@ public:
   inline void* allocateLarge(size_t size) {
     // std::cerr << "\nallocLarge " << size;
     char* p = reinterpret_cast<char*>(malloc(size + headerSize));
-    linkBack(largeBlocks_, p);
+    linkBack(largeBlocks_, p, size + headerSize);
+    recordAlloc(size);
+#ifdef OHMU_MEMREGION_STATS
+    ++numLargeAllocs_;
+#endif
     return p + headerSize;
   }
 
   void grabNewBlock();
 
 private:
-  static const unsigned defaultBlockSize  = 4096;  // 4kb blocks
-  static const unsigned maxBumpAllocSize  = 512;   // 8 allocs per block
-  static const unsigned headerSize        = sizeof(void*);
+  static const unsigned headerSize = sizeof(BlockHeader);
 
-  void linkBack(char*& blockPointer, char* newBlock) {
-    *reinterpret_cast<char**>(newBlock) = blockPointer;
+  static BlockHeader* header(char* block) {
+    return reinterpret_cast<BlockHeader*>(block);
+  }
+
+  void linkBack(char*& blockPointer, char* newBlock, size_t size) {
+    BlockHeader* h = reinterpret_cast<BlockHeader*>(newBlock);
+    h->next = blockPointer;
+    h->size = size;
     blockPointer = newBlock;
   }
 
+#ifdef OHMU_MEMREGION_STATS
+  static const unsigned maxScopes = 16;
+
+  struct ScopeStats {
+    const char* name;
+    size_t      bytes;
+  };
+
+  inline void recordAlloc(size_t size) {
+    bytesAllocated_ += size;
+    liveBytes_      += size;
+    if (liveBytes_ > highWaterMark_)
+      highWaterMark_ = liveBytes_;
+    if (scopeDepth_ > 0)
+      scopes_[scopeStack_[scopeDepth_ - 1]].bytes += size;
+  }
+#else
+  inline void recordAlloc(size_t size) { }
+#endif
+
+  static unsigned nextId();
+
+  unsigned id_;             // process-unique region id; see id()
+  unsigned blockSize_;      // size of bump allocation blocks
+
   char* currentBlock_;      // current bump allocation block
   char* currentBlockEnd_;
   char* currentPosition_;
 
   char* largeBlocks_;       // linked list of large blocks
+
+#ifdef OHMU_MEMREGION_STATS
+  size_t bytesAllocated_;   // total bytes ever allocated
+  size_t liveBytes_;        // bytes currently allocated (net of rollbacks)
+  size_t highWaterMark_;    // maximum value of liveBytes_
+  size_t numBlocks_;        // number of bump blocks grabbed
+  size_t numLargeAllocs_;   // number of large allocations
+
+  ScopeStats scopes_[maxScopes];      // per-scope byte counts
+  unsigned   numScopes_;
+  unsigned   scopeStack_[maxScopes];  // indices of active scopes
+  unsigned   scopeDepth_;
+#endif
 };
 
 
@@ -117,6 +300,9 @@ public:
 
   void setRegion(MemRegion *r) { allocator_ = r; }
 
+  // The id of the referenced region, or 0 for a null reference.
+  unsigned regionId() const { return allocator_ ? allocator_->id() : 0; }
+
   void *allocate(size_t sz) {
     return allocator_->allocate(sz);
   }
@@ -129,6 +315,14 @@ public:
     return allocator_->allocateT<T>(nelems);
   }
 
+  void reserve(size_t nbytes) {
+    allocator_->reserve(nbytes);
+  }
+
+  bool tryGrowInPlace(void* ptr, size_t oldSize, size_t newSize) {
+    return allocator_->tryGrowInPlace(ptr, oldSize, newSize);
+  }
+
 private:
   MemRegion* allocator_;
 };
@@ -10,6 +10,7 @@
 #ifndef OHMU_BASE_MUTARRAYREF_H
 #define OHMU_BASE_MUTARRAYREF_H
 
+#include <cstddef>
 
 namespace ohmu {
 
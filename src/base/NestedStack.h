@@ -66,10 +66,20 @@ public:
 
   /// Clear all elements from topmost stack.
   void clear() {
-    for (unsigned i=0,n=size(); i < n; ++i)
-      Elements.pop_back();
+    Elements.resize(Start);
   }
 
+  /// Clear every stack, including saved ones, but retain the allocated
+  /// storage.  Use this to recycle a stack across parses of successive
+  /// definitions instead of constructing a fresh one each time.
+  void clearAll() {
+    Elements.clear();
+    Start = 0;
+  }
+
+  /// Pre-allocate storage for n elements across all nested stacks.
+  void reserve(unsigned n) { Elements.reserve(n); }
+
   /// Save topmost stack, and return an id that can be used to restore it.
   /// Clear topmost stack.
   unsigned save() {
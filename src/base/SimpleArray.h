@@ -44,9 +44,15 @@ public:
   }
 
   /// Reserve space for at least Ncp items, reallocating if necessary.
+  /// If this array is the most recent allocation in its region, the buffer
+  /// is grown in place, with no copy and no wasted arena space.
   void reserve(size_t Ncp, MemRegionRef A) {
     if (Ncp <= Capacity)
       return;
+    if (Data && A.tryGrowInPlace(Data, sizeof(T) * Capacity, sizeof(T) * Ncp)) {
+      Capacity = Ncp;
+      return;
+    }
     T *Odata = Data;
     Data = A.allocateT<T>(Ncp);
     Capacity = Ncp;
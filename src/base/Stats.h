@@ -0,0 +1,115 @@
+//===- Stats.h -------------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// Compile-time-optional statistics counters for the hot paths of the
+// pipeline.  Define OHMU_STATS to compile the counters in; without it,
+// the macros expand to nothing and there is no run-time cost at all.
+//
+// Usage, at file scope in the translation unit that owns the counter:
+//
+//   OHMU_STAT(NumWidgets, "Widgets frobbed.");
+//   ...
+//   OHMU_STAT_INC(NumWidgets);
+//   OHMU_STAT_ADD(NumWidgets, n);
+//
+// Counters register themselves in a global list at static initialization
+// time, and printStatistics() writes a consolidated report.  A counter
+// defined in a header exists once per translation unit; the report merges
+// counters by name, so the totals come out right.  Increments are relaxed
+// atomics, so counters may be bumped freely from pool threads.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_BASE_STATS_H
+#define OHMU_BASE_STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <string>
+
+namespace ohmu {
+
+#ifdef OHMU_STATS
+
+class Statistic {
+public:
+  Statistic(const char* name, const char* desc)
+      : name_(name), desc_(desc), value_(0) {
+    // Lock-free push onto the global list; counters are only registered
+    // during static initialization, and never removed.
+    next_ = head().exchange(this);
+  }
+
+  void add(uint64_t n) { value_.fetch_add(n, std::memory_order_relaxed); }
+
+  const char* name()  const { return name_; }
+  const char* desc()  const { return desc_; }
+  uint64_t    value() const { return value_.load(std::memory_order_relaxed); }
+  Statistic*  next()  const { return next_; }
+
+  static std::atomic<Statistic*>& head() {
+    static std::atomic<Statistic*> h;
+    return h;
+  }
+
+private:
+  const char* name_;
+  const char* desc_;
+  std::atomic<uint64_t> value_;
+  Statistic* next_;
+};
+
+
+// Writes every registered counter to Out, one per line, merging counters
+// that share a name (the same header-defined counter seen from several
+// translation units).  Counters that were never bumped are omitted.
+inline void printStatistics(std::ostream& Out) {
+  std::map<std::string, std::pair<uint64_t, const char*>> merged;
+  for (Statistic* s = Statistic::head().load(); s; s = s->next()) {
+    auto& entry = merged[s->name()];
+    entry.first += s->value();
+    entry.second = s->desc();
+  }
+  Out << "\n=== Statistics ===\n";
+  for (auto& entry : merged) {
+    if (entry.second.first == 0)
+      continue;
+    Out << std::setw(12) << entry.second.first << "  "
+        << entry.first << " - " << entry.second.second << "\n";
+  }
+}
+
+#define OHMU_STAT(Var, Desc) static ohmu::Statistic Var(#Var, Desc)
+#define OHMU_STAT_INC(Var) (Var.add(1))
+#define OHMU_STAT_ADD(Var, N) (Var.add(N))
+
+#else  // OHMU_STATS
+
+inline void printStatistics(std::ostream&) { }
+
+#define OHMU_STAT(Var, Desc)
+#define OHMU_STAT_INC(Var) ((void)0)
+#define OHMU_STAT_ADD(Var, N) ((void)0)
+
+#endif  // OHMU_STATS
+
+}  // end namespace ohmu
+
+#endif  // OHMU_BASE_STATS_H
@@ -0,0 +1,152 @@
+//===- StringInterner.h ----------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// StringInterner stores a single canonical copy of each distinct string in
+// a MemRegion, and hands out stable 32-bit symbol ids.  Interned strings
+// can then be compared, hashed, and used as map keys by id (or by data
+// pointer), instead of by contents, and identifiers stop being copied
+// around as std::strings.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_BASE_STRINGINTERNER_H
+#define OHMU_BASE_STRINGINTERNER_H
+
+#include "LLVMDependencies.h"
+#include "MemRegion.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace ohmu {
+
+
+class StringInterner {
+public:
+  typedef uint32_t SymbolID;
+
+  static const SymbolID InvalidSymbolID = 0xFFFFFFFFu;
+
+  StringInterner() { }
+  explicit StringInterner(MemRegionRef A)
+      : Arena(A), Buckets(InitialBuckets, SymbolID(InvalidSymbolID)) { }
+
+  // Set the arena that canonical copies are allocated in.
+  // Must be called before intern() if the default constructor was used.
+  void setArena(MemRegionRef A) {
+    Arena = A;
+    if (Buckets.empty())
+      Buckets.assign(InitialBuckets, SymbolID(InvalidSymbolID));
+  }
+
+  // The number of distinct strings interned so far.
+  unsigned size() const { return static_cast<unsigned>(Symbols.size()); }
+
+  // Return the symbol id for S, interning a copy of S if necessary.
+  // Ids are dense, starting at 0, in order of first interning.
+  SymbolID intern(StringRef S) {
+    unsigned Mask = static_cast<unsigned>(Buckets.size()) - 1;
+    unsigned i = hash(S) & Mask;
+    while (Buckets[i] != InvalidSymbolID) {
+      SymbolID Id = Buckets[i];
+      if (Symbols[Id] == S)
+        return Id;
+      i = (i + 1) & Mask;
+    }
+
+    char* Mem = Arena.allocateT<char>(S.size() + 1);
+    SymbolID Id = static_cast<SymbolID>(Symbols.size());
+    Symbols.push_back(copyStringRef(Mem, S));
+    Buckets[i] = Id;
+
+    // Keep the table under 3/4 full.
+    if (Symbols.size() * 4 > Buckets.size() * 3)
+      rehash();
+    return Id;
+  }
+
+  // Return the canonical copy of S, interning it if necessary.  Equal
+  // strings always return a StringRef with the same data pointer, so
+  // callers can compare by pointer.
+  StringRef internStr(StringRef S) { return Symbols[intern(S)]; }
+
+  // Return the string for a previously interned symbol id.
+  StringRef string(SymbolID Id) const {
+    assert(Id < Symbols.size() && "Invalid symbol id.");
+    return Symbols[Id];
+  }
+
+  // Forget every interned string, e.g. because the arena the canonical
+  // copies live in is being replaced.  All previously returned ids and
+  // canonical StringRefs become invalid.
+  void clear() {
+    Symbols.clear();
+    if (!Buckets.empty())
+      Buckets.assign(Buckets.size(), SymbolID(InvalidSymbolID));
+  }
+
+  // Forget every string interned after size() returned n, reverting the
+  // table to that point.  Use together with a rollback of the arena the
+  // canonical copies live in (see MemRegion::Snapshot): the forgotten
+  // copies dangle once the arena is rolled back, and ids at or above n
+  // become invalid.
+  void rollback(unsigned n) {
+    if (n >= Symbols.size())
+      return;
+    Symbols.erase(Symbols.begin() + n, Symbols.end());
+    rebuild(static_cast<unsigned>(Buckets.size()));
+  }
+
+private:
+  static const unsigned InitialBuckets = 64;   // must be a power of two
+
+  // FNV-1a.
+  static unsigned hash(StringRef S) {
+    unsigned H = 2166136261u;
+    for (unsigned i = 0, n = static_cast<unsigned>(S.size()); i < n; ++i) {
+      H = H ^ static_cast<unsigned char>(S.data()[i]);
+      H = H * 16777619u;
+    }
+    return H;
+  }
+
+  // Double the bucket array and reinsert all symbols.
+  void rehash() {
+    rebuild(static_cast<unsigned>(Buckets.size()) * 2);
+  }
+
+  // Rebuild the bucket array at the given size from Symbols.
+  void rebuild(unsigned NBuckets) {
+    Buckets.assign(NBuckets, SymbolID(InvalidSymbolID));
+    unsigned Mask = NBuckets - 1;
+    for (SymbolID Id = 0, n = size(); Id < n; ++Id) {
+      unsigned i = hash(Symbols[Id]) & Mask;
+      while (Buckets[i] != InvalidSymbolID)
+        i = (i + 1) & Mask;
+      Buckets[i] = Id;
+    }
+  }
+
+  MemRegionRef Arena;
+  std::vector<StringRef> Symbols;   // id -> canonical string
+  std::vector<SymbolID>  Buckets;   // open-addressed hash table
+};
+
+
+}  // end namespace ohmu
+
+#endif  // OHMU_BASE_STRINGINTERNER_H
@@ -0,0 +1,261 @@
+//===- ThreadPool.h --------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// ThreadPool is a reusable work-stealing thread pool.  Worker threads are
+// started once and shared by all parallel passes, so individual passes do
+// not pay thread creation cost, and do not each invent their own scheduler.
+//
+// Each worker owns a task deque; idle workers steal from the other end of
+// their neighbours' deques.  parallelFor() runs an indexed loop body across
+// the pool, with the calling thread participating, and blocks until the
+// loop is complete.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_BASE_THREADPOOL_H
+#define OHMU_BASE_THREADPOOL_H
+
+#include "MemRegion.h"
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ohmu {
+
+
+class ThreadPool {
+public:
+  // Create a pool with nthreads workers; 0 means one per hardware core.
+  explicit ThreadPool(unsigned nthreads = 0)
+      : stop_(false), pending_(0), nextQueue_(0) {
+    if (nthreads == 0) {
+      nthreads = std::thread::hardware_concurrency();
+      if (nthreads == 0)
+        nthreads = 1;
+    }
+    numThreads_ = nthreads;
+    workers_ = new Worker[nthreads];
+    for (unsigned i = 0; i < nthreads; ++i)
+      workers_[i].thread = std::thread(&ThreadPool::workerMain, this, i);
+  }
+
+  // Drain remaining tasks and join all workers.
+  ~ThreadPool() {
+    waitForAll();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wakeCV_.notify_all();
+    for (unsigned i = 0; i < numThreads_; ++i)
+      workers_[i].thread.join();
+    delete[] workers_;
+  }
+
+  unsigned numThreads() const { return numThreads_; }
+
+  // The index of the calling worker thread, in [0, numThreads()).
+  // Returns 0 on threads that are not part of the pool.
+  static unsigned threadIndex() { return threadIndexRef(); }
+
+  // A MemRegion with affinity to the calling thread.  Tasks that allocate
+  // scratch memory should use this rather than sharing a region (and its
+  // cache lines) across workers.  The region lives until the thread exits.
+  static MemRegion& threadRegion() {
+    static thread_local MemRegion region;
+    return region;
+  }
+
+  // Submit a task for asynchronous execution.
+  void submit(std::function<void()> task) {
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    unsigned i = nextQueue_.fetch_add(1, std::memory_order_relaxed)
+                 % numThreads_;
+    {
+      std::lock_guard<std::mutex> lock(workers_[i].mutex);
+      workers_[i].queue.push_back(std::move(task));
+    }
+    wakeCV_.notify_one();
+  }
+
+  // Run body(i) for each i in [0, n), distributed across the pool.
+  // The calling thread participates, and the call blocks until every
+  // iteration has completed.
+  void parallelFor(size_t n, const std::function<void(size_t)>& body) {
+    if (n == 0)
+      return;
+    if (n == 1) {
+      body(0);
+      return;
+    }
+
+    std::atomic<size_t> nextIndex(0);
+    std::atomic<unsigned> running(0);
+    std::mutex doneMutex;
+    std::condition_variable doneCV;
+
+    auto runChunks = [&nextIndex, &body, n]() {
+      for (;;) {
+        size_t i = nextIndex.fetch_add(1, std::memory_order_relaxed);
+        if (i >= n)
+          return;
+        body(i);
+      }
+    };
+
+    unsigned nhelpers = numThreads_;
+    if (nhelpers > n - 1)
+      nhelpers = static_cast<unsigned>(n - 1);
+    running.store(nhelpers);
+    for (unsigned t = 0; t < nhelpers; ++t) {
+      submit([&runChunks, &running, &doneMutex, &doneCV]() {
+        runChunks();
+        if (running.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(doneMutex);
+          doneCV.notify_all();
+        }
+      });
+    }
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    doneCV.wait(lock, [&running]() { return running.load() == 0; });
+  }
+
+  // Block until every submitted task has finished.  The waiting thread
+  // runs queued tasks itself rather than sleeping, so a saturated pool
+  // cannot starve the waiter.
+  //
+  // Must not be called from inside a pool task: pending_ counts the
+  // caller's own task, so the wait could never return.  Tasks that need
+  // to join work they spawned should count their own tasks, as
+  // parallelFor() does.
+  void waitForAll() {
+    assert(!onWorkerThread() && "waitForAll() deadlocks inside a pool task.");
+    std::function<void()> task;
+    while (pending_.load() > 0) {
+      if (findTask(threadIndex(), task)) {
+        task();
+        task = nullptr;
+        if (pending_.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          doneCV_.notify_all();
+        }
+        continue;
+      }
+      // Nothing queued; the remaining tasks are running on the workers.
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (pending_.load() == 0)
+        break;
+      doneCV_.wait_for(lock, std::chrono::milliseconds(1));
+    }
+  }
+
+  // Return true if the calling thread is one of the pool's workers.
+  static bool onWorkerThread() { return onWorkerThreadRef(); }
+
+  // A process-wide shared pool, created on first use.
+  static ThreadPool& instance() {
+    static ThreadPool pool;
+    return pool;
+  }
+
+private:
+  struct Worker {
+    std::deque<std::function<void()>> queue;
+    std::mutex                        mutex;
+    std::thread                       thread;
+  };
+
+  static unsigned& threadIndexRef() {
+    static thread_local unsigned index = 0;
+    return index;
+  }
+
+  static bool& onWorkerThreadRef() {
+    static thread_local bool onWorker = false;
+    return onWorker;
+  }
+
+  // Pop a task from our own queue, or steal one from a neighbour.
+  // Workers pop their own queue LIFO for locality; thieves steal FIFO.
+  bool findTask(unsigned self, std::function<void()>& task) {
+    for (unsigned k = 0; k < numThreads_; ++k) {
+      Worker& w = workers_[(self + k) % numThreads_];
+      std::lock_guard<std::mutex> lock(w.mutex);
+      if (w.queue.empty())
+        continue;
+      if (k == 0) {
+        task = std::move(w.queue.back());
+        w.queue.pop_back();
+      }
+      else {
+        task = std::move(w.queue.front());
+        w.queue.pop_front();
+      }
+      return true;
+    }
+    return false;
+  }
+
+  void workerMain(unsigned self) {
+    threadIndexRef() = self;
+    onWorkerThreadRef() = true;
+    std::function<void()> task;
+    for (;;) {
+      if (findTask(self, task)) {
+        task();
+        task = nullptr;
+        if (pending_.fetch_sub(1) == 1) {
+          std::lock_guard<std::mutex> lock(mutex_);
+          doneCV_.notify_all();
+        }
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (stop_)
+        return;
+      // Timed wait: a task may have been enqueued between the failed
+      // findTask and this wait, and we must not sleep through it.
+      wakeCV_.wait_for(lock, std::chrono::milliseconds(1));
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  void operator=(const ThreadPool&) = delete;
+
+  unsigned                numThreads_;
+  Worker*                 workers_;
+  bool                    stop_;
+  std::atomic<unsigned>   pending_;    // submitted but unfinished tasks
+  std::atomic<unsigned>   nextQueue_;  // round-robin submission cursor
+  std::mutex              mutex_;      // guards stop_, backs the CVs
+  std::condition_variable wakeCV_;
+  std::condition_variable doneCV_;
+};
+
+
+}  // end namespace ohmu
+
+#endif  // OHMU_BASE_THREADPOOL_H
@@ -0,0 +1,171 @@
+//===- Trace.h -------------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// A lightweight scoped-event tracer for the pipeline stages.  Set the
+// OHMU_TRACE environment variable to a file name to enable it; at process
+// exit a JSON timeline in the Chrome trace format is written there, which
+// chrome://tracing (about:tracing) can load directly.  Events carry the
+// recording thread's id, so parallel stages show up as occupancy across
+// timeline rows.
+//
+// Events are recorded into a fixed-size ring buffer per thread (newest
+// events win), so recording is lock-free, allocation-free after the first
+// event on a thread, and safe from pool threads.  When tracing is off the
+// cost of a scope is a single flag test.
+//
+//   void Pass::run() {
+//     OHMU_TRACE_SCOPE("pass-name");
+//     ...
+//   }
+//
+// For spans that open and close in different functions (e.g. an
+// enterX/exitX pair), use TraceLog::begin() and TraceLog::complete().
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_BASE_TRACE_H
+#define OHMU_BASE_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+namespace ohmu {
+
+class TraceLog {
+public:
+  static bool enabled() { return instance().fileName_ != nullptr; }
+
+  // Microseconds since the tracer was initialized.
+  static uint64_t now() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - instance().epoch_).count();
+  }
+
+  // Begin/complete pair for a span that does not fit a single scope.
+  // begin() returns 0 when tracing is off, and complete() is then a no-op.
+  static uint64_t begin() { return enabled() ? now() + 1 : 0; }
+
+  static void complete(const char* name, uint64_t start) {
+    if (start)
+      record(name, start - 1, now() - (start - 1));
+  }
+
+  // Record a completed event.  The name must be a string literal (it is
+  // not copied).
+  static void record(const char* name, uint64_t start, uint64_t dur) {
+    ThreadBuffer* buf = buffer();
+    Event& e = buf->events[buf->pos % BufferSize];
+    e.name = name;
+    e.start = start;
+    e.dur = dur;
+    ++buf->pos;
+  }
+
+private:
+  // Ring buffer capacity, in events per thread.
+  static const unsigned BufferSize = 1 << 14;
+
+  struct Event {
+    const char* name;
+    uint64_t start;
+    uint64_t dur;
+  };
+
+  struct ThreadBuffer {
+    Event events[BufferSize];
+    uint64_t pos;
+    unsigned tid;
+    ThreadBuffer* next;
+  };
+
+  TraceLog()
+      : fileName_(getenv("OHMU_TRACE")), epoch_(std::chrono::steady_clock::now()),
+        threads_(nullptr), nextTid_(0) { }
+
+  // The trace is written when the singleton is destroyed at process exit.
+  ~TraceLog() {
+    if (!fileName_)
+      return;
+    FILE* file = fopen(fileName_, "w");
+    if (!file)
+      return;
+    fprintf(file, "{\"traceEvents\":[");
+    const char* sep = "";
+    for (ThreadBuffer* buf = threads_.load(); buf; buf = buf->next) {
+      uint64_t count = buf->pos < BufferSize ? buf->pos : BufferSize;
+      uint64_t first = buf->pos - count;
+      for (uint64_t i = first; i < buf->pos; ++i) {
+        const Event& e = buf->events[i % BufferSize];
+        fprintf(file,
+                "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,"
+                "\"ts\":%llu,\"dur\":%llu}",
+                sep, e.name, buf->tid,
+                (unsigned long long)e.start, (unsigned long long)e.dur);
+        sep = ",";
+      }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+  }
+
+  static TraceLog& instance() {
+    static TraceLog log;
+    return log;
+  }
+
+  // Returns the calling thread's ring buffer, registering it on first use.
+  // Buffers are kept alive until the trace is written, outliving threads
+  // that exit early.
+  static ThreadBuffer* buffer() {
+    static thread_local ThreadBuffer* buf = nullptr;
+    if (!buf) {
+      TraceLog& log = instance();
+      buf = new ThreadBuffer();
+      buf->pos = 0;
+      buf->tid = log.nextTid_.fetch_add(1, std::memory_order_relaxed);
+      buf->next = log.threads_.exchange(buf);
+    }
+    return buf;
+  }
+
+  const char* fileName_;
+  std::chrono::steady_clock::time_point epoch_;
+  std::atomic<ThreadBuffer*> threads_;
+  std::atomic<unsigned> nextTid_;
+};
+
+
+// Records an event covering the enclosing scope.
+class TraceScope {
+public:
+  explicit TraceScope(const char* name)
+      : name_(name), start_(TraceLog::begin()) { }
+  ~TraceScope() { TraceLog::complete(name_, start_); }
+
+private:
+  const char* name_;
+  uint64_t start_;
+};
+
+#define OHMU_TRACE_SCOPE(Name) ohmu::TraceScope ohmuTraceScope__(Name)
+
+}  // end namespace ohmu
+
+#endif  // OHMU_BASE_TRACE_H
@@ -0,0 +1,414 @@
+//===- benchmarks.cpp ------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// Microbenchmarks for the hot paths of the pipeline: lexing, parsing,
+// SSA conversion, bytecode serialization, and LSA supersteps.
+//
+// Run from the top of the source tree (like the tests, the grammar and
+// the checked-in corpus are found by relative path):
+//
+//   benchmarks [-reps N] [name]
+//
+// Each benchmark is repeated N times (default 10) and the fastest
+// repetition is reported, which suppresses scheduler and cache-warmup
+// noise in wall-clock measurements.  An optional name argument runs
+// only the benchmarks whose name contains it.
+//
+//===----------------------------------------------------------------------===//
+
+#include "base/Stats.h"
+#include "lsa/StandaloneGraphComputation.h"
+#include "test/Driver.h"
+#include "til/Bytecode.h"
+#include "til/CFGBuilder.h"
+#include "til/SSAPass.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace ohmu;
+using namespace ohmu::parsing;
+using namespace ohmu::til;
+
+
+//===----------------------------------------------------------------------===//
+// Timing harness.
+//===----------------------------------------------------------------------===//
+
+typedef std::chrono::steady_clock Clock;
+
+// One repetition: the wall time of the measured region, and how many
+// items (tokens, bytes, instructions...) it processed.
+struct BenchRep {
+  double seconds;
+  uint64_t items;
+};
+
+static unsigned numReps = 10;
+static const char* nameFilter = nullptr;
+
+static double secondsSince(Clock::time_point start) {
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Runs body() numReps times and reports the fastest repetition.  The
+// body times its own measured region, so per-repetition setup (corpus
+// construction, arenas) stays out of the numbers.
+template <class Body>
+static void benchmark(const char* name, const char* unit, Body body) {
+  if (nameFilter && !strstr(name, nameFilter))
+    return;
+
+  BenchRep best = { -1.0, 0 };
+  double total = 0.0;
+  for (unsigned r = 0; r < numReps; ++r) {
+    BenchRep rep = body();
+    total += rep.seconds;
+    if (best.seconds < 0.0 || rep.seconds < best.seconds)
+      best = rep;
+  }
+  printf("%-18s %10.3f ms  (mean %8.3f)  %9.2f M%s/s\n",
+         name, best.seconds * 1.0e3, (total / numReps) * 1.0e3,
+         best.items / best.seconds * 1.0e-6, unit);
+}
+
+
+//===----------------------------------------------------------------------===//
+// Corpora.
+//===----------------------------------------------------------------------===//
+
+// The checked-in corpus: small but hand-written, realistic sources.
+// (Only the files that the current grammar accepts.)
+static const char* const corpusFiles[] = {
+  "src/ohmu/test_loop.ohmu",
+  "src/ohmu/test_ssa.ohmu",
+  "src/ohmu/test_dependent_functions.ohmu",
+};
+
+static bool readFile(const char* fname, std::string* out) {
+  FILE* file = fopen(fname, "r");
+  if (!file)
+    return false;
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+    out->append(buf, n);
+  fclose(file);
+  return true;
+}
+
+// Generates numDefs top-level definitions in the style of the checked-in
+// tests; at the default size the result is a few hundred kilobytes, big
+// enough that per-file setup costs vanish from the measurement.
+static std::string makeSyntheticSource(unsigned numDefs) {
+  std::stringstream ss;
+  for (unsigned i = 0; i < numDefs; ++i) {
+    ss << "f" << i << "(a: Int, b: Int): Int -> {\n"
+       << "  let x = a + " << (i % 100) << " * b;\n"
+       << "  let y = if (x == a) then x + b else x - b;\n"
+       << "  let z = y * y + a * " << (i % 7 + 1) << ";\n"
+       << "  if (z >= b) then z + x else z - y;\n"
+       << "};\n\n";
+  }
+  return ss.str();
+}
+
+
+//===----------------------------------------------------------------------===//
+// Lexing.
+//===----------------------------------------------------------------------===//
+
+static void benchLexing(const std::string& corpus) {
+  DefaultLexer lexer;
+  // The grammar normally registers the keywords; give the standalone
+  // lexer the same table so keyword hashing is on the measured path.
+  static const char* const keywords[] =
+    { "if", "then", "else", "let", "var", "function" };
+  for (const char* kw : keywords)
+    lexer.registerKeyword(kw);
+
+  benchmark("lex", "tok", [&]() -> BenchRep {
+    BenchRep rep;
+    auto start = Clock::now();
+    // Lex the buffer in place; no characters are copied.
+    lexer.setSourceBuffer(corpus.data(), corpus.size());
+    uint64_t numTokens = 0;
+    for (;;) {
+      Token tok = lexer.readToken();
+      if (tok.id() == TK_EOF)
+        break;
+      ++numTokens;
+    }
+    rep.seconds = secondsSince(start);
+    rep.items = numTokens;
+    return rep;
+  });
+}
+
+
+//===----------------------------------------------------------------------===//
+// Parsing.
+//===----------------------------------------------------------------------===//
+
+static void benchParsing(Driver& driver, const char* name,
+                         const std::vector<std::string>& sources) {
+  uint64_t numBytes = 0;
+  for (auto& src : sources)
+    numBytes += src.size();
+
+  benchmark(name, "byte", [&]() -> BenchRep {
+    BenchRep rep;
+    rep.items = numBytes;
+    auto start = Clock::now();
+    for (auto& src : sources) {
+      // One Global (and string arena) per source; the driver's parser is
+      // reused, and setArenas() resets its interner for the new arena.
+      Global global;
+      StringStream stream(src.c_str());
+      if (!driver.parseDefinitions(&global, stream)) {
+        printf("FAILED: parse error in benchmark corpus.\n");
+        break;
+      }
+    }
+    rep.seconds = secondsSince(start);
+    return rep;
+  });
+}
+
+
+//===----------------------------------------------------------------------===//
+// SSA conversion.
+//===----------------------------------------------------------------------===//
+
+// Builds a chain of diamonds in load/store form: each stage branches,
+// stores to x or y on the two sides, and rejoins, so SSAPass has to
+// place a phi node per stage.
+static SCFG* makeLoadStoreChain(CFGBuilder& bld, unsigned numStages) {
+  bld.beginCFG(nullptr);
+  auto* cfg = bld.currentCFG();
+
+  bld.beginBlock(cfg->entry());
+  bld.sealBlock(cfg->entry());
+  // Local variables are allocs of a field (type and initializer), which
+  // is the form SSAPass knows how to eliminate.
+  auto* intTy = bld.newScalarType(BaseType::getBaseType<int>());
+  auto* x = bld.newAlloc(bld.newField(intTy, bld.newLiteralT<int>(0)),
+                         Alloc::AK_Local);
+  auto* y = bld.newAlloc(bld.newField(intTy, bld.newLiteralT<int>(0)),
+                         Alloc::AK_Local);
+
+  for (unsigned s = 0; s < numStages; ++s) {
+    auto* b1 = bld.newBlock();
+    auto* b2 = bld.newBlock();
+    auto* b3 = bld.newBlock();
+    auto* cond = bld.newBinaryOp(BOP_Leq, bld.newLoad(x),
+                                 bld.newLiteralT<int>(static_cast<int>(s)));
+    cond->setBaseType(BaseType::getBaseType<bool>());
+    bld.newBranch(cond, b1, b2);
+    bld.sealBlock(b1);
+    bld.sealBlock(b2);
+
+    bld.beginBlock(b1);
+    auto* inc = bld.newBinaryOp(BOP_Add, bld.newLoad(x),
+                                bld.newLiteralT<int>(1));
+    inc->setBaseType(BaseType::getBaseType<int>());
+    bld.newStore(x, inc);
+    bld.newGoto(b3);
+
+    bld.beginBlock(b2);
+    bld.newStore(y, bld.newLoad(x));
+    bld.newGoto(b3);
+    bld.sealBlock(b3);
+
+    bld.beginBlock(b3);
+  }
+
+  bld.newGoto(cfg->exit(), bld.newLoad(x));
+  bld.endCFG();
+  return cfg;
+}
+
+static void benchSSA(unsigned numStages) {
+  benchmark("ssa", "instr", [&]() -> BenchRep {
+    // Rebuild the CFG each repetition; SSAPass rewrites it in place.
+    MemRegion region;
+    MemRegionRef arena(&region);
+    CFGBuilder bld(arena);
+    SCFG* cfg = makeLoadStoreChain(bld, numStages);
+    cfg->computeNormalForm();
+
+    BenchRep rep;
+    rep.items = cfg->numInstructions();
+    auto start = Clock::now();
+    SSAPass ssaPass(bld.arena());
+    ssaPass.scope()->enterNullScope(0);
+    ssaPass.traverseAll(cfg);
+    rep.seconds = secondsSince(start);
+    return rep;
+  });
+}
+
+
+//===----------------------------------------------------------------------===//
+// Bytecode round trip.
+//===----------------------------------------------------------------------===//
+
+static void benchBytecode(unsigned numStages) {
+  // The serialized expression is built once; writing does not mutate it.
+  MemRegion region;
+  MemRegionRef arena(&region);
+  CFGBuilder bld(arena);
+  SCFG* cfg = makeLoadStoreChain(bld, numStages);
+  cfg->computeNormalForm();
+
+  benchmark("bytecode", "byte", [&]() -> BenchRep {
+    BenchRep rep;
+    auto start = Clock::now();
+
+    BytecodeStringWriter writeStream;
+    BytecodeWriter writer(&writeStream);
+    writer.traverseAll(cfg);
+    writeStream.flush();
+    std::string buffer = writeStream.str();
+
+    MemRegion readRegion;
+    MemRegionRef readArena(&readRegion);
+    CFGBuilder readBld(readArena);
+    InMemoryReader readStream(buffer.data(), buffer.size(), readBld.arena());
+    BytecodeReader reader(readBld, &readStream);
+    SExpr* e = reader.read();
+
+    rep.seconds = secondsSince(start);
+    // Count each byte once written and once read.
+    rep.items = 2 * buffer.size();
+    if (!e)
+      printf("FAILED: bytecode did not read back.\n");
+    return rep;
+  });
+}
+
+
+//===----------------------------------------------------------------------===//
+// LSA supersteps.
+//===----------------------------------------------------------------------===//
+
+static const int PulseSteps = 10;
+
+// Every vertex forwards a counter to its neighbors on every superstep
+// for a fixed number of steps, so the measurement is the framework's
+// superstep and message-delivery overhead rather than any analysis.
+class PulseComputation;
+
+namespace ohmu {
+namespace lsa {
+template <> struct GraphTraits<PulseComputation> {
+  typedef int VertexValueType;
+  typedef int MessageValueType;
+};
+}  // end namespace lsa
+}  // end namespace ohmu
+
+class PulseComputation : public lsa::GraphComputation<PulseComputation> {
+public:
+  void computePhase(GraphVertex* Vertex, const string& Phase,
+                    MessageList Messages) override {
+    if (stepCount() >= PulseSteps) {
+      Vertex->voteToHalt();
+      return;
+    }
+    int Value = *Vertex->mutableValue();
+    for (auto& Message : Messages)
+      Value += Message.value();
+    *Vertex->mutableValue() = Value;
+    for (auto& Neighbor : Vertex->outgoingCalls())
+      Vertex->sendMessage(Neighbor, 1);
+  }
+
+  string output(const GraphVertex* Vertex) const override { return ""; }
+};
+
+static void benchLsaSupersteps(unsigned numVertices) {
+  benchmark("lsa-supersteps", "vertex-step", [&]() -> BenchRep {
+    // Rebuild the graph each repetition; a run mutates vertex values.
+    lsa::StandaloneGraphBuilder<PulseComputation> builder;
+    builder.setNThreads(4);
+    char from[16], to[16];
+    for (unsigned i = 0; i < numVertices; ++i) {
+      snprintf(from, sizeof(from), "f%u", i);
+      snprintf(to, sizeof(to), "f%u", (i + 1) % numVertices);
+      builder.addCall(from, to);
+      snprintf(to, sizeof(to), "f%u", (i * 7 + 3) % numVertices);
+      builder.addCall(from, to);
+    }
+    lsa::GraphComputationFactory<PulseComputation> factory;
+
+    BenchRep rep;
+    rep.items = static_cast<uint64_t>(numVertices) * PulseSteps;
+    auto start = Clock::now();
+    builder.run(&factory);
+    rep.seconds = secondsSince(start);
+    return rep;
+  });
+}
+
+
+//===----------------------------------------------------------------------===//
+// Driver.
+//===----------------------------------------------------------------------===//
+
+int main(int argc, const char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-reps") == 0 && i + 1 < argc)
+      numReps = atoi(argv[++i]);
+    else
+      nameFilter = argv[i];
+  }
+
+  Driver driver;
+  if (!driver.initParser("src/grammar/ohmu.grammar"))
+    return -1;
+
+  std::string synthetic = makeSyntheticSource(2000);
+
+  std::vector<std::string> checkedIn;
+  for (const char* fname : corpusFiles) {
+    std::string src;
+    if (readFile(fname, &src))
+      checkedIn.push_back(std::move(src));
+    else
+      printf("Cannot read %s; skipping.\n", fname);
+  }
+
+  printf("%-18s %13s  %15s  %12s\n", "benchmark", "best", "mean", "rate");
+
+  benchLexing(synthetic);
+  benchParsing(driver, "parse-synthetic",
+               std::vector<std::string>(1, synthetic));
+  if (!checkedIn.empty())
+    benchParsing(driver, "parse-corpus", checkedIn);
+  benchSSA(2000);
+  benchBytecode(2000);
+  benchLsaSupersteps(3000);
+
+  // No-op unless the tree was built with -DOHMU_STATS.
+  printStatistics(std::cout);
+  return 0;
+}
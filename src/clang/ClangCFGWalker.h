@@ -65,6 +65,19 @@ class CFGVisitor {
 };
 
 
+// Observes the statement stream of a walk.  walk() can be given an
+// observer alongside its main visitor, so that auxiliary analyses (such
+// as call-edge extraction during export) share one traversal of the CFG
+// instead of re-walking it.  As with CFGVisitor, methods are not
+// virtual; observers are templatized.
+class CFGWalkObserver {
+public:
+  void handleStatement(const Stmt *S) {}
+  void handleDestructorCall(const Expr *E, const CXXDestructorDecl *Dd) {}
+  void handleDestructorCall(const VarDecl *Vd, const CXXDestructorDecl *Dd) {}
+};
+
+
 // Walks the clang CFG, and invokes methods on a given CFGVisitor.
 class ClangCFGWalker {
 public:
@@ -92,6 +105,14 @@ public:
   // Traverse the CFG, calling methods on V as appropriate.
   template <class Visitor>
   void walk(Visitor &V) {
+    CFGWalkObserver Obs;
+    walk(V, Obs);
+  }
+
+  // Traverse the CFG once, calling methods on V as appropriate and
+  // feeding the statement stream to Obs as well.
+  template <class Visitor, class Observer>
+  void walk(Visitor &V, Observer &Obs) {
     PostOrderCFGView::CFGBlockSet VisitedBlocks(CFGraph);
 
     V.enterCFG(CFGraph, getDecl(), &CFGraph->getEntry());
@@ -130,6 +151,7 @@ public:
         case CFGElement::Statement: {
           const CFGStmt* S = reinterpret_cast<const CFGStmt*>(&Bi);
           V.handleStatement(S->getStmt());
+          Obs.handleStatement(S->getStmt());
           break;
         }
         case CFGElement::DeleteDtor: {
@@ -139,6 +161,7 @@ public:
               Dtor->getDestructorDecl(ACtx->getASTContext()));
           const Expr *E = Dtor->getDeleteExpr()->getArgument();
           V.handleDestructorCall(E, Dd);
+          Obs.handleDestructorCall(E, Dd);
           break;
         }
         case CFGElement::AutomaticObjectDtor: {
@@ -148,6 +171,7 @@ public:
               Dtor->getDestructorDecl(ACtx->getASTContext()));
           VarDecl *Vd = const_cast<VarDecl*>(Dtor->getVarDecl());
           V.handleDestructorCall(Vd, Dd);
+          Obs.handleDestructorCall(Vd, Dd);
           break;
         }
         default:
@@ -9,6 +9,7 @@
 
 #include "clang/Analysis/Til/ClangTranslator.h"
 #include "clang/Analysis/Til/SSAPass.h"
+#include "clang/Analysis/Til/SimplifyCFG.h"
 #include "clang/Analysis/Til/TILPrettyPrint.h"
 #include "clang/AST/Attr.h"
 #include "clang/AST/DeclCXX.h"
@@ -32,27 +33,25 @@ static bool isCalleeArrow(const Expr *E) {
 }
 
 
-static StringRef getStringRefFromString(MemRegionRef A, const std::string& S) {
-  unsigned len = S.length();
-  char* Cs = A.allocateT<char>(len+1);
-  strncpy(Cs, S.c_str(), len);
-  return StringRef(Cs, len);
-}
-
-
-static StringRef getDeclName(MemRegionRef A, const NamedDecl *D,
+static StringRef getDeclName(ClangTranslator &Tr, const NamedDecl *D,
                              bool Qual = false) {
   if (Qual)
-    return getStringRefFromString(A, D->getQualifiedNameAsString());
+    return Tr.internName(StringRef(D->getQualifiedNameAsString()));
   if (!D->getIdentifier())
-    return getStringRefFromString(A, D->getNameAsString());
+    return Tr.internName(StringRef(D->getNameAsString()));
   return D->getName();
 }
 
 
 StringRef ClangTranslator::getMangledValueName(const NamedDecl* Nd) {
   if (!isa<FunctionDecl>(Nd) && !isa<VarDecl>(Nd))
-    return getDeclName(Builder.arena(), Nd, true);
+    return getDeclName(*this, Nd, true);
+
+  // A decl's mangled name is requested once per reference to the decl;
+  // mangle and intern it on the first request only.
+  auto It = VNameMap.find(Nd);
+  if (It != VNameMap.end())
+    return It->second;
 
   if (!Mangler) {
     // Grab ourselves a mangler on first use...
@@ -69,12 +68,18 @@ StringRef ClangTranslator::getMangledValueName(const NamedDecl* Nd) {
   else
     Mangler->mangleName(Nd, Sos);
 
-  return getStringRefFromString(Builder.arena(), Sos.str());
+  StringRef S = internName(StringRef(Sos.str()));
+  VNameMap.insert(std::make_pair(Nd, S));
+  return S;
 }
 
 
 StringRef ClangTranslator::getMangledTypeName(const Type* Ty,
                                               const NamedDecl *Nd) {
+  auto It = TNameMap.find(Ty);
+  if (It != TNameMap.end())
+    return It->second;
+
   if (!Mangler) {
     // Grab ourselves a mangler on first use...
     Mangler.reset(Nd->getASTContext().createMangleContext());
@@ -86,7 +91,10 @@ StringRef ClangTranslator::getMangledTypeName(const Type* Ty,
   std::string mangledName;
   llvm::raw_string_ostream Sos(mangledName);
   Mangler->mangleTypeName(Qt, Sos);
-  return getStringRefFromString(Builder.arena(), Sos.str());
+
+  StringRef S = internName(StringRef(Sos.str()));
+  TNameMap.insert(std::make_pair(Ty, S));
+  return S;
 }
 
 
@@ -719,7 +727,7 @@ til::SExpr *ClangTranslator::translateUnaryOperator(const UnaryOperator *Uo,
           // This is a pointer-to-member expression, e.g. &MyClass::mu_.
           // We interpret this syntax specially, as a wildcard.
           auto *W = Builder.newWildcard();
-          StringRef Nm = getDeclName(Builder.arena(), D, true);
+          StringRef Nm = getDeclName(*this, D, true);
           auto *P = Builder.newProject(W, Nm);
           P->setForeignSlotDecl(D);
           return P;
@@ -1201,12 +1209,24 @@ void ClangTranslator::enterCFG(CFG *Cfg, const NamedDecl *D,
   StringRef SltNm = getMangledValueName(D);
   TopLevelSlot = Builder.newSlot(SltNm, Topdef);
 
-  // Create a new CFG
+  // The clang CFG knows its dimensions up front, so size everything to
+  // match rather than growing through reserveCheck during translation.
   unsigned NBlocks = Cfg->getNumBlockIDs();
-  Builder.beginCFG(nullptr);
+  unsigned NElements = 0;
+  for (auto *B : *Cfg)
+    NElements += B->size();
+
+  // Rough bytes-per-node estimate for the translated instructions and
+  // block shells; a low guess only means one more region block.
+  Builder.arena().reserve(NBlocks * sizeof(til::BasicBlock) +
+                          NElements * 64);
+
+  // Create a new CFG, with block storage for the source's block count.
+  Builder.beginCFG(nullptr, true, nullptr, NBlocks);
   Funbody->setBody(Builder.currentCFG());
 
-  // Create map from clang blocks to til::BasicBlocks
+  // Create map from clang blocks to til::BasicBlocks, pre-sizing each
+  // block's predecessor and instruction arrays from the source block.
   BMap.resize(NBlocks, nullptr);
   for (auto *B : *Cfg) {
     if (B == &Cfg->getEntry()) {
@@ -1216,7 +1236,7 @@ void ClangTranslator::enterCFG(CFG *Cfg, const NamedDecl *D,
       insertBlock(B, Builder.currentCFG()->exit());
     }
     else {
-      auto *BB = Builder.newBlock();
+      auto *BB = Builder.newBlock(0, B->pred_size(), B->size());
       insertBlock(B, BB);
     }
   }
@@ -1424,6 +1444,9 @@ void ClangTranslator::exitCFG(const CFGBlock *Last) {
     til::SSAPass ssaPass(Builder.arena());
     ssaPass.traverseAll(TopLevelSlot);
 
+    // Shrink the CFG before it is encoded as bytecode.
+    til::SimplifyCFG::simplify(Scfg);
+
     // Uncomment for debugging;
     // std::cout << "\n--- After SSA ---\n";
     // til::TILDebugPrinter::print(TopLevelSlot, std::cout);
@@ -19,6 +19,8 @@
 #include "clang/AST/ExprObjC.h"
 #include "clang/AST/Mangle.h"
 
+#include "base/StringInterner.h"
+
 #include <memory>
 
 namespace clang {
@@ -77,6 +79,10 @@ public:
   til::CFGBuilder& builder() { return Builder; }
   MemRegionRef&    arena()   { return Builder.arena(); }
 
+  /// Return the canonical, arena-interned copy of S.  Equal names share
+  /// one allocation and compare equal by data pointer.
+  StringRef internName(StringRef S) { return Names.internStr(S); }
+
 protected:
   // Map from clang statements to ohmu SExprs.
   typedef llvm::DenseMap<const Stmt*, til::Instruction*> StatementMap;
@@ -87,6 +93,11 @@ protected:
   // Map from basic block IDs in the clang CFG to ohmu basic blocks.
   typedef std::vector<til::BasicBlock*> BasicBlockMap;
 
+  // Caches of mangled names, so repeated references to the same decl or
+  // type neither re-run the mangler nor re-copy the name.
+  typedef llvm::DenseMap<const NamedDecl*, StringRef> ValueNameMap;
+  typedef llvm::DenseMap<const Type*, StringRef> TypeNameMap;
+
 
   til::SExpr *lookupStmt(const Stmt *S) {
     auto It = SMap.find(S);
@@ -220,8 +231,9 @@ private:
 
 public:
   ClangTranslator(MemRegionRef A)
-      : Builder(A), Mangler(nullptr), CapabilityExprMode(false), SSAMode(true),
-        SelfVar(nullptr), TopLevelSlot(nullptr), NumFunctionParams(0) {
+      : Builder(A), Names(A), Mangler(nullptr), CapabilityExprMode(false),
+        SSAMode(true), SelfVar(nullptr), TopLevelSlot(nullptr),
+        NumFunctionParams(0) {
     // FIXME: we don't always have a self-variable.
     auto* Svd = Builder.newVarDecl(til::VarDecl::VK_SFun, "this", nullptr);
     SelfVar = Builder.newVariable(Svd);
@@ -229,9 +241,12 @@ public:
 
 private:
   til::CFGBuilder Builder;
+  StringInterner  Names;     // One arena copy per distinct name.
   StatementMap    SMap;
   LocalVarMap     LVarMap;
   BasicBlockMap   BMap;
+  ValueNameMap    VNameMap;
+  TypeNameMap     TNameMap;
   std::unique_ptr<MangleContext> Mangler;
 
   // Set to true when parsing capability expressions, which get translated
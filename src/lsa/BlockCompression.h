@@ -0,0 +1,251 @@
+//===- BlockCompression.h --------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+// Byte-oriented block compression for the IR section of graph snapshots.
+// The codec is a simple greedy LZ with 16-bit match offsets, chosen for
+// decompression speed rather than ratio: snapshot reads from network
+// storage are I/O bound, and a fast 3-4x reduction in bytes read is the
+// whole point.  Blocks compress independently, so a reader working from
+// a memory-mapped snapshot decompresses only the blocks covering the
+// functions an analysis actually touches.
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_LSA_BLOCKCOMPRESSION_H
+#define OHMU_LSA_BLOCKCOMPRESSION_H
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/LLVMDependencies.h"
+
+namespace ohmu {
+namespace lsa {
+
+/// Size of an independently compressed block of IR bytes.
+const uint64_t IRBlockSize = 1 << 16;
+
+/// Compressed streams are a sequence of tokens.  Each token is one byte:
+/// the high nibble is a literal run length and the low nibble a match
+/// length minus 4; a nibble of 15 is extended by following bytes, each
+/// adding 0-255, until a byte below 255.  The literal bytes follow the
+/// token (and any literal extension), then a 16-bit little-endian match
+/// offset and any match extension.  The final token carries literals
+/// only; the stream simply ends after them.
+
+inline uint32_t hashFour(const uint8_t *P) {
+  uint32_t V;
+  memcpy(&V, P, 4);
+  return (V * 2654435761u) >> 19;  // 13 bits.
+}
+
+/// Append Src[0..Len) to Out in compressed form.
+inline void compressBlock(const uint8_t *Src, size_t Len,
+                          std::vector<uint8_t> &Out) {
+  const size_t MinMatch = 4;
+  auto emitRun = [&Out](size_t N) {
+    while (N >= 255) {
+      Out.push_back(255);
+      N -= 255;
+    }
+    Out.push_back(static_cast<uint8_t>(N));
+  };
+  auto emitToken = [&](size_t Anchor, size_t i, size_t MLen, size_t Off) {
+    size_t Lit = i - Anchor;
+    uint8_t LitN = Lit < 15 ? static_cast<uint8_t>(Lit) : 15;
+    uint8_t MatN = 0;  // MLen == 0 marks the final, literals-only token.
+    if (MLen > 0)
+      MatN = MLen - MinMatch < 15 ? static_cast<uint8_t>(MLen - MinMatch) : 15;
+    Out.push_back(static_cast<uint8_t>((LitN << 4) | MatN));
+    if (LitN == 15)
+      emitRun(Lit - 15);
+    Out.insert(Out.end(), Src + Anchor, Src + i);
+    if (MLen > 0) {
+      Out.push_back(static_cast<uint8_t>(Off & 255));
+      Out.push_back(static_cast<uint8_t>(Off >> 8));
+      if (MatN == 15)
+        emitRun(MLen - MinMatch - 15);
+    }
+  };
+
+  // Positions of recently seen 4-byte sequences, offset by one so that
+  // zero means empty.
+  uint32_t Table[1 << 13];
+  memset(Table, 0, sizeof(Table));
+
+  size_t i = 0, Anchor = 0;
+  while (i + MinMatch <= Len) {
+    uint32_t H = hashFour(Src + i);
+    size_t Cand = Table[H];
+    Table[H] = static_cast<uint32_t>(i + 1);
+    if (Cand != 0 && i - (Cand - 1) <= 65535 &&
+        memcmp(Src + Cand - 1, Src + i, MinMatch) == 0) {
+      size_t MatchPos = Cand - 1;
+      size_t MLen = MinMatch;
+      while (i + MLen < Len && Src[MatchPos + MLen] == Src[i + MLen])
+        MLen++;
+      emitToken(Anchor, i, MLen, i - MatchPos);
+      i += MLen;
+      Anchor = i;
+    } else {
+      i++;
+    }
+  }
+
+  // The final token: whatever literals remain, and no match.
+  emitToken(Anchor, Len, 0, 0);
+}
+
+/// Decompress Src[0..CompLen) into Dst[0..RawLen).  Returns false if the
+/// stream is malformed or does not produce exactly RawLen bytes.
+inline bool decompressBlock(const uint8_t *Src, size_t CompLen,
+                            uint8_t *Dst, size_t RawLen) {
+  const uint8_t *Sp = Src, *Se = Src + CompLen;
+  uint8_t *Dp = Dst, *De = Dst + RawLen;
+  while (Sp < Se) {
+    uint8_t Token = *Sp++;
+    size_t Lit = Token >> 4;
+    if (Lit == 15) {
+      uint8_t B;
+      do {
+        if (Sp >= Se)
+          return false;
+        B = *Sp++;
+        Lit += B;
+      } while (B == 255);
+    }
+    if (Lit > static_cast<size_t>(Se - Sp) ||
+        Lit > static_cast<size_t>(De - Dp))
+      return false;
+    memcpy(Dp, Sp, Lit);
+    Sp += Lit;
+    Dp += Lit;
+    if (Sp >= Se)
+      break;  // The final token ends after its literals.
+    if (Se - Sp < 2)
+      return false;
+    size_t Off = Sp[0] | (static_cast<size_t>(Sp[1]) << 8);
+    Sp += 2;
+    if (Off == 0 || Off > static_cast<size_t>(Dp - Dst))
+      return false;
+    size_t MLen = (Token & 15) + 4;
+    if ((Token & 15) == 15) {
+      uint8_t B;
+      do {
+        if (Sp >= Se)
+          return false;
+        B = *Sp++;
+        MLen += B;
+      } while (B == 255);
+    }
+    if (MLen > static_cast<size_t>(De - Dp))
+      return false;
+    // Matches may overlap their own output; copy bytewise.
+    const uint8_t *Mp = Dp - Off;
+    for (size_t k = 0; k < MLen; k++)
+      Dp[k] = Mp[k];
+    Dp += MLen;
+  }
+  return Dp == De;
+}
+
+
+/// Serves function IR out of the block-compressed section of a mapped
+/// snapshot.  Functions are addressed by their uncompressed byte range
+/// (the snapshot's IROffsets keep their logical meaning); only the
+/// blocks covering a requested function are ever decompressed, and each
+/// block is decompressed at most once.  Safe to call from parallel
+/// computation steps; block materialization is serialized on a mutex.
+class CompressedIRStore {
+public:
+  CompressedIRStore(const uint64_t *IROffsets, uint32_t NFunc,
+                    const uint64_t *CompOffsets, const uint8_t *CompBytes,
+                    uint64_t BlockSize, uint64_t NBlocks)
+      : IROffsets(IROffsets), NFunc(NFunc), CompOffsets(CompOffsets),
+        CompBytes(CompBytes), BlockSize(BlockSize), Blocks(NBlocks) {}
+
+  /// The raw IR of function Id.  The returned bytes stay valid for the
+  /// lifetime of the store; returns an empty ref on a corrupt block.
+  StringRef ir(uint32_t Id) {
+    uint64_t Begin = IROffsets[Id], End = IROffsets[Id + 1];
+    if (Begin == End)
+      return StringRef("", 0);
+    std::lock_guard<std::mutex> Lock(Mutex);
+    uint64_t FirstBlock = Begin / BlockSize;
+    uint64_t LastBlock = (End - 1) / BlockSize;
+    if (FirstBlock == LastBlock) {
+      const uint8_t *B = blockData(FirstBlock);
+      if (!B)
+        return StringRef("", 0);
+      return StringRef(reinterpret_cast<const char*>(B + Begin % BlockSize),
+                       static_cast<size_t>(End - Begin));
+    }
+
+    // The function spans blocks; assemble a contiguous copy, kept so
+    // repeated requests return the same bytes.
+    auto It = Assembled.find(Id);
+    if (It == Assembled.end()) {
+      std::string Buf;
+      Buf.reserve(static_cast<size_t>(End - Begin));
+      for (uint64_t b = FirstBlock; b <= LastBlock; b++) {
+        const uint8_t *B = blockData(b);
+        if (!B)
+          return StringRef("", 0);
+        uint64_t Lo = (b == FirstBlock) ? Begin % BlockSize : 0;
+        uint64_t Hi = (b == LastBlock) ? (End - 1) % BlockSize + 1
+                                       : rawBlockLength(b);
+        Buf.append(reinterpret_cast<const char*>(B + Lo),
+                   static_cast<size_t>(Hi - Lo));
+      }
+      It = Assembled.emplace(Id, std::move(Buf)).first;
+    }
+    return StringRef(It->second.data(), It->second.size());
+  }
+
+private:
+  uint64_t rawBlockLength(uint64_t b) const {
+    uint64_t Total = IROffsets[NFunc];
+    uint64_t Rest = Total - b * BlockSize;
+    return Rest < BlockSize ? Rest : BlockSize;
+  }
+
+  /// The decompressed bytes of block b, materializing it on first use.
+  const uint8_t *blockData(uint64_t b) {
+    std::unique_ptr<uint8_t[]> &Slot = Blocks[b];
+    if (!Slot) {
+      uint64_t RawLen = rawBlockLength(b);
+      std::unique_ptr<uint8_t[]> Buf(new uint8_t[RawLen]);
+      if (!decompressBlock(CompBytes + CompOffsets[b],
+                           static_cast<size_t>(CompOffsets[b + 1] -
+                                               CompOffsets[b]),
+                           Buf.get(), static_cast<size_t>(RawLen)))
+        return nullptr;
+      Slot = std::move(Buf);
+    }
+    return Slot.get();
+  }
+
+  const uint64_t *IROffsets;
+  uint32_t NFunc;
+  const uint64_t *CompOffsets;
+  const uint8_t *CompBytes;
+  uint64_t BlockSize;
+
+  std::mutex Mutex;
+  std::vector<std::unique_ptr<uint8_t[]>> Blocks;
+  std::unordered_map<uint32_t, std::string> Assembled;
+};
+
+} // namespace lsa
+} // namespace ohmu
+
+#endif // OHMU_LSA_BLOCKCOMPRESSION_H
@@ -13,9 +13,15 @@
 #include "clang/Analysis/Til/ClangTranslator.h"
 #include "clang/AST/DeclCXX.h"
 #include "clang/AST/Mangle.h"
+#include "clang/Lex/Lexer.h"
 #include "BuildCallGraph.h"
+#include "StreamingIRWriter.h"
+#include "TranslationCache.h"
+#include "base/ThreadPool.h"
 
+#include <algorithm>
 #include <memory>
+#include <set>
 
 namespace {
 
@@ -35,27 +41,84 @@ std::string getMangledName(clang::MangleContext *Mc,
   return Out.str();
 }
 
+/// Reports outgoing call edges to the CallGraphBuilder as the translator
+/// walks the CFG, so export makes a single pass over each function.
+class CallEdgeCollector : public clang::tilcpp::CFGWalkObserver {
+public:
+  CallEdgeCollector(clang::MangleContext *Mc, const std::string &FName,
+                    ohmu::lsa::CallGraphBuilder &B,
+                    std::vector<std::string> *Record = nullptr)
+      : Mc(Mc), FName(FName), Builder(B), Record(Record) {}
+
+  void handleStatement(const clang::Stmt *S) {
+    const clang::NamedDecl *Call = nullptr;
+    if (const auto *CallE = llvm::dyn_cast<clang::CallExpr>(S)) {
+      if (CallE->getDirectCallee())
+        Call = CallE->getDirectCallee();
+    } else if (const auto *ConsE = llvm::dyn_cast<clang::CXXConstructExpr>(S)) {
+      Call = ConsE->getConstructor();
+    }
+    if (Call)
+      reportCall(*Call);
+  }
+
+  void handleDestructorCall(const clang::Expr *E,
+                            const clang::CXXDestructorDecl *Dd) {
+    reportCall(*Dd);
+  }
+  void handleDestructorCall(const clang::VarDecl *Vd,
+                            const clang::CXXDestructorDecl *Dd) {
+    reportCall(*Dd);
+  }
+
+private:
+  void reportCall(const clang::NamedDecl &Callee) {
+    std::string CName = getMangledName(Mc, Callee);
+    Builder.AddCall(FName, CName);
+    if (Record)
+      Record->push_back(std::move(CName));
+  }
+
+  clang::MangleContext *Mc;
+  const std::string &FName;
+  ohmu::lsa::CallGraphBuilder &Builder;
+  std::vector<std::string> *Record; // Callees, for the translation cache.
+};
+
 /// Callback that builds the CFG for each function it is called on. Reports
 /// the Ohmu IR translation of that CFG as well as the calls made from that
 /// function to the provided GraphConstructor.
 class ExtendCallGraph : public clang::ast_matchers::MatchFinder::MatchCallback {
 public:
-  explicit ExtendCallGraph(ohmu::lsa::CallGraphBuilder &C) : Builder(C) {}
+  ExtendCallGraph(ohmu::lsa::CallGraphBuilder &C, ohmu::ThreadPool *P,
+                  ohmu::lsa::TranslationCache *Cache,
+                  ohmu::lsa::StreamingIRWriter *Stream)
+      : Builder(C), Pool(P), Cache(Cache), Stream(Stream) {}
 
   void
   run(const clang::ast_matchers::MatchFinder::MatchResult &Result) override;
 
 private:
-  /// Traverses the CFG for calls to functions, constructors and destructors.
-  void DiscoverCallGraph(clang::MangleContext *Mc, const std::string &FName,
-                         clang::ASTContext &Ctxt, clang::CFG *CFG);
-
-  /// Generates the Ohmu IR of the function.
-  void GenerateOhmuIR(const std::string &FName, const clang::Decl *Fun,
-                      clang::AnalysisDeclContext &AC);
+  /// Builds the CFG for Fun and, in one walk, generates its Ohmu IR and
+  /// reports its outgoing calls.  In parallel mode this runs on a worker
+  /// thread; everything it builds is per-call, and results are reported
+  /// through the thread-safe CallGraphBuilder.
+  void ProcessFunction(const clang::FunctionDecl *Fun);
+
+  /// Report the bytecode emitted for Fun: spill it immediately in
+  /// streaming mode, otherwise retain it in the call graph.
+  void EmitIR(const std::string &FName, const std::string &IR) {
+    if (Stream)
+      Stream->Append(FName, IR);
+    else
+      Builder.SetOhmuIR(FName, IR);
+  }
 
 private:
   ohmu::lsa::CallGraphBuilder &Builder;
+  ohmu::ThreadPool *Pool; // Workers for per-function translation; may be null.
+  ohmu::lsa::TranslationCache *Cache; // Prior-run results; may be null.
+  ohmu::lsa::StreamingIRWriter *Stream; // IR spill stream; may be null.
 };
 
 void ExtendCallGraph::run(
@@ -69,58 +132,44 @@ void ExtendCallGraph::run(
   if (Fun->isDependentContext())
     return;
 
+  if (Pool) {
+    // Function bodies are translated from independent clang CFGs, so the
+    // per-function work can run concurrently; the matcher thread just
+    // queues definitions as it finds them.
+    Pool->submit([this, Fun]() { ProcessFunction(Fun); });
+    return;
+  }
+  ProcessFunction(Fun);
+}
+
+void ExtendCallGraph::ProcessFunction(const clang::FunctionDecl *Fun) {
   std::unique_ptr<clang::MangleContext> Mc(
       Fun->getASTContext().createMangleContext());
   std::string FName = getMangledName(Mc.get(), *Fun);
-  clang::AnalysisDeclContextManager ADCM(true, true, true, true, true, true);
-  clang::AnalysisDeclContext AC(&ADCM, Fun, ADCM.getCFGBuildOptions());
 
-  GenerateOhmuIR(FName, Fun, AC);
-  DiscoverCallGraph(Mc.get(), FName, Fun->getASTContext(), AC.getCFG());
-}
-
-void ExtendCallGraph::DiscoverCallGraph(clang::MangleContext *Mc,
-                                        const std::string &FName,
-                                        clang::ASTContext &Ctxt,
-                                        clang::CFG *CFG) {
-  if (CFG == nullptr)
-    return;
-  for (auto CFGBlockIter = CFG->begin(), E = CFG->end(); CFGBlockIter != E;
-       ++CFGBlockIter) {
-    for (auto CFGElementIter = (*CFGBlockIter)->begin(),
-              BE = (*CFGBlockIter)->end();
-         CFGElementIter != BE; ++CFGElementIter) {
-      const clang::NamedDecl *Call = nullptr;
-
-      if (clang::Optional<clang::CFGStmt> stmt =
-              CFGElementIter->getAs<clang::CFGStmt>()) {
-        clang::Stmt *S = const_cast<clang::Stmt *>(stmt->getStmt());
-
-        if (const auto *CallE = llvm::dyn_cast<clang::CallExpr>(S)) {
-          if (CallE->getDirectCallee())
-            Call = CallE->getDirectCallee();
-
-        } else if (const auto *ConsE =
-                       llvm::dyn_cast<clang::CXXConstructExpr>(S)) {
-          Call = ConsE->getConstructor();
-        }
-
-      } else if (auto ImplD = CFGElementIter->getAs<clang::CFGImplicitDtor>()) {
-        const clang::CXXDestructorDecl *DestrD = ImplD->getDestructorDecl(Ctxt);
-        Call = DestrD;
-      }
-
-      if (Call) {
-        std::string CName = getMangledName(Mc, *Call);
-        Builder.AddCall(FName.data(), CName);
-      }
+  uint64_t Hash = 0;
+  if (Cache) {
+    // Key the cache on the function's source text; if it is unchanged
+    // since the previous run, reuse the bytecode and call edges emitted
+    // then instead of rebuilding the CFG and re-serializing.
+    const clang::ASTContext &Ctx = Fun->getASTContext();
+    clang::StringRef Text = clang::Lexer::getSourceText(
+        clang::CharSourceRange::getTokenRange(Fun->getSourceRange()),
+        Ctx.getSourceManager(), Ctx.getLangOpts());
+    Hash = ohmu::lsa::TranslationCache::hashSource(
+        ohmu::StringRef(Text.data(), Text.size()));
+
+    if (const auto *E = Cache->lookup(FName, Hash)) {
+      EmitIR(FName, E->OhmuIR);
+      for (const std::string &Call : E->Calls)
+        Builder.AddCall(FName, Call);
+      return;
     }
   }
-}
 
-void ExtendCallGraph::GenerateOhmuIR(const std::string &FName,
-                                     const clang::Decl *Fun,
-                                     clang::AnalysisDeclContext &AC) {
+  clang::AnalysisDeclContextManager ADCM(true, true, true, true, true, true);
+  clang::AnalysisDeclContext AC(&ADCM, Fun, ADCM.getCFGBuildOptions());
+
   clang::tilcpp::ClangCFGWalker Walker;
   if (!Walker.init(AC))
     return;
@@ -129,14 +178,22 @@ void ExtendCallGraph::GenerateOhmuIR(const std::string &FName,
   ohmu::MemRegionRef Arena(&Region);
   clang::tilcpp::ClangTranslator SxBuilder(Arena);
   SxBuilder.setSSAMode(true);
-  Walker.walk(SxBuilder);
+
+  // One walk produces both the IR translation and the call edges.
+  std::vector<std::string> CalleeNames;
+  CallEdgeCollector Calls(Mc.get(), FName, Builder,
+                          Cache ? &CalleeNames : nullptr);
+  Walker.walk(SxBuilder, Calls);
 
   ohmu::til::BytecodeStringWriter WriteStream;
   ohmu::til::BytecodeWriter Writer(&WriteStream);
 
   Writer.traverseAll(SxBuilder.topLevelSlot());
   WriteStream.flush();
-  Builder.SetOhmuIR(FName, WriteStream.str());
+  std::string IR = WriteStream.str();
+  EmitIR(FName, IR);
+  if (Cache)
+    Cache->update(FName, Hash, IR, std::move(CalleeNames));
 }
 
 } // end namespace
@@ -146,12 +203,14 @@ namespace lsa {
 
 void DefaultCallGraphBuilder::AddCall(const std::string &From,
                                       const std::string &To) {
+  std::lock_guard<std::mutex> Lock(Mutex);
   CallGraphNode *FromNode = GetNodeByName(From);
   FromNode->AddCall(To);
 }
 
 void DefaultCallGraphBuilder::SetOhmuIR(const std::string &Func,
                                         const std::string &IR) {
+  std::lock_guard<std::mutex> Lock(Mutex);
   GetNodeByName(Func)->SetIR(IR);
 }
 
@@ -188,10 +247,57 @@ void DefaultCallGraphBuilder::CallGraphNode::Print(std::ostream &Out) {
   Out << "\n";
 }
 
+void CompactCallGraph::Build(DefaultCallGraphBuilder &Builder) {
+  const auto &Graph = Builder.GetGraph();
+  NFunctions = Graph.size();
+
+  Names.clear();
+  IR.clear();
+  Offsets.clear();
+  Edges.clear();
+  Ids.clear();
+
+  // Functions with bodies get the low IDs, in sorted name order.
+  Names.reserve(NFunctions);
+  for (const auto &Pair : Graph)
+    Names.push_back(Pair.first);
+  std::sort(Names.begin(), Names.end());
+  for (uint32_t i = 0; i < NFunctions; ++i)
+    Ids[Names[i]] = i;
+
+  // Call targets without a body of their own get the IDs above.
+  std::set<std::string> External;
+  for (const auto &Pair : Graph)
+    for (const std::string &Call : *Pair.second->GetCalls())
+      if (Ids.count(Call) == 0)
+        External.insert(Call);
+  for (const std::string &Name : External) {
+    Ids[Name] = Names.size();
+    Names.push_back(Name);
+  }
+
+  IR.reserve(NFunctions);
+  Offsets.reserve(NFunctions + 1);
+  Offsets.push_back(0);
+  for (uint32_t i = 0; i < NFunctions; ++i) {
+    const auto *Node = Graph.at(Names[i]).get();
+    IR.push_back(&Node->GetIR());
+    for (const std::string &Call : *Node->GetCalls())
+      Edges.push_back(Ids[Call]);
+    // The node's call set iterates in hash order; sort the edge range so
+    // the CSR form (and anything serialized from it) is deterministic.
+    std::sort(Edges.begin() + Offsets[i], Edges.end());
+    Offsets.push_back(Edges.size());
+  }
+}
+
 void CallGraphBuilderTool::RegisterMatchers(
-    CallGraphBuilder &Builder, clang::ast_matchers::MatchFinder *Finder) {
+    CallGraphBuilder &Builder, clang::ast_matchers::MatchFinder *Finder,
+    ohmu::ThreadPool *Pool, TranslationCache *Cache,
+    StreamingIRWriter *Stream) {
 
-  ExtendCallGraph *Extender = new ExtendCallGraph(Builder);
+  ExtendCallGraph *Extender =
+      new ExtendCallGraph(Builder, Pool, Cache, Stream);
   Finder->addMatcher(clang::ast_matchers::functionDecl(
                          clang::ast_matchers::decl().bind("decl")),
                      Extender);
@@ -15,14 +15,23 @@
 
 #include "clang/ASTMatchers/ASTMatchFinder.h"
 
+#include <cstdint>
+#include <mutex>
 #include <ostream>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 namespace ohmu {
+
+class ThreadPool;
+
 namespace lsa {
 
+class StreamingIRWriter;
+class TranslationCache;
+
 /// Interface for actually constructing the call graph from the discovered calls
 /// and produced Ohmu IR. In this graph functions are identified by their C++
 /// mangled name.
@@ -40,7 +49,8 @@ public:
 };
 
 /// The standard implementation of GraphConstructor stores the call graph as a
-/// mapping from function identifier to CGNode.
+/// mapping from function identifier to CGNode.  AddCall and SetOhmuIR are
+/// thread-safe, so parallel translation workers can report results directly.
 class DefaultCallGraphBuilder : public CallGraphBuilder {
 public:
   void AddCall(const std::string &From, const std::string &To) override;
@@ -72,19 +82,86 @@ public:
 private:
   /// Returns the CGNode currently constructed for the function identified by
   /// Func. Creates a new node if none is associated with this function yet.
+  /// The caller must hold Mutex.
   CallGraphNode *GetNodeByName(const std::string &Func);
 
+  std::mutex Mutex; // Serializes updates from translation workers.
   std::unordered_map<std::string, std::unique_ptr<CallGraphNode>>
       Graph; // Mapping function names to their nodes.
 };
 
+/// Finalized compressed-sparse-row (CSR) form of a call graph.
+///
+/// Built once after matching completes.  Function names are interned to
+/// dense integer IDs, and all outgoing edges live in two flat arrays: the
+/// callees of function Id are Edges[Offsets[Id] .. Offsets[Id+1]).  Graph
+/// algorithms iterate edges without hashing or pointer chasing, and the
+/// graph costs a few words per function plus one word per edge instead of
+/// a heap node and a set of strings per function.
+///
+/// The compact graph refers to the IR strings owned by the builder's
+/// nodes, so the builder must outlive it.
+class CompactCallGraph {
+public:
+  static const uint32_t InvalidId = 0xFFFFFFFF;
+
+  /// Build the CSR arrays from Builder's graph.  IDs are assigned in
+  /// sorted name order, so the result is deterministic.  Functions with
+  /// bodies get the IDs below NumFunctions(); names that appear only as
+  /// call targets (e.g. external functions) get the IDs above.
+  void Build(DefaultCallGraphBuilder &Builder);
+
+  uint32_t NumFunctions() const { return NFunctions; }
+  uint32_t NumNames() const { return Names.size(); }
+  uint32_t NumEdges() const { return Edges.size(); }
+
+  const std::string &GetName(uint32_t Id) const { return Names[Id]; }
+  const std::string &GetIR(uint32_t Id) const { return *IR[Id]; }
+
+  /// Returns the ID interned for Name, or InvalidId if unknown.
+  uint32_t GetId(const std::string &Name) const {
+    auto It = Ids.find(Name);
+    return It == Ids.end() ? InvalidId : It->second;
+  }
+
+  /// The callee IDs of function Id, sorted ascending.
+  const uint32_t *CallsBegin(uint32_t Id) const {
+    return Edges.data() + Offsets[Id];
+  }
+  const uint32_t *CallsEnd(uint32_t Id) const {
+    return Edges.data() + Offsets[Id + 1];
+  }
+
+private:
+  uint32_t NFunctions = 0;
+  std::vector<std::string> Names;      // Indexed by ID.
+  std::vector<const std::string *> IR; // Indexed by ID, below NFunctions.
+  std::vector<uint32_t> Offsets;       // NFunctions + 1 entries into Edges.
+  std::vector<uint32_t> Edges;         // Callee IDs, grouped by caller.
+  std::unordered_map<std::string, uint32_t> Ids;
+};
+
 /// Tool to be used for creating call graphs with Ohmu IR for each function.
 class CallGraphBuilderTool {
 public:
   /// Create the required AST matchers and register them with 'Finder'.
   /// Matches all function declarations.
+  /// If Pool is given, per-function translation is farmed out to its
+  /// worker threads; each worker builds its own clang CFG, arena, and
+  /// translator, and synchronizes only inside Builder.  The caller must
+  /// call Pool->waitForAll() after matching, before reading the graph.
+  /// If Cache is given, functions whose source text hashes to a cached
+  /// entry reuse the IR and call edges from the previous run instead of
+  /// being re-translated; newly translated functions are stored back.
+  /// If Stream is given, each function's bytecode is appended to its
+  /// spill file as soon as the function is serialized, and is not
+  /// retained in Builder; write the snapshot with
+  /// GraphSerializer::write(File, Builder, Stream).
   void RegisterMatchers(CallGraphBuilder &Builder,
-                        clang::ast_matchers::MatchFinder *Finder);
+                        clang::ast_matchers::MatchFinder *Finder,
+                        ohmu::ThreadPool *Pool = nullptr,
+                        TranslationCache *Cache = nullptr,
+                        StreamingIRWriter *Stream = nullptr);
 
 private:
   /// This tool creates and owns its MatchCallbacks.
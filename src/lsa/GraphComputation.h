@@ -14,6 +14,8 @@
 #ifndef OHMU_LSA_GRAPHCOMPUTATION_H
 #define OHMU_LSA_GRAPHCOMPUTATION_H
 
+#include <cstring>
+
 #include "StandaloneGraphComputation.h"
 
 /// To provide serialization in Google's Pregel framework.
@@ -48,6 +50,30 @@ static uint64_t readUInt64FromString(const string &str, int &index) {
   return V;
 }
 
+/// Raw-byte serialization for trivially copyable value and message types.
+/// A computation whose types are plain (bit-fields, packed flags, small
+/// integer structs) can derive its coder specialization from this so that
+/// encoding and decoding are a single memcpy:
+///
+///   template <> class StringCoderCustom<MyValue>
+///       : public ohmu::lsa::StringCoderPOD<MyValue> {};
+///
+/// Saved state and shard exchange records then carry the value's bytes
+/// verbatim, so the encoded form is only portable between identical
+/// builds.
+template <class T> class StringCoderPOD {
+public:
+  static void Encode(const T &value, string *result) {
+    result->assign(reinterpret_cast<const char *>(&value), sizeof(T));
+  }
+  static bool Decode(const string &str, T *result) {
+    if (str.size() != sizeof(T))
+      return false;
+    std::memcpy(result, str.data(), sizeof(T));
+    return true;
+  }
+};
+
 } // namespace lsa
 } // namespace ohmu
 
@@ -1,34 +1,241 @@
 #ifndef OHMU_LSA_GRAPHDESERIALIZER_H
 #define OHMU_LSA_GRAPHDESERIALIZER_H
 
+#include "lsa/BlockCompression.h"
 #include "lsa/StandaloneGraphComputation.h"
 #include "til/Bytecode.h"
 
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <vector>
+
 namespace ohmu {
 namespace lsa {
 
 template <class UserComputation>
 class GraphDeserializer {
 public:
+  /// Memory-map the snapshot and address its sections in place; see
+  /// GraphSerializer for the indexed layout.  There is no per-record
+  /// parsing: names are sliced out of the mapped name table, edges are
+  /// read from the mapped CSR arrays, and each vertex keeps a reference
+  /// into the mapped IR blobs, materializing its body on demand the
+  /// first time ohmuIR() is called.
   static void read(const std::string& FileName,
                    StandaloneGraphBuilder<UserComputation> *Builder) {
-    ohmu::MemRegion Arena;
-    ohmu::til::BytecodeFileReader ReadStream(FileName,
-        ohmu::MemRegionRef(&Arena));
-
-    int32_t NFunc = ReadStream.readInt32();
-    for (unsigned i = 0; i < NFunc; i++) {
-      std::string Function = ReadStream.readString();
-      std::string OhmuIR = ReadStream.readString();
+    std::unique_ptr<ohmu::til::BytecodeFileMap> Map(
+        new ohmu::til::BytecodeFileMap(FileName));
+    Sections S;
+    if (!parse(FileName, *Map, &S))
+      return;
+
+    std::vector<std::string> Names;
+    sliceNames(S, Names);
+    std::unique_ptr<CompressedIRStore> Store = makeStore(S);
+
+    for (uint32_t i = 0; i < S.NFunc; i++) {
       typename GraphTraits<UserComputation>::VertexValueType Value;
-      Builder->addVertex(Function, OhmuIR, Value);
+      if (Store)
+        Builder->addVertex(Names[i], Store.get(), i, Value);
+      else
+        Builder->addVertex(Names[i], irOf(S, i), Value);
+
+      for (uint32_t e = S.EdgeOffsets[i]; e < S.EdgeOffsets[i + 1]; e++)
+        Builder->addCall(Names[i], Names[S.Edges[e]]);
+    }
+
+    // The vertices reference the mapping, so the graph takes ownership.
+    if (Store)
+      Builder->adoptIRStore(std::move(Store));
+    Builder->adoptFileMap(std::move(Map));
+  }
+
+  /// Load only shard ShardIndex of NShards from the snapshot.  The
+  /// assignment is computed from the snapshot alone - BFS clustering
+  /// over the CSR edges splits discovery order into NShards equal
+  /// contiguous blocks - so every process derives the same assignment
+  /// with no coordination, and connected neighborhoods land in the same
+  /// shard.  Local vertices get their full edge sets (one-sided for
+  /// edges whose other endpoint is remote); ShardOf receives the shard
+  /// of every name in the snapshot, which the driver uses to route
+  /// outgoing messages.  Returns false if the snapshot cannot be read.
+  static bool readShard(const std::string &FileName,
+                        StandaloneGraphBuilder<UserComputation> *Builder,
+                        unsigned ShardIndex, unsigned NShards,
+                        std::unordered_map<string, unsigned> *ShardOf) {
+    std::unique_ptr<ohmu::til::BytecodeFileMap> Map(
+        new ohmu::til::BytecodeFileMap(FileName));
+    Sections S;
+    if (!parse(FileName, *Map, &S))
+      return false;
+
+    std::vector<std::string> Names;
+    sliceNames(S, Names);
+    std::unique_ptr<CompressedIRStore> Store = makeStore(S);
+    std::vector<unsigned> Shard = assignShards(S, NShards);
+    for (uint32_t i = 0; i < S.NNames; i++)
+      ShardOf->emplace(Names[i], Shard[i]);
+
+    for (uint32_t i = 0; i < S.NFunc; i++) {
+      if (Shard[i] == ShardIndex) {
+        typename GraphTraits<UserComputation>::VertexValueType Value;
+        if (Store)
+          Builder->addVertex(Names[i], Store.get(), i, Value);
+        else
+          Builder->addVertex(Names[i], irOf(S, i), Value);
+      }
+      for (uint32_t e = S.EdgeOffsets[i]; e < S.EdgeOffsets[i + 1]; e++) {
+        uint32_t d = S.Edges[e];
+        if (Shard[i] == ShardIndex && Shard[d] == ShardIndex)
+          Builder->addCall(Names[i], Names[d]);
+        else if (Shard[i] == ShardIndex)
+          Builder->addOutgoingCall(Names[i], Names[d]);
+        else if (Shard[d] == ShardIndex)
+          Builder->addIncomingCall(Names[d], Names[i]);
+      }
+    }
+
+    if (Store)
+      Builder->adoptIRStore(std::move(Store));
+    Builder->adoptFileMap(std::move(Map));
+    return true;
+  }
+
+private:
+  /// The snapshot's sections, pointing into the mapping.
+  struct Sections {
+    uint32_t NNames;
+    uint32_t NFunc;
+    uint32_t NEdges;
+    uint32_t Flags;
+    const uint32_t *NameOffsets;
+    const char *NameBytes;
+    const uint32_t *EdgeOffsets;
+    const uint32_t *Edges;
+    const uint64_t *IROffsets;
+    const char *IRBytes;
+    // Set when the IR section is block-compressed.
+    uint64_t BlockSize;
+    uint64_t NBlocks;
+    const uint64_t *CompOffsets;
+    const uint8_t *CompBytes;
+  };
+
+  /// A lazy block-decompressing store for compressed snapshots, or null
+  /// when the IR section is raw.
+  static std::unique_ptr<CompressedIRStore> makeStore(const Sections &S) {
+    std::unique_ptr<CompressedIRStore> Store;
+    if (S.Flags & 1)
+      Store.reset(new CompressedIRStore(S.IROffsets, S.NFunc, S.CompOffsets,
+                                        S.CompBytes, S.BlockSize, S.NBlocks));
+    return Store;
+  }
+
+  static bool parse(const std::string &FileName,
+                    const ohmu::til::BytecodeFileMap &Map, Sections *S) {
+    if (!Map.valid()) {
+      std::cerr << "Cannot map file " << FileName << ".\n";
+      return false;
+    }
 
-      int32_t NNodes = ReadStream.readInt32();
-      for (unsigned n = 0; n < NNodes; n++) {
-        std::string Call = ReadStream.readString();
-        Builder->addCall(Function, Call);
+    // Must match GraphSerializer, which lives on the clang side of the
+    // export and is not included here.  Version 1 snapshots are version
+    // 2 snapshots with a zero flags word, so both are accepted.
+    const uint32_t MagicNumber = 0x41534C4F; // "OLSA", little-endian.
+    const uint32_t FormatVersion = 2;
+
+    const char *Base = Map.data();
+    const uint32_t *Header = reinterpret_cast<const uint32_t*>(Base);
+    if (Map.size() < 24 || Header[0] != MagicNumber ||
+        Header[1] == 0 || Header[1] > FormatVersion) {
+      std::cerr << "File " << FileName << " is not a graph snapshot.\n";
+      return false;
+    }
+    S->NNames = Header[2];
+    S->NFunc = Header[3];
+    S->NEdges = Header[4];
+    S->Flags = Header[5];
+
+    // Section positions follow from the counts alone.
+    uint64_t Pos = 24;
+    S->NameOffsets = reinterpret_cast<const uint32_t*>(Base + Pos);
+    Pos += (S->NNames + 1) * sizeof(uint32_t);
+    S->NameBytes = Base + Pos;
+    Pos = align(Pos + S->NameOffsets[S->NNames], 4);
+    S->EdgeOffsets = reinterpret_cast<const uint32_t*>(Base + Pos);
+    Pos += (S->NFunc + 1) * sizeof(uint32_t);
+    S->Edges = reinterpret_cast<const uint32_t*>(Base + Pos);
+    Pos = align(Pos + S->NEdges * sizeof(uint32_t), 8);
+    S->IROffsets = reinterpret_cast<const uint64_t*>(Base + Pos);
+    Pos += (S->NFunc + 1) * sizeof(uint64_t);
+    if (S->Flags & 1) {
+      // Compressed IR: a block header, the blocks, and the block index
+      // at the very end of the file.
+      const uint64_t *CompHeader =
+          reinterpret_cast<const uint64_t*>(Base + Pos);
+      S->BlockSize = CompHeader[0];
+      S->NBlocks = CompHeader[1];
+      S->CompBytes = reinterpret_cast<const uint8_t*>(Base + Pos + 16);
+      S->CompOffsets = reinterpret_cast<const uint64_t*>(
+          Base + Map.size() - (S->NBlocks + 1) * sizeof(uint64_t));
+      S->IRBytes = nullptr;
+    }
+    else {
+      S->IRBytes = Base + Pos;
+    }
+    return true;
+  }
+
+  static void sliceNames(const Sections &S, std::vector<std::string> &Names) {
+    Names.resize(S.NNames);
+    for (uint32_t i = 0; i < S.NNames; i++)
+      Names[i].assign(S.NameBytes + S.NameOffsets[i],
+                      S.NameOffsets[i + 1] - S.NameOffsets[i]);
+  }
+
+  static ohmu::StringRef irOf(const Sections &S, uint32_t i) {
+    return ohmu::StringRef(
+        S.IRBytes + S.IROffsets[i],
+        static_cast<unsigned>(S.IROffsets[i + 1] - S.IROffsets[i]));
+  }
+
+  /// BFS discovery order over the CSR, split into NShards contiguous
+  /// blocks of near-equal size.
+  static std::vector<unsigned> assignShards(const Sections &S,
+                                            unsigned NShards) {
+    std::vector<uint32_t> Order;
+    Order.reserve(S.NNames);
+    std::vector<char> Visited(S.NNames, 0);
+    for (uint32_t Seed = 0; Seed < S.NNames; Seed++) {
+      if (Visited[Seed])
+        continue;
+      Visited[Seed] = 1;
+      size_t Head = Order.size();
+      Order.push_back(Seed);
+      while (Head < Order.size()) {
+        uint32_t v = Order[Head++];
+        if (v >= S.NFunc)
+          continue; // External names have no out-edges.
+        for (uint32_t e = S.EdgeOffsets[v]; e < S.EdgeOffsets[v + 1]; e++) {
+          uint32_t t = S.Edges[e];
+          if (!Visited[t]) {
+            Visited[t] = 1;
+            Order.push_back(t);
+          }
+        }
       }
     }
+
+    std::vector<unsigned> Shard(S.NNames, 0);
+    for (size_t p = 0; p < Order.size(); p++)
+      Shard[Order[p]] = static_cast<unsigned>(
+          std::min<uint64_t>(p * NShards / S.NNames, NShards - 1));
+    return Shard;
+  }
+
+  static uint64_t align(uint64_t Pos, uint64_t Align) {
+    return (Pos + Align - 1) / Align * Align;
   }
 };
 
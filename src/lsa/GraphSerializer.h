@@ -2,28 +2,209 @@
 #define OHMU_LSA_GRAPHSERIALIZER_H
 
 #include "clang/Analysis/Til/Bytecode.h"
+#include "lsa/BlockCompression.h"
 #include "lsa/BuildCallGraph.h"
+#include "lsa/StreamingIRWriter.h"
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
 
 namespace ohmu {
 namespace lsa {
 
+/// Writes call-graph snapshots in an indexed binary layout that the
+/// reader memory-maps and addresses directly, without per-record
+/// parsing:
+///
+///   u32 Magic, Version, NNames, NFunc, NEdges, Pad
+///   u32 NameOffsets[NNames+1]   byte offsets into NameBytes
+///   u8  NameBytes[]             padded to a 4-byte boundary
+///   u32 EdgeOffsets[NFunc+1]    indices into Edges
+///   u32 Edges[NEdges]           callee name IDs, grouped by caller
+///   u64 IROffsets[NFunc+1]      byte offsets into IRBytes (8-aligned)
+///   u8  IRBytes[]               each function's serialized IR
+///
+/// The last header word holds flags.  With FlagCompressedIR set, the IR
+/// section is block-compressed (see BlockCompression.h) and IRBytes is
+/// replaced by:
+///
+///   u64 BlockSize, NBlocks
+///   u8  CompBytes[]             independently compressed blocks
+///   u64 CompOffsets[NBlocks+1]  at the very end of the file (8-aligned)
+///
+/// IROffsets keep their uncompressed meaning, so a function is still
+/// addressed by its logical byte range, and a reader decompresses only
+/// the blocks covering that range.  The block index trails the file
+/// because block sizes are not known until the blocks are written; the
+/// reader locates it from the file size.
+///
+/// All integers are little-endian and every section is aligned to its
+/// element size, so loading costs the header and the index arrays; the
+/// name, edge and IR data are only touched when used, and the OS page
+/// cache carries them across repeated runs on the same snapshot.
+/// Functions with bodies occupy the name IDs below NFunc, in name-table
+/// order.
 class GraphSerializer {
 public:
+  static const uint32_t MagicNumber = 0x41534C4F; // "OLSA", little-endian.
+  static const uint32_t FormatVersion = 2;
+  static const uint32_t FlagCompressedIR = 1;
+
   static void write(const std::string& FileName,
-                    DefaultCallGraphBuilder *Builder) {
-    ohmu::til::BytecodeFileWriter WriteStream(FileName);
-
-    WriteStream.writeInt32(Builder->GetGraph().size());
-    for (const auto &Pair : Builder->GetGraph()) {
-      WriteStream.writeString(Pair.first);
-      WriteStream.writeString(Pair.second->GetIR());
-      WriteStream.writeInt32(Pair.second->GetCalls()->size());
-      for (const std::string &Call : *Pair.second->GetCalls()) {
-        WriteStream.writeString(Call);
+                    DefaultCallGraphBuilder *Builder, bool Compress = true) {
+    CompactCallGraph Graph;
+    Graph.Build(*Builder);
+    writeSnapshot(FileName, Graph, [&Graph](uint32_t Id) {
+      return StringRef(Graph.GetIR(Id));
+    }, Compress);
+  }
+
+  /// Write the snapshot when translation ran in streaming mode: Builder
+  /// holds only the call edges, and the function bodies live in Stream's
+  /// spill file.  The spill is memory-mapped and each function's IR is
+  /// copied straight from the mapping into the snapshot, so no more than
+  /// one body is ever rebuilt in memory.
+  static void write(const std::string &FileName,
+                    DefaultCallGraphBuilder *Builder,
+                    StreamingIRWriter *Stream, bool Compress = true) {
+    Stream->Finish();
+    ohmu::til::BytecodeFileMap Map(Stream->GetFileName());
+    if (!Map.valid())
+      return;
+    ohmu::til::MappedMemoryReader ReadStream(Map);
+
+    // The spill stores (name, IR) pairs in completion order; index them
+    // by name so the snapshot can be written in the CSR's ID order.  The
+    // StringRefs point into the mapping, which outlives the write.
+    std::unordered_map<std::string, StringRef> SpilledIR;
+    SpilledIR.reserve(Stream->GetNumChunks());
+    for (uint32_t i = 0, n = Stream->GetNumChunks(); i < n; i++) {
+      std::string Func = ReadStream.readString().str();
+      SpilledIR.emplace(std::move(Func), ReadStream.readString());
+    }
+
+    CompactCallGraph Graph;
+    Graph.Build(*Builder);
+    writeSnapshot(FileName, Graph, [&Graph, &SpilledIR](uint32_t Id) {
+      auto It = SpilledIR.find(Graph.GetName(Id));
+      return It == SpilledIR.end() ? StringRef("", 0) : It->second;
+    }, Compress);
+  }
+
+private:
+  /// Emit the indexed layout from the finalized CSR form; IROf maps a
+  /// function ID to its serialized body.
+  static void writeSnapshot(const std::string &FileName,
+                            CompactCallGraph &Graph,
+                            const std::function<StringRef(uint32_t)> &IROf,
+                            bool Compress) {
+    uint32_t NNames = Graph.NumNames();
+    uint32_t NFunc = Graph.NumFunctions();
+    uint32_t NEdges = Graph.NumEdges();
+
+    ohmu::til::BytecodeFileWriter Out(FileName);
+    uint64_t Pos = 0;
+
+    uint32_t Header[6] = {MagicNumber, FormatVersion, NNames, NFunc,
+                          NEdges, Compress ? FlagCompressedIR : 0};
+    emit(Out, Pos, Header, sizeof(Header));
+
+    // Name table: offsets, then the concatenated bytes.
+    std::vector<uint32_t> NameOffsets(NNames + 1, 0);
+    for (uint32_t i = 0; i < NNames; i++)
+      NameOffsets[i + 1] =
+          NameOffsets[i] + static_cast<uint32_t>(Graph.GetName(i).size());
+    emit(Out, Pos, NameOffsets.data(), (NNames + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < NNames; i++)
+      emit(Out, Pos, Graph.GetName(i).data(), Graph.GetName(i).size());
+    pad(Out, Pos, 4);
+
+    // CSR edges; the graph already stores them as flat arrays.
+    std::vector<uint32_t> EdgeOffsets(NFunc + 1, 0);
+    for (uint32_t i = 0; i < NFunc; i++)
+      EdgeOffsets[i + 1] =
+          EdgeOffsets[i] +
+          static_cast<uint32_t>(Graph.CallsEnd(i) - Graph.CallsBegin(i));
+    emit(Out, Pos, EdgeOffsets.data(), (NFunc + 1) * sizeof(uint32_t));
+    for (uint32_t i = 0; i < NFunc; i++)
+      emit(Out, Pos, Graph.CallsBegin(i),
+           (Graph.CallsEnd(i) - Graph.CallsBegin(i)) * sizeof(uint32_t));
+
+    // IR blobs: offsets (always uncompressed byte positions), then the
+    // concatenated bodies, raw or block-compressed.
+    pad(Out, Pos, 8);
+    std::vector<uint64_t> IROffsets(NFunc + 1, 0);
+    for (uint32_t i = 0; i < NFunc; i++)
+      IROffsets[i + 1] = IROffsets[i] + IROf(i).size();
+    emit(Out, Pos, IROffsets.data(), (NFunc + 1) * sizeof(uint64_t));
+
+    if (!Compress) {
+      for (uint32_t i = 0; i < NFunc; i++) {
+        StringRef IR = IROf(i);
+        emit(Out, Pos, IR.data(), IR.size());
       }
+      Out.flush();
+      return;
     }
 
-    WriteStream.flush();
+    // Stream the bodies through a block-sized staging buffer, writing
+    // each block as it fills; memory stays bounded by one block no
+    // matter how large the IR section is.
+    uint64_t TotalIR = IROffsets[NFunc];
+    uint64_t NBlocks = (TotalIR + IRBlockSize - 1) / IRBlockSize;
+    uint64_t CompHeader[2] = {IRBlockSize, NBlocks};
+    emit(Out, Pos, CompHeader, sizeof(CompHeader));
+
+    std::vector<uint64_t> CompOffsets;
+    CompOffsets.reserve(NBlocks + 1);
+    CompOffsets.push_back(0);
+    std::vector<uint8_t> Staging, CompBuf;
+    Staging.reserve(IRBlockSize);
+    auto flushBlock = [&]() {
+      CompBuf.clear();
+      compressBlock(Staging.data(), Staging.size(), CompBuf);
+      emit(Out, Pos, CompBuf.data(), CompBuf.size());
+      CompOffsets.push_back(CompOffsets.back() + CompBuf.size());
+      Staging.clear();
+    };
+    for (uint32_t i = 0; i < NFunc; i++) {
+      StringRef IR = IROf(i);
+      const uint8_t *Data = reinterpret_cast<const uint8_t*>(IR.data());
+      size_t Off = 0;
+      while (Off < IR.size()) {
+        size_t N = IR.size() - Off;
+        size_t Room = IRBlockSize - Staging.size();
+        if (N > Room)
+          N = Room;
+        Staging.insert(Staging.end(), Data + Off, Data + Off + N);
+        Off += N;
+        if (Staging.size() == IRBlockSize)
+          flushBlock();
+      }
+    }
+    if (!Staging.empty())
+      flushBlock();
+
+    pad(Out, Pos, 8);
+    emit(Out, Pos, CompOffsets.data(), (NBlocks + 1) * sizeof(uint64_t));
+    Out.flush();
+  }
+
+  static void emit(ohmu::til::BytecodeFileWriter &Out, uint64_t &Pos,
+                   const void *Data, uint64_t Size) {
+    if (Size == 0)
+      return;
+    Out.writeBytes(Data, Size);
+    Pos += Size;
+  }
+
+  /// Zero-fill up to the next multiple of Align.
+  static void pad(ohmu::til::BytecodeFileWriter &Out, uint64_t &Pos,
+                  uint64_t Align) {
+    static const char Zeros[8] = {0};
+    if (Pos % Align)
+      emit(Out, Pos, Zeros, Align - Pos % Align);
   }
 };
 
@@ -0,0 +1,150 @@
+//===- IncrementalState.h --------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+// Persists the final vertex values of a run and seeds a later run from
+// them.  The state file records, for every vertex, its value and the
+// outgoing calls it was computed with; seeding diffs those calls against
+// the freshly built graph, restores the values of vertices whose
+// neighborhood did not change, and leaves only the dirty frontier active.
+// A fixpoint analysis then re-converges from the previous solution,
+// propagating just the consequences of the edit instead of recomputing
+// the whole graph.
+//
+// Values are encoded with the same StringCoderCustom specialization the
+// computation provides for the Pregel framework.
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_LSA_INCREMENTALSTATE_H
+#define OHMU_LSA_INCREMENTALSTATE_H
+
+#include "lsa/GraphComputation.h"
+#include "til/Bytecode.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace ohmu {
+namespace lsa {
+
+template <class UserComputation> class IncrementalState {
+public:
+  typedef
+      typename GraphTraits<UserComputation>::VertexValueType VertexValueType;
+
+  static const uint32_t MagicNumber = 0x53534C4F; // "OLSS", little-endian.
+  static const uint32_t FormatVersion = 1;
+
+  /// Write every vertex's final value together with its outgoing calls,
+  /// so the next run can detect which parts of the graph changed.
+  static void write(const std::string &FileName,
+                    StandaloneGraphBuilder<UserComputation> *Builder) {
+    ohmu::til::BytecodeFileWriter Out(FileName);
+    Out.writeInt32(static_cast<int32_t>(MagicNumber));
+    Out.writeInt32(static_cast<int32_t>(FormatVersion));
+    Out.writeUInt32(static_cast<uint32_t>(Builder->getVertices().size()));
+    string Encoded;
+    for (const auto &Vertex : Builder->getVertices()) {
+      Out.writeString(StringRef(Vertex.id()));
+      StringCoderCustom<VertexValueType>::Encode(Vertex.value(), &Encoded);
+      Out.writeString(StringRef(Encoded));
+      Out.writeUInt32(static_cast<uint32_t>(Vertex.outgoingCalls().size()));
+      for (const string &Callee : Vertex.outgoingCalls())
+        Out.writeString(StringRef(Callee));
+    }
+    Out.flush();
+  }
+
+  /// Seed Builder's graph from the state file of a previous run.  A
+  /// vertex is dirty when it is new, its outgoing calls changed, or a
+  /// call toward it appeared or disappeared (including calls from
+  /// vertices that were deleted); every other vertex restarts from its
+  /// previous value and stays halted until the dirty frontier's messages
+  /// reach it.  Returns false, leaving the graph untouched for a full
+  /// run, when the file cannot be read.
+  static bool seed(const std::string &FileName,
+                   StandaloneGraphBuilder<UserComputation> *Builder) {
+    ohmu::til::BytecodeFileMap Map(FileName);
+    if (!Map.valid()) {
+      std::cerr << "Cannot map state file " << FileName << ".\n";
+      return false;
+    }
+    ohmu::til::MappedMemoryReader In(Map);
+    if (In.readInt32() != static_cast<int32_t>(MagicNumber) ||
+        In.readInt32() != static_cast<int32_t>(FormatVersion)) {
+      std::cerr << "File " << FileName << " is not a vertex state file.\n";
+      return false;
+    }
+
+    struct Record {
+      string Value;
+      std::unordered_set<string> Out;
+    };
+    std::unordered_map<string, Record> Previous;
+    uint32_t NVertices = In.readUInt32();
+    Previous.reserve(NVertices);
+    for (uint32_t i = 0; i < NVertices; i++) {
+      string Id = In.readString().str();
+      Record &R = Previous[Id];
+      R.Value = In.readString().str();
+      uint32_t NOut = In.readUInt32();
+      for (uint32_t c = 0; c < NOut; c++)
+        R.Out.emplace(In.readString().str());
+    }
+
+    std::unordered_set<string> CurrentIds;
+    for (const auto &Vertex : Builder->getVertices())
+      CurrentIds.emplace(Vertex.id());
+
+    // Collect the dirty frontier.  Callers of a changed vertex need no
+    // marking here: an edge only changes when its source's outgoing set
+    // does, which dirties the source directly.
+    std::unordered_set<string> Dirty;
+    for (const auto &Vertex : Builder->getVertices()) {
+      auto It = Previous.find(Vertex.id());
+      if (It == Previous.end()) {
+        Dirty.emplace(Vertex.id());
+        for (const string &Callee : Vertex.outgoingCalls())
+          Dirty.emplace(Callee);
+        continue;
+      }
+      const std::unordered_set<string> &Old = It->second.Out;
+      const std::unordered_set<string> &New = Vertex.outgoingCalls();
+      if (Old != New)
+        Dirty.emplace(Vertex.id());
+      for (const string &Callee : New)
+        if (!Old.count(Callee))
+          Dirty.emplace(Callee); // Gained an incoming call.
+      for (const string &Callee : Old)
+        if (!New.count(Callee))
+          Dirty.emplace(Callee); // Lost an incoming call.
+    }
+    // Deleted vertices dirty their former callees.
+    for (const auto &Entry : Previous)
+      if (!CurrentIds.count(Entry.first))
+        for (const string &Callee : Entry.second.Out)
+          Dirty.emplace(Callee);
+
+    for (const auto &Vertex : Builder->getVertices()) {
+      if (Dirty.count(Vertex.id()))
+        continue;
+      // Decode assumes a default-constructed target; a value that fails
+      // to decode simply leaves its vertex dirty.
+      VertexValueType Value;
+      if (StringCoderCustom<VertexValueType>::Decode(
+              Previous[Vertex.id()].Value, &Value))
+        Builder->seedVertex(Vertex.id(), Value);
+    }
+    return true;
+  }
+};
+
+} // namespace lsa
+} // namespace ohmu
+
+#endif // OHMU_LSA_INCREMENTALSTATE_H
@@ -0,0 +1,317 @@
+//===- SCCEngine.h ---------------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+// Native strongly-connected-component engine over a CSR graph.  Finding
+// SCCs by superstep label propagation (see examples/SCCComputation.h)
+// takes O(diameter) rounds, thousands on a call graph's long chains; this
+// engine runs the forward-backward algorithm with trimming directly on
+// the flat edge arrays instead.  Trimming peels vertices with no
+// remaining in- or out-edges (the acyclic bulk of a call graph resolves
+// entirely here, in worklist order), then each remaining region is split
+// by a pivot's forward and backward reachability: the intersection is an
+// SCC and the three leftover parts recurse independently.  The
+// reachability sweeps run breadth-first and expand large frontiers on a
+// thread pool.
+//
+// Analyses use the engine as a library phase before their superstep
+// computation, injecting the components back as vertex values; see
+// computeStronglyConnectedComponents below.
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_LSA_SCCENGINE_H
+#define OHMU_LSA_SCCENGINE_H
+
+#include "base/ThreadPool.h"
+#include "lsa/StandaloneGraphComputation.h"
+
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace ohmu {
+namespace lsa {
+
+class SCCEngine {
+public:
+  enum : uint32_t { None = 0xFFFFFFFFu };
+
+  /// Compute the components of the graph whose out-edges of vertex v are
+  /// Targets[Offsets[v] .. Offsets[v+1]).  NThreads as in ThreadPool: 0
+  /// means one thread per core.
+  void compute(const std::vector<uint32_t> &Offsets,
+               const std::vector<uint32_t> &Targets, unsigned NThreads = 0) {
+    Off = Offsets.data();
+    Tgt = Targets.data();
+    uint32_t N = static_cast<uint32_t>(Offsets.size() - 1);
+
+    buildReverse(N, Targets);
+    Comp.assign(N, None);
+    TaskOf.assign(N, 0);
+    OutDeg.assign(N, 0);
+    InDeg.assign(N, 0);
+    SeenF.reset(new std::atomic<char>[N]);
+    SeenB.reset(new std::atomic<char>[N]);
+    for (uint32_t v = 0; v < N; v++) {
+      SeenF[v].store(0, std::memory_order_relaxed);
+      SeenB[v].store(0, std::memory_order_relaxed);
+    }
+    NComponents = 0;
+    if (NThreads != 1)
+      Pool.reset(new ohmu::ThreadPool(NThreads));
+
+    // Worklist of (task id, members) regions still to decompose; task
+    // ids make the membership test during traversal a single compare.
+    uint32_t NextTask = 0;
+    std::vector<std::pair<uint32_t, std::vector<uint32_t>>> Worklist;
+    Worklist.emplace_back(0u, std::vector<uint32_t>());
+    Worklist.back().second.resize(N);
+    for (uint32_t v = 0; v < N; v++)
+      Worklist.back().second[v] = v;
+
+    while (!Worklist.empty()) {
+      uint32_t Task = Worklist.back().first;
+      std::vector<uint32_t> Members = std::move(Worklist.back().second);
+      Worklist.pop_back();
+
+      trim(Task, Members);
+
+      std::vector<uint32_t> Alive;
+      for (uint32_t v : Members)
+        if (Comp[v] == None)
+          Alive.push_back(v);
+      if (Alive.empty())
+        continue;
+
+      // Forward and backward reachability from a pivot; the
+      // intersection is one SCC.
+      uint32_t Pivot = Alive[0];
+      std::vector<uint32_t> F = reach(Pivot, Off, Tgt, Task, SeenF.get());
+      std::vector<uint32_t> B =
+          reach(Pivot, RevOff.data(), RevTgt.data(), Task, SeenB.get());
+
+      uint32_t Id = NComponents++;
+      std::vector<uint32_t> FOnly, BOnly, Rest;
+      for (uint32_t v : F) {
+        if (SeenB[v].load(std::memory_order_relaxed))
+          Comp[v] = Id;
+        else
+          FOnly.push_back(v);
+      }
+      for (uint32_t v : B)
+        if (!SeenF[v].load(std::memory_order_relaxed))
+          BOnly.push_back(v);
+      for (uint32_t v : Alive) {
+        if (!SeenF[v].load(std::memory_order_relaxed) &&
+            !SeenB[v].load(std::memory_order_relaxed))
+          Rest.push_back(v);
+        SeenF[v].store(0, std::memory_order_relaxed);
+        SeenB[v].store(0, std::memory_order_relaxed);
+      }
+
+      if (!Rest.empty()) {
+        retask(++NextTask, Rest);
+        Worklist.emplace_back(NextTask, std::move(Rest));
+      }
+      if (!BOnly.empty()) {
+        retask(++NextTask, BOnly);
+        Worklist.emplace_back(NextTask, std::move(BOnly));
+      }
+      if (!FOnly.empty()) {
+        retask(++NextTask, FOnly);
+        Worklist.emplace_back(NextTask, std::move(FOnly));
+      }
+    }
+  }
+
+  /// The component of vertex V, in [0, numComponents()).  Only valid
+  /// after compute().
+  uint32_t component(uint32_t V) const { return Comp[V]; }
+
+  uint32_t numComponents() const { return NComponents; }
+
+private:
+  void buildReverse(uint32_t N, const std::vector<uint32_t> &Targets) {
+    RevOff.assign(N + 1, 0);
+    for (uint32_t t : Targets)
+      ++RevOff[t + 1];
+    for (uint32_t v = 0; v < N; v++)
+      RevOff[v + 1] += RevOff[v];
+    RevTgt.resize(Targets.size());
+    std::vector<uint32_t> Cursor(RevOff.begin(), RevOff.end() - 1);
+    for (uint32_t v = 0; v < N; v++)
+      for (uint32_t e = Off[v]; e < Off[v + 1]; e++)
+        RevTgt[Cursor[Tgt[e]]++] = v;
+  }
+
+  bool alive(uint32_t V, uint32_t Task) const {
+    return TaskOf[V] == Task && Comp[V] == None;
+  }
+
+  void retask(uint32_t Task, const std::vector<uint32_t> &Members) {
+    for (uint32_t v : Members)
+      TaskOf[v] = Task;
+  }
+
+  /// Peel vertices with no in- or out-edges inside the region; each is a
+  /// singleton SCC.  Removals cascade through a worklist, so an acyclic
+  /// region unravels completely without any reachability sweep.
+  void trim(uint32_t Task, const std::vector<uint32_t> &Members) {
+    std::vector<uint32_t> Queue;
+    for (uint32_t v : Members) {
+      if (Comp[v] != None)
+        continue;
+      uint32_t Out = 0, In = 0;
+      for (uint32_t e = Off[v]; e < Off[v + 1]; e++)
+        if (alive(Tgt[e], Task) && Tgt[e] != v)
+          ++Out;
+      for (uint32_t e = RevOff[v]; e < RevOff[v + 1]; e++)
+        if (alive(RevTgt[e], Task) && RevTgt[e] != v)
+          ++In;
+      OutDeg[v] = Out;
+      InDeg[v] = In;
+      if (Out == 0 || In == 0)
+        Queue.push_back(v);
+    }
+    while (!Queue.empty()) {
+      uint32_t v = Queue.back();
+      Queue.pop_back();
+      if (Comp[v] != None)
+        continue;
+      Comp[v] = NComponents++;
+      for (uint32_t e = Off[v]; e < Off[v + 1]; e++) {
+        uint32_t t = Tgt[e];
+        if (alive(t, Task) && --InDeg[t] == 0)
+          Queue.push_back(t);
+      }
+      for (uint32_t e = RevOff[v]; e < RevOff[v + 1]; e++) {
+        uint32_t t = RevTgt[e];
+        if (alive(t, Task) && --OutDeg[t] == 0)
+          Queue.push_back(t);
+      }
+    }
+  }
+
+  /// Vertices of the region reachable from Pivot over the given edge
+  /// arrays.  Frontiers above kParallelFrontier are expanded on the
+  /// pool, claiming vertices with an atomic exchange on the Seen flags.
+  std::vector<uint32_t> reach(uint32_t Pivot, const uint32_t *EOff,
+                              const uint32_t *ETgt, uint32_t Task,
+                              std::atomic<char> *Seen) {
+    std::vector<uint32_t> Visited, Frontier;
+    Seen[Pivot].store(1, std::memory_order_relaxed);
+    Visited.push_back(Pivot);
+    Frontier.push_back(Pivot);
+
+    while (!Frontier.empty()) {
+      std::vector<uint32_t> Next;
+      if (!Pool || Frontier.size() < kParallelFrontier) {
+        for (uint32_t v : Frontier)
+          for (uint32_t e = EOff[v]; e < EOff[v + 1]; e++) {
+            uint32_t t = ETgt[e];
+            if (alive(t, Task) &&
+                !Seen[t].exchange(1, std::memory_order_relaxed))
+              Next.push_back(t);
+          }
+      } else {
+        unsigned NSlots = Pool->numThreads();
+        std::vector<std::vector<uint32_t>> Local(NSlots);
+        std::atomic<size_t> NextChunk(0);
+        auto *Self = this;
+        Pool->parallelFor(NSlots, [Self, &Frontier, &Local, &NextChunk,
+                                   EOff, ETgt, Task, Seen](size_t Slot) {
+          const size_t ChunkSize = 64;
+          for (;;) {
+            size_t Begin =
+                NextChunk.fetch_add(ChunkSize, std::memory_order_relaxed);
+            if (Begin >= Frontier.size())
+              return;
+            size_t End = std::min(Begin + ChunkSize, Frontier.size());
+            for (size_t i = Begin; i < End; i++) {
+              uint32_t v = Frontier[i];
+              for (uint32_t e = EOff[v]; e < EOff[v + 1]; e++) {
+                uint32_t t = ETgt[e];
+                if (Self->alive(t, Task) &&
+                    !Seen[t].exchange(1, std::memory_order_relaxed))
+                  Local[Slot].push_back(t);
+              }
+            }
+          }
+        });
+        for (auto &L : Local)
+          Next.insert(Next.end(), L.begin(), L.end());
+      }
+      Visited.insert(Visited.end(), Next.begin(), Next.end());
+      Frontier.swap(Next);
+    }
+    return Visited;
+  }
+
+private:
+  static const size_t kParallelFrontier = 512;
+
+  const uint32_t *Off = nullptr;
+  const uint32_t *Tgt = nullptr;
+  std::vector<uint32_t> RevOff;
+  std::vector<uint32_t> RevTgt;
+  std::vector<uint32_t> Comp;
+  std::vector<uint32_t> TaskOf;
+  std::vector<uint32_t> OutDeg; // Degrees inside the current task.
+  std::vector<uint32_t> InDeg;
+  std::unique_ptr<std::atomic<char>[]> SeenF;
+  std::unique_ptr<std::atomic<char>[]> SeenB;
+  uint32_t NComponents = 0;
+  std::unique_ptr<ohmu::ThreadPool> Pool;
+};
+
+/// Library phase gluing the engine to a standalone graph: builds the CSR
+/// from the vertices' outgoing calls, runs the engine, and hands each
+/// vertex's component representative (the smallest vertex id in its SCC)
+/// to Inject(Id, Representative), which typically stores it into the
+/// vertex value via StandaloneGraphBuilder::setVertexValue.
+template <class UserComputation, class InjectFn>
+void computeStronglyConnectedComponents(
+    StandaloneGraphBuilder<UserComputation> *Builder, unsigned NThreads,
+    InjectFn Inject) {
+  const std::vector<GraphVertex<UserComputation>> &Vertices =
+      Builder->getVertices();
+  uint32_t N = static_cast<uint32_t>(Vertices.size());
+
+  std::unordered_map<string, uint32_t> Index;
+  Index.reserve(N);
+  for (uint32_t i = 0; i < N; i++)
+    Index.emplace(Vertices[i].id(), i);
+
+  std::vector<uint32_t> Offsets(1, 0);
+  std::vector<uint32_t> Targets;
+  for (uint32_t i = 0; i < N; i++) {
+    for (const string &Callee : Vertices[i].outgoingCalls()) {
+      auto It = Index.find(Callee);
+      if (It != Index.end())
+        Targets.push_back(It->second);
+    }
+    Offsets.push_back(static_cast<uint32_t>(Targets.size()));
+  }
+
+  SCCEngine Engine;
+  Engine.compute(Offsets, Targets, NThreads);
+
+  std::vector<const string *> Representative(Engine.numComponents(), nullptr);
+  for (uint32_t i = 0; i < N; i++) {
+    const string *&Rep = Representative[Engine.component(i)];
+    if (!Rep || Vertices[i].id() < *Rep)
+      Rep = &Vertices[i].id();
+  }
+  for (uint32_t i = 0; i < N; i++)
+    Inject(Vertices[i].id(), *Representative[Engine.component(i)]);
+}
+
+} // namespace lsa
+} // namespace ohmu
+
+#endif // OHMU_LSA_SCCENGINE_H
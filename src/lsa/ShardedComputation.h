@@ -0,0 +1,245 @@
+//===- ShardedComputation.h ------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+// Multi-process mode for standalone graph computations, for graphs that
+// exceed one process's memory.  Each process loads one shard of the
+// snapshot (GraphDeserializer::readShard derives the same BFS-clustered
+// assignment in every process) and runs it on the standalone tool's step
+// loop; messages crossing shards are appended to flat per-thread logs
+// (no locking), radix-bucketed by destination shard once per step, and
+// exchanged at every step barrier as batched binary files in a shared
+// directory, written to a temporary name and renamed so readers only
+// ever see complete files.  Each exchange file carries the sender's
+// active-vertex count, total messages sent this round, and reiterate
+// vote, from which every shard independently derives the same global
+// phase-completion and transition decisions, keeping all processes in
+// lockstep without a coordinator.
+//
+// Message values are encoded with the computation's StringCoderCustom
+// specialization, as in IncrementalState.
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_LSA_SHARDEDCOMPUTATION_H
+#define OHMU_LSA_SHARDEDCOMPUTATION_H
+
+#include "lsa/GraphComputation.h"
+#include "lsa/GraphDeserializer.h"
+#include "til/Bytecode.h"
+
+#include <cstdio>
+#include <sstream>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace ohmu {
+namespace lsa {
+
+template <class UserComputation>
+class ShardedGraphTool
+    : public StandaloneGraphTool<UserComputation>::RemoteMessageSink {
+public:
+  typedef typename GraphTraits<UserComputation>::VertexValueType
+      VertexValueType;
+  typedef typename GraphTraits<UserComputation>::MessageValueType
+      MessageValueType;
+
+  ShardedGraphTool(const std::string &ExchangeDir, unsigned ShardIndex,
+                   unsigned NShards)
+      : ExchangeDir(ExchangeDir), ShardIndex(ShardIndex), NShards(NShards) {}
+
+  /// Load this process's shard of the snapshot.
+  bool load(const std::string &SnapshotFile) {
+    return GraphDeserializer<UserComputation>::readShard(
+        SnapshotFile, &Builder, ShardIndex, NShards, &ShardOf);
+  }
+
+  /// The local shard's graph, for seeding, partitioning or output.
+  StandaloneGraphBuilder<UserComputation> &graphBuilder() { return Builder; }
+
+  /// Run the computation in lockstep with the other shards.
+  void run(GraphComputationFactory<UserComputation> *Factory) {
+    StandaloneGraphTool<UserComputation> &Tool = Builder.Tool;
+    Tool.setRemoteSink(this);
+    Tool.beginRun(Factory);
+    ThreadLogs.assign(Tool.numThreads(), std::vector<StagedMessage>());
+
+    uint64_t Round = 0;
+    while (Tool.currentPhase().compare("HALT") != 0) {
+      Tool.beginPhase();
+      bool RemoteReiterate = false;
+
+      for (;;) {
+        Tool.step();
+        size_t LocalActive = Tool.numActiveVertices();
+
+        // One counting sort over the contiguous per-thread logs groups
+        // this step's messages by destination shard.
+        std::vector<StagedMessage> Batch;
+        std::vector<size_t> Begin;
+        bucketByShard(&Batch, &Begin);
+        uint64_t LocalSent = Batch.size();
+
+        // Publish this round: the batch slice per destination shard,
+        // plus the header every shard needs for the global decision.
+        for (unsigned To = 0; To < NShards; To++) {
+          if (To == ShardIndex)
+            continue;
+          writeExchange(Round, To, LocalActive, LocalSent,
+                        Tool.shouldReiterate(), Batch, Begin);
+        }
+
+        // Collect every other shard's round: inject their messages and
+        // fold their headers into the global picture.
+        uint64_t GlobalActive = LocalActive;
+        uint64_t GlobalSent = LocalSent;
+        for (unsigned From = 0; From < NShards; From++) {
+          if (From == ShardIndex)
+            continue;
+          readExchange(Round, From, &Tool, &GlobalActive, &GlobalSent,
+                       &RemoteReiterate);
+        }
+        Round++;
+
+        // All shards see the same sums, so they agree the phase is over:
+        // nobody is active and no message is in flight.
+        if (GlobalActive == 0 && GlobalSent == 0)
+          break;
+      }
+
+      Tool.orReiterate(RemoteReiterate);
+      Tool.transitionPhase();
+    }
+
+    Tool.finishRun();
+    Tool.setRemoteSink(nullptr);
+  }
+
+  /// RemoteMessageSink: append the message to the calling worker's log.
+  /// Each pool thread owns one log, so staging needs no locking; the
+  /// logs are bucketed by destination shard at the step barrier.
+  void deliverRemote(const string &Destination, const string &Source,
+                     const MessageValueType &Value) override {
+    auto It = ShardOf.find(Destination);
+    if (It == ShardOf.end())
+      return; // Unknown identity; dropped, as in the single-process mode.
+    StagedMessage M;
+    M.Shard = It->second;
+    M.Destination = Destination;
+    M.Source = Source;
+    StringCoderCustom<MessageValueType>::Encode(Value, &M.Value);
+    ThreadLogs[ohmu::ThreadPool::threadIndex() % ThreadLogs.size()]
+        .push_back(std::move(M));
+  }
+
+private:
+  struct StagedMessage {
+    unsigned Shard; // Destination's shard, looked up when staged.
+    string Destination;
+    string Source;
+    string Value; // Encoded.
+  };
+
+  /// Counting sort of the per-thread logs by destination shard: Batch
+  /// receives all staged messages with shard s occupying
+  /// [Begin[s], Begin[s+1]), and the logs are left empty.
+  void bucketByShard(std::vector<StagedMessage> *Batch,
+                     std::vector<size_t> *Begin) {
+    std::vector<size_t> Count(NShards, 0);
+    size_t Total = 0;
+    for (const auto &Log : ThreadLogs) {
+      for (const StagedMessage &M : Log)
+        Count[M.Shard]++;
+      Total += Log.size();
+    }
+    Begin->assign(NShards + 1, 0);
+    for (unsigned s = 0; s < NShards; s++)
+      (*Begin)[s + 1] = (*Begin)[s] + Count[s];
+
+    Batch->resize(Total);
+    std::vector<size_t> Next(Begin->begin(), Begin->end() - 1);
+    for (auto &Log : ThreadLogs) {
+      for (StagedMessage &M : Log)
+        (*Batch)[Next[M.Shard]++] = std::move(M);
+      Log.clear();
+    }
+  }
+
+  std::string exchangeName(uint64_t Round, unsigned From, unsigned To) {
+    std::stringstream Name;
+    Name << ExchangeDir << "/x." << Round << "." << From << "." << To;
+    return Name.str();
+  }
+
+  void writeExchange(uint64_t Round, unsigned To, uint64_t Active,
+                     uint64_t Sent, bool Reiterate,
+                     const std::vector<StagedMessage> &Batch,
+                     const std::vector<size_t> &Begin) {
+    std::string Final = exchangeName(Round, ShardIndex, To);
+    std::string Temp = Final + ".tmp";
+    {
+      ohmu::til::BytecodeFileWriter Out(Temp);
+      Out.writeUInt64(Active);
+      Out.writeUInt64(Sent);
+      Out.writeUInt8(Reiterate ? 1 : 0);
+      Out.writeUInt32(static_cast<uint32_t>(Begin[To + 1] - Begin[To]));
+      for (size_t i = Begin[To]; i < Begin[To + 1]; i++) {
+        Out.writeString(StringRef(Batch[i].Destination));
+        Out.writeString(StringRef(Batch[i].Source));
+        Out.writeString(StringRef(Batch[i].Value));
+      }
+      Out.flush();
+    }
+    // The writer's destructor synced the file; the rename makes it
+    // appear complete or not at all.
+    ::rename(Temp.c_str(), Final.c_str());
+  }
+
+  void readExchange(uint64_t Round, unsigned From,
+                    StandaloneGraphTool<UserComputation> *Tool,
+                    uint64_t *GlobalActive, uint64_t *GlobalSent,
+                    bool *Reiterate) {
+    std::string Name = exchangeName(Round, From, ShardIndex);
+    while (::access(Name.c_str(), F_OK) != 0)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    ohmu::til::BytecodeFileMap Map(Name);
+    ohmu::til::MappedMemoryReader In(Map);
+    *GlobalActive += In.readUInt64();
+    *GlobalSent += In.readUInt64();
+    if (In.readUInt8())
+      *Reiterate = true;
+    uint32_t NRecords = In.readUInt32();
+    for (uint32_t i = 0; i < NRecords; i++) {
+      string Destination = In.readString().str();
+      string Source = In.readString().str();
+      string Encoded = In.readString().str();
+      MessageValueType Value;
+      if (StringCoderCustom<MessageValueType>::Decode(Encoded, &Value))
+        Tool->injectMessage(Destination, Value, Source);
+    }
+    ::unlink(Name.c_str());
+  }
+
+private:
+  std::string ExchangeDir;
+  unsigned ShardIndex;
+  unsigned NShards;
+  StandaloneGraphBuilder<UserComputation> Builder;
+  std::unordered_map<string, unsigned> ShardOf;
+
+  /// Per-worker-thread staging logs for the current step, indexed by the
+  /// pool's thread index; see deliverRemote.
+  std::vector<std::vector<StagedMessage>> ThreadLogs;
+};
+
+} // namespace lsa
+} // namespace ohmu
+
+#endif // OHMU_LSA_SHARDEDCOMPUTATION_H
@@ -22,14 +22,23 @@
 #define OHMU_LSA_STANDALONEGRAPHCOMPUTATION_H
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <ostream>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
 
-#include "clang/Analysis/Til/Bytecode.h"
-#include "clang/Analysis/Til/CFGBuilder.h"
+#include "base/Stats.h"
+#include "base/ThreadPool.h"
+#include "base/Trace.h"
+#include "lsa/BlockCompression.h"
+#include "til/Bytecode.h"
+#include "til/CFGBuilder.h"
 
 /// Allow for custom string type.
 #ifndef HAS_GLOBAL_STRING
@@ -39,6 +48,10 @@ using std::string;
 namespace ohmu {
 namespace lsa {
 
+// Defined here in the header, this counter exists once per translation
+// unit; printStatistics() merges counters by name (see base/Stats.h).
+OHMU_STAT(NumLsaMessagesSent, "Messages sent between LSA vertices.");
+
 /// A message send between two vertices.
 template <class MessageValueType> class Message {
 public:
@@ -46,6 +59,9 @@ public:
 
   const MessageValueType &value() const { return Value; }
 
+  /// Get a mutable pointer to the carried value, for message combiners.
+  MessageValueType *mutableValue() { return &Value; }
+
   const string &source() const { return Source; }
 
 private:
@@ -67,8 +83,13 @@ template <class T> struct GraphTraits {
 /// Forward declaration of the tool that controls the computation.
 template <class UserComputation> class StandaloneGraphTool;
 
-/// Implementation of the GraphVertex API for standalone computations. All
-/// methods only make local changes to enable easy multithreading.
+/// Forward declaration of the multi-process driver (ShardedComputation.h).
+template <class UserComputation> class ShardedGraphTool;
+
+/// Implementation of the GraphVertex API for standalone computations.
+/// Methods either make local changes or, for sendMessage, deliver into the
+/// destination's mailbox through the tool; both are safe to call from
+/// parallel computation steps.
 template <class UserComputation> class GraphVertex {
 public:
   typedef ohmu::lsa::GraphTraits<UserComputation> Traits;
@@ -78,25 +99,33 @@ public:
 
 public:
   GraphVertex(const string &Id)
-      : VertexId(Id), OhmuIR(nullptr), OhmuIRBuilt(false),
-        Value(VertexValueType()), HaltVote(false), ReiterateVote(false) {}
+      : VertexId(Id), OhmuIRRaw(nullptr, 0), IRStore(nullptr), IRStoreId(0),
+        OhmuIR(nullptr), OhmuIRBuilt(false), HaltVote(false),
+        ReiterateVote(false), Tool(nullptr), VertexIndex(0) {}
 
 public:
   /// The identity of this vertex.
   const string &id() const { return VertexId; }
 
-  /// The ohmu IR of this function.
+  /// The ohmu IR of this function.  Decoded from the retained bytecode on
+  /// first use; when the tool runs with a decoded-IR budget, cold IR may
+  /// be dropped again and is transparently re-decoded here.
   ohmu::til::SExpr *ohmuIR() {
     if (!OhmuIRBuilt)
       buildOhmuIR();
+    if (Tool)
+      Tool->noteIRUse(VertexIndex);
     return OhmuIR;
   }
 
-  /// Get a non-mutable reference to the value at this vertex.
-  const VertexValueType &value() const { return Value; }
+  /// Get a non-mutable reference to the value at this vertex.  Values
+  /// live in a flat array on the tool (indexed like the vertices), so
+  /// passes that touch only values walk contiguous memory instead of
+  /// striding over the vertex records.
+  const VertexValueType &value() const { return Tool->Values[VertexIndex]; }
 
   /// Get a mutable pointer to the value at this vertex.
-  VertexValueType *mutableValue() { return &Value; }
+  VertexValueType *mutableValue() { return &Tool->Values[VertexIndex]; }
 
   /// Get the list of functions called from this vertex.
   const std::unordered_set<string> &outgoingCalls() const {
@@ -108,14 +137,11 @@ public:
     return IncomingCalls;
   }
 
-  /// Send a message to the vertex with identity 'Destination'. The message is
-  /// cached locally, relying on the StandaloneGraphTool to actually move the
-  /// messages to the destinations after each step.
+  /// Send a message to the vertex with identity 'Destination'. The message
+  /// is delivered straight into the destination's mailbox, where it becomes
+  /// readable in the next step; there is no inter-step merge.
   void sendMessage(const string &Destination,
-                   const MessageValueType &MessageValue) {
-    getOutMessagesTo(Destination)
-        .emplace_back(Message<MessageValueType>(MessageValue, VertexId));
-  }
+                   const MessageValueType &MessageValue);
 
   /// Indicate that for this vertex the current phase is finished. This vertex
   /// becomes inactive for the remainder of this phase, unless it receives new
@@ -136,36 +162,57 @@ public:
   }
 
 private:
-  /// Return all messages currently queued to be send to the vertex identified
-  /// by 'Id'.
-  MessageList &getOutMessagesTo(const string &Id) {
-    auto Pair = OutMessagesCache.emplace(std::make_pair(Id, MessageList()));
-    return Pair.first->second;
+  /// Drop the decoded IR, keeping the bytecode; a later ohmuIR() call
+  /// re-decodes.  Called by the tool when evicting cold IR.
+  void dropOhmuIR() {
+    OhmuIR = nullptr;
+    OhmuIRBuilt = false;
+    Region.reset();
   }
 
   void buildOhmuIR() {
-    ohmu::MemRegionRef Arena(&Region);
+    // Compressed snapshots resolve the raw bytes on first use, so only
+    // the blocks covering touched functions are ever decompressed.  The
+    // resolved ref stays valid for the store's lifetime, so re-decodes
+    // after an IR-budget eviction do not decompress again.
+    if (!OhmuIRRaw.data() && IRStore)
+      OhmuIRRaw = IRStore->ir(IRStoreId);
+
+    // The region is created on demand, so vertices whose IR is never
+    // requested do not pay for an arena.  (It also keeps this class
+    // movable: MemRegion must not be copied when the vertex vector
+    // grows.)
+    if (!Region)
+      Region.reset(new ohmu::MemRegion());
+    ohmu::MemRegionRef Arena(Region.get());
     ohmu::til::CFGBuilder Builder(Arena);
 
-    ohmu::til::InMemoryReader ReadStream(OhmuIRRaw.data(), OhmuIRRaw.length(),
-                                         Arena);
+    // OhmuIRRaw typically points into the memory-mapped snapshot; only
+    // this function's bytes are touched, and string literals in the IR
+    // reference the mapping without being copied.
+    ohmu::til::MappedMemoryReader ReadStream(OhmuIRRaw.data(),
+                                             OhmuIRRaw.size());
     ohmu::til::BytecodeReader Reader(Builder, &ReadStream);
     OhmuIR = Reader.read();
+    OhmuIRBuilt = true;
   }
 
 private:
   string VertexId;
-  string OhmuIRRaw;
+  ohmu::StringRef OhmuIRRaw;
+  CompressedIRStore *IRStore; // Lazy source of OhmuIRRaw; owned by the tool.
+  uint32_t IRStoreId;         // This function's ID in the snapshot.
   ohmu::til::SExpr *OhmuIR;
-  ohmu::MemRegion Region; // Holding the IR.
+  std::unique_ptr<ohmu::MemRegion> Region; // Holding the IR.
   bool OhmuIRBuilt;
-  VertexValueType Value;
   bool HaltVote;
   bool ReiterateVote;
   std::unordered_set<string> OutgoingCalls;
   std::unordered_set<string> IncomingCalls;
 
-  std::unordered_map<string, MessageList> OutMessagesCache;
+  /// Set by the tool; routes sendMessage to the destination's mailbox.
+  StandaloneGraphTool<UserComputation> *Tool;
+  unsigned VertexIndex; // This vertex's index in the tool's Vertices.
 
 private:
   /// To access internal representation without exposing an interface to the
@@ -203,10 +250,28 @@ public:
   /// should be executed, return the phase "HALT";
   virtual string transition(const string &Phase) { return "HALT"; }
 
+  /// Overwrite to fold messages bound for the same vertex, Pregel-combiner
+  /// style: fold 'In' into '*Acc' and return true, or return false to
+  /// deliver 'In' as a separate message (the default).  When only an
+  /// aggregate of the incoming messages matters (a minimum, a union),
+  /// folding caps a mailbox at one message regardless of fan-in.
+  /// The fold must be commutative and associative, and runs on the
+  /// sender's thread under the receiver's mailbox lock, so it must not
+  /// touch per-computation state.  A combined message keeps the first
+  /// sender as its source; decline to combine in phases where the
+  /// computation inspects message sources.
+  virtual bool combineMessages(Message *Acc, const Message &In) {
+    return false;
+  }
+
 public:
   /// Get the current step number in this phase (starting at 0).
   int stepCount() const { return Tool->stepCount(); }
 
+  /// Get the phase currently being run.  Unlike the argument passed to
+  /// computePhase, this is also available to combineMessages.
+  const string &phase() const { return Tool->currentPhase(); }
+
   /// Request to remove the call from 'Source' to 'Destination' from the call
   /// graph.
   void removeCall(const string &Source, const string &Destination) {
@@ -262,7 +327,9 @@ public:
   typedef ohmu::lsa::GraphComputation<UserComputation> GraphComputation;
   typedef ohmu::lsa::GraphVertex<UserComputation> GraphVertex;
 
-  StandaloneGraphTool() : StepCount(0), ReiterateResult(false), Phase("START") {
+  StandaloneGraphTool()
+      : StepCount(0), ReiterateResult(false), Phase("START"),
+        TouchedCount(0) {
     // By default we start as many threads as there are cores.
     setNThreads(std::thread::hardware_concurrency());
   }
@@ -273,17 +340,76 @@ public:
       NThreads = 1;
   }
 
+  /// The number of worker threads the computation runs with.
+  unsigned numThreads() const { return NThreads; }
+
+  /// Collect per-phase and per-step statistics (wall time, active
+  /// vertices, message volume, per-thread work) during run(), for
+  /// printStats().  Off by default; when off the only cost is a
+  /// predictable branch per step and per delivery.
+  void enableStats() { StatsEnabled = true; }
+
+  /// Dump the collected statistics as a line-oriented, machine-readable
+  /// report: one 'phase' record per phase (with the transition taken),
+  /// followed by its 'step' and 'thread' records.
+  void printStats(std::ostream &Out) const {
+    Out << "# lsa-stats v1\n";
+    for (const PhaseStats &P : Stats) {
+      Out << "phase " << P.Phase << " steps " << P.Steps.size()
+          << " seconds " << P.Seconds << " messages " << P.Messages
+          << " reiterate " << (P.Reiterate ? 1 : 0) << " next "
+          << P.NextPhase << "\n";
+      for (size_t i = 0; i < P.Steps.size(); i++)
+        Out << "step " << P.Phase << " " << i << " active "
+            << P.Steps[i].Active << " messages " << P.Steps[i].Messages
+            << " seconds " << P.Steps[i].Seconds << "\n";
+      for (size_t t = 0; t < P.ThreadVertices.size(); t++)
+        Out << "thread " << P.Phase << " " << t << " vertices "
+            << P.ThreadVertices[t] << "\n";
+    }
+  }
+
+  /// Bound the total decoded IR kept alive, in bytes of retained bytecode
+  /// (the decoded form is roughly proportional).  When the budget is
+  /// exceeded, the least recently used vertices' IR is dropped and
+  /// re-decoded on demand.  0 (the default) keeps all decoded IR.
+  void setIRCacheBudget(uint64_t Bytes) { IRCacheBudget = Bytes; }
+
   /// Methods exposed via StandaloneGraphBuilder.
 public:
   /// Adds a vertex with the specified identity and value. If the vertex already
   /// exists, that vertex' value is updated instead of creating a new vertex.
-  void addVertex(const string &Id, const string &IRRaw,
+  /// The raw IR is referenced, not copied; its backing memory must stay
+  /// alive for the lifetime of the graph (see adoptFileMap).
+  void addVertex(const string &Id, ohmu::StringRef IRRaw,
                  const VertexValueType Value) {
     GraphVertex &Vertex = getVertex(Id);
     *Vertex.mutableValue() = Value;
     Vertex.OhmuIRRaw = IRRaw;
   }
 
+  /// As above, but for block-compressed snapshots: the raw IR is fetched
+  /// from Store on first use, so functions an analysis never touches are
+  /// never decompressed.  StoreId is the function's ID in the snapshot.
+  void addVertex(const string &Id, CompressedIRStore *Store, uint32_t StoreId,
+                 const VertexValueType Value) {
+    GraphVertex &Vertex = getVertex(Id);
+    *Vertex.mutableValue() = Value;
+    Vertex.IRStore = Store;
+    Vertex.IRStoreId = StoreId;
+  }
+
+  /// Take ownership of the memory-mapped snapshot that the vertices' raw
+  /// IR references.
+  void adoptFileMap(std::unique_ptr<ohmu::til::BytecodeFileMap> Map) {
+    IRFileMap = std::move(Map);
+  }
+
+  /// Take ownership of the compressed-IR store the vertices fetch from.
+  void adoptIRStore(std::unique_ptr<CompressedIRStore> Store) {
+    IRStore = std::move(Store);
+  }
+
   /// Adds a call from Source to Destination. If a vertex does not exist, it is
   /// created using the default constructor for its value.
   void addCall(const string &Source, const string &Destination) {
@@ -291,6 +417,88 @@ public:
     getVertex(Destination).IncomingCalls.emplace(Source);
   }
 
+  /// One-sided halves of addCall, for sharded loading: record the edge
+  /// on the local endpoint only, without creating a vertex for the
+  /// remote one.  Messages sent to the remote identity then go through
+  /// the RemoteMessageSink.
+  void addOutgoingCall(const string &Source, const string &Destination) {
+    getVertex(Source).OutgoingCalls.emplace(Destination);
+  }
+  void addIncomingCall(const string &Destination, const string &Source) {
+    getVertex(Destination).IncomingCalls.emplace(Source);
+  }
+
+  /// Set Id's value directly, bypassing the superstep framework; used to
+  /// inject results computed by library phases (see SCCEngine.h).
+  /// Unknown identities are ignored.
+  void setVertexValue(const string &Id, const VertexValueType &Value) {
+    auto Element = VertexMap.find(Id);
+    if (Element != VertexMap.end())
+      *Vertices[Element->second].mutableValue() = Value;
+  }
+
+  /// Seed Id's value from a previous run and mark the vertex clean: the
+  /// next run starts it halted on this value, and it participates only
+  /// once a message from the dirty frontier wakes it.  Unknown
+  /// identities are ignored.  (See IncrementalState.)
+  void seedVertex(const string &Id, const VertexValueType &Value) {
+    auto Element = VertexMap.find(Id);
+    if (Element == VertexMap.end())
+      return;
+    CleanVertex.resize(Vertices.size(), 0);
+    *Vertices[Element->second].mutableValue() = Value;
+    CleanVertex[Element->second] = 1;
+  }
+
+  /// Reorder vertex storage by call locality: BFS clustering over the
+  /// call edges (in both directions) lays connected neighborhoods out
+  /// contiguously, so the chunked work claiming in runVerticesStep hands
+  /// a neighborhood to one worker and most messages stay thread-local,
+  /// and vertex data touched together is adjacent in memory.  Call after
+  /// the graph is built (and seeded), before run().
+  void partitionByCallLocality() {
+    unsigned N = static_cast<unsigned>(Vertices.size());
+    std::vector<unsigned> Order;
+    Order.reserve(N);
+    std::vector<char> Visited(N, 0);
+    for (unsigned Seed = 0; Seed < N; Seed++) {
+      if (Visited[Seed])
+        continue;
+      Visited[Seed] = 1;
+      // Order doubles as the BFS queue; Head chases its growth.
+      size_t Head = Order.size();
+      Order.push_back(Seed);
+      while (Head < Order.size()) {
+        unsigned v = Order[Head++];
+        for (const string &Callee : Vertices[v].OutgoingCalls)
+          visitForOrder(Callee, Visited, Order);
+        for (const string &Caller : Vertices[v].IncomingCalls)
+          visitForOrder(Caller, Visited, Order);
+      }
+    }
+
+    std::vector<GraphVertex> NewVertices;
+    std::vector<VertexValueType> NewValues;
+    NewVertices.reserve(N);
+    NewValues.reserve(N);
+    for (unsigned i = 0; i < N; i++) {
+      NewValues.emplace_back(std::move(Values[Order[i]]));
+      NewVertices.emplace_back(std::move(Vertices[Order[i]]));
+      NewVertices.back().VertexIndex = i;
+      VertexMap[NewVertices.back().VertexId] = i;
+    }
+    Vertices.swap(NewVertices);
+    Values.swap(NewValues);
+
+    if (!CleanVertex.empty()) {
+      CleanVertex.resize(N, 0);
+      std::vector<char> NewClean(N);
+      for (unsigned i = 0; i < N; i++)
+        NewClean[i] = CleanVertex[Order[i]];
+      CleanVertex.swap(NewClean);
+    }
+  }
+
   /// Request to order the vertices by id, useful when testing.
   void sortVertices() { std::sort(Vertices.begin(), Vertices.end()); }
 
@@ -300,6 +508,70 @@ public:
   /// Run the computation created by the specified factory.
   void run(GraphComputationFactory *Factory);
 
+  /// Step-level control, used by run() and by the sharded driver
+  /// (ShardedComputation.h), which interleaves its exchange barriers
+  /// with the steps.
+public:
+  /// Sink for messages whose destination is not in this graph, installed
+  /// by the sharded driver.  Called from worker threads during a step;
+  /// implementations synchronize internally.  Without a sink such
+  /// messages are dropped, as before.
+  class RemoteMessageSink {
+  public:
+    virtual ~RemoteMessageSink() {}
+    virtual void deliverRemote(const string &Destination,
+                               const string &Source,
+                               const MessageValueType &Value) = 0;
+  };
+
+  void setRemoteSink(RemoteMessageSink *Sink) { RemoteSink = Sink; }
+
+  /// Set up pools, mailboxes and per-thread computations; the prefix of
+  /// run() before any phase executes.
+  void beginRun(GraphComputationFactory *Factory);
+
+  /// Reset votes and the worklist for the current phase.
+  void beginPhase();
+
+  /// Run one step: the parallel vertex sweep plus the sequential
+  /// mailbox/worklist processing.  Safe to call with an empty worklist,
+  /// which a shard does while its neighbors are still converging.
+  void step();
+
+  /// Number of vertices that will run in the next step.
+  size_t numActiveVertices() const { return ActiveVertices.size(); }
+
+  /// Fold a remote shard's reiterate vote into this phase's result.
+  void orReiterate(bool Vote) { ReiterateResult |= Vote; }
+
+  /// Run the user transition() from the current phase; returns the new
+  /// phase.  Also finalizes this phase's statistics.
+  const string &transitionPhase();
+
+  /// The suffix of run() after the last phase.
+  void finishRun();
+
+  /// Deliver a message that arrived from another shard.  Must be called
+  /// between steps: the message lands directly in the destination's
+  /// inbox for the next step and wakes the vertex.  Messages to unknown
+  /// identities are dropped.
+  void injectMessage(const string &Destination,
+                     const MessageValueType &Value, const string &Source) {
+    auto Element = VertexMap.find(Destination);
+    if (Element == VertexMap.end())
+      return;
+    unsigned index = Element->second;
+    MessageList &Box = Inbox[index];
+    Message<MessageValueType> M(Value, Source);
+    if (Box.empty() || !UserComputations[0]->combineMessages(&Box.back(), M))
+      Box.emplace_back(std::move(M));
+    Vertices[index].HaltVote = false;
+    if (!ActiveFlag[index]) {
+      ActiveFlag[index] = 1;
+      ActiveVertices.push_back(index);
+    }
+  }
+
   /// Methods called by GraphComputation.
 public:
   /// Get the current step number in this phase (starting at 0)
@@ -308,16 +580,108 @@ public:
   /// Returns whether any vertex requested further phase iterations.
   bool shouldReiterate() { return ReiterateResult; }
 
+  /// The phase currently being run; stable for the duration of a step.
+  const string &currentPhase() const { return Phase; }
+
+  /// Called by GraphVertex::ohmuIR whenever a vertex's decoded IR is
+  /// requested.  Refreshes the vertex in the LRU list and, if the budget
+  /// is exceeded, drops the coldest decoded IR.  Vertices currently in a
+  /// computation step are never evicted: only the computing thread can
+  /// reach its vertex's IR, so everything else is provably cold.
+  void noteIRUse(unsigned Index) {
+    if (IRCacheBudget == 0 || InIRCache.size() != Vertices.size())
+      return;
+    std::lock_guard<std::mutex> Lock(IRCacheMutex);
+    if (InIRCache[Index])
+      IRCacheLRU.erase(IRCachePos[Index]);
+    else {
+      InIRCache[Index] = 1;
+      IRCacheBytes += Vertices[Index].OhmuIRRaw.size();
+    }
+    IRCacheLRU.push_front(Index);
+    IRCachePos[Index] = IRCacheLRU.begin();
+
+    size_t Scanned = 0;
+    while (IRCacheBytes > IRCacheBudget && IRCacheLRU.size() > 1 &&
+           Scanned++ < IRCacheLRU.size()) {
+      unsigned Old = IRCacheLRU.back();
+      if (Old == Index)
+        break;
+      IRCacheLRU.pop_back();
+      if (InCompute[Old].load(std::memory_order_acquire)) {
+        // In use right now; treat as freshly touched and keep looking.
+        IRCacheLRU.push_front(Old);
+        IRCachePos[Old] = IRCacheLRU.begin();
+        continue;
+      }
+      InIRCache[Old] = 0;
+      IRCacheBytes -= Vertices[Old].OhmuIRRaw.size();
+      Vertices[Old].dropOhmuIR();
+    }
+  }
+
+  /// Called by GraphVertex::sendMessage from parallel computation steps.
+  /// Appends the message to the destination's mailbox under that vertex's
+  /// spinlock; contention is per receiver, not global, and messages are
+  /// already in place when the step's barrier is reached.  Messages to
+  /// unknown identities are dropped, as before.
+  void deliverMessage(const string &Destination,
+                      Message<MessageValueType> M) {
+    OHMU_STAT_INC(NumLsaMessagesSent);
+    if (StatsEnabled)
+      SlotMessages[ohmu::ThreadPool::threadIndex() % NThreads].fetch_add(
+          1, std::memory_order_relaxed);
+    auto Element = VertexMap.find(Destination);
+    if (Element == VertexMap.end()) {
+      if (RemoteSink)
+        RemoteSink->deliverRemote(Destination, M.source(), M.value());
+      return;
+    }
+    unsigned index = Element->second;
+
+    while (MailboxLocks[index].test_and_set(std::memory_order_acquire)) {
+    }
+    MessageList &Box = NextInbox[index];
+    bool First = Box.empty();
+    // Fold into the last delivered message if the computation defines a
+    // combiner; mailboxes of combinable messages then hold one entry no
+    // matter the fan-in.
+    if (First || !UserComputations[0]->combineMessages(&Box.back(), M))
+      Box.emplace_back(std::move(M));
+    MailboxLocks[index].clear(std::memory_order_release);
+
+    // Record each touched mailbox once, so delivery processing after the
+    // step does not need to scan every vertex.  The first-push test is
+    // made under the mailbox lock, so exactly one sender records it.
+    if (First)
+      Touched[TouchedCount.fetch_add(1, std::memory_order_relaxed)] = index;
+  }
+
 private:
   /// Returns the vertex with identity 'Id'. If no such vertex exists, one is
   /// created with the default value.
   GraphVertex &getVertex(const string &Id) {
     unsigned index = VertexMap.emplace(Id, Vertices.size()).first->second;
-    if (index == Vertices.size())
+    if (index == Vertices.size()) {
       Vertices.emplace_back(GraphVertex(Id));
+      Vertices[index].VertexIndex = index;
+      Vertices[index].Tool = this; // value() reads the tool's Values.
+      Values.emplace_back();
+    }
     return Vertices[index];
   }
 
+  /// BFS helper for partitionByCallLocality: append Id's vertex to Order
+  /// if it has not been discovered yet.
+  void visitForOrder(const string &Id, std::vector<char> &Visited,
+                     std::vector<unsigned> &Order) {
+    auto Element = VertexMap.find(Id);
+    if (Element == VertexMap.end() || Visited[Element->second])
+      return;
+    Visited[Element->second] = 1;
+    Order.push_back(Element->second);
+  }
+
   /// Returns true if all vertices have halted.
   bool phaseCompleted();
 
@@ -328,26 +692,6 @@ private:
   /// calls.
   void applyGraphChanges();
 
-  /// Returns the messages that were sent to vertex 'Id' in the previous
-  /// computation step.
-  const MessageList &getMessagesTo(const string &Id) const {
-    // Deliberate memory leak to create a method-default return value.
-    static const MessageList NoMessages = *(new MessageList());
-    auto El = Messages.find(Id);
-    if (El == Messages.end()) {
-      return NoMessages;
-    }
-    return El->second;
-  }
-
-  /// Move the outgoing messages cached by each vertex to the right destination.
-  void sendMessages(const string &Destination, MessageList Incoming) {
-    MessageList &DestinationMessages =
-        Messages.emplace(Destination, MessageList()).first->second;
-    std::move(Incoming.begin(), Incoming.end(),
-              std::back_inserter(DestinationMessages));
-  }
-
   /// Remove the call from Source to Destination.
   void removeCall(const string &Source, const string &Destination) {
     auto Element = VertexMap.find(Source);
@@ -369,15 +713,138 @@ private:
   unsigned NThreads;
   std::unordered_map<string, unsigned> VertexMap;
   std::vector<GraphVertex> Vertices;
-  std::unordered_map<string, MessageList> Messages;
+
+  /// Vertex values in a flat array parallel to Vertices (a vertex finds
+  /// its value through its VertexIndex, which survives sortVertices).
+  /// Keeping values out of the vertex records means a computation that
+  /// only reads and writes values touches a dense array.
+  std::vector<VertexValueType> Values;
+
+  /// Double-buffered per-vertex mailboxes, indexed like Vertices.  During
+  /// a step workers deliver into NextInbox under the per-vertex spinlock;
+  /// after the step's barrier the touched mailboxes are swapped into
+  /// Inbox, which the next step reads without synchronization.
+  std::vector<MessageList> Inbox;
+  std::vector<MessageList> NextInbox;
+  std::unique_ptr<std::atomic_flag[]> MailboxLocks;
+  std::vector<unsigned> Touched;    // Mailboxes delivered to this step.
+  std::atomic<size_t> TouchedCount; // Live prefix of Touched.
+
+  /// LRU accounting for decoded IR, by vertex index.  All fields are
+  /// guarded by IRCacheMutex; InCompute marks vertices whose computePhase
+  /// is running, which the evictor must not touch.
+  uint64_t IRCacheBudget = 0; // 0: keep all decoded IR.
+  uint64_t IRCacheBytes = 0;
+  std::mutex IRCacheMutex;
+  std::list<unsigned> IRCacheLRU; // Most recently used at the front.
+  std::vector<std::list<unsigned>::iterator> IRCachePos;
+  std::vector<char> InIRCache;
+  std::unique_ptr<std::atomic<char>[]> InCompute;
+
+  /// Indices of the vertices that must run in the next step: those that
+  /// have not voted to halt, plus those woken by a message.  Steps
+  /// iterate this list instead of scanning the whole graph, so the cost
+  /// of a step is proportional to its live work even when nearly every
+  /// vertex has converged.
+  std::vector<unsigned> ActiveVertices;
+  std::vector<char> ActiveFlag; // Per-vertex membership in ActiveVertices.
+
+  /// Vertices seeded from a previous run's state (see seedVertex); they
+  /// start each phase halted instead of active.  Cleared when the run
+  /// finishes, so a subsequent run is a full one unless reseeded.
+  std::vector<char> CleanVertex;
+
+  std::unique_ptr<ohmu::til::BytecodeFileMap> IRFileMap;
+  std::unique_ptr<CompressedIRStore> IRStore;
+
+  /// Statistics collection (see enableStats).  The per-slot counters are
+  /// bumped with relaxed atomics by the worker threads; everything else
+  /// is filled in by the sequential part of run().
+  struct StepStats {
+    size_t Active;
+    uint64_t Messages;
+    double Seconds;
+  };
+  struct PhaseStats {
+    string Phase;
+    string NextPhase;
+    double Seconds;
+    uint64_t Messages;
+    bool Reiterate;
+    std::vector<StepStats> Steps;
+    std::vector<uint64_t> ThreadVertices;
+  };
+  bool StatsEnabled = false;
+  std::vector<PhaseStats> Stats;
+  PhaseStats CurPhaseStats; // Accumulates the phase being run.
+  std::chrono::steady_clock::time_point PhaseStartTime;
+  std::unique_ptr<std::atomic<uint64_t>[]> SlotMessages;
+  std::unique_ptr<std::atomic<uint64_t>[]> SlotVertices;
+
+  /// Receives messages addressed outside this graph; see setRemoteSink.
+  RemoteMessageSink *RemoteSink = nullptr;
+
+  uint64_t slotTotal(const std::unique_ptr<std::atomic<uint64_t>[]> &Slots) {
+    uint64_t Total = 0;
+    for (unsigned i = 0; i < NThreads; i++)
+      Total += Slots[i].load(std::memory_order_relaxed);
+    return Total;
+  }
+
+  /// Persistent workers shared by every step of every phase; created once
+  /// per run.  A computation makes thousands of small supersteps, so
+  /// spawning and joining threads per step would dominate them.
+  std::unique_ptr<ohmu::ThreadPool> Pool;
 
   /// 'NCores' computations to be run multithreaded, each caching the graph
   /// changes made in a computation step.
   std::vector<std::unique_ptr<GraphComputation>> UserComputations;
+
+private:
+  /// Vertices reach their entry in Values through the tool.
+  friend ohmu::lsa::GraphVertex<UserComputation>;
 };
 
 template <class C>
 void StandaloneGraphTool<C>::run(GraphComputationFactory *Factory) {
+  OHMU_TRACE_SCOPE("lsa-run");
+  beginRun(Factory);
+  while (Phase.compare("HALT") != 0) {
+    beginPhase();
+    while (!phaseCompleted())
+      step();
+    transitionPhase();
+  }
+  finishRun();
+}
+
+template <class C>
+void StandaloneGraphTool<C>::beginRun(GraphComputationFactory *Factory) {
+
+  // The workers persist across all steps and phases of the run; each
+  // runVerticesStep hands them work and barriers on its completion.
+  if (!Pool || Pool->numThreads() != NThreads)
+    Pool.reset(new ohmu::ThreadPool(NThreads));
+
+  // Size the mailboxes; the vertex set is fixed for the whole run.
+  Inbox.assign(Vertices.size(), MessageList());
+  NextInbox.assign(Vertices.size(), MessageList());
+  Touched.assign(Vertices.size(), 0);
+  TouchedCount.store(0, std::memory_order_relaxed);
+  MailboxLocks.reset(new std::atomic_flag[Vertices.size()]);
+  InCompute.reset(new std::atomic<char>[Vertices.size()]);
+  for (unsigned i = 0; i < Vertices.size(); i++) {
+    MailboxLocks[i].clear();
+    InCompute[i].store(0, std::memory_order_relaxed);
+    Vertices[i].Tool = this;
+  }
+
+  // Reset the decoded-IR accounting; IR decoded by a previous run is
+  // simply re-registered when it is next used.
+  IRCacheLRU.clear();
+  IRCachePos.assign(Vertices.size(), IRCacheLRU.end());
+  InIRCache.assign(Vertices.size(), 0);
+  IRCacheBytes = 0;
 
   // Create separate computations for all threads, allowing for caching graph
   // changes per thread.
@@ -388,67 +855,141 @@ void StandaloneGraphTool<C>::run(GraphComputationFactory *Factory) {
     UserComputations.emplace_back(move(Computation));
   }
 
-  while (Phase.compare("HALT") != 0) {
+  if (StatsEnabled) {
+    Stats.clear();
+    SlotMessages.reset(new std::atomic<uint64_t>[NThreads]);
+    SlotVertices.reset(new std::atomic<uint64_t>[NThreads]);
+  }
+}
 
-    // New phase, reset step counter and wake up all vertices.
-    StepCount = 0;
-    for (auto &Vertex : Vertices) {
-      Vertex.HaltVote = false;
-      Vertex.ReiterateVote = false;
-    }
+template <class C> void StandaloneGraphTool<C>::beginPhase() {
+  // New phase, reset step counter and wake up all vertices.  Vertices
+  // seeded from a previous run stay halted on their seeded value; the
+  // dirty frontier wakes them through messages if their inputs really
+  // changed.
+  StepCount = 0;
+  ReiterateResult = false;
+  ActiveVertices.clear();
+  ActiveFlag.assign(Vertices.size(), 0);
+  CleanVertex.resize(Vertices.size(), 0);
+  for (unsigned i = 0; i < Vertices.size(); i++) {
+    Vertices[i].HaltVote = false;
+    Vertices[i].ReiterateVote = false;
+    if (CleanVertex[i])
+      continue;
+    ActiveFlag[i] = 1;
+    ActiveVertices.push_back(i);
+  }
 
-    while (!phaseCompleted()) {
-      runVerticesStep();
-      applyGraphChanges();
-      ++StepCount;
+  if (StatsEnabled) {
+    CurPhaseStats = PhaseStats();
+    CurPhaseStats.Phase = Phase;
+    for (unsigned i = 0; i < NThreads; i++) {
+      SlotMessages[i].store(0, std::memory_order_relaxed);
+      SlotVertices[i].store(0, std::memory_order_relaxed);
     }
+    PhaseStartTime = std::chrono::steady_clock::now();
+  }
+}
 
-    Phase = UserComputations[0]->transition(Phase);
+template <class C> void StandaloneGraphTool<C>::step() {
+  size_t Active = ActiveVertices.size();
+  uint64_t MessagesBefore = 0;
+  std::chrono::steady_clock::time_point StepStart;
+  if (StatsEnabled) {
+    MessagesBefore = slotTotal(SlotMessages);
+    StepStart = std::chrono::steady_clock::now();
   }
+
+  runVerticesStep();
+  applyGraphChanges();
+  ++StepCount;
+
+  if (StatsEnabled) {
+    StepStats SStats;
+    SStats.Active = Active;
+    SStats.Messages = slotTotal(SlotMessages) - MessagesBefore;
+    SStats.Seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - StepStart)
+                         .count();
+    CurPhaseStats.Steps.push_back(SStats);
+  }
+}
+
+template <class C>
+const string &StandaloneGraphTool<C>::transitionPhase() {
+  Phase = UserComputations[0]->transition(Phase);
+
+  if (StatsEnabled) {
+    CurPhaseStats.Seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                      PhaseStartTime)
+            .count();
+    CurPhaseStats.Messages = slotTotal(SlotMessages);
+    CurPhaseStats.Reiterate = ReiterateResult;
+    CurPhaseStats.NextPhase = Phase; // Logs the transition() decision.
+    CurPhaseStats.ThreadVertices.resize(NThreads);
+    for (unsigned i = 0; i < NThreads; i++)
+      CurPhaseStats.ThreadVertices[i] =
+          SlotVertices[i].load(std::memory_order_relaxed);
+    Stats.push_back(std::move(CurPhaseStats));
+  }
+  return Phase;
+}
+
+template <class C> void StandaloneGraphTool<C>::finishRun() {
+  // Seeding is one-shot; the values just computed supersede it.
+  CleanVertex.clear();
 }
 
 template <class C> void StandaloneGraphTool<C>::runVerticesStep() {
+  OHMU_TRACE_SCOPE("lsa-step");
   auto *Self = this;
-  std::vector<std::thread> ThreadPool;
 
-  // Divide the work over 'NCores' threads.
-  for (unsigned i = 0; i < NThreads; i++) {
-    unsigned Start = i;
-    std::thread t([Self, Start]() {
-      unsigned index = Start;
-
-      // Run computation for vertex i, i+NCores, i+2*NCores, etc.
-      while (index < Self->Vertices.size()) {
-        auto &Vertex = Self->Vertices[index];
-        if (!Vertex.HaltVote) {
-          // Each thread uses its own computation 'UserComputations[Start]'.
-          Self->UserComputations[Start]->computePhase(
-              &Vertex, Self->Phase, Self->getMessagesTo(Vertex.id()));
-        }
-
-        index += Self->NThreads;
+  // Vertices are claimed dynamically in chunks off a shared cursor, so a
+  // thread that lands a few huge-CFG vertices simply claims fewer chunks
+  // while the others keep working; static striding left the step as slow
+  // as its unluckiest thread.  Chunks amortize the claim to one atomic
+  // add per ChunkSize vertices.
+  std::atomic<size_t> NextChunk(0);
+
+  // Each of the NThreads slots is claimed by exactly one thread, so slot
+  // i can safely use 'UserComputations[i]'; parallelFor returning is the
+  // barrier between this step and the sequential applyGraphChanges.
+  Pool->parallelFor(NThreads, [Self, &NextChunk](size_t Slot) {
+    const size_t ChunkSize = 16;
+    size_t NActive = Self->ActiveVertices.size();
+    uint64_t Processed = 0;
+
+    for (;;) {
+      size_t Begin =
+          NextChunk.fetch_add(ChunkSize, std::memory_order_relaxed);
+      if (Begin >= NActive)
+        break;
+      size_t End = std::min(Begin + ChunkSize, NActive);
+      Processed += End - Begin;
+
+      for (size_t i = Begin; i < End; ++i) {
+        unsigned index = Self->ActiveVertices[i];
+        // Shield the vertex's decoded IR from eviction while it runs.
+        Self->InCompute[index].store(1, std::memory_order_release);
+        // Each slot uses its own computation 'UserComputations[Slot]'.
+        Self->UserComputations[Slot]->computePhase(
+            &Self->Vertices[index], Self->Phase, Self->Inbox[index]);
+        Self->InCompute[index].store(0, std::memory_order_release);
       }
-    });
-    ThreadPool.push_back(move(t));
-  }
-
-  // Main thread waits for all worker threads to finish.
-  for (std::thread &t : ThreadPool) {
-    t.join();
-  }
+    }
+    if (Self->StatsEnabled)
+      Self->SlotVertices[Slot].fetch_add(Processed,
+                                         std::memory_order_relaxed);
+  });
 }
 
 template <class C> void StandaloneGraphTool<C>::applyGraphChanges() {
-  // Remove messages from previous step.
-  Messages.clear();
-
-  // Send messages as requested. This overhead could be removed by adopting a
-  // thread-safe data structure to queue messages in.
-  for (auto &Vertex : Vertices) {
-    for (const auto &Pair : Vertex.OutMessagesCache)
-      sendMessages(Pair.first, Pair.second);
-    Vertex.OutMessagesCache.clear();
-  }
+  // The messages read this step have been consumed; drop them.  Messages
+  // sent this step are already sitting in their receivers' NextInbox.
+  for (unsigned index : ActiveVertices)
+    Inbox[index].clear();
 
   // Remove requested calls.
   for (auto &Computation : UserComputations) {
@@ -457,24 +998,48 @@ template <class C> void StandaloneGraphTool<C>::applyGraphChanges() {
     Computation->RemoveRequests.clear();
   }
 
-  // Wake up vertices that got new messages.
-  for (auto &Vertex : Vertices)
-    if (!getMessagesTo(Vertex.id()).empty())
-      Vertex.HaltVote = false;
-
   // Collect votes on whether the phasing iteration cycle should terminate.
-  ReiterateResult = false;
-  for (const auto &Vertex : Vertices)
-    if (Vertex.ReiterateVote)
+  // Votes are only ever set within a phase, so accumulating over the
+  // vertices that just ran sees every vote exactly once.
+  for (unsigned index : ActiveVertices)
+    if (Vertices[index].ReiterateVote)
       ReiterateResult = true;
+
+  // Rebuild the worklist for the next step: vertices that did not halt
+  // stay active, and vertices whose mailbox was delivered to are woken,
+  // their NextInbox becoming the Inbox the next step reads.
+  std::vector<unsigned> JustRan;
+  JustRan.swap(ActiveVertices);
+  ActiveFlag.assign(Vertices.size(), 0);
+  for (unsigned index : JustRan) {
+    if (!Vertices[index].HaltVote && !ActiveFlag[index]) {
+      ActiveFlag[index] = 1;
+      ActiveVertices.push_back(index);
+    }
+  }
+  size_t NTouched = TouchedCount.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < NTouched; i++) {
+    unsigned index = Touched[i];
+    Inbox[index].swap(NextInbox[index]);
+    Vertices[index].HaltVote = false;
+    if (!ActiveFlag[index]) {
+      ActiveFlag[index] = 1;
+      ActiveVertices.push_back(index);
+    }
+  }
+  TouchedCount.store(0, std::memory_order_relaxed);
 }
 
 template <class C> bool StandaloneGraphTool<C>::phaseCompleted() {
-  for (const auto &Vertex : Vertices) {
-    if (!Vertex.HaltVote)
-      return false;
-  }
-  return true;
+  return ActiveVertices.empty();
+}
+
+// Defined here because it needs the tool's definition.
+template <class C>
+void GraphVertex<C>::sendMessage(const string &Destination,
+                                 const MessageValueType &MessageValue) {
+  Tool->deliverMessage(Destination,
+                       Message<MessageValueType>(MessageValue, VertexId));
 }
 
 /// Public API for building a graph and running a computation on that graph.
@@ -490,17 +1055,61 @@ public:
 public:
   /// Adds a vertex with the specified identity and value. If the vertex already
   /// exists, that vertex' value is updated instead of creating a new vertex.
-  void addVertex(const string &Id, const string &OhmuIR,
+  /// The raw IR is referenced, not copied.
+  void addVertex(const string &Id, ohmu::StringRef OhmuIR,
                  VertexValueType &Value) {
     Tool.addVertex(Id, OhmuIR, Value);
   }
 
+  /// As above, for block-compressed snapshots; see
+  /// StandaloneGraphTool::addVertex.
+  void addVertex(const string &Id, CompressedIRStore *Store, uint32_t StoreId,
+                 VertexValueType &Value) {
+    Tool.addVertex(Id, Store, StoreId, Value);
+  }
+
+  /// Take ownership of the memory-mapped snapshot that the vertices' raw
+  /// IR references.
+  void adoptFileMap(std::unique_ptr<ohmu::til::BytecodeFileMap> Map) {
+    Tool.adoptFileMap(std::move(Map));
+  }
+
+  /// Take ownership of the compressed-IR store the vertices fetch from.
+  void adoptIRStore(std::unique_ptr<CompressedIRStore> Store) {
+    Tool.adoptIRStore(std::move(Store));
+  }
+
   /// Adds a call from Source to Destination. If a vertex does not exist, it is
   /// created using the default constructor for its value.
   void addCall(const string &Source, const string &Destination) {
     Tool.addCall(Source, Destination);
   }
 
+  /// One-sided edges for sharded loading; see
+  /// StandaloneGraphTool::addOutgoingCall.
+  void addOutgoingCall(const string &Source, const string &Destination) {
+    Tool.addOutgoingCall(Source, Destination);
+  }
+  void addIncomingCall(const string &Destination, const string &Source) {
+    Tool.addIncomingCall(Destination, Source);
+  }
+
+  /// Set a vertex's value directly; see
+  /// StandaloneGraphTool::setVertexValue.
+  void setVertexValue(const string &Id, const VertexValueType &Value) {
+    Tool.setVertexValue(Id, Value);
+  }
+
+  /// Seed a vertex's value from a previous run; see
+  /// StandaloneGraphTool::seedVertex.
+  void seedVertex(const string &Id, const VertexValueType &Value) {
+    Tool.seedVertex(Id, Value);
+  }
+
+  /// Reorder vertex storage by call locality; see
+  /// StandaloneGraphTool::partitionByCallLocality.
+  void partitionByCallLocality() { Tool.partitionByCallLocality(); }
+
   /// Request to order the vertices by id, useful when testing.
   void sortVertices() { Tool.sortVertices(); }
 
@@ -509,11 +1118,24 @@ public:
 
   void setNThreads(unsigned N) { Tool.setNThreads(N); }
 
+  /// Bound the decoded IR kept alive; see StandaloneGraphTool.
+  void setIRCacheBudget(uint64_t Bytes) { Tool.setIRCacheBudget(Bytes); }
+
+  /// Collect run statistics; see StandaloneGraphTool::enableStats.
+  void enableStats() { Tool.enableStats(); }
+
+  /// Dump collected run statistics; see StandaloneGraphTool::printStats.
+  void printStats(std::ostream &Out) const { Tool.printStats(Out); }
+
   /// Run the computation created by the specified factory.
   void run(GraphComputationFactory *Factory) { Tool.run(Factory); }
 
 private:
   ohmu::lsa::StandaloneGraphTool<UserComputation> Tool;
+
+  /// The sharded driver runs the tool's step loop itself, interleaving
+  /// message exchange between shards.
+  friend class ohmu::lsa::ShardedGraphTool<UserComputation>;
 };
 
 } // namespace lsa
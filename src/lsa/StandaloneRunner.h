@@ -16,8 +16,10 @@
 #include "clang/Tooling/CommonOptionsParser.h"
 #include "llvm/Support/CommandLine.h"
 #include "lsa/GraphDeserializer.h"
+#include "lsa/IncrementalState.h"
 #include "lsa/StandaloneGraphComputation.h"
 
+#include <fstream>
 #include <iostream>
 
 namespace ohmu {
@@ -32,6 +34,39 @@ static llvm::cl::opt<std::string>
     InputFile("i", llvm::cl::desc("Specify input file"),
               llvm::cl::value_desc("file"), llvm::cl::Required);
 
+static llvm::cl::opt<unsigned long long> IRCacheBudget(
+    "ir-cache-budget",
+    llvm::cl::desc("Bound decoded IR to this many bytes of bytecode, "
+                   "dropping and re-decoding cold vertices (0: unbounded)"),
+    llvm::cl::value_desc("bytes"), llvm::cl::Optional);
+
+static llvm::cl::opt<std::string> StatsFile(
+    "stats",
+    llvm::cl::desc("Write a per-phase/per-step report of wall time, "
+                   "active vertices, message volume and per-thread work "
+                   "to this file ('-' for stderr)"),
+    llvm::cl::value_desc("file"), llvm::cl::Optional);
+
+static llvm::cl::opt<bool> PartitionLocality(
+    "partition-locality",
+    llvm::cl::desc("Reorder vertex storage by call locality before the "
+                   "run, keeping connected neighborhoods on the same "
+                   "worker"),
+    llvm::cl::Optional);
+
+static llvm::cl::opt<std::string> SeedStateFile(
+    "seed-state",
+    llvm::cl::desc("Seed vertex values from this state file of a previous "
+                   "run, recomputing only the vertices affected by graph "
+                   "changes"),
+    llvm::cl::value_desc("file"), llvm::cl::Optional);
+
+static llvm::cl::opt<std::string> SaveStateFile(
+    "save-state",
+    llvm::cl::desc("Write the final vertex values to this file, for "
+                   "seeding a later run"),
+    llvm::cl::value_desc("file"), llvm::cl::Optional);
+
 template <class UserComputation> class StandaloneRunner {
 public:
   StandaloneRunner(int argc, const char *argv[]) {
@@ -41,13 +76,49 @@ public:
   void readCallGraph() {
     GraphDeserializer<UserComputation>::read(InputFile.getValue(),
                                              &ComputationGraphBuilder);
+    if (!SeedStateFile.getValue().empty())
+      IncrementalState<UserComputation>::seed(SeedStateFile.getValue(),
+                                              &ComputationGraphBuilder);
   }
 
   void runComputation() {
     if (NThreads.getNumOccurrences() > 0)
       ComputationGraphBuilder.setNThreads(NThreads.getValue());
+    if (IRCacheBudget.getNumOccurrences() > 0)
+      ComputationGraphBuilder.setIRCacheBudget(IRCacheBudget.getValue());
+    if (PartitionLocality)
+      ComputationGraphBuilder.partitionByCallLocality();
+    if (!StatsFile.getValue().empty())
+      ComputationGraphBuilder.enableStats();
 
     ComputationGraphBuilder.run(&Factory);
+
+    if (!StatsFile.getValue().empty()) {
+      if (StatsFile.getValue() == "-") {
+        ComputationGraphBuilder.printStats(std::cerr);
+      } else {
+        std::ofstream Out(StatsFile.getValue());
+        ComputationGraphBuilder.printStats(Out);
+      }
+    }
+
+    if (!SaveStateFile.getValue().empty())
+      IncrementalState<UserComputation>::write(SaveStateFile.getValue(),
+                                               &ComputationGraphBuilder);
+  }
+
+  /// The graph being analyzed; library phases (see SCCEngine.h) run on
+  /// it directly, between readCallGraph and runComputation.
+  ohmu::lsa::StandaloneGraphBuilder<UserComputation> &graphBuilder() {
+    return ComputationGraphBuilder;
+  }
+
+  /// The number of threads requested on the command line, or 0 when
+  /// unspecified (one per core).
+  unsigned numThreads() const {
+    return NThreads.getNumOccurrences() > 0
+               ? static_cast<unsigned>(NThreads.getValue())
+               : 0;
   }
 
   void printComputationResult(bool Alphabetic = false) {
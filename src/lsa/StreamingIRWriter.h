@@ -0,0 +1,62 @@
+//===- StreamingIRWriter.h -------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+// Streams translated function bodies to a spill file as export workers
+// finish them, instead of retaining every IR string in the call graph
+// until serialization.  Resident memory during export is then bounded by
+// one function per worker (each worker's arena dies with its function),
+// not by the size of the translation unit.
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_LSA_STREAMINGIRWRITER_H
+#define OHMU_LSA_STREAMINGIRWRITER_H
+
+#include "clang/Analysis/Til/Bytecode.h"
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ohmu {
+namespace lsa {
+
+class StreamingIRWriter {
+public:
+  explicit StreamingIRWriter(const std::string &FileName)
+      : FileName(FileName),
+        WriteStream(new ohmu::til::BytecodeFileWriter(FileName)),
+        NumChunks(0) {}
+
+  /// Append the bytecode chunk emitted for Func.  Thread-safe; workers
+  /// call this as soon as a function is translated and serialized.
+  void Append(const std::string &Func, const std::string &IR) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    WriteStream->writeString(StringRef(Func));
+    WriteStream->writeString(StringRef(IR));
+    ++NumChunks;
+  }
+
+  /// Close the spill file.  The writer's destructor drains its background
+  /// thread and syncs to disk, so once this returns the spill can be
+  /// memory-mapped.  Call after all workers have finished.
+  void Finish() { WriteStream.reset(); }
+
+  const std::string &GetFileName() const { return FileName; }
+  uint32_t GetNumChunks() const { return NumChunks; }
+
+private:
+  std::string FileName;
+  std::unique_ptr<ohmu::til::BytecodeFileWriter> WriteStream;
+  uint32_t NumChunks;
+  std::mutex Mutex; // Serializes appends from translation workers.
+};
+
+} // namespace lsa
+} // namespace ohmu
+
+#endif // OHMU_LSA_STREAMINGIRWRITER_H
@@ -0,0 +1,132 @@
+//===- TranslationCache.h --------------------------------------*- C++ --*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License.  See LICENSE.TXT in the LLVM repository for details.
+//
+//===----------------------------------------------------------------------===//
+// Persistent per-function translation cache for incremental call graph
+// export.  Between two export runs only a small fraction of functions
+// typically change; the cache maps each function to a hash of its source
+// text together with the bytecode and call edges emitted when it was last
+// translated, so unchanged functions are copied byte-for-byte from the
+// prior run instead of re-walked and re-serialized.
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_LSA_TRANSLATIONCACHE_H
+#define OHMU_LSA_TRANSLATIONCACHE_H
+
+#include "clang/Analysis/Til/Bytecode.h"
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace ohmu {
+namespace lsa {
+
+class TranslationCache {
+public:
+  /// The results of translating one function, keyed by a hash of the
+  /// source text it was translated from.
+  struct Entry {
+    uint64_t SourceHash;
+    std::string OhmuIR;
+    std::vector<std::string> Calls;
+    bool Live; // Looked up or stored this run; stale entries are dropped
+               // by write().
+  };
+
+  /// 64-bit FNV-1a hash of the function's source text.
+  /// (See StringInterner for the 32-bit version used for interning.)
+  static uint64_t hashSource(StringRef S) {
+    uint64_t H = 0xCBF29CE484222325ULL;
+    for (int64_t i = 0, N = S.length(); i < N; ++i) {
+      H = H ^ static_cast<uint8_t>(S[i]);
+      H = H * 0x100000001B3ULL;
+    }
+    return H;
+  }
+
+  /// Returns the entry cached for Func if its source hash matches, or
+  /// null if the function is new or has changed.  Thread-safe; a returned
+  /// entry is not modified for the remainder of the run.
+  const Entry *lookup(const std::string &Func, uint64_t Hash) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    auto It = Entries.find(Func);
+    if (It == Entries.end() || It->second.SourceHash != Hash)
+      return nullptr;
+    It->second.Live = true;
+    return &It->second;
+  }
+
+  /// Records the results of translating Func.  Thread-safe.
+  void update(const std::string &Func, uint64_t Hash, const std::string &IR,
+              std::vector<std::string> &&Calls) {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    Entry &E = Entries[Func];
+    E.SourceHash = Hash;
+    E.OhmuIR = IR;
+    E.Calls = std::move(Calls);
+    E.Live = true;
+  }
+
+  /// Load the cache written by a previous run.  Returns false if the file
+  /// cannot be mapped (e.g. the first run); the cache is then empty.
+  bool read(const std::string &FileName) {
+    ohmu::til::BytecodeFileMap Map(FileName);
+    if (!Map.valid())
+      return false;
+    ohmu::til::MappedMemoryReader ReadStream(Map);
+
+    int32_t NFunc = ReadStream.readInt32();
+    for (int32_t i = 0; i < NFunc; i++) {
+      std::string Func = ReadStream.readString().str();
+      Entry &E = Entries[Func];
+      E.SourceHash = static_cast<uint64_t>(ReadStream.readInt64());
+      E.OhmuIR = ReadStream.readString().str();
+      E.Live = false;
+      int32_t NCalls = ReadStream.readInt32();
+      for (int32_t n = 0; n < NCalls; n++)
+        E.Calls.push_back(ReadStream.readString().str());
+    }
+    return true;
+  }
+
+  /// Write the cache for the next run.  Entries that were neither looked
+  /// up nor stored this run belong to deleted functions and are dropped.
+  void write(const std::string &FileName) {
+    ohmu::til::BytecodeFileWriter WriteStream(FileName);
+
+    int32_t NFunc = 0;
+    for (const auto &Pair : Entries)
+      if (Pair.second.Live)
+        ++NFunc;
+
+    WriteStream.writeInt32(NFunc);
+    for (const auto &Pair : Entries) {
+      const Entry &E = Pair.second;
+      if (!E.Live)
+        continue;
+      WriteStream.writeString(Pair.first);
+      WriteStream.writeInt64(static_cast<int64_t>(E.SourceHash));
+      WriteStream.writeString(E.OhmuIR);
+      WriteStream.writeInt32(E.Calls.size());
+      for (const std::string &Call : E.Calls)
+        WriteStream.writeString(Call);
+    }
+
+    WriteStream.flush();
+  }
+
+private:
+  std::mutex Mutex; // Serializes access from translation workers.
+  std::unordered_map<std::string, Entry> Entries;
+};
+
+} // namespace lsa
+} // namespace ohmu
+
+#endif // OHMU_LSA_TRANSLATIONCACHE_H
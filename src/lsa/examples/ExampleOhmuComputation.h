@@ -130,4 +130,20 @@ private:
 } // namespace ohmu
 } // namespace lsa
 
+/// Serialization for Google's Pregel framework and for incremental
+/// recomputation (see lsa/IncrementalState.h).
+template <> class StringCoderCustom<bool> {
+public:
+  static void Encode(const bool &value, string *result) {
+    result->assign(1, value ? '1' : '0');
+  }
+
+  static bool Decode(const string &str, bool *result) {
+    if (str.size() != 1)
+      return false;
+    *result = (str[0] == '1');
+    return true;
+  }
+};
+
 #endif // OHMU_LSA_EXAMPLES_EXAMPLEOHMUOMPUTATION_H
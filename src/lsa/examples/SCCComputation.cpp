@@ -64,6 +64,20 @@ void SCCComputation::computePhase(GraphVertex *Vertex, const string &Phase,
   Vertex->voteToHalt();
 }
 
+bool SCCComputation::combineMessages(Message *Acc, const Message &In) {
+  // The decompose phase matches messages against their source to find
+  // edges leaving the partition; those must arrive individually.
+  if (phase() == kPhaseDecompose)
+    return false;
+
+  // Forward and backward phases take the minimum over the incoming ids,
+  // with kInfinity ranking above every real id; keep only the minimum.
+  if (Acc->value() == kInfinity ||
+      (In.value() != kInfinity && In.value().compare(Acc->value()) < 0))
+    *Acc->mutableValue() = In.value();
+  return true;
+}
+
 /// First set the current ForwardMin to this vertex' id and forward it on all
 /// outgoing calls. While the incoming messages contain an id lower than
 /// ForwardMin, update it and forward the new lowest value.
@@ -59,6 +59,10 @@ public:
 
   string transition(const string &Phase) override;
 
+  /// The forward and backward phases only propagate the minimum id, so
+  /// messages to one vertex are folded to their minimum on delivery.
+  bool combineMessages(Message *Acc, const Message &In) override;
+
   string output(const GraphVertex *Vertex) const override {
     return partitionID(Vertex);
   }
@@ -96,9 +96,9 @@ ParseResult BNFParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
       return nullptr;
     return prs[i].getToken();
   };
-  auto tokList = [=](unsigned i) -> std::vector< Token* >* {
+  auto tokList = [=](unsigned i) -> MutArrayRef<Token*> {
     if (!prs[i].isTokenList() || i >= arity)
-      return nullptr;
+      return MutArrayRef<Token*>();
     return prs[i].getTokenList();
   };
   auto pr = [=](unsigned i) -> ParseRule* {
@@ -111,9 +111,9 @@ ParseResult BNFParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
       return nullptr;
     return prs[i].getNode<ast::ASTNode>(BPR_ASTNode);
   };
-  auto astList = [=](unsigned i) -> std::vector< ast::ASTNode* >* {
+  auto astList = [=](unsigned i) -> MutArrayRef<ast::ASTNode*> {
     if (!prs[i].isList(BPR_ASTNode) || i >= arity)
-      return nullptr;
+      return MutArrayRef<ast::ASTNode*>();
     return prs[i].getList<ast::ASTNode>(BPR_ASTNode);
   };
 
@@ -165,13 +165,9 @@ ParseResult BNFParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
       auto r = new ParseReference(t->cppString());
       delete t;
       // get argument list
-      auto *v = tokList(1);
-      if (v) {
-        for (Token *at : *v) {
-          r->addArgument(at->cppString());
-          delete at;
-        }
-        delete v;
+      for (Token *at : tokList(1)) {
+        r->addArgument(at->cppString());
+        delete at;
       }
       return ParseResult(BPR_ParseRule, r);
     }
@@ -185,13 +181,9 @@ ParseResult BNFParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
       auto r = new ParseNamedDefinition(t->cppString(), pr(2));
       delete t;
       // get argument list
-      auto *v = tokList(1);
-      if (v) {
-        for (Token *at : *v) {
-          r->addArgument(at->cppString());
-          delete at;
-        }
-        delete v;
+      for (Token *at : tokList(1)) {
+        r->addArgument(at->cppString());
+        delete at;
       }
 
       // Add definition to target parser now.  No need to return it.
@@ -223,36 +215,31 @@ ParseResult BNFParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
     case BNF_Construct: {
       assert(arity == 2);
       Token *t = tok(0);
-      auto v = astList(1);
+      MutArrayRef<ast::ASTNode*> v = astList(1);
       ast::Construct* c = nullptr;
 
-      if (!v) {
-        c = new ast::ConstructN<0>(t->cppString());
-      }
-      else {
-        switch (v->size()) {
-          case 1:
-            c = new ast::ConstructN<1>(t->cppString(), (*v)[0]);
-            break;
-          case 2:
-            c = new ast::ConstructN<2>(t->cppString(), (*v)[0], (*v)[1]);
-            break;
-          case 3:
-            c = new ast::ConstructN<3>(t->cppString(), (*v)[0], (*v)[1],
-                                       (*v)[2]);
-            break;
-          case 4:
-            c = new ast::ConstructN<4>(t->cppString(), (*v)[0], (*v)[1],
-                                       (*v)[2], (*v)[3]);
-            break;
-          case 5:
-            c = new ast::ConstructN<5>(t->cppString(), (*v)[0], (*v)[1],
-                                       (*v)[2], (*v)[3], (*v)[4]);
-            break;
-        }
+      switch (v.size()) {
+        case 0:
+          c = new ast::ConstructN<0>(t->cppString());
+          break;
+        case 1:
+          c = new ast::ConstructN<1>(t->cppString(), v[0]);
+          break;
+        case 2:
+          c = new ast::ConstructN<2>(t->cppString(), v[0], v[1]);
+          break;
+        case 3:
+          c = new ast::ConstructN<3>(t->cppString(), v[0], v[1], v[2]);
+          break;
+        case 4:
+          c = new ast::ConstructN<4>(t->cppString(), v[0], v[1], v[2], v[3]);
+          break;
+        case 5:
+          c = new ast::ConstructN<5>(t->cppString(), v[0], v[1], v[2], v[3],
+                                     v[4]);
+          break;
       }
       delete t;
-      delete v;
       return ParseResult(BPR_ASTNode, c);
     }
     case BNF_EmptyList: {
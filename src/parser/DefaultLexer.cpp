@@ -73,6 +73,95 @@ unsigned DefaultLexer::registerKeyword(const std::string& s) {
 }
 
 
+namespace {
+
+// Character class bits for table-driven scanning.  The hot loops
+// (whitespace, identifier bodies, comments, string literals) classify
+// characters with one table load apiece and consume long runs straight
+// out of the input buffer; the scalar paths handle run boundaries.
+const unsigned char CC_WhiteSpace = 0x01;
+const unsigned char CC_Digit      = 0x02;
+const unsigned char CC_Letter     = 0x04;
+const unsigned char CC_Operator   = 0x08;
+const unsigned char CC_HexDigit   = 0x10;
+const unsigned char CC_StringChar = 0x20;  // ordinary string literal chars
+const unsigned char CC_NotEOL     = 0x40;  // anything but newline or NUL
+
+struct CharClassTable {
+  unsigned char cls[256];
+
+  CharClassTable() {
+    memset(cls, 0, sizeof(cls));
+    cls[static_cast<unsigned>(' ')]  |= CC_WhiteSpace;
+    cls[static_cast<unsigned>('\t')] |= CC_WhiteSpace;
+    for (unsigned c = '0'; c <= '9'; ++c) cls[c] |= CC_Digit | CC_HexDigit;
+    for (unsigned c = 'a'; c <= 'z'; ++c) cls[c] |= CC_Letter;
+    for (unsigned c = 'A'; c <= 'Z'; ++c) cls[c] |= CC_Letter;
+    for (unsigned c = 'a'; c <= 'f'; ++c) cls[c] |= CC_HexDigit;
+    for (unsigned c = 'A'; c <= 'F'; ++c) cls[c] |= CC_HexDigit;
+    cls[static_cast<unsigned>('_')] |= CC_Letter;
+
+    const char* ops = "~!@#$%^&*-+=|<>?/:\\";
+    for (const char* p = ops; *p; ++p)
+      cls[static_cast<unsigned char>(*p)] |= CC_Operator;
+
+    for (unsigned c = 1; c < 256; ++c) {
+      if (c != '\n' && c != '\r')
+        cls[c] |= CC_NotEOL;
+      if (c != '\n' && c != '\r' && c != '\t' && c != '"' && c != '\\')
+        cls[c] |= CC_StringChar;
+    }
+  }
+};
+
+const CharClassTable ccTable;
+
+inline unsigned char charClass(char c) {
+  return ccTable.cls[static_cast<unsigned char>(c)];
+}
+
+}  // end anonymous namespace
+
+
+char DefaultLexer::scanRun(unsigned char mask) {
+  for (;;) {
+    const char* p = bufferData();
+    unsigned    n = bufferAvail();
+    unsigned    i = 0;
+    while (i < n && (charClass(p[i]) & mask))
+      ++i;
+    if (i > 0) {
+      putChars(p, i);
+      skipChars(i);
+    }
+    if (i < n)
+      return p[i];
+    // Buffer boundary: refill and recheck one character.
+    char c = lookChar();
+    if (c == 0 || (charClass(c) & mask) == 0)
+      return c;
+  }
+}
+
+
+char DefaultLexer::skipRun(unsigned char mask) {
+  for (;;) {
+    const char* p = bufferData();
+    unsigned    n = bufferAvail();
+    unsigned    i = 0;
+    while (i < n && (charClass(p[i]) & mask))
+      ++i;
+    if (i > 0)
+      skipChars(i);
+    if (i < n)
+      return p[i];
+    char c = lookChar();
+    if (c == 0 || (charClass(c) & mask) == 0)
+      return c;
+  }
+}
+
+
 inline bool isDigit(char c) {
 
   return (c >= '0' && c <= '9');
@@ -138,45 +227,28 @@ void DefaultLexer::readNewline(char c) {
 
 
 void DefaultLexer::readIdentifier(char startChar) {
-  char c = startChar;
-  putChar(c);
+  putChar(startChar);
   skipChar();
-  c = lookChar();
-  while (isLetter(c) | isDigit(c)) {
-    putChar(c);
-    skipChar();
-    c = lookChar();
-  };
+  scanRun(CC_Letter | CC_Digit);
 }
 
 
 void DefaultLexer::readInteger(char startChar) {
-  char c = startChar;
-  do {
-    putChar(c);
-    skipChar();
-    c = lookChar();
-  } while (isDigit(c));
+  putChar(startChar);
+  skipChar();
+  scanRun(CC_Digit);
 }
 
 
 void DefaultLexer::readHexInteger() {
-  char c = lookChar();
-  while (isDigit(c) || isHexDigit(c)) {
-    putChar(c);
-    skipChar();
-    c = lookChar();
-  }
+  scanRun(CC_HexDigit);
 }
 
 
 void DefaultLexer::readOperator(char startChar) {
-  char c = startChar;
-  do {
-    putChar(c);
-    skipChar();
-    c = lookChar();
-  } while (isOperatorChar(c));
+  putChar(startChar);
+  skipChar();
+  scanRun(CC_Operator);
 }
 
 
@@ -184,11 +256,7 @@ void DefaultLexer::readLineComment() {
   skipChar();  // skip '/'
   skipChar();  // skip '/'
 
-  char c = lookChar();
-  while (c && !isNewline(c)) {
-    skipChar();
-    c = lookChar();
-  }
+  char c = skipRun(CC_NotEOL);
   if (isNewline(c)) readNewline(c);
 }
 
@@ -234,11 +302,11 @@ bool DefaultLexer::readEscapeCharacter(char c) {
 
 bool DefaultLexer::readString() {
   skipChar();  // skip leading '"'
-  char c = lookChar();
+  char c = scanRun(CC_StringChar);
   while (c != '\"') {
     if (!readEscapeCharacter(c))
       return false;
-    c = lookChar();
+    c = scanRun(CC_StringChar);
   }
   skipChar();  // skip trailing '"'
   return true;
@@ -284,10 +352,8 @@ Token DefaultLexer::readToken() {
 
   while (true) {
     // skip whitespace
-    while (isWhiteSpace(c)) {
-      skipChar();
-      c = lookChar();
-    }
+    if (isWhiteSpace(c))
+      c = skipRun(CC_WhiteSpace);
 
     // newlines
     if (isNewline(c)) {
@@ -363,7 +429,7 @@ Token DefaultLexer::readToken() {
     StringRef str = copyStr(finishToken());
 
     unsigned short keyid =
-      static_cast<unsigned short>( lookupKeyword(str.c_str()) );
+      static_cast<unsigned short>( lookupKeyword(str.data(), static_cast<unsigned>(str.size())) );
     if (keyid) {
       return Token(keyid, str, sloc);
     }
@@ -376,7 +442,7 @@ Token DefaultLexer::readToken() {
     StringRef str = copyStr(finishToken());
 
     unsigned short keyid =
-      static_cast<unsigned short>( lookupKeyword(str.c_str()) );
+      static_cast<unsigned short>( lookupKeyword(str.data(), static_cast<unsigned>(str.size())) );
     if (keyid) {
       return Token(keyid, str, sloc);
     }
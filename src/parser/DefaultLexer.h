@@ -91,6 +91,10 @@ public:
   bool readFloatExp(char startChar);
 
   StringRef copyStr(StringRef s) {
+    // Compact pre-lexing references token strings in the source buffer,
+    // or copies them to the side table, so no arena copy is needed.
+    if (compactPreLexing())
+      return s;
     char* mem = static_cast<char*>(stringArena_.allocate(s.size()+1));
     return copyStringRef(mem, s);
   }
@@ -103,6 +107,15 @@ public:
   inline bool isInteractive() const { return interactive_; }
   inline void setInteractive(bool b) { interactive_ = b; }
 
+private:
+  // Scan a run of characters in the classes given by mask (see
+  // DefaultLexer.cpp), copying them into the token buffer.  Returns the
+  // first character past the run.
+  char scanRun(unsigned char mask);
+
+  // As scanRun, but discards the characters instead of copying them.
+  char skipRun(unsigned char mask);
+
 private:
   MemRegion    stringRegion_;   // Region to allocate all token strings
   MemRegionRef stringArena_;
@@ -0,0 +1,340 @@
+//===- GrammarFile.cpp -----------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+
+#include "parser/GrammarFile.h"
+
+namespace ohmu {
+namespace parsing {
+
+namespace {
+
+// Writes the rule graph as a byte stream: each rule is a one-byte kind tag
+// followed by its operands.  Strings are a 32-bit length plus the bytes.
+class GrammarFileWriter {
+public:
+  GrammarFileWriter(Parser& parser, FILE* file)
+      : parser_(parser), file_(file), success_(true)
+  { }
+
+  bool write() {
+    writeUInt32(GrammarFile::FileMagic);
+    writeUInt32(GrammarFile::FileVersion);
+
+    const std::vector<ParseNamedDefinition*>& defs = parser_.definitions();
+    writeUInt32(defs.size());
+    for (ParseNamedDefinition* d : defs) {
+      writeString(d->name());
+      writeUInt32(d->argNames().size());
+      for (const std::string& a : d->argNames())
+        writeString(a);
+      writeRule(d->definition());
+    }
+    return success_;
+  }
+
+private:
+  void writeUInt8(unsigned char c) {
+    if (fwrite(&c, 1, 1, file_) != 1)
+      success_ = false;
+  }
+
+  void writeUInt32(unsigned v) {
+    unsigned char buf[4] = {
+      static_cast<unsigned char>(v),
+      static_cast<unsigned char>(v >> 8),
+      static_cast<unsigned char>(v >> 16),
+      static_cast<unsigned char>(v >> 24)
+    };
+    if (fwrite(buf, 1, 4, file_) != 4)
+      success_ = false;
+  }
+
+  void writeString(const std::string& s) {
+    writeUInt32(s.length());
+    if (s.length() > 0 && fwrite(s.data(), 1, s.length(), file_) != s.length())
+      success_ = false;
+  }
+
+  void writeRule(ParseRule* r) {
+    if (!r) {
+      success_ = false;
+      return;
+    }
+    writeUInt8(static_cast<unsigned char>(r->kind()));
+    switch (r->kind()) {
+    case PR_None:
+      break;
+    case PR_Token: {
+      // Token ids depend on the lexer, so store the name.
+      ParseToken* t = static_cast<ParseToken*>(r);
+      writeString(parser_.getTokenIDString(t->tokenID()));
+      writeUInt8(t->skipped() ? 1 : 0);
+      break;
+    }
+    case PR_Keyword:
+      writeString(cast<ParseKeyword>(r)->keywordStr());
+      break;
+    case PR_Sequence: {
+      ParseSequence* s = cast<ParseSequence>(r);
+      writeString(s->letName());
+      writeRule(s->first());
+      writeRule(s->second());
+      break;
+    }
+    case PR_Option: {
+      ParseOption* o = cast<ParseOption>(r);
+      writeRule(o->left());
+      writeRule(o->right());
+      break;
+    }
+    case PR_RecurseLeft: {
+      ParseRecurseLeft* rl = cast<ParseRecurseLeft>(r);
+      writeString(rl->letName());
+      writeRule(rl->base());
+      writeRule(rl->rest());
+      break;
+    }
+    case PR_Reference: {
+      ParseReference* ref = cast<ParseReference>(r);
+      writeString(ref->name());
+      writeUInt32(ref->argNames().size());
+      for (const std::string& a : ref->argNames())
+        writeString(a);
+      break;
+    }
+    case PR_Action:
+      writeASTNode(cast<ParseAction>(r)->node());
+      break;
+    default:
+      success_ = false;
+      break;
+    }
+  }
+
+  void writeASTNode(ast::ASTNode* n) {
+    if (!n) {
+      writeUInt8(ast::ASTNode::AST_None);
+      return;
+    }
+    writeUInt8(static_cast<unsigned char>(n->opcode()));
+    switch (n->opcode()) {
+    case ast::ASTNode::AST_None:
+      break;
+    case ast::ASTNode::AST_Variable:
+      writeString(cast<ast::Variable>(n)->name());
+      break;
+    case ast::ASTNode::AST_TokenStr:
+      writeString(cast<ast::TokenStr>(n)->string());
+      break;
+    case ast::ASTNode::AST_Construct: {
+      ast::Construct* c = cast<ast::Construct>(n);
+      writeString(c->opcodeName());
+      writeUInt8(c->arity());
+      for (unsigned i = 0, m = c->arity(); i < m; ++i)
+        writeASTNode(c->subExpr(i));
+      break;
+    }
+    case ast::ASTNode::AST_EmptyList:
+      break;
+    case ast::ASTNode::AST_Append: {
+      ast::Append* a = cast<ast::Append>(n);
+      writeASTNode(a->list());
+      writeASTNode(a->item());
+      break;
+    }
+    }
+  }
+
+  Parser& parser_;
+  FILE*   file_;
+  bool    success_;
+};
+
+
+// Reconstructs the rule graph written by GrammarFileWriter.
+class GrammarFileReader {
+public:
+  GrammarFileReader(Parser& parser, FILE* file)
+      : parser_(parser), file_(file), success_(true)
+  { }
+
+  bool read() {
+    if (readUInt32() != GrammarFile::FileMagic ||
+        readUInt32() != GrammarFile::FileVersion)
+      return false;
+
+    unsigned ndefs = readUInt32();
+    for (unsigned i = 0; i < ndefs && success_; ++i) {
+      std::string name = readString();
+      ParseNamedDefinition* d = new ParseNamedDefinition(std::move(name));
+      unsigned nargs = readUInt32();
+      for (unsigned j = 0; j < nargs; ++j)
+        d->addArgument(readString());
+      d->setDefinition(readRule());
+      parser_.addDefinition(d);
+    }
+    return success_;
+  }
+
+private:
+  unsigned char readUInt8() {
+    unsigned char c = 0;
+    if (fread(&c, 1, 1, file_) != 1)
+      success_ = false;
+    return c;
+  }
+
+  unsigned readUInt32() {
+    unsigned char buf[4] = { 0, 0, 0, 0 };
+    if (fread(buf, 1, 4, file_) != 4)
+      success_ = false;
+    return static_cast<unsigned>(buf[0]) |
+           (static_cast<unsigned>(buf[1]) << 8) |
+           (static_cast<unsigned>(buf[2]) << 16) |
+           (static_cast<unsigned>(buf[3]) << 24);
+  }
+
+  std::string readString() {
+    unsigned len = readUInt32();
+    if (!success_ || len > maxStringLength_) {
+      success_ = false;
+      return std::string();
+    }
+    std::string s(len, 0);
+    if (len > 0 && fread(&s[0], 1, len, file_) != len)
+      success_ = false;
+    return s;
+  }
+
+  ParseRule* readRule() {
+    if (!success_)
+      return nullptr;
+    unsigned char kind = readUInt8();
+    switch (kind) {
+    case PR_None:
+      return new ParseNone();
+    case PR_Token: {
+      unsigned tid = parser_.lookupTokenID(readString());
+      bool skip = (readUInt8() != 0);
+      return new ParseToken(tid, skip);
+    }
+    case PR_Keyword:
+      return new ParseKeyword(readString());
+    case PR_Sequence: {
+      std::string letName = readString();
+      ParseRule* first  = readRule();
+      ParseRule* second = readRule();
+      return new ParseSequence(std::move(letName), first, second);
+    }
+    case PR_Option: {
+      ParseRule* left  = readRule();
+      ParseRule* right = readRule();
+      return new ParseOption(left, right);
+    }
+    case PR_RecurseLeft: {
+      std::string letName = readString();
+      ParseRule* base = readRule();
+      ParseRule* rest = readRule();
+      return new ParseRecurseLeft(std::move(letName), base, rest);
+    }
+    case PR_Reference: {
+      ParseReference* ref = new ParseReference(readString());
+      unsigned nargs = readUInt32();
+      for (unsigned i = 0; i < nargs && success_; ++i)
+        ref->addArgument(readString());
+      return ref;
+    }
+    case PR_Action:
+      return new ParseAction(readASTNode());
+    default:
+      success_ = false;
+      return nullptr;
+    }
+  }
+
+  ast::ASTNode* readASTNode() {
+    if (!success_)
+      return nullptr;
+    unsigned char op = readUInt8();
+    switch (op) {
+    case ast::ASTNode::AST_None:
+      return nullptr;
+    case ast::ASTNode::AST_Variable:
+      return new ast::Variable(readString());
+    case ast::ASTNode::AST_TokenStr:
+      return new ast::TokenStr(readString());
+    case ast::ASTNode::AST_Construct: {
+      std::string opName = readString();
+      unsigned arity = readUInt8();
+      ast::ASTNode* e[ast::Construct::Max_Arity] =
+        { nullptr, nullptr, nullptr, nullptr, nullptr };
+      if (arity > ast::Construct::Max_Arity) {
+        success_ = false;
+        return nullptr;
+      }
+      for (unsigned i = 0; i < arity; ++i)
+        e[i] = readASTNode();
+      switch (arity) {
+      case 0: return new ast::ConstructN<0>(opName);
+      case 1: return new ast::ConstructN<1>(opName, e[0]);
+      case 2: return new ast::ConstructN<2>(opName, e[0], e[1]);
+      case 3: return new ast::ConstructN<3>(opName, e[0], e[1], e[2]);
+      case 4: return new ast::ConstructN<4>(opName, e[0], e[1], e[2], e[3]);
+      case 5: return new ast::ConstructN<5>(opName, e[0], e[1], e[2], e[3],
+                                            e[4]);
+      }
+      return nullptr;
+    }
+    case ast::ASTNode::AST_EmptyList:
+      return new ast::EmptyList();
+    case ast::ASTNode::AST_Append: {
+      ast::ASTNode* l = readASTNode();
+      ast::ASTNode* i = readASTNode();
+      return new ast::Append(l, i);
+    }
+    default:
+      success_ = false;
+      return nullptr;
+    }
+  }
+
+  static const unsigned maxStringLength_ = 0x10000;
+
+  Parser& parser_;
+  FILE*   file_;
+  bool    success_;
+};
+
+}  // end anonymous namespace
+
+
+bool GrammarFile::writeParserFile(Parser &parser, FILE *file) {
+  GrammarFileWriter writer(parser, file);
+  return writer.write();
+}
+
+
+bool GrammarFile::initParserFromFile(Parser &parser, FILE *file) {
+  GrammarFileReader reader(parser, file);
+  if (!reader.read())
+    return false;
+  return parser.init();
+}
+
+
+}  // end namespace parsing
+}  // end namespace ohmu
@@ -0,0 +1,58 @@
+//===- GrammarFile.h -------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// GrammarFile reads and writes precompiled grammars.  A precompiled grammar
+// is the ParseNamedDefinition rule graph of a parser, serialized to a compact
+// binary file.  Loading one restores the definitions and initializes the
+// parser directly, so startup skips running BNFParser over the grammar text.
+//
+// Token ids and keyword ids are not stored; tokens are serialized by name
+// and re-resolved against the lexer when the file is loaded.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_GRAMMAR_FILE_H
+#define OHMU_GRAMMAR_FILE_H
+
+#include "parser/Parser.h"
+
+#include <stdio.h>
+
+namespace ohmu {
+namespace parsing {
+
+
+class GrammarFile {
+public:
+  static const unsigned FileMagic   = 0x4D52474F;  // "OGRM"
+  static const unsigned FileVersion = 1;
+
+  // Serialize the named definitions of parser to file.
+  // The parser need not be initialized.  Returns true on success.
+  static bool writeParserFile(Parser &parser, FILE *file);
+
+  // Restore the definitions stored in file, add them to parser, and
+  // initialize it.  Returns false if the file is not a valid grammar file,
+  // or if the restored grammar fails to validate.
+  static bool initParserFromFile(Parser &parser, FILE *file);
+};
+
+
+}  // end namespace parsing
+}  // end namespace ohmu
+
+#endif  // OHMU_GRAMMAR_FILE_H
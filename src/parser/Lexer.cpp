@@ -21,8 +21,14 @@
 #ifndef _MSC_VER
 #include <readline/readline.h>
 #include <readline/history.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
+#include "base/Stats.h"
 #include "parser/Lexer.h"
 
 namespace ohmu {
@@ -34,6 +40,41 @@ unsigned FileStream::fillBuffer(char* buf, unsigned size) {
   return static_cast<unsigned>(n);
 }
 
+#ifndef _MSC_VER
+MemoryMappedFileStream::MemoryMappedFileStream(const char* fname)
+    : data_(nullptr), size_(0), pos_(0) {
+  int fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void* p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p != MAP_FAILED) {
+      data_ = reinterpret_cast<const char*>(p);
+      size_ = static_cast<unsigned>(st.st_size);
+    }
+  }
+  close(fd);
+}
+
+
+MemoryMappedFileStream::~MemoryMappedFileStream() {
+  if (data_)
+    munmap(const_cast<char*>(data_), size_);
+}
+
+
+unsigned MemoryMappedFileStream::fillBuffer(char* buf, unsigned size) {
+  unsigned remaining = size_ - pos_;
+  unsigned n = (size < remaining) ? size : remaining;
+  memcpy(buf, data_ + pos_, n);
+  pos_ += n;
+  return n;
+}
+#endif
+
+
 unsigned StringStream::fillBuffer(char* buf, unsigned size)  {
   if (str_[0] == 0)
     return 0;
@@ -106,12 +147,55 @@ unsigned Lexer::registerKeyword(const std::string& s) {
     unsigned sz = keyList_.size();
     keyList_.push_back(s);  // map from unsigned to string
     keyDict_[s] = sz;       // map from string to unsigned
+    keywordTableDirty_ = true;
     return sz + startKeywordTokenID_;
   }
   return it->second + startKeywordTokenID_;
 }
 
 
+void Lexer::buildKeywordTable() {
+  // Search for a seed that hashes every keyword to a distinct slot, so
+  // that lookupKeyword() needs no probing: one hash, one compare.  The
+  // keyword set is small and fixed once the grammar has loaded, so the
+  // search runs rarely, and a table a few times larger than the square
+  // of the set size succeeds within a couple of seeds on average.
+  unsigned n = keyList_.size();
+  unsigned size = 16;
+  while (size < n * n && size < (1u << 16))
+    size <<= 1;
+
+  unsigned seed = 0x811c9dc5;
+  for (unsigned attempt = 0; ; ++attempt) {
+    keywordTable_.assign(size, KeywordHashEntry());
+    bool ok = true;
+    for (unsigned i = 0; i < n && ok; ++i) {
+      const std::string& kw = keyList_[i];
+      unsigned idx =
+        hashBytes(kw.data(), static_cast<unsigned>(kw.length()), seed)
+        & (size - 1);
+      if (keywordTable_[idx].str)
+        ok = false;
+      else {
+        keywordTable_[idx].str = kw.c_str();
+        keywordTable_[idx].len = static_cast<unsigned>(kw.length());
+        keywordTable_[idx].id  = i + startKeywordTokenID_;
+      }
+    }
+    if (ok)
+      break;
+    seed = seed * 1664525u + 1013904223u;
+    // Grow the table if this keyword set is hard to hash perfectly.
+    if ((attempt & 31) == 31 && size < (1u << 20))
+      size <<= 1;
+  }
+
+  keywordHashSeed_  = seed;
+  keywordHashMask_  = size - 1;
+  keywordTableDirty_ = false;
+}
+
+
 void Lexer::signalLexicalError() {
   char c = lookChar();
   std::cerr << "Lexical error: unknown character ";
@@ -137,12 +221,15 @@ bool Lexer::signalCloseBrace(unsigned short tokid) {
 }
 
 
+OHMU_STAT(NumTokensLexed, "Tokens lexed.");
+
 void Lexer::readTokens(unsigned numTokens) {
   unsigned i = 0;
   for (; i < numTokens; ++i) {
     if (stream_eof_ || lexical_error)
       break;
     lookAhead_.push_back(readToken());
+    OHMU_STAT_INC(NumTokensLexed);
   }
 
   // push extra EOF tokens onto the end if necessary to enable
@@ -153,7 +240,91 @@ void Lexer::readTokens(unsigned numTokens) {
 }
 
 
+void Lexer::preLexCompact() {
+  // Index the newlines up front; locationForOffset() recovers line and
+  // column information from the index when a location is requested.
+  for (unsigned i = 0; i < bufferLen_; ++i) {
+    if (buffer_[i] == '\n')
+      newlines_.push_back(i);
+  }
+
+  compactPreLexing_ = true;
+  while (!stream_eof_ && !lexical_error) {
+    Token tok = readToken();
+    if (tok.id() == TK_EOF)
+      break;
+    OHMU_STAT_INC(NumTokensLexed);
+
+    CompactToken ct;
+    ct.tokenID = static_cast<unsigned short>(tok.id());
+    unsigned len = tok.length();
+    unsigned end = bufferPos_;   // absolute offset; the buffer is external
+    if (len <= end &&
+        (len == 0 || memcmp(buffer_ + end - len, tok.c_str(), len) == 0)) {
+      // The token text is the source text; reference it in place.
+      ct.offset = end - len;
+      ct.length = len;
+    }
+    else {
+      // The token text was synthesized during lexing (e.g. an escape
+      // sequence was translated); spill it to the side table.
+      ct.offset = static_cast<unsigned>(sideStrings_.size());
+      ct.length = len | CompactToken::SynthesizedStr;
+      sideStrings_.push_back(SideString());
+      sideStrings_.back().str = tok.cppString();
+      sideStrings_.back().loc = tok.location();
+    }
+    ctokens_.push_back(ct);
+  }
+  compactPreLexing_ = false;
+}
+
+
+Token Lexer::makeToken(const CompactToken& ct) {
+  if (ct.length & CompactToken::SynthesizedStr) {
+    const SideString& ss = sideStrings_[ct.offset];
+    return Token(ct.tokenID, StringRef(ss.str), ss.loc);
+  }
+  return Token(ct.tokenID, StringRef(buffer_ + ct.offset, ct.length),
+               locationForOffset(ct.offset));
+}
+
+
+SourceLocation Lexer::locationForOffset(unsigned offset) {
+  // Parsing visits tokens almost entirely in order, so resume the search
+  // from the previous position rather than bisecting every time.
+  size_t c = newlineCursor_;
+  while (c < newlines_.size() && newlines_[c] < offset)
+    ++c;
+  while (c > 0 && newlines_[c-1] >= offset)
+    --c;
+  newlineCursor_ = c;
+
+  // Column numbers match the lexer's running position counter: the first
+  // line starts at column 1, and signalNewline() resets the counter to 0
+  // after the newline is skipped, so later lines start at column 0.
+  unsigned col = (c > 0) ? offset - (newlines_[c-1] + 1) : offset + 1;
+  return SourceLocation(static_cast<unsigned>(c) + 1,
+                        static_cast<unsigned short>(col));
+}
+
+
 void Lexer::fillBuffer(unsigned numChars) {
+  // An external buffer already holds the entire input; there is nothing to
+  // copy or 0-pad, and lookChar() returns 0 past the end.  Being asked for
+  // more characters means the input is exhausted.
+  if (externalBuffer_) {
+    stream_eof_ = true;
+    return;
+  }
+
+  // The stream buffer is allocated on first use, so that lexers which
+  // only ever lex external buffers never allocate one.
+  if (!allocBuffer_) {
+    allocBuffer_ = new char[bufferCapacity_];
+    buffer_      = allocBuffer_;
+  }
+
   unsigned bsize = bufferSize();
 
   if (bufferPos_ > 0) {
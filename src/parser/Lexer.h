@@ -18,9 +18,10 @@
 // This file defines a basic lexing infrastructure.
 //
 // class CharStream:
-// class FileStream:         reads characters from a file.
-// class StringStream:       reads characters from a string.
-// class InteractiveStream:  reads characters line by line from stdin.
+// class FileStream:             reads characters from a file.
+// class MemoryMappedFileStream: memory-maps a whole file, zero-copy.
+// class StringStream:           reads characters from a string.
+// class InteractiveStream:      reads characters line by line from stdin.
 //
 // class Lexer: base class for custom lexers.
 //
@@ -34,6 +35,7 @@
 
 #include <stdio.h>
 
+#include <cassert>
 #include <cstring>
 #include <deque>
 #include <map>
@@ -65,6 +67,31 @@ private:
   FILE* file_;
 };
 
+#ifndef _MSC_VER
+// Memory-maps a file and exposes it as a single contiguous buffer.
+// Pass the buffer to Lexer::setSourceBuffer() for zero-copy lexing of
+// large inputs; fillBuffer() is also provided so that it can be used as
+// an ordinary CharStream.
+class MemoryMappedFileStream : public CharStream {
+public:
+  MemoryMappedFileStream(const char* fname);
+  ~MemoryMappedFileStream();
+
+  // Returns true if the file was successfully mapped.
+  bool valid() const { return data_ != nullptr; }
+
+  const char* data() const { return data_; }
+  unsigned    size() const { return size_; }
+
+  virtual unsigned fillBuffer(char* buf, unsigned size);
+
+private:
+  const char* data_;    // the mapped file, or null on failure
+  unsigned    size_;    // length of the mapping
+  unsigned    pos_;     // read cursor for fillBuffer
+};
+#endif
+
 // Convert a string to a stream of characters.
 class StringStream : public CharStream {
 public:
@@ -99,20 +126,24 @@ private:
 // Derived classes override readToken() to parse characters into Tokens.
 class Lexer {
 public:
+  // Construction does no allocation: the stream buffer is allocated on
+  // first use, and external source buffers are lexed in place, so lexing
+  // a memory-mapped file never allocates a character buffer at all.
   Lexer()
     : lineNum_(1), linePos_(1),
-      buffer_(0), bufferLen_(0), bufferPos_(0),
+      allocBuffer_(0), buffer_(0), bufferLen_(0), bufferPos_(0),
+      externalBuffer_(false),
       stream_eof_(true), lexical_error(false),
-      tokenBuffer_(0), tokenPos_(0),
-      charStream_(0), startKeywordTokenID_(TK_BasicTokenEnd),
+      tokenPos_(0),
+      charStream_(0), preLexed_(false), compactTokens_(false),
+      compactPreLexing_(false), tokenCursor_(0), newlineCursor_(0),
+      startKeywordTokenID_(TK_BasicTokenEnd),
+      keywordHashSeed_(0), keywordHashMask_(0), keywordTableDirty_(true),
       eofToken_(TK_EOF), emptyString_("") {
-    buffer_      = new char[bufferCapacity_];
-    tokenBuffer_ = new char[tokenCapacity_];
   }
 
   virtual ~Lexer() {
-    if (buffer_)      delete[] buffer_;
-    if (tokenBuffer_) delete[] tokenBuffer_;
+    if (allocBuffer_) delete[] allocBuffer_;
   }
 
   // Defined by derived classes to register supported tokens
@@ -133,15 +164,76 @@ public:
     charStream_   = stream;
     lineNum_      = 1;
     linePos_      = 1;
+    buffer_       = allocBuffer_;
+    externalBuffer_ = false;
     bufferLen_    = 0;
     bufferPos_    = 0;
     stream_eof_   = false;
     lexical_error = false;
     tokenPos_     = 0;
+    lookAhead_.clear();   // drop buffered tokens (e.g. EOF) from the old input
+    resetPreLexState();
+  }
+
+  // Lex directly from buf, which holds the entire input (e.g. a memory
+  // mapped file).  No characters are copied into the internal buffer; buf
+  // must remain valid until lexing is complete.
+  void setSourceBuffer(const char* buf, unsigned len) {
+    charStream_   = nullptr;
+    lineNum_      = 1;
+    linePos_      = 1;
+    buffer_       = const_cast<char*>(buf);
+    externalBuffer_ = true;
+    bufferLen_    = len;
+    bufferPos_    = 0;
+    stream_eof_   = false;   // set when lookahead runs past the buffer
+    lexical_error = false;
+    tokenPos_     = 0;
+    lookAhead_.clear();
+    resetPreLexState();
+  }
+
+  // Lex the entire input up front into a dense token array.  look() then
+  // indexes into the array and consume() is a cursor increment; use
+  // tokenPosition() and rewindTo() for cheap backtracking by index.
+  //
+  // When lexing an external source buffer, tokens are stored as compact
+  // (id, offset, length) triples that reference the source text in place
+  // (see CompactToken), and line/column information is recovered from a
+  // newline index on demand.  Otherwise tokens are stored whole, and
+  // derived lexers must copy token strings out of the token buffer.
+  void preLexAll() {
+    resetPreLexState();
+    compactTokens_ = externalBuffer_;
+    if (compactTokens_)
+      preLexCompact();
+    else {
+      while (!stream_eof_ && !lexical_error) {
+        Token tok = readToken();
+        if (tok.id() == TK_EOF)
+          break;
+        tokens_.push_back(std::move(tok));
+      }
+    }
+    preLexed_ = true;
   }
 
   // Get the i'th lookahead token.
   const Token& look(unsigned i = 0) {
+    if (preLexed_) {
+      size_t idx = tokenCursor_ + i;
+      if (idx >= numPreLexedTokens())
+        return eofToken_;
+      if (!compactTokens_)
+        return tokens_[idx];
+      // Materialize the compact token into a lookahead slot.  The
+      // reference is valid until the slot is reused, which requires i+4
+      // more tokens of lookahead.
+      assert(i < lookBufferSize_ && "Lookahead too deep.");
+      Token& slot = lookBuffer_[i % lookBufferSize_];
+      slot = makeToken(ctokens_[idx]);
+      return slot;
+    }
     unsigned lsize = lookAhead_.size();
     if (i >= lsize)
       readTokens(i - lsize + 1);
@@ -150,17 +242,35 @@ public:
 
   // Pull the next token off the token stream.
   void consume() {
+    if (preLexed_) {
+      if (tokenCursor_ < numPreLexedTokens())
+        ++tokenCursor_;
+      return;
+    }
     lookAhead_.pop_front();
   }
 
+  // Return the current position in the pre-lexed token array.
+  size_t tokenPosition() const { return tokenCursor_; }
+
+  // Jump back to a position previously returned by tokenPosition().
+  // Only valid after preLexAll().
+  void rewindTo(size_t pos) {
+    assert(preLexed_ && pos <= numPreLexedTokens());
+    tokenCursor_ = pos;
+  }
+
   // clear all unhandled input.
   void clearUnhandledInput() {
     lookAhead_.clear();
+    tokenCursor_ = numPreLexedTokens();
     bufferPos_ = bufferLen_;
   }
 
   // Return true if no more tokens are available.
   bool eof() const {
+    if (preLexed_)
+      return tokenCursor_ >= numPreLexedTokens();
     return (stream_eof_ || lexical_error) && (lookAhead_.size() == 0);
   }
 
@@ -178,11 +288,23 @@ public:
     return startKeywordTokenID_ + keyList_.size() - 1;
   }
 
+  // Returns the token id of the given keyword.  This is the hot path,
+  // called for every identifier and operator lexed: the registered
+  // keywords are hashed into a collision-free table, so a lookup is one
+  // hash, one index, and one string compare, with no allocation.
+  unsigned lookupKeyword(const char* s, unsigned len) {
+    if (keywordTableDirty_)
+      buildKeywordTable();
+    const KeywordHashEntry& e =
+      keywordTable_[hashBytes(s, len, keywordHashSeed_) & keywordHashMask_];
+    if (e.str && e.len == len && memcmp(e.str, s, len) == 0)
+      return e.id;
+    return 0;
+  }
+
   // Returns the token id of the given keyword
   unsigned lookupKeyword(const std::string& s) {
-    KeywordDict::iterator it = keyDict_.find(s);
-    if (it == keyDict_.end()) return 0;
-    else return it->second + startKeywordTokenID_;
+    return lookupKeyword(s.data(), static_cast<unsigned>(s.length()));
   }
 
   // Returns the keyword string for the given keyword token id.
@@ -217,6 +339,29 @@ protected:
     ++linePos_;
   }
 
+  // Direct access to the unread characters currently in the buffer, for
+  // scanning loops that consume runs of characters in bulk.  The pointer
+  // is only valid until the next call to lookChar().
+  const char* bufferData()  const { return buffer_ + bufferPos_; }
+  unsigned    bufferAvail() const { return bufferLen_ - bufferPos_; }
+
+  // Skip n characters, which must already be in the buffer, and must not
+  // include newlines (see signalNewline).
+  void skipChars(unsigned n) {
+    bufferPos_ += n;
+    linePos_   += n;
+  }
+
+  // Put n characters into the current token buffer.  As with putChar(),
+  // characters that do not fit are dropped.
+  void putChars(const char* p, unsigned n) {
+    unsigned space = tokenCapacity_ - 1 - tokenPos_;
+    if (n > space)
+      n = space;
+    memcpy(tokenBuffer_ + tokenPos_, p, n);
+    tokenPos_ += n;
+  }
+
   // Puts the char into the current token buffer.
   // Returns true on success, or false if the token buffer is full.
   bool putChar(char c) {
@@ -268,6 +413,12 @@ protected:
   // be that of the corresponding open brace.
   bool signalCloseBrace(unsigned short tokid);
 
+  // True while preLexAll() is building a compact token array.  Derived
+  // lexers may skip copying token strings to stable storage in this mode;
+  // the strings are either read from the source buffer in place, or
+  // copied to the side table.
+  bool compactPreLexing() const { return compactPreLexing_; }
+
  private:
   static const unsigned bufferCapacity_  = 65536;
   static const unsigned tokenCapacity_   = 1024;
@@ -285,24 +436,84 @@ protected:
   // Read numTokens into the lookahead buffer
   void readTokens(unsigned numTokens);
 
+  // Discard any pre-lexed token state.
+  void resetPreLexState() {
+    preLexed_      = false;
+    compactTokens_ = false;
+    tokenCursor_   = 0;
+    newlineCursor_ = 0;
+    tokens_.clear();
+    ctokens_.clear();
+    newlines_.clear();
+    sideStrings_.clear();
+  }
+
+  size_t numPreLexedTokens() const {
+    return compactTokens_ ? ctokens_.size() : tokens_.size();
+  }
+
+  // Lex the external source buffer into compact tokens (see preLexAll).
+  void preLexCompact();
+
+  // Expand a compact token back into a Token.
+  Token makeToken(const CompactToken& ct);
+
+  // Compute the source location of the given byte offset from the newline
+  // index.  Amortized O(1) when offsets are visited roughly in order.
+  SourceLocation locationForOffset(unsigned offset);
+
+  // Seeded byte-string hash for the keyword table.
+  static unsigned hashBytes(const char* s, unsigned len, unsigned seed) {
+    unsigned h = seed;
+    for (unsigned i = 0; i < len; ++i)
+      h = (h ^ static_cast<unsigned char>(s[i])) * 16777619u;
+    return h;
+  }
+
+  // Rebuild the collision-free keyword hash table (see lookupKeyword).
+  void buildKeywordTable();
+
  private:
   unsigned  lineNum_;                    // current line number
   unsigned  linePos_;                    // current line position
   std::vector<unsigned short> braces_;   // stack for matching braces
 
+  char*     allocBuffer_;    // internal buffer owned by the lexer
   char*     buffer_;         // buffered input
   unsigned  bufferLen_;      // current buffer size (not capacity)
   unsigned  bufferPos_;      // current read position within buffer_
+  bool      externalBuffer_; // buffer_ points at caller-owned input
 
   bool      stream_eof_;     // true when we hit end of input
   bool      lexical_error;   // true when we hit a lexical error
 
-  char*     tokenBuffer_;    // stores characters for the current token
+  char      tokenBuffer_[tokenCapacity_];  // characters of the current token
   unsigned  tokenPos_;       // write position within tokenBuffer_
 
   CharStream*       charStream_;    // incoming character stream
   std::deque<Token> lookAhead_;     // queue of lexed tokens
 
+  // A side-table entry for a compact token whose string is not a literal
+  // substring of the source buffer.
+  struct SideString {
+    std::string    str;
+    SourceLocation loc;
+  };
+
+  static const unsigned lookBufferSize_ = 4;
+
+  bool               preLexed_;     // the whole input has been lexed
+  bool               compactTokens_;     // tokens are stored in ctokens_
+  bool               compactPreLexing_;  // preLexCompact() is running
+  std::vector<Token> tokens_;       // dense token array (see preLexAll)
+  size_t             tokenCursor_;  // current position in the token array
+
+  std::vector<CompactToken> ctokens_;      // compact token array
+  std::vector<unsigned>     newlines_;     // offsets of '\n' in the source
+  size_t                    newlineCursor_;  // cursor into newlines_
+  std::vector<SideString>   sideStrings_;  // strings spilled from ctokens_
+  Token                     lookBuffer_[lookBufferSize_];  // see look()
+
   typedef std::map<std::string, unsigned> KeywordDict;
   typedef std::vector<std::string>        KeywordList;
 
@@ -312,6 +523,19 @@ protected:
   KeywordDict tokenDict_;
   KeywordList tokenList_;
 
+  // One slot of the keyword hash table.  str points into keyList_, and is
+  // refreshed whenever the table is rebuilt.
+  struct KeywordHashEntry {
+    const char* str;
+    unsigned    len;
+    unsigned    id;
+  };
+
+  std::vector<KeywordHashEntry> keywordTable_;  // power-of-two sized
+  unsigned keywordHashSeed_;
+  unsigned keywordHashMask_;    // keywordTable_.size() - 1
+  bool     keywordTableDirty_;  // a keyword was registered; rebuild
+
   Token       eofToken_;
   std::string emptyString_;
 };
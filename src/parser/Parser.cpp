@@ -21,8 +21,11 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <cstring>
 #include <iostream>
 
+#include "base/Stats.h"
+#include "base/Trace.h"
 #include "parser/Parser.h"
 
 
@@ -37,25 +40,279 @@ bool Parser::init() {
     success = success && r->init(*this);
   if (!success) {
     std::cerr << "\nFailed to initialize parser.\n";
+    return success;
   }
+  compileProgram();
   return success;
 }
 
 // Public entry point to parsing.
 ParseResult Parser::parse(ParseNamedDefinition* start) {
+  OHMU_TRACE_SCOPE("parse");
   if (start->numArguments() != 0) {
     parseError(SourceLocation()) << "Start rule must have no arguments";
     return ParseResult();
   }
   parseError_ = false;
   resultStack_.clear();
-  parseRule(start);
+  // Use the compiled rule table when available.  Tracing walks the
+  // ParseRule graph, which knows how to print itself.
+  DefinitionAddrMap::iterator it = defAddr_.find(start);
+  if (!trace_ && it != defAddr_.end())
+    parseProgram(it->second);
+  else
+    parseRule(start);
   if (!parseError_)
     return resultStack_.getBack();
+  resultStack_.clear();  // drop the partial results of the failed parse
   return ParseResult();
 }
 
 
+// Compile every named definition into the instruction table.
+// References are patched afterwards, when all addresses are known.
+void Parser::compileProgram() {
+  program_.clear();
+  firstSets_.clear();
+  defAddr_.clear();
+  defFirstSets_.clear();
+  firstSetIndex_.clear();
+
+  for (ParseNamedDefinition *d : definitions_) {
+    defAddr_[d] = program_.size();
+    PendingBlocks pending;
+    compileTail(d->definition(), pending);
+    // Compile the blocks called from this definition.
+    while (!pending.empty()) {
+      std::pair<unsigned, ParseRule*> pb = pending.back();
+      pending.pop_back();
+      program_[pb.first].target = program_.size();
+      compileTail(pb.second, pending);
+    }
+  }
+
+  for (TableInstr &in : program_) {
+    if (in.op == TOP_TailCall) {
+      ParseReference* ref = cast<ParseReference>(in.rule);
+      in.target = defAddr_[ref->definition()];
+    }
+  }
+}
+
+
+void Parser::compileTail(ParseRule* r, PendingBlocks& pending) {
+  switch (r->kind()) {
+  case PR_None:
+    emit(TOP_Return);
+    return;
+  case PR_Token:
+  case PR_Keyword:
+  case PR_Action:
+    compileFirst(r, pending);
+    emit(TOP_Return);
+    return;
+  case PR_Sequence: {
+    ParseSequence* s = cast<ParseSequence>(r);
+    compileFirst(s->first(), pending);
+    compileTail(s->second(), pending);   // tail call to second
+    return;
+  }
+  case PR_Option: {
+    // Branch to the left option if it accepts the next token;
+    // otherwise fall through to the right option.
+    ParseOption* o = cast<ParseOption>(r);
+    unsigned bi = emit(TOP_Branch, 0, makeFirstSet(o->left()));
+    compileTail(o->right(), pending);
+    program_[bi].target = program_.size();
+    compileTail(o->left(), pending);
+    return;
+  }
+  case PR_RecurseLeft: {
+    // Parse the base case, then keep parsing the recursive case for
+    // as long as it accepts the next token.
+    ParseRecurseLeft* rl = cast<ParseRecurseLeft>(r);
+    compileFirst(rl->base(), pending);
+    unsigned loop = program_.size();
+    unsigned bi = emit(TOP_Branch, 0, makeFirstSet(rl->rest()));
+    emit(TOP_Return);
+    program_[bi].target = program_.size();
+    compileFirst(rl->rest(), pending);
+    emit(TOP_Goto, 0, 0, loop);
+    return;
+  }
+  case PR_Reference:
+    emit(TOP_TailCall, 0, 0, 0, r);   // target patched in compileProgram
+    return;
+  default:
+    assert(false && "Unhandled parse rule kind.");
+    emit(TOP_Return);
+    return;
+  }
+}
+
+
+void Parser::compileFirst(ParseRule* r, PendingBlocks& pending) {
+  switch (r->kind()) {
+  case PR_None:
+    return;
+  case PR_Token:
+  case PR_Keyword: {
+    ParseToken* t = static_cast<ParseToken*>(r);
+    emit(t->skipped() ? TOP_Skip : TOP_Match,
+         static_cast<unsigned short>(t->tokenID()));
+    return;
+  }
+  case PR_Action:
+    emit(TOP_Action, 0, 0, 0, r);
+    return;
+  default: {
+    // Rules with internal control flow become a separate block, so that
+    // their tail calls return here rather than to our caller.
+    unsigned ci = emit(TOP_Call);
+    pending.push_back(std::make_pair(ci, r));
+    return;
+  }
+  }
+}
+
+
+unsigned Parser::makeFirstSet(ParseRule* r) {
+  // All keywords have been registered by init(), so token ids are
+  // stable by now.
+  std::vector<bool> s(lexer_->getLastTokenID() + 1);
+  addFirstTokens(r, s);
+
+  // Many branch sites test the same set; share a single copy.
+  std::map<std::vector<bool>, unsigned>::iterator it = firstSetIndex_.find(s);
+  if (it != firstSetIndex_.end())
+    return it->second;
+
+  firstSets_.push_back(s);
+  unsigned idx = firstSets_.size() - 1;
+  firstSetIndex_[std::move(s)] = idx;
+  return idx;
+}
+
+
+// This mirrors the accepts() methods of the rule classes, with one
+// addition: the first set of a named definition is computed at most once,
+// no matter how many references lead to it.  accepts() re-walks the rule
+// graph on every query, which makes first-set construction quadratic in
+// grammars built from deep reference chains.
+void Parser::addFirstTokens(ParseRule* r, std::vector<bool>& s) {
+  switch (r->kind()) {
+  case PR_None:
+  case PR_Action:
+    // These match the empty input, and so accept any token.
+    s.assign(s.size(), true);
+    return;
+  case PR_Token:
+  case PR_Keyword: {
+    unsigned tid = static_cast<ParseToken*>(r)->tokenID();
+    if (tid < s.size())
+      s[tid] = true;
+    return;
+  }
+  case PR_Sequence:
+    addFirstTokens(cast<ParseSequence>(r)->first(), s);
+    return;
+  case PR_Option: {
+    ParseOption* o = cast<ParseOption>(r);
+    addFirstTokens(o->left(), s);
+    addFirstTokens(o->right(), s);
+    return;
+  }
+  case PR_RecurseLeft:
+    addFirstTokens(cast<ParseRecurseLeft>(r)->base(), s);
+    return;
+  case PR_NamedDefinition:
+    addFirstTokens(cast<ParseNamedDefinition>(r)->definition(), s);
+    return;
+  case PR_Reference: {
+    ParseNamedDefinition* def = cast<ParseReference>(r)->definition();
+    std::map<ParseNamedDefinition*, std::vector<bool>>::iterator it =
+      defFirstSets_.find(def);
+    if (it == defFirstSets_.end()) {
+      // Insert an empty placeholder first, which terminates degenerate
+      // reference cycles.  (accepts() does not terminate on those.)
+      defFirstSets_[def].resize(s.size());
+      std::vector<bool> ds(s.size());
+      addFirstTokens(def->definition(), ds);
+      defFirstSets_[def] = std::move(ds);
+      it = defFirstSets_.find(def);
+    }
+    const std::vector<bool>& ds = it->second;
+    for (unsigned i = 0, n = s.size(); i < n; ++i)
+      if (ds[i])
+        s[i] = true;
+    return;
+  }
+  }
+}
+
+
+// The parser is predictive (choices are resolved by first sets, with no
+// backtracking), so the interesting count is choice points evaluated.
+OHMU_STAT(NumParserChoices, "Parser choice points evaluated.");
+
+// The table interpreter.  This is the parsing inner loop.
+void Parser::parseProgram(unsigned pc) {
+  std::vector<unsigned> callStack;
+
+  while (!parseError_) {
+    const TableInstr& in = program_[pc];
+    switch (in.op) {
+    case TOP_Return:
+      if (callStack.empty())
+        return;
+      pc = callStack.back();
+      callStack.pop_back();
+      break;
+    case TOP_Match:
+    case TOP_Skip: {
+      const Token& tok = look();
+      if (tok.id() != in.tokenID) {
+        parseError(tok.location())
+          << "expecting token: "
+          << getTokenIDString(in.tokenID)
+          << " received token: "
+          << getTokenIDString(tok.id());
+        return;
+      }
+      if (in.op == TOP_Skip)
+        skip();
+      else
+        consume();   // Pushes token onto the stack.
+      ++pc;
+      break;
+    }
+    case TOP_Branch: {
+      OHMU_STAT_INC(NumParserChoices);
+      const std::vector<bool>& s = firstSets_[in.arg];
+      unsigned id = look().id();
+      pc = (id < s.size() && s[id]) ? in.target : pc + 1;
+      break;
+    }
+    case TOP_Goto:
+      pc = in.target;
+      break;
+    case TOP_Call:
+      callStack.push_back(pc + 1);
+      pc = in.target;
+      break;
+    case TOP_TailCall:
+      static_cast<ParseReference*>(in.rule)->prepareCall(*this);
+      pc = in.target;
+      break;
+    case TOP_Action:
+      static_cast<ParseAction*>(in.rule)->invoke(*this);
+      ++pc;
+      break;
+    }
+  }
+}
+
+
 // Parse rule p.  The result will be left on the top of the stack.
 void Parser::parseRule(ParseRule* rule) {
   ParseRule* nextState = rule;
@@ -92,23 +349,43 @@ std::ostream& Parser::parseError(const SourceLocation& sloc) {
 }
 
 
-bool ParseResult::append(ParseResult &&p) {
-  ListType* vect;
+bool ParseResult::append(MemRegionRef a, ParseResult &&p) {
+  static const unsigned initialCapacity = 4;
+
+  ListData* vect;
   if (isEmpty()) {
     assert(result_ == nullptr);
     resultKind_ = p.resultKind_;
     isList_ = true;
-    vect = new ListType();
+    vect = new (a) ListData();
+    vect->elems =
+      static_cast<void**>(a.allocate(initialCapacity * sizeof(void*)));
+    vect->size = 0;
+    vect->capacity = initialCapacity;
     result_ = vect;
   }
   else {
     assert(isList_);
-    vect = reinterpret_cast<ListType*>(result_);
+    vect = reinterpret_cast<ListData*>(result_);
   }
   if (p.isList_ || p.resultKind_ != resultKind_)
     return false;
 
-  vect->push_back(p.result_);
+  if (vect->size == vect->capacity) {
+    // Lists are usually the most recent allocation, so they can
+    // generally be grown in place without copying.
+    unsigned ncap = vect->capacity * 2;
+    if (!a.tryGrowInPlace(vect->elems, vect->capacity * sizeof(void*),
+                          ncap * sizeof(void*))) {
+      void** ne = static_cast<void**>(a.allocate(ncap * sizeof(void*)));
+      memcpy(ne, vect->elems, vect->size * sizeof(void*));
+      vect->elems = ne;
+    }
+    vect->capacity = ncap;
+  }
+
+  vect->elems[vect->size] = p.result_;
+  ++vect->size;
   p.release();
   return true;
 }
@@ -395,6 +672,7 @@ bool ParseOption::accepts(const Token& tok) {
 
 
 ParseRule* ParseOption::parse(Parser& parser) {
+  OHMU_STAT_INC(NumParserChoices);
   if (left_->accepts(parser.look()))
     return left_;   // tail call to left_
   else
@@ -639,12 +917,17 @@ bool ParseReference::accepts(const Token& tok) {
 }
 
 
-ParseRule* ParseReference::parse(Parser& parser) {
+void ParseReference::prepareCall(Parser& parser) {
   unsigned frameStart = parser.resultStack_.size() - frameSize_;
   for (unsigned i=0, n=arguments_.size(); i<n; ++i)
     parser.resultStack_.moveAndPush(frameStart + arguments_[i]);
   if (drop_ > 0)
     parser.resultStack_.drop(drop_, arguments_.size());
+}
+
+
+ParseRule* ParseReference::parse(Parser& parser) {
+  prepareCall(parser);
   return definition_;
 }
 
@@ -735,7 +1018,7 @@ public:
 
   ParseResult reduceAppend(ast::Append &node,
                            ParseResult &&l, ParseResult &&e) {
-    bool success = l.append(std::move(e));
+    bool success = l.append(parser_->resultArena_, std::move(e));
     if (!success) {
       parser_->parseError(SourceLocation()) <<
         "Lists must contain the same kind of node.";
@@ -794,13 +1077,18 @@ bool ParseAction::accepts(const Token& tok) {
 }
 
 
-ParseRule* ParseAction::parse(Parser& parser) {
+void ParseAction::invoke(Parser& parser) {
   unsigned frameStart = parser.resultStack_.size() - frameSize_;
 
   ASTInterpreter interpreter(&parser, frameStart);
   parser.resultStack_.push_back(interpreter.traverse(node_));
   if (drop_ > 0)
     parser.resultStack_.drop(drop_, 1);
+}
+
+
+ParseRule* ParseAction::parse(Parser& parser) {
+  invoke(parser);
   return nullptr;
 }
 
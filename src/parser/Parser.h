@@ -24,6 +24,9 @@
 #ifndef OHMU_PARSER_H
 #define OHMU_PARSER_H
 
+#include "base/MemRegion.h"
+#include "base/MutArrayRef.h"
+
 #include "parser/ASTNode.h"
 #include "parser/Lexer.h"
 
@@ -113,6 +116,9 @@ public:
   ParseRule* parse(Parser& parser) override;
   void       prettyPrint(Parser& parser, std::ostream& out) override;
 
+  unsigned tokenID() const { return tokenID_; }
+  bool     skipped() const { return skip_; }
+
 protected:
   ParseToken(ParseRuleKind k, unsigned tid, bool skip)
     : ParseRule(k), tokenID_(tid), skip_(skip)
@@ -137,6 +143,8 @@ public:
   bool init(Parser& parser) override;
   void prettyPrint(Parser& parser, std::ostream& out) override;
 
+  const std::string& keywordStr() const { return keywordStr_; }
+
 private:
   const std::string keywordStr_;
 };
@@ -160,11 +168,16 @@ public:
   // Returns true if the head of this sequence has a name.
   inline bool hasLetName() { return letName_.length() > 0; }
 
+  const std::string& letName() const { return letName_; }
+
   bool       init(Parser& parser) override;
   bool       accepts(const Token& tok) override;
   ParseRule* parse(Parser& parser) override;
   void       prettyPrint(Parser& parser, std::ostream& out) override;
 
+  ParseRule* first()  const { return first_; }
+  ParseRule* second() const { return second_; }
+
  private:
   std::string letName_;
   ParseRule*  first_;
@@ -190,6 +203,9 @@ public:
   ParseRule* parse(Parser& parser) override;
   void       prettyPrint(Parser& parser, std::ostream& out) override;
 
+  ParseRule* left()  const { return left_; }
+  ParseRule* right() const { return right_; }
+
  private:
   ParseRule* left_;
   ParseRule* right_;
@@ -214,11 +230,16 @@ public:
 
   inline bool hasLetName() { return letName_.length() > 0; }
 
+  const std::string& letName() const { return letName_; }
+
   virtual bool       init(Parser& parser);
   virtual bool       accepts(const Token& tok);
   virtual ParseRule* parse(Parser& parser);
   virtual void       prettyPrint(Parser& parser, std::ostream& out);
 
+  ParseRule* base() const { return base_; }
+  ParseRule* rest() const { return rest_; }
+
 private:
   std::string letName_;
   ParseRule*  base_;
@@ -249,10 +270,14 @@ public:
   const std::string& name() const { return name_; }
   unsigned numArguments()   const { return argNames_.size(); }
 
+  const std::vector<std::string>& argNames() const { return argNames_; }
+
   void addArgument(std::string s) { argNames_.push_back(std::move(s)); }
 
   void setDefinition(ParseRule* rule) { rule_ = rule; }
 
+  ParseRule* definition() const { return rule_; }
+
 private:
   std::string              name_;
   std::vector<std::string> argNames_;
@@ -286,6 +311,16 @@ public:
     argNames_.emplace_back(std::move(arg));
   }
 
+  ParseNamedDefinition* definition() const { return definition_; }
+
+  const std::string& name() const { return name_; }
+
+  const std::vector<std::string>& argNames() const { return argNames_; }
+
+  // Move the arguments of the call into place on the result stack.
+  // This is the stack shuffle that parse() does before the tail call.
+  void prepareCall(Parser& parser);
+
  private:
   std::string              name_;
   ParseNamedDefinition*    definition_;
@@ -315,6 +350,11 @@ public:
   ParseRule* parse(Parser& parser) override;
   void       prettyPrint(Parser& parser, std::ostream& out) override;
 
+  // Interpret the ASTNode and leave the result on the stack.
+  void invoke(Parser& parser);
+
+  ast::ASTNode* node() const { return node_; }
+
 private:
   ast::ASTNode* node_;    // ASTNode to interpret
   unsigned frameSize_;    // size of the stack frame
@@ -330,10 +370,20 @@ private:
 // ParseResults are move-only objects which hold unique pointers.
 // Teading the result will relinquish ownership of the pointer.
 // Failure to use a parse result is an error.
+//
+// List results are allocated from the parser's result arena, and are
+// read out as MutArrayRefs; building a list performs no heap allocation,
+// and the memory is reclaimed wholesale with the arena.
 class ParseResult {
 public:
-  typedef unsigned char      KindType;
-  typedef std::vector<void*> ListType;
+  typedef unsigned char KindType;
+
+  // A growable list of result pointers, allocated in the result arena.
+  struct ListData {
+    void**   elems;
+    unsigned size;
+    unsigned capacity;
+  };
 
   enum ResultKind {
     PRS_None = 0,
@@ -385,9 +435,9 @@ public:
   }
 
   // Return a list of tokens, and release ownership.
-  std::vector<Token*>* getTokenList() {
+  MutArrayRef<Token*> getTokenList() {
     assert(isTokenList());
-    return getAs< std::vector<Token*> >();
+    return getListAs<Token>();
   }
 
   // Return an AST node, and release ownership.
@@ -398,16 +448,21 @@ public:
   }
 
   // Return the node list, and release ownership.
+  // The underlying memory is owned by the parser's result arena.
   template <class T>
-  std::vector<T*>* getList(KindType k) {
+  MutArrayRef<T*> getList(KindType k) {
     assert(isList(k));
-    return getAs< std::vector<T*> >();
+    return getListAs<T>();
   }
 
   // Append p to this list, and consume p.
-  // If this is an empty result, create a new list.
+  // If this is an empty result, create a new list, allocating from a.
   // Returns false on failure, if kind of p does not match.
-  bool append(ParseResult&& p);
+  bool append(MemRegionRef a, ParseResult&& p);
+
+  // Discard the result without reading it, e.g. the partial result of a
+  // failed parse.
+  void discard() { release(); }
 
 private:
   ParseResult(const ParseResult& r) = delete;
@@ -426,6 +481,15 @@ private:
     return p;
   }
 
+  template<class T>
+  inline MutArrayRef<T*> getListAs() {
+    ListData* d = reinterpret_cast<ListData*>(result_);
+    release();
+    if (!d)
+      return MutArrayRef<T*>();
+    return MutArrayRef<T*>(reinterpret_cast<T**>(d->elems), d->size);
+  }
+
   KindType resultKind_;
   bool     isList_;
   void*    result_;
@@ -470,7 +534,11 @@ public:
 
   ParseResult getBack() { return std::move(stack_.back()); }
 
+  // Discard whatever is on the stack, e.g. the partial results of a
+  // failed parse.
   void clear() {
+    for (ParseResult &r : stack_)
+      r.discard();
     stack_.clear();
   }
 
@@ -581,7 +649,9 @@ private:
 class Parser {
 public:
   // Create a new parser.
-  Parser(Lexer* lexer) : lexer_(lexer) { }
+  Parser(Lexer* lexer) : lexer_(lexer) {
+    resultArena_.setRegion(&resultRegion_);
+  }
   virtual ~Parser() {
     for (auto *d : definitions_)
       if (d) delete d;
@@ -609,6 +679,11 @@ public:
       definitionDict_[s] = def;
   }
 
+  // Return all top-level named definitions, in definition order.
+  const std::vector<ParseNamedDefinition*>& definitions() const {
+    return definitions_;
+  }
+
   // Find a top-level definition by name.
   ParseNamedDefinition* findDefinition(const std::string& s) {
     DefinitionDict::iterator it = definitionDict_.find(s);
@@ -667,6 +742,36 @@ protected:
   // Parse rule p.  This is invoked internally to make recursive calls.
   inline void parseRule(ParseRule *p);
 
+  // A validated grammar is compiled into a flat table of instructions,
+  // which is interpreted by a single switch loop (see parseProgram).
+  // This avoids the virtual dispatch and pointer chasing of walking the
+  // ParseRule graph on every rule application; the rule classes remain
+  // the frontend for building and validating grammars.
+  enum TableOpcode {
+    TOP_Return,     // return from a call, or finish if the stack is empty
+    TOP_Match,      // match tokenID and push it onto the result stack
+    TOP_Skip,       // match tokenID and discard it
+    TOP_Branch,     // jump to target if look() is in first set arg
+    TOP_Goto,       // jump to target
+    TOP_Call,       // call the block at target
+    TOP_TailCall,   // shuffle arguments and jump to a named definition
+    TOP_Action      // interpret the ASTNode of a ParseAction
+  };
+
+  struct TableInstr {
+    unsigned char  op;       // TableOpcode
+    unsigned short tokenID;  // Match, Skip: the token to match
+    unsigned       arg;      // Branch: index of the first set
+    unsigned       target;   // Branch, Goto, Call, TailCall: address
+    ParseRule*     rule;     // TailCall: reference; Action: action
+  };
+
+  // Compile all named definitions into the instruction table.
+  void compileProgram();
+
+  // Interpret the instruction table, starting at pc.
+  void parseProgram(unsigned pc);
+
   // look at the next token
   const Token& look(unsigned i = 0) {
     return lexer_->look(i);
@@ -694,6 +799,32 @@ protected:
   }
 
 private:
+  typedef std::vector<std::pair<unsigned, ParseRule*>> PendingBlocks;
+  typedef std::map<ParseNamedDefinition*, unsigned>    DefinitionAddrMap;
+
+  // Emit an instruction, and return its address.
+  unsigned emit(unsigned char op, unsigned short tok = 0, unsigned arg = 0,
+                unsigned target = 0, ParseRule* rule = nullptr) {
+    TableInstr in = { op, tok, arg, target, rule };
+    program_.push_back(in);
+    return program_.size() - 1;
+  }
+
+  // Compile rule r, ending every control path with TOP_Return.
+  void compileTail(ParseRule* r, PendingBlocks& pending);
+
+  // Compile rule r so that control continues with the next instruction.
+  // Rules with internal control flow are deferred to a called block.
+  void compileFirst(ParseRule* r, PendingBlocks& pending);
+
+  // Build the set of tokens accepted as the first token of rule r.
+  // Returns an index into firstSets_; identical sets are shared.
+  unsigned makeFirstSet(ParseRule* r);
+
+  // Add the first tokens of rule r to set s.  The first set of each
+  // named definition is computed at most once (see defFirstSets_).
+  void addFirstTokens(ParseRule* r, std::vector<bool>& s);
+
   Lexer*          lexer_ = nullptr;
   DefinitionVect  definitions_;
   DefinitionDict  definitionDict_;
@@ -702,6 +833,18 @@ private:
   AbstractStack   abstractStack_;
   bool            parseError_ = false;
 
+  MemRegion       resultRegion_;  // holds list results (see ParseResult)
+  MemRegionRef    resultArena_;
+
+  std::vector<TableInstr>        program_;    // compiled rule table
+  std::vector<std::vector<bool>> firstSets_;  // first sets for TOP_Branch
+  DefinitionAddrMap              defAddr_;    // start address of each rule
+
+  // Memo tables used while compiling.  Each named definition's first set
+  // is computed once, and branches with identical sets share an entry.
+  std::map<ParseNamedDefinition*, std::vector<bool>> defFirstSets_;
+  std::map<std::vector<bool>, unsigned>              firstSetIndex_;
+
   // Used for debugging and pretty printing
   bool trace_ = false;
   bool traceValidate_ = false;
@@ -109,10 +109,10 @@ TIL_CastOpcode TILParser::lookupCastOpcode(StringRef s) {
 
 
 inline StringRef TILParser::copyStr(StringRef s) {
-  // Put all strings in the string arena, which must survive
-  // for the duration of the compile.
-  char* temp = reinterpret_cast<char*>(stringArena_.allocate(s.size()+1));
-  return copyStringRef(temp, s);
+  // Intern all strings in the string arena, which must survive for the
+  // duration of the compile.  Repeated identifiers (variable and slot
+  // names) share a single canonical copy.
+  return stringInterner_.internStr(s);
 }
 
 bool TILParser::toBool(StringRef s) {
@@ -123,22 +123,26 @@ bool TILParser::toBool(StringRef s) {
 }
 
 char TILParser::toChar(StringRef s) {
-  return s.c_str()[0];
+  return s.size() ? s.c_str()[0] : 0;
 }
 
 int TILParser::toInteger(StringRef s) {
+  // s may reference the source buffer in place, without null termination.
+  std::string str = s.str();
   char* end = nullptr;
-  long long val = strtol(s.c_str(), &end, 0);
+  long long val = strtol(str.c_str(), &end, 0);
   // FIXME: some proper error handling here?
-  assert(end == s.c_str() + s.size() && "Could not parse string.");
+  assert(end == str.c_str() + str.size() && "Could not parse string.");
   return static_cast<int>(val);
 }
 
 double TILParser::toDouble(StringRef s) {
+  // s may reference the source buffer in place, without null termination.
+  std::string str = s.str();
   char* end = nullptr;
-  double val = strtod(s.c_str(), &end);
+  double val = strtod(str.c_str(), &end);
   // FIXME: some proper error handling here?
-  assert(end == s.c_str() + s.size() && "Could not parse string.");
+  assert(end == str.c_str() + str.size() && "Could not parse string.");
   return val;
 }
 
@@ -154,9 +158,9 @@ ParseResult TILParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
     return prs[i].getToken();
   };
   /*
-  auto tokList = [=](unsigned i) -> std::vector< Token* >* {
+  auto tokList = [=](unsigned i) -> MutArrayRef<Token*> {
     if (!prs[i].isTokenList() || i >= arity)
-      return nullptr;
+      return MutArrayRef<Token*>();
     return prs[i].getTokenList();
   };
   */
@@ -165,9 +169,9 @@ ParseResult TILParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
       return nullptr;
     return prs[i].getNode<SExpr>(TILP_SExpr);
   };
-  auto sexprList = [=](unsigned i) -> std::vector<SExpr*>* {
+  auto sexprList = [=](unsigned i) -> MutArrayRef<SExpr*> {
     if (!prs[i].isList(TILP_SExpr) || i >= arity)
-      return nullptr;
+      return MutArrayRef<SExpr*>();
     return prs[i].getList<SExpr>(TILP_SExpr);
   };
 
@@ -250,7 +254,7 @@ ParseResult TILParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
     case TCOP_Record: {
       assert(arity == 1 || arity == 2);
       SExpr *p;
-      std::vector<SExpr*>* es;
+      MutArrayRef<SExpr*> es;
       if (arity == 1) {
         p  = nullptr;
         es = sexprList(0);
@@ -259,13 +263,12 @@ ParseResult TILParser::makeExpr(unsigned op, unsigned arity, ParseResult *prs) {
         p  = sexpr(0);
         es = sexprList(1);
       }
-      auto *r = new (arena_) Record(arena_, es->size(), p);
-      for (SExpr* e : *es) {
+      auto *r = new (arena_) Record(arena_, es.size(), p);
+      for (SExpr* e : es) {
         Slot* s = dyn_cast<Slot>(e);
         if (s)
           r->slots().emplace_back(arena_, s);
       }
-      delete es;
       return ParseResult(TILP_SExpr, r);
     }
     case TCOP_Slot: {
@@ -23,6 +23,7 @@
 #ifndef OHMU_TIL_PARSER_H
 #define OHMU_TIL_PARSER_H
 
+#include "base/StringInterner.h"
 #include "parser/Parser.h"
 #include "parser/BNFParser.h"
 #include "til/TIL.h"
@@ -82,7 +83,7 @@ public:
   static const unsigned short TILP_SExpr = ParseResult::PRS_UserDefined;
 
 
-  TILParser(Lexer *lexer) : Parser(lexer) {
+  TILParser(Lexer *lexer) : Parser(lexer), stringArenaId_(0) {
     initMap();
   }
   ~TILParser() { }
@@ -91,9 +92,21 @@ public:
 
   void setArenas(MemRegionRef strArena, MemRegionRef parseArena) {
     arena_ = parseArena;
+    // The interner's canonical copies live in the string arena.  When a
+    // different arena is installed, the copies made in the old one are
+    // about to dangle, so the interner must forget them; reusing one
+    // parser across many Globals is then safe.  The old id is cached
+    // rather than read back through stringArena_: the old region may be
+    // gone by now, with a fresh one constructed at the same address.
+    if (stringArenaId_ != strArena.regionId())
+      stringInterner_.clear();
+    stringArenaId_ = strArena.regionId();
     stringArena_ = strArena;
+    stringInterner_.setArena(strArena);
   }
 
+  StringInterner& stringInterner() { return stringInterner_; }
+
   const char* getOpcodeName(TIL_ConstructOp op);
 
   void initMap();
@@ -116,6 +129,8 @@ public:
 private:
    MemRegionRef arena_;
    MemRegionRef stringArena_;
+   unsigned stringArenaId_;   // id of stringArena_'s region; see setArenas()
+   StringInterner stringInterner_;
 
    std::unordered_map<std::string, unsigned> opcodeMap_;
    std::unordered_map<std::string, unsigned> unaryOpcodeMap_;
@@ -95,6 +95,23 @@ private:
 };
 
 
+// A compact token representation, used for pre-lexed token arrays.
+// Stores only a 16-bit token id plus the token's byte offset and length in
+// the source buffer; token strings are read directly out of the source, and
+// line/column information is computed from a newline index only when a
+// location is needed.  Token strings that are not literal substrings of the
+// source (e.g. string literals with escape sequences) are spilled to a side
+// table; for those, the high bit of length is set and offset holds the
+// side-table index.
+struct CompactToken {
+  static const unsigned SynthesizedStr = 0x80000000;
+
+  unsigned short tokenID;
+  unsigned       offset;   // byte offset of the token, or a side-table index
+  unsigned       length;   // length in bytes; high bit marks side-table strings
+};
+
+
 class TokenSet {
 public:
   bool get(int i) const {
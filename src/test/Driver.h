@@ -25,8 +25,10 @@
 #define OHMU_TEST_DRIVER_H
 
 
+#include "base/ThreadPool.h"
 #include "parser/DefaultLexer.h"
 #include "parser/BNFParser.h"
+#include "parser/GrammarFile.h"
 #include "parser/TILParser.h"
 #include "til/Global.h"
 #include "til/TIL.h"
@@ -35,7 +37,23 @@
 #include "til/TILTraverse.h"
 
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _MSC_VER
+#include <time.h>
+#endif
 
 namespace ohmu {
 
@@ -52,22 +70,67 @@ public:
   bool parseDefinitions(Global *global, FILE *file);
   bool parseDefinitions(Global *global, const char* fname);
 
+  // Parse a file as above, but parse independent top-level definitions
+  // concurrently on the thread pool.  nworkers == 0 uses one worker per
+  // pool thread.  Falls back to sequential parsing for small inputs, or
+  // when the file cannot be split.
+  bool parseDefinitionsParallel(Global *global, const char* fname,
+                                unsigned nworkers = 0);
+
+  // Compile a list of files as one program, sharing one global namespace.
+  // Parsing runs as a pipeline on the thread pool: files parse concurrently
+  // on per-thread parsers while the calling thread merges finished files
+  // into the global in list order, with a bounded window of in-flight
+  // files; lowering then runs data-parallel over the merged namespace
+  // (see Global::lowerParallel).  nworkers bounds the window; 0 uses one
+  // per pool thread.
+  bool compileBatch(Global *global, const std::vector<const char*> &files,
+                    unsigned nworkers = 0);
+
   Driver() : tilParser(&lexer), startRule(nullptr) { }
 
+  // The underlying parser, e.g. for checkpointing its string interner
+  // alongside a Global capture (see CompileServer).
+  TILParser& parser() { return tilParser; }
+
 private:
+  // A lexer, parser, and regions of its own for one worker thread, so
+  // concurrent parses share no mutable state.
+  struct ParseWorker {
+    DefaultLexer lexer;
+    TILParser    parser;
+    std::unique_ptr<MemRegion> stringRegion;
+    std::unique_ptr<MemRegion> parseRegion;
+    ParseNamedDefinition* start;
+    bool ok;
+
+    ParseWorker()
+        : parser(&lexer), stringRegion(new MemRegion()),
+          parseRegion(new MemRegion()), start(nullptr), ok(true)
+    { }
+  };
+
+  // Replicate the loaded grammar into n fresh workers, each parsing into
+  // its own regions.
+  bool makeParseWorkers(std::vector<std::unique_ptr<ParseWorker>> &workers,
+                        unsigned n);
+
+  // Look up the start rule after the grammar has been loaded.
+  bool findStartRule();
+
+  // Split source text into contiguous spans of whole top-level definitions.
+  static std::vector<StringRef> splitTopLevel(const char* buf, size_t len);
+
+  // Parse whatever input the lexer is currently set up with.
+  bool parseCurrentInput(Global *global);
+
   DefaultLexer lexer;
   TILParser    tilParser;
   ParseNamedDefinition* startRule;
 };
 
 
-bool Driver::initParser(FILE* grammarFile) {
-  // Build the ohmu parser from the grammar file.
-  bool success = BNFParser::initParserFromFile(tilParser, grammarFile, false);
-  if (!success)
-    return false;
-
-  // Find the starting point.
+bool Driver::findStartRule() {
   startRule = tilParser.findDefinition("definitions");
   if (!startRule) {
     std::cout << "Grammar does not contain rule named 'definitions'.\n";
@@ -77,7 +140,28 @@ bool Driver::initParser(FILE* grammarFile) {
 }
 
 
+bool Driver::initParser(FILE* grammarFile) {
+  // Build the ohmu parser from the grammar file.
+  bool success = BNFParser::initParserFromFile(tilParser, grammarFile, false);
+  if (!success)
+    return false;
+  return findStartRule();
+}
+
+
 bool Driver::initParser(const char* grammarFileName) {
+  // Load a precompiled grammar if one is present, which skips running
+  // BNFParser over the grammar text.  (See GrammarFile.h.)
+  std::string binName = std::string(grammarFileName) + ".bin";
+  FILE* binFile = fopen(binName.c_str(), "rb");
+  if (binFile) {
+    bool success = GrammarFile::initParserFromFile(tilParser, binFile);
+    fclose(binFile);
+    if (success)
+      return findStartRule();
+    std::cout << "Cannot load " << binName << "; using grammar text.\n";
+  }
+
   // Open the grammar file.
   FILE* grammarFile = fopen(grammarFileName, "r");
   if (!grammarFile) {
@@ -92,25 +176,30 @@ bool Driver::initParser(const char* grammarFileName) {
 
 
 
-bool Driver::parseDefinitions(Global *global, CharStream &stream) {
+bool Driver::parseCurrentInput(Global *global) {
   tilParser.setArenas(global->StringArena, global->ParseArena);
-  lexer.setStream(&stream);
   // tilParser.setTrace(true);
   ParseResult result = tilParser.parse(startRule);
-  if (tilParser.parseError())
+  if (tilParser.parseError()) {
+    result.discard();
     return false;
+  }
 
   // Add parsed definitions to global namespace.
-  auto* v = result.getList<SExpr>(TILParser::TILP_SExpr);
-  if (!v) {
+  if (!result.isList(TILParser::TILP_SExpr)) {
     std::cout << "No definitions found.\n";
     return false;
   }
-  global->addDefinitions(*v);
-  delete v;
+  global->addDefinitions(result.getList<SExpr>(TILParser::TILP_SExpr));
   return true;
 }
 
+
+bool Driver::parseDefinitions(Global *global, CharStream &stream) {
+  lexer.setStream(&stream);
+  return parseCurrentInput(global);
+}
+
 bool Driver::parseDefinitions(Global *global, FILE *file) {
   // Parse file.
   FileStream fs(file);
@@ -119,6 +208,18 @@ bool Driver::parseDefinitions(Global *global, FILE *file) {
 
 
 bool Driver::parseDefinitions(Global *global, const char* fname) {
+#ifndef _MSC_VER
+  // Map the whole file and lex it in place, with no buffer copies.
+  MemoryMappedFileStream mfs(fname);
+  if (mfs.valid()) {
+    lexer.setSourceBuffer(mfs.data(), mfs.size());
+    // The whole input is in memory, so lex it all up front; the parser
+    // then walks a dense token array.
+    lexer.preLexAll();
+    return parseCurrentInput(global);
+  }
+#endif
+
   FILE* file = fopen(fname, "r");
   if (!file) {
     std::cout << "File " << fname << " not found.\n";
@@ -129,6 +230,826 @@ bool Driver::parseDefinitions(Global *global, const char* fname) {
   return success;
 }
 
+
+// Top-level definitions end with ';' at bracket depth zero.  The scanner
+// tracks comments, string and character literals, and bracket nesting; if
+// the input is unbalanced it returns the whole buffer as a single span, and
+// trailing text after the last ';' (e.g. a closing comment) is folded into
+// the preceding span.
+std::vector<StringRef> Driver::splitTopLevel(const char* buf, size_t len) {
+  std::vector<StringRef> spans;
+  size_t start = 0;
+  int depth = 0;
+  size_t i = 0;
+  while (i < len) {
+    char c = buf[i];
+    if (c == '/' && i + 1 < len && buf[i + 1] == '/') {
+      while (i < len && buf[i] != '\n')
+        ++i;
+      continue;
+    }
+    if (c == '"' || c == '\'') {
+      ++i;
+      while (i < len && buf[i] != c) {
+        if (buf[i] == '\\')
+          ++i;
+        ++i;
+      }
+      ++i;
+      continue;
+    }
+    switch (c) {
+    case '(': case '[': case '{':
+      ++depth;
+      break;
+    case ')': case ']': case '}':
+      --depth;
+      break;
+    case ';':
+      if (depth == 0) {
+        spans.push_back(StringRef(buf + start, i + 1 - start));
+        start = i + 1;
+      }
+      break;
+    default:
+      break;
+    }
+    if (depth < 0)
+      break;
+    ++i;
+  }
+  if (depth != 0 || spans.empty()) {
+    spans.clear();
+    spans.push_back(StringRef(buf, len));
+    return spans;
+  }
+  if (start < len) {
+    // Attach the remainder to the last definition; spans stay contiguous.
+    const char* d = spans.back().data();
+    spans.back() = StringRef(d, len - (d - buf));
+  }
+  return spans;
+}
+
+
+// Replicate the grammar into each worker's parser by round-tripping it
+// through the binary grammar format.  (See GrammarFile.h.)
+bool Driver::makeParseWorkers(
+    std::vector<std::unique_ptr<ParseWorker>> &workers, unsigned n) {
+  FILE* gramFile = tmpfile();
+  if (!gramFile)
+    return false;
+  if (!GrammarFile::writeParserFile(tilParser, gramFile)) {
+    fclose(gramFile);
+    return false;
+  }
+
+  for (unsigned w = 0; w < n; ++w) {
+    workers.emplace_back(new ParseWorker());
+    ParseWorker* pw = workers.back().get();
+    rewind(gramFile);
+    if (!GrammarFile::initParserFromFile(pw->parser, gramFile)) {
+      fclose(gramFile);
+      return false;
+    }
+    pw->start = pw->parser.findDefinition("definitions");
+    if (!pw->start) {
+      fclose(gramFile);
+      return false;
+    }
+    pw->parser.setArenas(MemRegionRef(pw->stringRegion.get()),
+                         MemRegionRef(pw->parseRegion.get()));
+  }
+  fclose(gramFile);
+  return true;
+}
+
+
+bool Driver::parseDefinitionsParallel(Global *global, const char* fname,
+                                      unsigned nworkers) {
+#ifdef _MSC_VER
+  return parseDefinitions(global, fname);
+#else
+  MemoryMappedFileStream mfs(fname);
+  if (!mfs.valid())
+    return parseDefinitions(global, fname);
+
+  std::vector<StringRef> chunks = splitTopLevel(mfs.data(), mfs.size());
+  ThreadPool& pool = ThreadPool::instance();
+  if (nworkers == 0)
+    nworkers = pool.numThreads();
+  if (nworkers > chunks.size())
+    nworkers = chunks.size();
+  if (chunks.size() < 2 || nworkers < 2) {
+    lexer.setSourceBuffer(mfs.data(), mfs.size());
+    lexer.preLexAll();
+    return parseCurrentInput(global);
+  }
+
+  // Each worker has its own lexer, parser, and regions, so the workers
+  // share no mutable state.  The parsed definitions live in the worker
+  // regions, which the global adopts once parsing succeeds.
+  std::vector<std::unique_ptr<ParseWorker>> workers;
+  if (!makeParseWorkers(workers, nworkers))
+    return parseDefinitions(global, fname);
+
+  // Parse contiguous blocks of definitions on the pool.  Results are
+  // stored per chunk, so they can be merged in source order below.
+  std::vector<std::vector<SExpr*>> results(chunks.size());
+  size_t perWorker = (chunks.size() + nworkers - 1) / nworkers;
+  pool.parallelFor(nworkers, [&](size_t w) {
+    ParseWorker* pw = workers[w].get();
+    size_t begin = w * perWorker;
+    size_t end = begin + perWorker;
+    if (end > chunks.size())
+      end = chunks.size();
+    for (size_t i = begin; i < end && pw->ok; ++i) {
+      pw->lexer.setSourceBuffer(chunks[i].data(), chunks[i].size());
+      pw->lexer.preLexAll();
+      ParseResult result = pw->parser.parse(pw->start);
+      if (pw->parser.parseError() ||
+          !result.isList(TILParser::TILP_SExpr)) {
+        result.discard();
+        pw->ok = false;
+        return;
+      }
+      auto defs = result.getList<SExpr>(TILParser::TILP_SExpr);
+      results[i].assign(defs.begin(), defs.end());
+    }
+  });
+
+  for (auto &w : workers) {
+    if (!w->ok)
+      return false;
+    global->adoptRegion(w->stringRegion.release());
+    global->adoptRegion(w->parseRegion.release());
+  }
+
+  std::vector<SExpr*> defs;
+  for (auto &r : results)
+    defs.insert(defs.end(), r.begin(), r.end());
+  global->addDefinitions(MutArrayRef<SExpr*>(defs.data(), defs.size()));
+  return true;
+#endif
+}
+
+
+bool Driver::compileBatch(Global *global, const std::vector<const char*> &files,
+                          unsigned nworkers) {
+  ThreadPool& pool = ThreadPool::instance();
+  if (nworkers == 0)
+    nworkers = pool.numThreads();
+
+#ifndef _MSC_VER
+  if (files.size() >= 2 && nworkers >= 2) {
+    // Parse tasks run on pool threads, so one worker per pool thread is
+    // enough; a thread running several files reuses its parser.  The
+    // calling thread never runs parse tasks, it is the merge stage.
+    std::vector<std::unique_ptr<ParseWorker>> workers;
+    if (makeParseWorkers(workers, pool.numThreads())) {
+      struct FileSlot {
+        std::vector<SExpr*> defs;
+        bool ok;
+        bool done;
+        FileSlot() : ok(false), done(false) { }
+      };
+      std::vector<FileSlot> slots(files.size());
+      std::mutex mutex;
+      std::condition_variable doneCV;
+      bool abort = false;
+
+      auto parseTask = [&](size_t i) {
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (abort) {
+            slots[i].done = true;
+            doneCV.notify_all();
+            return;
+          }
+        }
+        ParseWorker* pw = workers[ThreadPool::threadIndex()].get();
+        bool ok = false;
+        std::vector<SExpr*> defs;
+        MemoryMappedFileStream mfs(files[i]);
+        if (mfs.valid()) {
+          pw->lexer.setSourceBuffer(mfs.data(), mfs.size());
+          pw->lexer.preLexAll();
+          ParseResult result = pw->parser.parse(pw->start);
+          if (!pw->parser.parseError() &&
+              result.isList(TILParser::TILP_SExpr)) {
+            auto ds = result.getList<SExpr>(TILParser::TILP_SExpr);
+            defs.assign(ds.begin(), ds.end());
+            ok = true;
+          }
+          else {
+            result.discard();
+          }
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        slots[i].defs.swap(defs);
+        slots[i].ok = ok;
+        slots[i].done = true;
+        doneCV.notify_all();
+      };
+
+      // The parse stage stays a bounded window ahead of the merge stage:
+      // a file's parse task is submitted only when the file a window back
+      // has been merged, so memory for parsed-but-unmerged files stays
+      // bounded no matter how long the file list is.
+      size_t window = nworkers * 2;
+      size_t submitted = 0;
+      for (; submitted < files.size() && submitted < window; ++submitted) {
+        size_t i = submitted;
+        pool.submit([&parseTask, i]() { parseTask(i); });
+      }
+
+      bool failed = false;
+      for (size_t i = 0; i < files.size() && !failed; ++i) {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          doneCV.wait(lock, [&slots, i]() { return slots[i].done; });
+          if (!slots[i].ok) {
+            abort = true;
+            failed = true;
+            break;
+          }
+        }
+        // Merge in list order while later files are still parsing.  The
+        // merge touches only the caller's global, never the workers.
+        FileSlot& slot = slots[i];
+        global->addDefinitions(
+            MutArrayRef<SExpr*>(slot.defs.data(), slot.defs.size()));
+        if (submitted < files.size()) {
+          size_t next = submitted++;
+          pool.submit([&parseTask, next]() { parseTask(next); });
+        }
+      }
+      // Wait for the tasks this call submitted, not for the whole pool:
+      // the pool's global pending count never reaches zero when the
+      // batch itself runs inside a pool task (as the registered corpus
+      // test does), so waitForAll() would never return there.
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        doneCV.wait(lock, [&slots, submitted]() {
+          for (size_t j = 0; j < submitted; ++j) {
+            if (!slots[j].done)
+              return false;
+          }
+          return true;
+        });
+      }
+
+      // The merged definitions live in the worker regions; the global
+      // owns them from here on, even if a later file failed to parse.
+      for (auto &w : workers) {
+        global->adoptRegion(w->stringRegion.release());
+        global->adoptRegion(w->parseRegion.release());
+      }
+      if (failed)
+        return false;
+      global->lowerParallel(pool);
+      return true;
+    }
+  }
+#endif
+
+  // Sequential fallback: parse the files in order, then lower.
+  for (const char* fname : files) {
+    if (!parseDefinitions(global, fname))
+      return false;
+  }
+  global->lower();
+  return true;
+}
+
+
+// Keeps a warm parser and global namespace resident across many small
+// compiles.  The grammar is parsed once by init(), resident definitions
+// (a prelude, standard library, etc.) are parsed once by loadResident(),
+// and every later request reuses them: before each request the global's
+// regions are rolled back to a checkpoint (see Global::capture), so a
+// small compile pays only for its own parsing and lowering, not for the
+// cold-start cost of rebuilding parser tables and preludes.
+//
+// serve() runs a request loop over a FILE* pair, so the server can sit
+// behind a pipe or socket; build systems that invoke the compiler
+// thousands of times connect once and stream requests instead.
+class CompileServer {
+public:
+  bool init(const char* grammarFileName) {
+    return driver.initParser(grammarFileName);
+  }
+
+  // Parse fname into the resident namespace.  Its definitions stay warm
+  // for every later request.  Must be called before the first compile.
+  bool loadResident(const char* fname) {
+    return driver.parseDefinitions(&global, fname);
+  }
+
+  // Compile Source as one request: parse, lower, and print the lowered
+  // namespace to Out.  Definitions made by one request are discarded
+  // when the next request begins.
+  bool compile(const char* Source, std::ostream &Out) {
+    // The interner's canonical strings live in the global's string
+    // arena, so it is rolled back in step with the arenas: strings
+    // interned by a discarded request would dangle otherwise.
+    if (global.captured()) {
+      global.restore();
+      driver.parser().stringInterner().rollback(internMark);
+    }
+    else {
+      global.capture();
+      internMark = driver.parser().stringInterner().size();
+    }
+    StringStream ss(Source);
+    if (!driver.parseDefinitions(&global, ss))
+      return false;
+    global.lower();
+    global.print(Out);
+    return true;
+  }
+
+  // Serve requests from In until end of file.  Each request is a header
+  // line "compile <nbytes>\n" followed by that many bytes of source; the
+  // reply is "ok <nbytes>\n" or "error <nbytes>\n" followed by the
+  // compiler output.  Returns the number of failed requests, or -1 on a
+  // malformed stream.
+  int serve(FILE* In, FILE* Out) {
+    int failed = 0;
+    char cmd[16];
+    unsigned long nbytes;
+    while (fscanf(In, "%15s %lu", cmd, &nbytes) == 2) {
+      fgetc(In);  // Consume the newline after the header.
+      if (strcmp(cmd, "compile") != 0)
+        return -1;
+      std::vector<char> buf(nbytes + 1, 0);
+      if (fread(buf.data(), 1, nbytes, In) != nbytes)
+        return -1;
+      std::stringstream reply;
+      bool ok = compile(buf.data(), reply);
+      if (!ok)
+        ++failed;
+      std::string text = reply.str();
+      fprintf(Out, "%s %lu\n", ok ? "ok" : "error",
+              static_cast<unsigned long>(text.size()));
+      fwrite(text.data(), 1, text.size(), Out);
+      fflush(Out);
+    }
+    return failed;
+  }
+
+  Global& globalNamespace() { return global; }
+
+private:
+  Driver driver;
+  Global global;
+  unsigned internMark = 0;  // interner size at capture; see compile()
+};
+
+
+// An incremental read-eval-print session for driving the compiler as an
+// embedded scripting engine, where per-interaction latency matters more
+// than throughput.  The grammar and a persistent Global stay warm across
+// inputs, as in CompileServer, and on top of that the session keeps
+// per-line caches:
+//
+//  - a scan cache keyed by the input line, holding the name the line
+//    defines and the identifiers it mentions, so repeated lines are
+//    never re-scanned;
+//  - a definition cache holding each definition's source and its last
+//    lowered, printed result.
+//
+// Identifier mentions form a (conservative, lexical) dependency graph
+// between definitions.  Re-entering a line whose dependency closure is
+// unchanged is answered straight from the cache, with no lexing,
+// parsing, or lowering at all.  When a definition changes, the session
+// rolls the namespace back to its checkpoint, replays the current
+// definitions, lowers once, and refreshes the cached results of exactly
+// the definitions whose dependencies changed.  (Lowering itself is
+// whole-namespace - see Global::lower - so the replay is shared; the
+// caches bound what must be rescanned and re-printed.)
+class InteractiveSession {
+public:
+  InteractiveSession() : numRebuilds(0) { }
+
+  bool init(const char* grammarFileName) {
+    return driver.initParser(grammarFileName);
+  }
+
+  // Parse fname into the resident namespace, below the checkpoint; its
+  // definitions survive every rebuild.
+  bool loadResident(const char* fname) {
+    return driver.parseDefinitions(&global, fname);
+  }
+
+  // Evaluate one input line holding a single top-level definition.
+  // Prints the lowered definition (cached when nothing it depends on
+  // has changed) and returns false if the line does not parse; the
+  // session state is unchanged in that case.
+  bool eval(const std::string &line, std::ostream &Out) {
+    auto ci = lineCache.find(line);
+    if (ci == lineCache.end()) {
+      LineInfo info;
+      scanIdentifiers(line.data(), line.size(), info.name, info.refs);
+      ci = lineCache.emplace(line, std::move(info)).first;
+    }
+    const LineInfo &info = ci->second;
+    if (info.name.empty()) {
+      Out << "error: expected a named definition.\n";
+      return false;
+    }
+
+    auto it = entries.find(info.name);
+    if (it != entries.end() && it->second.source == line &&
+        !it->second.dirty) {
+      Out << it->second.output;   // Nothing changed; replay the cache.
+      return true;
+    }
+
+    // Install the new or changed definition, remembering the previous
+    // one so a parse error can be rolled back.
+    bool existed = it != entries.end();
+    Entry saved;
+    if (existed)
+      saved = it->second;
+    Entry &e = entries[info.name];
+    e.source = line;
+    e.refs = info.refs;
+    e.dirty = true;
+    if (!existed)
+      order.push_back(info.name);
+    markDependentsDirty();
+
+    if (!rebuild()) {
+      // Revert to the previous definitions and rebuild those, so the
+      // namespace stays consistent with the caches.
+      if (existed)
+        entries[info.name] = saved;
+      else {
+        entries.erase(info.name);
+        order.pop_back();
+      }
+      rebuild();
+      Out << "error: input failed to parse.\n";
+      return false;
+    }
+    Out << entries[info.name].output;
+    return true;
+  }
+
+  // Number of restore-replay-lower passes made; re-entered inputs with
+  // unchanged dependencies do not rebuild.
+  unsigned rebuilds() const { return numRebuilds; }
+
+  Global& globalNamespace() { return global; }
+
+#ifndef _MSC_VER
+  // Drive the session from an interactive stream.  Characters are
+  // accumulated until a ';' at bracket depth zero completes a top-level
+  // definition, which is then evaluated as one input.  Returns the
+  // number of failed inputs.
+  int repl(InteractiveStream &stream, std::ostream &Out) {
+    std::string buf;
+    char chunk[256];
+    int failed = 0;
+    for (;;) {
+      unsigned n = stream.fillBuffer(chunk, sizeof(chunk));
+      if (n == 0)
+        break;
+      buf.append(chunk, n);
+      size_t end;
+      while ((end = firstDefinitionEnd(buf.data(), buf.size()))
+             != std::string::npos) {
+        if (!eval(buf.substr(0, end + 1), Out))
+          ++failed;
+        buf.erase(0, end + 1);
+        stream.resetPrompt();
+      }
+    }
+    return failed;
+  }
+#endif
+
+private:
+  // What the scanner extracts from one input line: the name it defines
+  // (the first identifier), and every other identifier it mentions.
+  // Mentions over-approximate references - a parameter name shadows a
+  // global without the scanner knowing - which can only make the session
+  // re-evaluate more than strictly needed, never less.
+  struct LineInfo {
+    std::string name;
+    std::vector<std::string> refs;
+  };
+
+  struct Entry {
+    std::string source;             // the defining input line
+    std::vector<std::string> refs;  // identifiers the source mentions
+    std::string output;             // last printed, lowered result
+    bool dirty;
+
+    Entry() : dirty(false) { }
+  };
+
+  // The lexical scan behind the line cache; comments and string and
+  // character literals are skipped, as in Driver::splitTopLevel.
+  static void scanIdentifiers(const char* buf, size_t len,
+                              std::string &name,
+                              std::vector<std::string> &refs) {
+    size_t i = 0;
+    while (i < len) {
+      char c = buf[i];
+      if (c == '/' && i + 1 < len && buf[i + 1] == '/') {
+        while (i < len && buf[i] != '\n')
+          ++i;
+        continue;
+      }
+      if (c == '"' || c == '\'') {
+        ++i;
+        while (i < len && buf[i] != c) {
+          if (buf[i] == '\\')
+            ++i;
+          ++i;
+        }
+        ++i;
+        continue;
+      }
+      if (isalpha(c) || c == '_') {
+        size_t start = i;
+        while (i < len && (isalnum(buf[i]) || buf[i] == '_'))
+          ++i;
+        std::string id(buf + start, i - start);
+        if (name.empty())
+          name = std::move(id);
+        else if (id != name &&
+                 std::find(refs.begin(), refs.end(), id) == refs.end())
+          refs.push_back(std::move(id));
+        continue;
+      }
+      ++i;
+    }
+  }
+
+  // Offset of the ';' completing the first top-level definition in
+  // buf, or npos if none is complete yet.
+  static size_t firstDefinitionEnd(const char* buf, size_t len) {
+    int depth = 0;
+    size_t i = 0;
+    while (i < len) {
+      char c = buf[i];
+      if (c == '/' && i + 1 < len && buf[i + 1] == '/') {
+        while (i < len && buf[i] != '\n')
+          ++i;
+        continue;
+      }
+      if (c == '"' || c == '\'') {
+        ++i;
+        while (i < len && buf[i] != c) {
+          if (buf[i] == '\\')
+            ++i;
+          ++i;
+        }
+        ++i;
+        continue;
+      }
+      switch (c) {
+      case '(': case '[': case '{':
+        ++depth;
+        break;
+      case ')': case ']': case '}':
+        --depth;
+        break;
+      case ';':
+        if (depth == 0)
+          return i;
+        break;
+      default:
+        break;
+      }
+      ++i;
+    }
+    return std::string::npos;
+  }
+
+  // Propagate dirtiness along the mention graph to a fixed point, so a
+  // changed definition also refreshes everything that refers to it,
+  // directly or transitively.
+  void markDependentsDirty() {
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (auto &kv : entries) {
+        if (kv.second.dirty)
+          continue;
+        for (const std::string &r : kv.second.refs) {
+          auto d = entries.find(r);
+          if (d != entries.end() && d->second.dirty) {
+            kv.second.dirty = true;
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // Roll the namespace back to the checkpoint, replay the current
+  // definitions in definition order, lower, and refresh the cached
+  // output of every dirty entry.
+  bool rebuild() {
+    // The interner rolls back with the arenas, as in CompileServer.
+    if (global.captured()) {
+      global.restore();
+      driver.parser().stringInterner().rollback(internMark);
+    }
+    else {
+      global.capture();
+      internMark = driver.parser().stringInterner().size();
+    }
+    if (order.empty())
+      return true;
+
+    std::string source;
+    for (const std::string &name : order) {
+      source += entries[name].source;
+      source += "\n";
+    }
+    StringStream ss(source.c_str());
+    if (!driver.parseDefinitions(&global, ss))
+      return false;
+    global.lower();
+    ++numRebuilds;
+
+    for (const std::string &name : order) {
+      Entry &e = entries[name];
+      if (!e.dirty)
+        continue;
+      std::stringstream out;
+      if (SExpr* def = global.findDefinition(
+              StringRef(name.data(), name.size())))
+        TILDebugPrinter::print(def, out);
+      out << "\n";
+      e.output = out.str();
+      e.dirty = false;
+    }
+    return true;
+  }
+
+  Driver driver;
+  Global global;
+  std::vector<std::string> order;          // names in definition order
+  std::map<std::string, Entry> entries;    // definitions by name
+  std::map<std::string, LineInfo> lineCache;  // scan results by line
+  unsigned numRebuilds;
+  unsigned internMark = 0;  // interner size at capture; see rebuild()
+};
+
+
+// Schedules independent test cases concurrently on the shared thread
+// pool, and records wall and cpu time per test.  Against a recorded
+// baseline file it flags tests whose runtime regressed beyond a
+// threshold, which turns the existing test corpus into a crude
+// continuous performance signal.
+//
+// Test bodies run in parallel, so they must not share mutable state;
+// give each test its own Driver, Global, and regions.
+class TestRunner {
+public:
+  typedef std::function<bool()> TestFn;
+
+  TestRunner() : regressionFactor_(1.5), numFailed_(0), numRegressed_(0) { }
+
+  void addTest(const std::string& name, TestFn fn) {
+    tests_.emplace_back(name, std::move(fn));
+  }
+
+  // A test regresses when its wall time exceeds factor * baseline.
+  void setRegressionFactor(double factor) { regressionFactor_ = factor; }
+
+  // Baseline files hold one "name seconds" line per test.
+  bool loadBaseline(const char* fname) {
+    FILE* file = fopen(fname, "r");
+    if (!file)
+      return false;
+    char name[256];
+    double seconds;
+    while (fscanf(file, "%255s %lf", name, &seconds) == 2)
+      baseline_[name] = seconds;
+    fclose(file);
+    return true;
+  }
+
+  bool saveBaseline(const char* fname) const {
+    FILE* file = fopen(fname, "w");
+    if (!file)
+      return false;
+    for (const TestCase& test : tests_)
+      fprintf(file, "%s %.6f\n", test.name.c_str(), test.wallSeconds);
+    fclose(file);
+    return true;
+  }
+
+  // Runs every test, nworkers at a time (0 uses one per hardware core),
+  // and prints a per-test report.  Returns true when every test passed;
+  // regressions are reported but do not fail the run (see regressed()).
+  //
+  // Test bodies run on dedicated threads, not on the shared ThreadPool:
+  // bodies are free to block on pool work of their own (batch compiles,
+  // parallel lowering), which would deadlock if the bodies themselves
+  // occupied every pool worker.
+  bool runAll(unsigned nworkers = 0) {
+    if (nworkers == 0) {
+      nworkers = std::thread::hardware_concurrency();
+      if (nworkers == 0)
+        nworkers = 1;
+    }
+    if (nworkers > tests_.size())
+      nworkers = static_cast<unsigned>(tests_.size());
+
+    // Tests are claimed off a shared cursor, so a worker that lands a
+    // slow test simply claims fewer of them.
+    std::atomic<size_t> next(0);
+    TestRunner* self = this;
+    auto worker = [self, &next]() {
+      for (size_t i = next++; i < self->tests_.size(); i = next++)
+        self->runOne(self->tests_[i]);
+    };
+    std::vector<std::thread> threads;
+    for (unsigned w = 1; w < nworkers; ++w)
+      threads.emplace_back(worker);
+    worker();
+    for (std::thread& t : threads)
+      t.join();
+
+    numFailed_ = 0;
+    numRegressed_ = 0;
+    for (const TestCase& test : tests_)
+      report(test);
+    std::cout << tests_.size() << " tests, " << numFailed_ << " failed, "
+              << numRegressed_ << " regressed.\n";
+    return numFailed_ == 0;
+  }
+
+  unsigned failed()    const { return numFailed_; }
+  unsigned regressed() const { return numRegressed_; }
+
+private:
+  struct TestCase {
+    std::string name;
+    TestFn fn;
+    bool passed;
+    double wallSeconds;
+    double cpuSeconds;
+
+    TestCase(const std::string& n, TestFn f)
+        : name(n), fn(std::move(f)), passed(false), wallSeconds(0.0),
+          cpuSeconds(0.0) { }
+  };
+
+  // Cpu time of the calling thread; tests run whole on one thread, so
+  // this is the test's own cpu time.  Falls back to wall time where no
+  // thread clock is available.
+  static double threadCpuSeconds() {
+#ifndef _MSC_VER
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) == 0)
+      return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+#endif
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static void runOne(TestCase& test) {
+    auto wallStart = std::chrono::steady_clock::now();
+    double cpuStart = threadCpuSeconds();
+    test.passed = test.fn();
+    test.cpuSeconds = threadCpuSeconds() - cpuStart;
+    test.wallSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - wallStart).count();
+  }
+
+  void report(const TestCase& test) {
+    if (!test.passed)
+      ++numFailed_;
+    std::cout << (test.passed ? "PASS" : "FAIL") << "  " << test.name
+              << "  wall " << test.wallSeconds * 1.0e3 << " ms"
+              << "  cpu " << test.cpuSeconds * 1.0e3 << " ms";
+    auto base = baseline_.find(test.name);
+    if (base != baseline_.end() &&
+        test.wallSeconds > base->second * regressionFactor_) {
+      ++numRegressed_;
+      std::cout << "  REGRESSED (baseline " << base->second * 1.0e3
+                << " ms)";
+    }
+    std::cout << "\n";
+  }
+
+  std::vector<TestCase> tests_;
+  std::map<std::string, double> baseline_;
+  double regressionFactor_;
+  unsigned numFailed_;
+  unsigned numRegressed_;
+};
+
 }  // end namespace ohmu
 
 
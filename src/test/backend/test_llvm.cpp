@@ -16,6 +16,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "backend/llvm/IRGen.h"
+#include "backend/llvm/JIT.h"
 #include "clang/Analysis/Analyses/ThreadSafetyTIL.h"
 #include "clang/Analysis/Analyses/ThreadSafetyTraverse.h"
 #include "parser/DefaultLexer.h"
@@ -83,13 +84,18 @@ int main(int argc, const char** argv) {
     return -1;
 
   // Pretty print the parsed ohmu code.
-  auto* v = result.getList<til::SExpr>(TILParser::TILP_SExpr);
-  if (!v) {
+  if (!result.isList(TILParser::TILP_SExpr)) {
     std::cout << "No definitions found.\n";
     return 0;
   }
+  auto v = result.getList<til::SExpr>(TILParser::TILP_SExpr);
 
-  for (SExpr* e : *v) {
+  // With -jit, run each definition in-process instead of only printing
+  // it; lazy materialization means only the entry function (and what it
+  // calls) is compiled.
+  bool runJit = argc > 2 && std::string(argv[2]) == "-jit";
+
+  for (SExpr* e : v) {
     std::cout << "\nDefinition:\n";
     printSExpr(e);
     std::cout << "\nCFG:\n";
@@ -97,10 +103,22 @@ int main(int argc, const char** argv) {
     printSExpr(e2);
 
     //backend_llvm::generate_LLVM_IR(cfg);
+    if (runJit) {
+      std::string error;
+      std::unique_ptr<backend_llvm::JITEngine> jit(backend_llvm::JITEngine::create(
+          backend_llvm::generate_LLVM_IR_module(e2), &error));
+      if (!jit) {
+        std::cout << "Cannot create JIT: " << error << "\n";
+        continue;
+      }
+      typedef void (*EntryFn)();
+      if (EntryFn entry = (EntryFn)jit->getFunction("ohmu_main"))
+        entry();
+      else
+        std::cout << "No ohmu_main in module.\n";
+    }
   }
 
-  delete v;
-
   std::cout << "\n";
   return 0;
 }
@@ -20,9 +20,12 @@
 //===----------------------------------------------------------------------===//
 
 #include "base/LLVMDependencies.h"
+#include "base/DenseBitSet.h"
 #include "base/MemRegion.h"
 #include "base/ArrayTree.h"
+#include "base/ThreadPool.h"
 
+#include <atomic>
 #include <vector>
 
 using namespace ohmu;
@@ -116,8 +119,141 @@ void testTreeArray() {
 
 
 
+void testTreeArrayAppend() {
+  MemRegion region;
+  MemRegionRef arena(&region);
+  ArrayTree<unsigned> atree;
+
+  unsigned n = 1000;
+  std::vector<unsigned> items;
+  for (unsigned i = 0; i < n; ++i)
+    items.push_back(i);
+
+  atree.append(arena, items.data(), 3);
+  atree.append(arena, items.data() + 3, n - 3);
+
+  for (unsigned i = 0; i < n; ++i) {
+    if (atree[i] != i)
+      error("Error: ArrayTree append failed.\n");
+  }
+
+  unsigned i = 0;
+  for (auto L : atree.leaves()) {
+    for (auto& H : L) {
+      if (H != i)
+        error("Error: ArrayTree leaf iteration failed.\n");
+      ++i;
+    }
+  }
+  if (i != n)
+    error("Error: ArrayTree leaf iteration failed.\n");
+}
+
+
+void testMemRegionRollback() {
+  MemRegion region;
+
+  region.allocate(64);
+  MemRegion::Checkpoint cp = region.checkpoint();
+
+  // Allocate enough to force several new blocks, plus a large block.
+  for (unsigned i = 0; i < 1024; ++i)
+    region.allocate(64);
+  region.allocate(4096);
+
+  region.rollback(cp);
+
+  // After rollback, the next allocation reuses the checkpointed position.
+  void* p = region.allocate(64);
+  region.rollback(cp);
+  void* q = region.allocate(64);
+  if (p != q)
+    error("Error: MemRegion rollback failed.\n");
+}
+
+
+void testThreadPool() {
+  ThreadPool pool(4);
+
+  unsigned n = 10000;
+  std::atomic<unsigned> sum(0);
+
+  pool.parallelFor(n, [&sum](size_t i) {
+    sum.fetch_add(static_cast<unsigned>(i));
+  });
+  if (sum.load() != (n * (n-1)) / 2)
+    error("Error: ThreadPool parallelFor failed.\n");
+
+  std::atomic<unsigned> count(0);
+  for (unsigned i = 0; i < 100; ++i)
+    pool.submit([&count]() { count.fetch_add(1); });
+  pool.waitForAll();
+  if (count.load() != 100)
+    error("Error: ThreadPool submit failed.\n");
+}
+
+
+void testDenseBitSet() {
+  MemRegion region;
+  MemRegionRef arena(&region);
+
+  // 200 bits spans several words, with a partial last word.
+  DenseBitSet a(arena, 200);
+  if (!a.empty() || a.count() != 0)
+    error("Error: new DenseBitSet should be empty.\n");
+
+  for (unsigned i = 0; i < 200; i += 3)
+    a.set(i);
+  if (a.count() != 67 || a.empty())
+    error("Error: DenseBitSet count failed.\n");
+  if (!a.test(63) || a.test(64))
+    error("Error: DenseBitSet test failed at a word boundary.\n");
+
+  unsigned expect = 0;
+  for (unsigned i : a) {
+    if (i != expect)
+      error("Error: DenseBitSet iteration out of order.\n");
+    expect += 3;
+  }
+  if (expect != 201)
+    error("Error: DenseBitSet iteration missed bits.\n");
+
+  DenseBitSet b(arena, 200);
+  for (unsigned i = 0; i < 200; i += 2)
+    b.set(i);
+
+  DenseBitSet c = a.clone(arena);
+  c &= b;                       // multiples of 6.
+  if (c.count() != 34)
+    error("Error: DenseBitSet operator&= failed.\n");
+
+  c.andNot(b);
+  if (!c.empty())
+    error("Error: DenseBitSet andNot failed.\n");
+
+  if (c.unionWith(b) != true || c != b)
+    error("Error: DenseBitSet unionWith should add bits.\n");
+  if (c.unionWith(b) != false)
+    error("Error: DenseBitSet unionWith found a false fixed point.\n");
+
+  if (!c.intersects(a) || c.testAndSet(0) != true || c.testAndSet(1) != false)
+    error("Error: DenseBitSet intersects/testAndSet failed.\n");
+
+  c.setAll();
+  if (c.count() != 200)
+    error("Error: DenseBitSet setAll leaked past capacity.\n");
+  c.clear();
+  if (!c.empty())
+    error("Error: DenseBitSet clear failed.\n");
+}
+
+
 int main(int argc, char** argv) {
   testTreeArray();
+  testTreeArrayAppend();
+  testMemRegionRollback();
+  testDenseBitSet();
+  testThreadPool();
   return 0;
 }
 
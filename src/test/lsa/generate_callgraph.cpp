@@ -10,11 +10,28 @@
 #include "llvm/Support/CommandLine.h"
 #include "lsa/BuildCallGraph.h"
 #include "lsa/GraphSerializer.h"
+#include "lsa/StreamingIRWriter.h"
+#include "lsa/TranslationCache.h"
+
+#include <memory>
 
 static llvm::cl::opt<std::string>
     OutputFile("o", llvm::cl::desc("Specify output file"),
                llvm::cl::value_desc("file"), llvm::cl::Optional);
 
+static llvm::cl::opt<std::string>
+    CacheFile("translation-cache",
+              llvm::cl::desc("Reuse per-function translation results from "
+                             "this file and update it for the next run"),
+              llvm::cl::value_desc("file"), llvm::cl::Optional);
+
+static llvm::cl::opt<std::string>
+    StreamFile("stream-ir",
+               llvm::cl::desc("Spill each function's IR to this file as it "
+                              "is translated, instead of holding the whole "
+                              "module in memory (requires -o)"),
+               llvm::cl::value_desc("file"), llvm::cl::Optional);
+
 int main(int argc, const char *argv[]) {
 
   clang::tooling::CommonOptionsParser OptParser(argc, argv,
@@ -22,7 +39,17 @@ int main(int argc, const char *argv[]) {
   ohmu::lsa::DefaultCallGraphBuilder CallGraphBuilder;
   clang::ast_matchers::MatchFinder Finder;
   ohmu::lsa::CallGraphBuilderTool BuilderTool;
-  BuilderTool.RegisterMatchers(CallGraphBuilder, &Finder);
+
+  ohmu::lsa::TranslationCache Cache;
+  bool UseCache = CacheFile.getNumOccurrences() > 0;
+  if (UseCache)
+    Cache.read(CacheFile.getValue());
+  std::unique_ptr<ohmu::lsa::StreamingIRWriter> Stream;
+  if (StreamFile.getNumOccurrences() > 0)
+    Stream.reset(new ohmu::lsa::StreamingIRWriter(StreamFile.getValue()));
+
+  BuilderTool.RegisterMatchers(CallGraphBuilder, &Finder, nullptr,
+                               UseCache ? &Cache : nullptr, Stream.get());
 
   clang::tooling::ClangTool Tool(OptParser.getCompilations(),
                                  OptParser.getSourcePathList());
@@ -31,8 +58,16 @@ int main(int argc, const char *argv[]) {
   if (Res != 0)
     return Res;
 
+  if (UseCache)
+    Cache.write(CacheFile.getValue());
+
   if (OutputFile.getNumOccurrences() > 0) {
-    ohmu::lsa::GraphSerializer::write(OutputFile.getValue(), &CallGraphBuilder);
+    if (Stream)
+      ohmu::lsa::GraphSerializer::write(OutputFile.getValue(),
+                                        &CallGraphBuilder, Stream.get());
+    else
+      ohmu::lsa::GraphSerializer::write(OutputFile.getValue(),
+                                        &CallGraphBuilder);
   } else {
     CallGraphBuilder.Print(std::cout);
   }
@@ -16,6 +16,7 @@
 //===----------------------------------------------------------------------===//
 
 #include "lsa/examples/SCCComputation.h"
+#include "lsa/SCCEngine.h"
 #include "lsa/StandaloneRunner.h"
 
 int main(int argc, const char *argv[]) {
@@ -23,7 +24,19 @@ int main(int argc, const char *argv[]) {
   ohmu::lsa::StandaloneRunner<ohmu::lsa::SCCComputation> Runner(argc, argv);
 
   Runner.readCallGraph();
-  Runner.runComputation();
+
+  // The native engine resolves the components directly on the call
+  // graph, replacing O(diameter) supersteps of label propagation; each
+  // vertex's value gets its component representative as both partition
+  // halves, matching the converged output of SCCComputation.
+  ohmu::lsa::computeStronglyConnectedComponents(
+      &Runner.graphBuilder(), Runner.numThreads(),
+      [&Runner](const string &Id, const string &Representative) {
+        ohmu::lsa::SCCNode Value;
+        Value.ForwardMin = Representative;
+        Value.BackwardMin = Representative;
+        Runner.graphBuilder().setVertexValue(Id, Value);
+      });
   Runner.printComputationResult();
 
   return 0;
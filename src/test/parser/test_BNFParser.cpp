@@ -20,6 +20,7 @@
 
 #include "parser/DefaultLexer.h"
 #include "parser/BNFParser.h"
+#include "parser/GrammarFile.h"
 #include "parser/TILParser.h"
 
 using namespace ohmu::parsing;
@@ -37,8 +38,29 @@ int bootstrapBNF() {
   }
 
   BNFParser::initParserFromFile(bootstrapBNFParser, file, false);
-  bootstrapBNFParser.printSyntax(std::cout);
 
+  // Round-trip the grammar through the precompiled binary format, and
+  // print the restored copy.  The output should be identical to printing
+  // bootstrapBNFParser directly.
+  FILE* binFile = tmpfile();
+  if (!binFile || !GrammarFile::writeParserFile(bootstrapBNFParser, binFile)) {
+    std::cout << "Could not write precompiled grammar.\n";
+    fclose(file);
+    return -1;
+  }
+  rewind(binFile);
+
+  ohmu::parsing::DefaultLexer restoredLexer;
+  ohmu::parsing::BNFParser restoredParser(&restoredLexer);
+  if (!GrammarFile::initParserFromFile(restoredParser, binFile)) {
+    std::cout << "Could not load precompiled grammar.\n";
+    fclose(binFile);
+    fclose(file);
+    return -1;
+  }
+  restoredParser.printSyntax(std::cout);
+
+  fclose(binFile);
   fclose(file);
   return 0;
 }
@@ -0,0 +1,288 @@
+//===- test_corpus.cpp -----------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// Parses and lowers every golden file in the corpus, scheduled
+// concurrently on the thread pool with per-test timing (see TestRunner
+// in test/Driver.h).
+//
+//   test_corpus [-baseline FILE] [-save FILE] file.ohmu...
+//
+// With -baseline, tests whose runtime regressed beyond the threshold
+// against the recorded times are flagged; -save records the times of
+// this run as the new baseline.
+//
+//===----------------------------------------------------------------------===//
+
+#include "test/Driver.h"
+
+#include <cstring>
+
+#ifndef _MSC_VER
+#include <unistd.h>
+#endif
+
+using namespace ohmu;
+
+
+// Parse and lower one file, with a driver and global of its own so the
+// tests share no mutable state.
+static bool parseAndLower(const char* fname) {
+  Driver driver;
+  if (!driver.initParser("src/grammar/ohmu.grammar"))
+    return false;
+  Global global;
+  if (!driver.parseDefinitions(&global, fname))
+    return false;
+  global.lower();
+  return true;
+}
+
+
+// A compile server keeps the parsed grammar warm, and rolls request
+// definitions back between compiles: the same request compiled twice
+// must produce the same output, with no leftovers from the first run.
+static bool testCompileServer() {
+  CompileServer server;
+  if (!server.init("src/grammar/ohmu.grammar"))
+    return false;
+
+  const char* src = "foo(a: Int, b: Int): Int -> a + b;";
+  std::stringstream first, second;
+  if (!server.compile(src, first) || !server.compile(src, second))
+    return false;
+  if (first.str().empty() || first.str() != second.str())
+    return false;
+
+  // The same requests over the pipe protocol.
+  FILE* in = tmpfile();
+  FILE* out = tmpfile();
+  if (!in || !out)
+    return false;
+  for (int i = 0; i < 2; ++i) {
+    fprintf(in, "compile %lu\n", static_cast<unsigned long>(strlen(src)));
+    fwrite(src, 1, strlen(src), in);
+  }
+  rewind(in);
+  bool ok = server.serve(in, out) == 0;
+  fclose(in);
+  fclose(out);
+  return ok;
+}
+
+
+#ifndef _MSC_VER
+// Write text to a fresh temporary file, and return its path.
+static bool writeTempFile(const char* text, std::string& path) {
+  char name[] = "/tmp/ohmu_batch_XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0)
+    return false;
+  size_t len = strlen(text);
+  bool ok = write(fd, text, len) == static_cast<ssize_t>(len);
+  close(fd);
+  path = name;
+  return ok;
+}
+#endif
+
+
+// Batch-compiles a small file list into one shared namespace, and
+// requires both definitions to resolve and the result to match the same
+// files compiled sequentially.
+static bool testBatchCompile() {
+#ifndef _MSC_VER
+  std::string file1, file2;
+  if (!writeTempFile("f1(a: Int): Int -> a + 1;", file1) ||
+      !writeTempFile("f2(a: Int): Int -> a + 2;", file2))
+    return false;
+  std::vector<const char*> files;
+  files.push_back(file1.c_str());
+  files.push_back(file2.c_str());
+
+  bool ok = false;
+  {
+    Driver driver;
+    Global global;
+    std::stringstream batched, sequential;
+    ok = driver.initParser("src/grammar/ohmu.grammar") &&
+         driver.compileBatch(&global, files) &&
+         global.findDefinition("f1") && global.findDefinition("f2");
+    if (ok) {
+      global.print(batched);
+
+      Driver seqDriver;
+      Global seqGlobal;
+      ok = seqDriver.initParser("src/grammar/ohmu.grammar") &&
+           seqDriver.parseDefinitions(&seqGlobal, files[0]) &&
+           seqDriver.parseDefinitions(&seqGlobal, files[1]);
+      if (ok) {
+        seqGlobal.lower();
+        seqGlobal.print(sequential);
+        ok = !batched.str().empty() && batched.str() == sequential.str();
+      }
+    }
+  }
+  unlink(file1.c_str());
+  unlink(file2.c_str());
+  return ok;
+#else
+  return true;
+#endif
+}
+
+
+// The parallel definition parser splits a file into top-level chunks
+// and parses them on worker parsers; the result must match the same
+// file parsed sequentially, with definitions still in source order.
+static bool testParallelParseParity() {
+#ifndef _MSC_VER
+  std::string path;
+  if (!writeTempFile("f1(a: Int): Int -> a + 1;\n"
+                     "f2(a: Int): Int -> a + 2;\n"
+                     "f3(a: Int): Int -> a * 3;\n"
+                     "f4(a: Int): Int -> a * 4;\n", path))
+    return false;
+
+  bool ok = false;
+  {
+    Driver seqDriver;
+    Global seqGlobal;
+    std::stringstream sequential, parallel;
+    ok = seqDriver.initParser("src/grammar/ohmu.grammar") &&
+         seqDriver.parseDefinitions(&seqGlobal, path.c_str());
+    if (ok) {
+      seqGlobal.lower();
+      seqGlobal.print(sequential);
+
+      // More workers than the pool has threads still exercises the
+      // chunked path; parallelFor lets the caller claim worker indices.
+      Driver parDriver;
+      Global parGlobal;
+      ok = parDriver.initParser("src/grammar/ohmu.grammar") &&
+           parDriver.parseDefinitionsParallel(&parGlobal, path.c_str(), 4);
+      if (ok) {
+        parGlobal.lower();
+        parGlobal.print(parallel);
+        ok = !sequential.str().empty() &&
+             sequential.str() == parallel.str();
+      }
+    }
+  }
+  unlink(path.c_str());
+  return ok;
+#else
+  return true;
+#endif
+}
+
+
+// An interactive session caches evaluated definitions: re-entering an
+// unchanged line must not rebuild, redefining a definition must refresh
+// its dependents, and a bad input must leave the session intact.
+static bool testInteractiveSession() {
+  InteractiveSession session;
+  if (!session.init("src/grammar/ohmu.grammar"))
+    return false;
+
+  const char* defA  = "a(x: Int): Int -> x + 1;";
+  const char* defB  = "b(x: Int): Int -> a(x);";
+  const char* defA2 = "a(x: Int): Int -> x + 2;";
+
+  std::stringstream outA, outB1, outB2, outB3;
+  if (!session.eval(defA, outA) || !session.eval(defB, outB1))
+    return false;
+  if (outA.str().empty() || outB1.str().empty())
+    return false;
+  unsigned builds = session.rebuilds();
+
+  // Re-entering b with nothing changed is a pure cache hit.
+  if (!session.eval(defB, outB2))
+    return false;
+  if (session.rebuilds() != builds || outB2.str() != outB1.str())
+    return false;
+
+  // Redefining a dirties b; the rebuild refreshes b's cached result, so
+  // re-entering b afterwards is a cache hit again.
+  std::stringstream outA2;
+  if (!session.eval(defA2, outA2) || outA2.str() == outA.str())
+    return false;
+  builds = session.rebuilds();
+  if (!session.eval(defB, outB3) || session.rebuilds() != builds)
+    return false;
+
+  // A parse error reports failure and leaves the definitions usable.
+  std::stringstream outErr, outB4;
+  if (session.eval("broken(", outErr))
+    return false;
+  return session.eval(defB, outB4) && outB4.str() == outB3.str();
+}
+
+
+// Lowers a source file with a loop and mutable locals all the way to a
+// CFG.  Nested functions make TypedEvaluator clone and share scope
+// environments heavily (see PersistentStack in AttributeGrammar.h), so
+// this covers the lowering path end to end, not just parsing.
+static bool testLowerSSA() {
+  Driver driver;
+  if (!driver.initParser("src/grammar/ohmu.grammar"))
+    return false;
+  Global global;
+  if (!driver.parseDefinitions(&global, "src/ohmu/test_ssa.ohmu"))
+    return false;
+  global.lower();
+  if (!global.findDefinition("sum"))
+    return false;
+
+  std::stringstream out;
+  global.print(out);
+  const std::string& s = out.str();
+  return s.find("phi(") != std::string::npos &&
+         s.find("goto") != std::string::npos;
+}
+
+
+int main(int argc, const char** argv) {
+  const char* baselineFile = nullptr;
+  const char* saveFile = nullptr;
+
+  TestRunner runner;
+  runner.addTest("compile-server", testCompileServer);
+  runner.addTest("batch-compile", testBatchCompile);
+  runner.addTest("parallel-parse", testParallelParseParity);
+  runner.addTest("interactive-session", testInteractiveSession);
+  runner.addTest("lower-ssa", testLowerSSA);
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-baseline") == 0 && i + 1 < argc)
+      baselineFile = argv[++i];
+    else if (strcmp(argv[i], "-save") == 0 && i + 1 < argc)
+      saveFile = argv[++i];
+    else {
+      const char* fname = argv[i];
+      runner.addTest(fname, [fname]() { return parseAndLower(fname); });
+    }
+  }
+
+  if (baselineFile && !runner.loadBaseline(baselineFile))
+    std::cout << "Cannot read baseline " << baselineFile << ".\n";
+
+  bool passed = runner.runAll();
+
+  if (saveFile && !runner.saveBaseline(saveFile))
+    std::cout << "Cannot write baseline " << saveFile << ".\n";
+
+  return passed ? 0 : -1;
+}
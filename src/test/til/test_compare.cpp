@@ -288,6 +288,24 @@ void testEquals(const SExpr *E1, const SExpr *E2, bool exp) {
   } else {
     successTests++;
   }
+
+  // Equal expressions must hash alike, and comparing again with the
+  // hashes now cached must not change the result.
+  tests++;
+  uint32_t H1 = HashComparator::hashCode(E1);
+  uint32_t H2 = HashComparator::hashCode(E2);
+  if ((exp && H1 != H2) ||
+      EqualsComparator::compareExprs(E1, E2) != exp) {
+    std::cout << "Hash test failed, expected " << exp << "." << std::endl;
+    std::cout << "Comparing" << std::endl;
+    TILDebugPrinter::print(E1, std::cout);
+    std::cout << std::endl << "with" << std::endl;
+    TILDebugPrinter::print(E2, std::cout);
+    std::cout << std::endl;
+    failedTests++;
+  } else {
+    successTests++;
+  }
 }
 
 void testEquals(const char *I1, const char *I2, bool exp) {
@@ -303,6 +321,32 @@ void testEquals(const char *I1, const char *I2, bool exp) {
   testEquals(E1, E2, exp);
 }
 
+// An in-place rewrite must drop the cached hash, so that a later
+// comparison sees the new contents rather than rejecting on a stale
+// hash.
+void testHashInvalidation() {
+  MemRegion    region;
+  MemRegionRef arena(&region);
+  CFGBuilder   builder(arena);
+
+  auto *e1 = builder.newBinaryOp(BOP_Add, builder.newLiteralT<int>(1),
+                                 builder.newLiteralT<int>(2));
+  auto *e2 = builder.newBinaryOp(BOP_Add, builder.newLiteralT<int>(1),
+                                 builder.newLiteralT<int>(3));
+  tests++;
+  HashComparator::hashCode(e1);
+  HashComparator::hashCode(e2);
+  e1->rewrite(e1->expr0(), e2->expr1());   // e1 becomes 1+3.
+  if (e1->hashCode() != 0 ||
+      !EqualsComparator::compareExprs(e1, e2) ||
+      HashComparator::hashCode(e1) != HashComparator::hashCode(e2)) {
+    std::cout << "Hash invalidation test failed." << std::endl;
+    failedTests++;
+  } else {
+    successTests++;
+  }
+}
+
 void testCompare() {
   MemRegion    region;
   MemRegionRef arena(&region);
@@ -344,6 +388,9 @@ void testCompare() {
   // Testing larger AST.
   testEquals(makeModule(builder), makeModule(builder), true);
 
+  // Cached hashes.
+  testHashInvalidation();
+
   std::cout << "Ran " << tests << " tests. ";
   std::cout << failedTests << " failed, ";
   std::cout << (tests - successTests - failedTests) << " aborted." << std::endl;
@@ -19,11 +19,14 @@
 
 #include "til/Bytecode.h"
 #include "til/CFGBuilder.h"
+#include "til/SSAPass.h"
 #include "til/TILPrettyPrint.h"
 
 
 #include <memory>
 #include <iostream>
+#include <sstream>
+#include <vector>
 
 using namespace ohmu;
 using namespace til;
@@ -70,6 +73,13 @@ void testByteStream() {
       sign = -sign;
     }
 
+    std::vector<uint32_t> grp;
+    for (unsigned i = 0; i < 1000; ++i)
+      grp.push_back(i * i * 4097);   // mix of 1 to 4 byte values
+    grp.push_back(0);
+    grp.push_back(0xFFFFFFFFu);
+    writer.writeUInt32Group(grp.data(), grp.size());
+
     writer.writeString("Done.");
     writer.flush();
 
@@ -134,6 +144,14 @@ void testByteStream() {
     sign = -sign;
   }
 
+  std::vector<uint32_t> grp(1002);
+  uint32_t ngrp = reader.readUInt32Group(grp.data(), grp.size());
+  CHECK(ngrp == 1002);
+  for (unsigned i = 0; i < 1000; ++i)
+    CHECK(grp[i] == i * i * 4097);
+  CHECK(grp[1000] == 0);
+  CHECK(grp[1001] == 0xFFFFFFFFu);
+
   s = reader.readString();
   CHECK(s == "Done.");
 }
@@ -396,8 +414,174 @@ void testSerialization() {
 
 
 
+// Identifier strings are deduplicated: a repeated name costs a varint
+// reference to its first occurrence, not another copy of the bytes.
+void testStringTable() {
+  MemRegion    region;
+  MemRegionRef arena(&region);
+  CFGBuilder   builder(arena);
+
+  StringRef name("a_rather_long_slot_name");
+  SExpr* e = builder.newLiteralT<int>(0);
+  for (int i = 0; i < 20; ++i)
+    e = builder.newProject(e, name);
+
+  BytecodeStringWriter writeStream;
+  BytecodeWriter writer(&writeStream);
+  writer.write(e);
+  std::string buffer = writeStream.str();
+
+  // Twenty occurrences should cost one copy of the string plus small
+  // references, not twenty copies.
+  CHECK(buffer.size() < name.size() * 3 + 64);
+
+  InMemoryReader readStream(buffer.data(), buffer.size(), arena);
+  BytecodeReader reader(builder, &readStream);
+  auto* e2 = reader.read();
+  CHECK(reader.success());
+  auto* p = cast<Project>(e2);
+  for (int i = 0; i < 20; ++i) {
+    CHECK(p->slotName() == name);
+    p = dyn_cast<Project>(p->record());
+  }
+  CHECK(p == nullptr);
+  std::cout << "String table ok (" << buffer.size() << " bytes).\n";
+}
+
+
+void testChunkedSerialization() {
+  MemRegion    region;
+  MemRegionRef arena(&region);
+  CFGBuilder   builder(arena);
+
+  BytecodeStringWriter writeStream;
+  BytecodeChunkWriter  chunkWriter(&writeStream);
+
+  std::vector<std::string> expected;
+  for (int i = 0; i < 32; ++i) {
+    auto* e = builder.newBinaryOp(BOP_Add, builder.newLiteralT<int>(i),
+                                  builder.newLiteralT<int>(i * 100));
+    std::stringstream ss;
+    TILDebugPrinter::print(e, ss);
+    expected.push_back(ss.str());
+    chunkWriter.addChunk(e);
+  }
+  chunkWriter.write();
+  std::string buffer = writeStream.str();
+  std::cout << "Chunked output " << buffer.size() << " bytes.\n";
+
+  ThreadPool pool(4);
+  BytecodeChunkReader reader(pool);
+  reader.readAll(buffer.data(), buffer.size());
+
+  CHECK(reader.success());
+  CHECK(reader.results().size() == 32);
+  for (unsigned i = 0; i < 32; ++i) {
+    std::stringstream ss;
+    TILDebugPrinter::print(reader.results()[i], ss);
+    CHECK(ss.str() == expected[i]);
+  }
+  auto regions = reader.takeRegions();
+  CHECK(regions.size() > 0);
+  std::cout << "Chunked round trip ok.\n";
+}
+
+
+SCFG* makeDiamondCFG(CFGBuilder& bld) {
+  auto *intTy = bld.newScalarType(BaseType::getBaseType<int>());
+  auto *cfg = bld.beginCFG(nullptr);
+
+  bld.beginBlock(cfg->entry());
+  auto *v = bld.newAlloc(bld.newField(intTy, bld.newLiteralT<int>(0)),
+                         Alloc::AK_Local);
+  auto *thenB = bld.newBlock();
+  auto *elseB = bld.newBlock();
+  auto *joinB = bld.newBlock();
+  auto *cond = bld.newBinaryOp(BOP_Leq, bld.newLoad(v),
+                               bld.newLiteralT<int>(1));
+  cond->setBaseType(BaseType::getBaseType<bool>());
+  bld.newBranch(cond, thenB, elseB);
+
+  bld.beginBlock(thenB);
+  bld.newStore(v, bld.newLiteralT<int>(2));
+  bld.newGoto(joinB);
+
+  bld.beginBlock(elseB);
+  bld.newStore(v, bld.newLiteralT<int>(3));
+  bld.newGoto(joinB);
+
+  bld.beginBlock(joinB);
+  auto *r = bld.newLoad(v);
+  bld.newGoto(cfg->exit(), r);
+
+  bld.endCFG();
+  return cfg;
+}
+
+
+void testCFGNativeSerialization() {
+  MemRegion    region;
+  MemRegionRef arena(&region);
+  CFGBuilder   builder(arena);
+
+  // Convert to SSA so that the CFG has phi nodes to round trip.
+  SCFG *cfg = makeDiamondCFG(builder);
+  cfg->computeNormalForm();
+  SSAPass ssaPass(arena);
+  ssaPass.scope()->enterNullScope(0);
+  ssaPass.traverseAll(cfg);
+  cfg->computeNormalForm();
+
+  CHECK(CFGNativeWriter::canEncode(cfg));
+
+  // Round trip through the traversal-based form for reference.  Both
+  // readers normalize the CFG the same way (dead slots dropped,
+  // predecessors in block order), so their results should be identical.
+  BytecodeStringWriter refStream;
+  BytecodeWriter refWriter(&refStream);
+  refWriter.write(cfg);
+  std::string refBuffer = refStream.str();
+
+  MemRegion    refRegion;
+  MemRegionRef refArena(&refRegion);
+  CFGBuilder   refBuilder(refArena);
+  InMemoryReader refReadStream(refBuffer.data(), refBuffer.size(), refArena);
+  BytecodeReader refReader(refBuilder, &refReadStream);
+  auto *refCfg = cast<SCFG>(refReader.read());
+  CHECK(refReader.success());
+  refCfg->computeNormalForm();
+  std::stringstream expected;
+  TILDebugPrinter::print(refCfg, expected);
+
+  BytecodeStringWriter writeStream;
+  CFGNativeWriter writer(&writeStream);
+  CHECK(writer.writeCFG(cfg));
+  std::string buffer = writeStream.str();
+  std::cout << "CFG-native output " << buffer.size() << " bytes ("
+            << refBuffer.size() << " traversal-based).\n";
+
+  MemRegion    region2;
+  MemRegionRef arena2(&region2);
+  CFGBuilder   builder2(arena2);
+  InMemoryReader readStream(buffer.data(), buffer.size(), arena2);
+  CFGNativeReader reader(builder2, &readStream);
+  SCFG *cfg2 = reader.readCFG();
+  CHECK(cfg2 != nullptr);
+  CHECK(reader.success());
+
+  cfg2->computeNormalForm();
+  std::stringstream read;
+  TILDebugPrinter::print(cfg2, read);
+  CHECK(expected.str() == read.str());
+  std::cout << "CFG-native round trip ok.\n";
+}
+
+
 int main(int argc, const char** argv) {
   testByteStream();
   testSerialization();
+  testStringTable();
+  testChunkedSerialization();
+  testCFGNativeSerialization();
 }
 
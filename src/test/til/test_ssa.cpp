@@ -0,0 +1,464 @@
+//===- test_ssa.cpp --------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// Tests on-the-fly SSA construction in CFGBuilder.
+//
+//===----------------------------------------------------------------------===//
+
+#include "til/AnnotationImpl.h"
+#include "til/AnnotationIndex.h"
+#include "til/CFGBuilder.h"
+#include "til/PassManager.h"
+#include "til/SimplifyCFG.h"
+#include "til/TILPrettyPrint.h"
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+using namespace ohmu;
+using namespace til;
+
+static int numErrors = 0;
+
+void check(bool B, const char* Msg) {
+  if (!B) {
+    std::cout << "FAILED: " << Msg << "\n";
+    ++numErrors;
+  }
+}
+
+
+// x = 1; y = 1; if (c) x = 2; else x = 3; return x + y
+// x needs a phi node at the join point; y does not.
+SCFG* makeDiamond(CFGBuilder& bld) {
+  bld.beginCFG(nullptr);
+  auto* cfg = bld.currentCFG();
+
+  unsigned x = bld.newLocalVar("x");
+  unsigned y = bld.newLocalVar("y");
+
+  bld.beginBlock(cfg->entry());
+  bld.sealBlock(cfg->entry());
+  auto* one = bld.newLiteralT<int>(1);
+  bld.writeLocalVar(x, one);
+  bld.writeLocalVar(y, one);
+  auto* cond = bld.newLiteralT<bool>(true);
+  auto* b1 = bld.newBlock();
+  auto* b2 = bld.newBlock();
+  auto* b3 = bld.newBlock();
+  bld.newBranch(cond, b1, b2);
+  bld.sealBlock(b1);
+  bld.sealBlock(b2);
+
+  bld.beginBlock(b1);
+  bld.writeLocalVar(x, bld.newLiteralT<int>(2));
+  bld.newGoto(b3);
+
+  bld.beginBlock(b2);
+  bld.writeLocalVar(x, bld.newLiteralT<int>(3));
+  bld.newGoto(b3);
+  bld.sealBlock(b3);
+
+  bld.beginBlock(b3);
+  auto* xv = bld.readLocalVar(x);
+  auto* yv = bld.readLocalVar(y);
+  check(isa<Phi>(xv), "x should merge in a phi node");
+  check(yv == one, "y should not need a phi node");
+  check(b3->numArguments() == 1, "join block should have one argument");
+  auto* sum = bld.newBinaryOp(BOP_Add, xv, yv);
+  sum->setBaseType(BaseType::getBaseType<int>());
+  bld.newGoto(cfg->exit(), sum);
+
+  bld.endCFG();
+  return cfg;
+}
+
+
+// i = 0; j = 1; while (i <= 10) i = i + 1; return i
+// The loop header is read before it is sealed; i needs a phi node, and
+// the incomplete phi node made for j must be eliminated as trivial.
+SCFG* makeLoop(CFGBuilder& bld) {
+  bld.beginCFG(nullptr);
+  auto* cfg = bld.currentCFG();
+
+  unsigned i = bld.newLocalVar("i");
+  unsigned j = bld.newLocalVar("j");
+
+  bld.beginBlock(cfg->entry());
+  bld.sealBlock(cfg->entry());
+  bld.writeLocalVar(i, bld.newLiteralT<int>(0));
+  auto* jdef = bld.newLiteralT<int>(1);
+  bld.writeLocalVar(j, jdef);
+  auto* header = bld.newBlock();
+  bld.newGoto(header);
+
+  // The back-edge has not been added yet, so header is not sealed.
+  bld.beginBlock(header);
+  auto* iv = bld.readLocalVar(i);
+  auto* jv = bld.readLocalVar(j);
+  check(isa<Phi>(iv), "loop variable should merge in a phi node");
+  check(isa<Phi>(jv), "unsealed reads should make an incomplete phi node");
+  auto* cond = bld.newBinaryOp(BOP_Leq, iv, bld.newLiteralT<int>(10));
+  cond->setBaseType(BaseType::getBaseType<bool>());
+  auto* body = bld.newBlock();
+  auto* done = bld.newBlock();
+  bld.newBranch(cond, body, done);
+  bld.sealBlock(body);
+  bld.sealBlock(done);
+
+  bld.beginBlock(body);
+  auto* i2 = bld.newBinaryOp(BOP_Add, bld.readLocalVar(i),
+                             bld.newLiteralT<int>(1));
+  i2->setBaseType(BaseType::getBaseType<int>());
+  bld.writeLocalVar(i, i2);
+  bld.newGoto(header);
+  bld.sealBlock(header);
+
+  check(header->numArguments() == 1,
+        "only the loop variable should become an argument");
+  check(header->arguments()[0] == iv, "phi node for i should survive");
+
+  bld.beginBlock(done);
+  check(bld.readLocalVar(i) == iv, "read of i should find the phi node");
+  check(bld.readLocalVar(j) == jdef,
+        "trivial phi node for j should collapse to its value");
+  bld.newGoto(cfg->exit(), bld.readLocalVar(i));
+
+  bld.endCFG();
+  return cfg;
+}
+
+
+// Counts the nodes that flow through the fused pipeline.
+class CountPass : public InplaceMicroPass {
+public:
+  Instruction* reduceInstruction(Instruction *I, CFGBuilder &Builder) {
+    ++NumInstrs;
+    return I;
+  }
+  void enterBlock(BasicBlock *B, CFGBuilder &Builder) { ++NumBlocks; }
+  void reduceTerminator(Terminator *T, CFGBuilder &Builder) { ++NumTerms; }
+
+  CountPass() : NumInstrs(0), NumBlocks(0), NumTerms(0) { }
+
+  unsigned NumInstrs;
+  unsigned NumBlocks;
+  unsigned NumTerms;
+};
+
+
+// Run two counting passes over cfg in a single fused walk, and check
+// that both see every node and that the walk leaves the CFG unchanged.
+void testPassPipeline(CFGBuilder& bld, SCFG* cfg) {
+  std::stringstream before;
+  TILDebugPrinter::print(cfg, before);
+
+  InplacePassPipeline<CountPass, CountPass> pipeline(bld.arena());
+  pipeline.scope()->enterNullScope(0);
+  pipeline.traverseAll(cfg);
+
+  CountPass& p0 = pipeline.pass<0>();
+  CountPass& p1 = pipeline.pass<1>();
+  check(p0.NumBlocks == cfg->numBlocks(),
+        "pipeline should enter every block");
+  check(p0.NumInstrs == p1.NumInstrs &&
+        p0.NumBlocks == p1.NumBlocks &&
+        p0.NumTerms  == p1.NumTerms,
+        "every pass in the pipeline should see every node");
+  check(p0.NumTerms == cfg->numBlocks(),
+        "every block should end in a terminator");
+
+  std::stringstream after;
+  TILDebugPrinter::print(cfg, after);
+  check(before.str() == after.str(),
+        "counting passes should not change the CFG");
+}
+
+
+// entry: dead = 1+1; goto b1;  b1: goto b2;  b2: sum = 1+1; goto exit(sum)
+// The dead add should be deleted, the empty block b1 threaded away, and
+// b2 merged into the entry block, leaving just the entry and exit blocks.
+void testSimplifyCFG(CFGBuilder& bld) {
+  bld.beginCFG(nullptr);
+  auto* cfg = bld.currentCFG();
+
+  bld.beginBlock(cfg->entry());
+  bld.sealBlock(cfg->entry());
+  auto* one = bld.newLiteralT<int>(1);
+  auto* dead = bld.newBinaryOp(BOP_Add, one, one);
+  dead->setBaseType(BaseType::getBaseType<int>());
+  auto* b1 = bld.newBlock();
+  auto* b2 = bld.newBlock();
+  bld.newGoto(b1);
+  bld.sealBlock(b1);
+
+  bld.beginBlock(b1);
+  bld.newGoto(b2);
+  bld.sealBlock(b2);
+
+  bld.beginBlock(b2);
+  auto* sum = bld.newBinaryOp(BOP_Add, one, one);
+  sum->setBaseType(BaseType::getBaseType<int>());
+  bld.newGoto(cfg->exit(), sum);
+
+  bld.endCFG();
+  cfg->computeNormalForm();
+  check(cfg->numBlocks() == 4, "test CFG should start with four blocks");
+
+  check(SimplifyCFG::simplify(cfg), "simplify should change the CFG");
+  check(cfg->numBlocks() == 2,
+        "simplify should leave only the entry and exit blocks");
+  check(cfg->entry()->numInstructions() == 1,
+        "the dead add should be deleted, and the live one kept");
+  check(cfg->exit()->numArguments() == 1,
+        "the return value phi node should be kept");
+  check(!SimplifyCFG::simplify(cfg), "simplify should reach a fixpoint");
+
+  std::cout << "Simplified:\n";
+  TILDebugPrinter::print(cfg, std::cout);
+  std::cout << "\n";
+}
+
+
+// The flat view should list every instruction in schedule order, with
+// block offsets marking the boundaries.
+void testFlatView(SCFG* cfg) {
+  cfg->renumber();
+  auto instrs = cfg->instrs();
+
+  unsigned total = 0;
+  for (auto &B : cfg->blocks()) {
+    unsigned i = cfg->blockOffset(B->blockID());
+    if (B->numArguments() > 0)
+      check(instrs[i] == B->arguments()[0],
+            "block offset should point at the first argument");
+    else if (B->numInstructions() > 0)
+      check(instrs[i] == B->instructions()[0],
+            "block offset should point at the first instruction");
+    else
+      check(instrs[i] == B->terminator(),
+            "block offset should point at the terminator");
+    total += B->numArguments() + B->numInstructions() +
+             (B->terminator() ? 1 : 0);
+  }
+  check(instrs.size() == total, "flat view should contain every instruction");
+  check(cfg->blockOffset(cfg->numBlocks()) == total,
+        "the last block offset should be the total size");
+  for (unsigned i = 1; i < instrs.size(); ++i)
+    check(instrs[i]->instrID() > instrs[i-1]->instrID(),
+          "flat view should be in schedule order");
+}
+
+
+// Use counts and last-use distances are recomputed by renumber(); check
+// them against the known uses in the diamond and loop CFGs.
+void testUseMetrics(SCFG* diamond, SCFG* loop) {
+  diamond->renumber();
+
+  BinaryOp* sum = nullptr;
+  for (auto *I : diamond->instrs()) {
+    if (auto *B = dyn_cast<BinaryOp>(I))
+      sum = B;
+  }
+  check(sum != nullptr, "diamond CFG should contain the add instruction");
+
+  auto* xv = cast<Phi>(sum->expr0());
+  check(xv->numUses() == 1, "the phi node is used only by the add");
+  check(xv->lastUseID() == sum->instrID(),
+        "the phi node's last use is the add");
+  check(xv->useDistance() == sum->instrID() - xv->instrID(),
+        "distance should span from the phi to the add");
+
+  check(sum->numUses() == 1, "the sum is passed to the exit block");
+  check(sum->lastUseID() == sum->block()->terminator()->instrID(),
+        "a phi-argument use is attributed to the goto");
+
+  // Literals float outside the CFG; their uses are not tracked.
+  auto* two = cast<Instruction>(xv->values()[0].get());
+  check(two->block() == nullptr && two->numUses() == 0,
+        "free-floating literals should not be counted");
+
+  check(diamond->entry()->terminator()->numUses() == 0,
+        "terminators are not used as values");
+
+  // In the loop, i merges in a phi node which is used by the comparison,
+  // the increment, and the goto that passes i out of the loop; the
+  // increment itself is used only on the back edge.
+  loop->renumber();
+  BinaryOp *cond = nullptr, *incr = nullptr;
+  for (auto *I : loop->instrs()) {
+    if (auto *B = dyn_cast<BinaryOp>(I)) {
+      if (B->binaryOpcode() == BOP_Leq)
+        cond = B;
+      else if (B->binaryOpcode() == BOP_Add)
+        incr = B;
+    }
+  }
+  check(cond && incr, "loop CFG should contain the comparison and add");
+
+  auto* iv = cast<Phi>(cond->expr0());
+  check(iv->numUses() == 3,
+        "the loop variable is used by the test, the increment, and "
+        "the exit goto");
+  check(iv->lastUseID() > incr->instrID(),
+        "the loop variable should outlive the increment");
+  check(incr->numUses() == 1, "the increment is used on the back edge");
+  check(incr->lastUseID() == incr->block()->terminator()->instrID(),
+        "the back-edge use is attributed to the goto");
+}
+
+
+// Recycled block and phi shells should be handed back out when the
+// builder makes new blocks.
+void testRecycleCFG(CFGBuilder& bld) {
+  bld.beginCFG(nullptr);
+  auto* cfg = bld.currentCFG();
+  bld.beginBlock(cfg->entry());
+  bld.newGoto(cfg->exit(), bld.newLiteralT<int>(1));
+  bld.endCFG();
+
+  std::vector<BasicBlock*> oldBlocks;
+  for (auto &B : cfg->blocks())
+    oldBlocks.push_back(B.get());
+  bld.recycleCFG(cfg);
+
+  bld.beginCFG(nullptr);
+  auto* cfg2 = bld.currentCFG();
+  auto isRecycled = [&oldBlocks](BasicBlock *B) {
+    return std::find(oldBlocks.begin(), oldBlocks.end(), B)
+           != oldBlocks.end();
+  };
+  check(isRecycled(cfg2->entry()) && isRecycled(cfg2->exit()),
+        "new blocks should come from the free pool");
+  check(cfg2->exit()->numArguments() == 1,
+        "recycled exit block should get a fresh return phi");
+  bld.beginBlock(cfg2->entry());
+  bld.newGoto(cfg2->exit(), bld.newLiteralT<int>(2));
+  bld.endCFG();
+  check(cfg2->entry()->terminator() != nullptr,
+        "recycled blocks should build like fresh ones");
+}
+
+
+// A small edit to one block should be renumberable within the block's
+// ID gap, without moving the IDs of any other block.
+void testRenumberBlock(CFGBuilder& bld, SCFG* cfg) {
+  cfg->renumber();
+  auto* entry = cfg->entry();
+  unsigned exitFirst = cfg->exit()->firstInstrID();
+  unsigned numInstrs = cfg->numInstructions();
+
+  entry->addInstruction(new (bld.arena()) Undefined());
+  cfg->renumberBlock(entry);
+  check(cfg->exit()->firstInstrID() == exitFirst,
+        "a local renumber should not move other blocks' IDs");
+  check(cfg->numInstructions() == numInstrs,
+        "a local renumber should not change the ID bound");
+  check(entry->terminator()->instrID() < numInstrs,
+        "renumbered IDs should stay under numInstructions()");
+
+  // Outgrow the gap; renumberBlock must fall back to a full renumbering.
+  for (int i = 0; i < 8; ++i)
+    entry->addInstruction(new (bld.arena()) Undefined());
+  cfg->renumberBlock(entry);
+  check(cfg->exit()->firstInstrID() > exitFirst,
+        "overflowing the gap should renumber the whole CFG");
+  check(cfg->exit()->terminator()->instrID() < cfg->numInstructions(),
+        "IDs should stay under numInstructions() after overflow");
+}
+
+
+// Annotate a couple of instructions in cfg, then check that indexed
+// lookups find exactly the annotations on the chains.
+void testAnnotationIndex(CFGBuilder& bld, SCFG* cfg) {
+  cfg->computeNormalForm();
+  Instruction* first = nullptr;
+  for (auto &B : cfg->blocks()) {
+    if (B->instructions().size() > 0) {
+      first = B->instructions()[0];
+      break;
+    }
+  }
+  check(first != nullptr, "test CFG should contain an instruction");
+  auto* term = cfg->entry()->terminator();
+
+  first->addAnnotation(bld.newAnnotationT<SourceLocAnnot>(42));
+  first->addAnnotation(bld.newAnnotationT<InstrNameAnnot>("first"));
+  term->addAnnotation(bld.newAnnotationT<SourceLocAnnot>(43));
+
+  AnnotationIndex index;
+  index.build(cfg);
+
+  auto* loc = index.lookup<SourceLocAnnot>(first);
+  check(loc && loc->position() == 42,
+        "index should find the source location");
+  auto* name = index.lookup<InstrNameAnnot>(first);
+  check(name && name->name() == "first",
+        "index should find the instruction name");
+  check(index.lookup<SourceLocAnnot>(term)->position() == 43,
+        "index should find the terminator's annotation");
+  check(index.lookup<PreconditionAnnot>(first) == nullptr,
+        "lookup of an absent kind should return null");
+
+  // Annotations made through the index land in its table without a rebuild.
+  index.add<SourceLocAnnot>(term, 44);
+  check(index.lookupAll<SourceLocAnnot>(term).size() == 2,
+        "lookupAll should see both source locations");
+}
+
+
+int main(int argc, const char** argv) {
+  MemRegion    region;
+  MemRegionRef arena(&region);
+  CFGBuilder   bld(arena);
+
+  auto* diamond = makeDiamond(bld);
+  diamond->computeNormalForm();
+  std::cout << "Diamond:\n";
+  TILDebugPrinter::print(diamond, std::cout);
+  std::cout << "\n";
+
+  auto* loop = makeLoop(bld);
+  loop->computeNormalForm();
+  std::cout << "Loop:\n";
+  TILDebugPrinter::print(loop, std::cout);
+  std::cout << "\n";
+
+  testPassPipeline(bld, diamond);
+  testPassPipeline(bld, loop);
+
+  testSimplifyCFG(bld);
+
+  testAnnotationIndex(bld, diamond);
+
+  testRenumberBlock(bld, loop);
+
+  testRecycleCFG(bld);
+
+  testFlatView(diamond);
+  testFlatView(loop);
+
+  testUseMetrics(diamond, loop);
+
+  if (numErrors > 0) {
+    std::cout << numErrors << " checks failed.\n";
+    return 1;
+  }
+  std::cout << "All checks passed.\n";
+  return 0;
+}
@@ -22,6 +22,15 @@ enum TIL_AnnKind {
 #include "TILAnnKinds.def"
 };
 
+#define TIL_ANNKIND_FIRST(X) \
+  const TIL_AnnKind ANNKIND_Min = ANNKIND_##X##Annot;
+#define TIL_ANNKIND_LAST(X) \
+  const TIL_AnnKind ANNKIND_Max = ANNKIND_##X##Annot;
+#include "TILAnnKinds.def"
+
+/// Number of annotation kinds; used to size per-kind side tables.
+const unsigned NumAnnKinds = ANNKIND_Max + 1;
+
 /// Annotation stores one annotation and a next-pointer; thus doubling as a
 /// linked list. New annotations need to be created in an arena.
 class Annotation {
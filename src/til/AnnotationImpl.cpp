@@ -21,11 +21,11 @@ InstrNameAnnot *InstrNameAnnot::copy(CFGBuilder &Builder,
 }
 
 void InstrNameAnnot::serialize(BytecodeWriter *B) {
-  B->getWriter()->writeString(Name);
+  B->writeIdentString(Name);
 }
 
 InstrNameAnnot *InstrNameAnnot::deserialize(BytecodeReader *B) {
-  StringRef Nm = B->getReader()->readString();
+  StringRef Nm = B->readIdentString();
   return B->getBuilder().newAnnotationT<InstrNameAnnot>(Nm);
 }
 
@@ -31,11 +31,11 @@ class Traversal;
 /// Sample annotation for storing instruction names.
 class InstrNameAnnot : public Annotation {
 public:
-  InstrNameAnnot(StringRef N) : Annotation(ANNKIND_InstrNameAnnot), Name(N) {}
+  static const TIL_AnnKind AnnKind = ANNKIND_InstrNameAnnot;
 
-  static bool classof(const Annotation *A) {
-    return A->kind() == ANNKIND_InstrNameAnnot;
-  }
+  InstrNameAnnot(StringRef N) : Annotation(AnnKind), Name(N) {}
+
+  static bool classof(const Annotation *A) { return A->kind() == AnnKind; }
 
   StringRef name() const { return Name; }
 
@@ -75,12 +75,11 @@ class SourceLocAnnot : public Annotation {
 public:
   typedef uint64_t SourcePosition;
 
-  SourceLocAnnot(SourcePosition P) :
-    Annotation(ANNKIND_SourceLocAnnot), Position(P) {}
+  static const TIL_AnnKind AnnKind = ANNKIND_SourceLocAnnot;
 
-  static bool classof(const Annotation *A) {
-    return A->kind() == ANNKIND_SourceLocAnnot;
-  }
+  SourceLocAnnot(SourcePosition P) : Annotation(AnnKind), Position(P) {}
+
+  static bool classof(const Annotation *A) { return A->kind() == AnnKind; }
 
   SourcePosition position() const { return Position; }
 
@@ -116,12 +115,11 @@ private:
 /// Annotation for storing preconditions.
 class PreconditionAnnot : public Annotation {
 public:
-  PreconditionAnnot(SExpr *P) :
-    Annotation(ANNKIND_PreconditionAnnot),Condition(P) {}
+  static const TIL_AnnKind AnnKind = ANNKIND_PreconditionAnnot;
 
-  static bool classof(const Annotation *A) {
-    return A->kind() == ANNKIND_PreconditionAnnot;
-  }
+  PreconditionAnnot(SExpr *P) : Annotation(AnnKind), Condition(P) {}
+
+  static bool classof(const Annotation *A) { return A->kind() == AnnKind; }
 
   SExpr *condition() { return Condition.get(); }
 
@@ -162,12 +160,12 @@ private:
 /// Just testing storing multiple SExprRefs.
 class TestTripletAnnot : public Annotation {
 public:
+  static const TIL_AnnKind AnnKind = ANNKIND_TestTripletAnnot;
+
   TestTripletAnnot(SExpr *A, SExpr *B, SExpr *C) :
-    Annotation(ANNKIND_TestTripletAnnot), ExpA(A), ExpB(B), ExpC(C) {}
+    Annotation(AnnKind), ExpA(A), ExpB(B), ExpC(C) {}
 
-  static bool classof(const Annotation *A) {
-    return A->kind() == ANNKIND_TestTripletAnnot;
-  }
+  static bool classof(const Annotation *A) { return A->kind() == AnnKind; }
 
   template <class Trav>
   void traverse(Trav *T) {
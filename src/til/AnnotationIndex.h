@@ -0,0 +1,124 @@
+//===- AnnotationIndex.h ---------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// AnnotationIndex provides O(1) lookup of annotations by kind and
+// instruction ID.  SExpr stores annotations as a sorted singly-linked
+// list, so getAnnotation<T>() walks the chain; passes that query
+// annotations for every instruction go quadratic on heavily annotated
+// code.  The index walks each chain once and builds a per-kind side
+// table keyed by instrID(), after which typed queries are array
+// lookups.  Annotations created through the index are allocated from
+// its own region, so they do not fragment the node arena.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_TIL_ANNOTATIONINDEX_H
+#define OHMU_TIL_ANNOTATIONINDEX_H
+
+#include "TIL.h"
+
+#include <vector>
+
+namespace ohmu {
+namespace til {
+
+
+class AnnotationIndex {
+public:
+  AnnotationIndex() : Arena(&Region), NumInstrs(0) { }
+
+  /// Rebuild the per-kind tables for Cfg.  The CFG must be numbered
+  /// (see SCFG::renumber); each instruction's annotation chain is
+  /// walked exactly once.
+  void build(SCFG *Cfg) {
+    NumInstrs = Cfg->numInstructions();
+    for (auto &Tab : Tables) {
+      Tab.clear();
+      Tab.resize(NumInstrs, nullptr);
+    }
+    for (auto &B : Cfg->blocks()) {
+      for (auto *A : B->arguments())
+        record(A);
+      for (auto *I : B->instructions())
+        record(I);
+      record(B->terminator());
+    }
+  }
+
+  /// Return the first annotation of type T on I, or null.
+  /// The chain is sorted by kind, so further annotations of the same
+  /// kind follow the result via next().
+  template <class T>
+  T* lookup(const Instruction *I) const {
+    const std::vector<Annotation*> &Tab = Tables[T::AnnKind];
+    unsigned ID = I->instrID();
+    if (ID >= Tab.size() || !Tab[ID])
+      return nullptr;
+    return cast<T>(Tab[ID]);
+  }
+
+  /// Return all annotations of type T on I, in chain order.
+  template <class T>
+  std::vector<T*> lookupAll(const Instruction *I) const {
+    std::vector<T*> Res;
+    for (Annotation *A = lookup<T>(I); A && A->kind() == T::AnnKind;
+         A = A->next())
+      Res.push_back(cast<T>(A));
+    return Res;
+  }
+
+  /// Create a new annotation of type T on I.  The annotation is
+  /// allocated from the index's own region rather than the node arena,
+  /// linked into I's chain, and recorded in the table.  The index must
+  /// outlive any instruction annotated through it.
+  template <class T, class... Params>
+  T* add(Instruction *I, Params... Ps) {
+    T *A = new (Arena) T(Ps...);
+    I->addAnnotation(A);
+    recordOne(I->instrID(), A);
+    return A;
+  }
+
+private:
+  /// Record the first annotation of each kind on I.
+  void record(Instruction *I) {
+    if (!I)
+      return;
+    unsigned ID = I->instrID();
+    for (Annotation *A = I->annotations(); A; A = A->next())
+      recordOne(ID, A);
+  }
+
+  void recordOne(unsigned ID, Annotation *A) {
+    std::vector<Annotation*> &Tab = Tables[A->kind()];
+    if (ID >= Tab.size())
+      Tab.resize(ID >= NumInstrs ? ID + 1 : NumInstrs, nullptr);
+    if (!Tab[ID])
+      Tab[ID] = A;
+  }
+
+  MemRegion    Region;   ///< Slab storage for annotations made by add().
+  MemRegionRef Arena;
+  unsigned     NumInstrs;
+  std::vector<Annotation*> Tables[NumAnnKinds];
+};
+
+
+}  // end namespace til
+}  // end namespace ohmu
+
+#endif  // OHMU_TIL_ANNOTATIONINDEX_H
@@ -47,6 +47,8 @@
 #include "TIL.h"
 #include "TILTraverse.h"
 
+#include <memory>
+
 namespace ohmu {
 namespace til {
 
@@ -80,6 +82,148 @@ public:
 
 
 
+/// A PersistentStack is a stack of values with O(1) copy, used to represent
+/// variable binding environments.  Values are stored in chunks, which are
+/// linked by parent pointers and shared between copies.  The top chunk is
+/// extended in place as long as it is uniquely owned, so a stack that is
+/// never copied pushes and pops like a plain vector.  Once a copy is taken,
+/// the shared chunks become immutable, and further pushes allocate a fresh
+/// chunk that links back to the shared prefix.
+///
+/// Environments are copied at every nested function during lazy rewriting
+/// (see ScopeFrame::clone() and the delayed substitutions in TypedEvaluator),
+/// so deeply curried code would otherwise pay O(depth^2) scope copying.
+///
+/// Values that are reachable through shared chunks must not be modified;
+/// the modification would be visible through every copy.
+template<class T>
+class PersistentStack {
+public:
+  unsigned size()  const { return Size; }
+  bool     empty() const { return Size == 0; }
+
+  /// Return the i^th value from the bottom of the stack.
+  /// The chunk holding the last lookup is cached, since successive
+  /// lookups tend to hit the same scope.
+  T& at(unsigned i) {
+    assert(i < Size && "Index out of bounds.");
+    Chunk *C = Cached;
+    if (!C || i < C->Base || i >= C->Base + C->Entries.size()) {
+      C = Tail.get();
+      while (i < C->Base)
+        C = C->Parent.get();
+      Cached = C;
+    }
+    return C->Entries[i - C->Base];
+  }
+
+  T& back() { return at(Size - 1); }
+
+  /// Replace the i^th value.  If the value lives in a shared chunk, the
+  /// entries from i upward are re-pushed onto a fresh chunk first
+  /// (copy-on-write), so the change is not visible through other copies.
+  void set(unsigned i, T &&V) {
+    assert(i < Size && "Index out of bounds.");
+    if (Tail && Tail.use_count() == 1 && i >= Tail->Base &&
+        i < Tail->Base + Tail->Entries.size()) {
+      Tail->Entries[i - Tail->Base] = std::move(V);
+      return;
+    }
+    unsigned N = Size;
+    std::vector<T> Top;
+    Top.reserve(N - i);
+    for (unsigned j = i; j < N; ++j)
+      Top.push_back(at(j));
+    Top[0] = std::move(V);
+    Size = i;
+    for (auto &E : Top)
+      push_back(std::move(E));
+  }
+
+  /// Push a value onto the top of the stack.
+  void push_back(const T &V) { growTail().Entries.push_back(V); ++Size; }
+  void push_back(T &&V) { growTail().Entries.push_back(std::move(V)); ++Size; }
+
+  /// Pop the top value.  The entry is destroyed only when it lives in the
+  /// uniquely-owned top chunk; entries in shared chunks (including entries
+  /// below an empty top chunk) are popped logically, and are destroyed when
+  /// the last stack sharing them goes away.
+  void pop_back() {
+    assert(Size > 0 && "Empty stack.");
+    --Size;
+    if (Tail.use_count() == 1 && !Tail->Entries.empty() &&
+        Tail->Base + Tail->Entries.size() == Size + 1)
+      Tail->Entries.pop_back();
+  }
+
+  void clear() {
+    Tail   = nullptr;
+    Size   = 0;
+    Cached = nullptr;
+  }
+
+  PersistentStack() : Size(0), Cached(nullptr) { }
+
+  /// Copies share storage with the original in O(1).
+  PersistentStack(const PersistentStack &S)
+      : Tail(S.Tail), Size(S.Size), Cached(nullptr) { }
+
+  PersistentStack(PersistentStack &&S)
+      : Tail(std::move(S.Tail)), Size(S.Size), Cached(S.Cached) {
+    S.Size   = 0;
+    S.Cached = nullptr;
+  }
+
+  PersistentStack& operator=(const PersistentStack &S) {
+    Tail   = S.Tail;
+    Size   = S.Size;
+    Cached = nullptr;
+    return *this;
+  }
+
+  PersistentStack& operator=(PersistentStack &&S) {
+    Tail     = std::move(S.Tail);
+    Size     = S.Size;
+    Cached   = S.Cached;
+    S.Size   = 0;
+    S.Cached = nullptr;
+    return *this;
+  }
+
+private:
+  struct Chunk {
+    std::shared_ptr<Chunk> Parent;   ///< Chain of chunks below this one.
+    unsigned               Base;     ///< Stack index of Entries[0].
+    std::vector<T>         Entries;
+
+    Chunk(std::shared_ptr<Chunk> &&P, unsigned B)
+        : Parent(std::move(P)), Base(B) { }
+  };
+
+  /// Return a top chunk that can be extended in place, allocating a new
+  /// one if the current top is shared, or does not end at the top of
+  /// the stack.
+  Chunk& growTail() {
+    if (!(Tail && Tail.use_count() == 1 &&
+          Tail->Base + Tail->Entries.size() == Size)) {
+      // Drop chunks that lie entirely above the current top; their
+      // entries are reachable only from copies that still include them.
+      std::shared_ptr<Chunk> P = Tail;
+      while (P && P->Base >= Size)
+        P = P->Parent;
+      Tail   = std::make_shared<Chunk>(std::move(P), Size);
+      Cached = nullptr;
+    }
+    return *Tail;
+  }
+
+  std::shared_ptr<Chunk> Tail;    ///< Top chunk of the stack.
+  unsigned               Size;    ///< Logical number of values.
+  Chunk*                 Cached;  ///< Last chunk hit by at().
+};
+
+
+
 /// A Substitution stores a list of terms that will be substituted for free
 /// variables.  Each variable has a deBruin index, which is used to look up the
 /// substitution for that variable.  Note that a "substitution" involves not
@@ -90,6 +234,9 @@ public:
 /// substituted for themselves.  A substitution of a variable for itself is a
 /// null substitution; and we provide special handling which optimizes for that
 /// case.
+///
+/// Copies of a Substitution share storage (see PersistentStack); a
+/// substitution must not be modified through var() once it has been copied.
 template<class Attr>
 class Substitution {
 public:
@@ -111,11 +258,19 @@ public:
   /// Return the substitution for the i^th variable, which cannot be null.
   Attr& var(unsigned i) {
     assert(i >= NullVars && i < size() && "Index out of bounds.");
-    return VarAttrs[i-NullVars];
+    return VarAttrs.at(i-NullVars);
   }
 
-  /// Return the list of non-null substitutions.
-  std::vector<Attr>& varAttrs() { return VarAttrs; }
+  /// Return the i^th non-null substitution, for i < numSubstVars().
+  Attr& varAttr(unsigned i) { return VarAttrs.at(i); }
+
+  /// Replace the substitution for the i^th variable.  Unlike writing
+  /// through var(), this does not modify entries that are shared with
+  /// copies of this substitution (see PersistentStack::set).
+  void update(unsigned i, Attr&& At) {
+    assert(i >= NullVars && i < size() && "Index out of bounds.");
+    VarAttrs.set(i - NullVars, std::move(At));
+  }
 
   /// Push n null substitutions.  This Substitution must be entirely null.
   void push_back_null(unsigned n) {
@@ -166,8 +321,8 @@ public:
   Substitution<Attr>& operator=(Substitution<Attr> &&S)      = default;
 
 protected:
-  unsigned          NullVars;   ///< Number of null variables
-  std::vector<Attr> VarAttrs;   ///< Synthesized attributes for remaining vars.
+  unsigned              NullVars;  ///< Number of null variables
+  PersistentStack<Attr> VarAttrs;  ///< Attributes for the remaining vars.
 };
 
 
@@ -188,6 +343,10 @@ public:
   bool     isNull(unsigned i)   { return Subst.isNull(i); }
   Attr&    var(unsigned i)      { return Subst.var(i); }
 
+  /// Replace the substitution for the i^th variable, without modifying
+  /// scopes that share the environment (see Substitution::update).
+  void updateVar(unsigned i, Attr&& At) { Subst.update(i, std::move(At)); }
+
 
   /// Lightweight state that is saved and restored in each subexpression.
   typedef LocStateT LocationState;
@@ -218,13 +377,22 @@ public:
   /// Enter scope of n null substitutions.
   void enterNullScope(unsigned n) {
     Subst.push_back_null(n);
-    for (unsigned i = 0; i < n; ++i)
-      VarDeclMap.push_back(nullptr);
+    if (VarDeclMap.empty())
+      NullDecls += n;
+    else
+      for (unsigned i = 0; i < n; ++i)
+        VarDeclMap.push_back(nullptr);
   }
 
   void exitScope() {
     Subst.pop_back();
-    VarDeclMap.pop_back();
+    if (VarDeclMap.empty()) {
+      assert(NullDecls > 0 && "Empty scope.");
+      --NullDecls;
+    }
+    else {
+      VarDeclMap.pop_back();
+    }
   }
 
   void enterCFG(SCFG *Orig) {
@@ -240,7 +408,9 @@ public:
   void exitBlock() { }
 
   /// Return the declaration for the i^th variable.
-  VarDecl* varDecl(unsigned i) { return VarDeclMap[i]; }
+  VarDecl* varDecl(unsigned i) {
+    return (i < NullDecls) ? nullptr : VarDeclMap.at(i - NullDecls);
+  }
 
   /// Return the substitution for the i^th instruction.
   Attr& instr(unsigned i) { return InstructionMap[i]; }
@@ -252,18 +422,17 @@ public:
   }
 
   /// Create a copy of this scope.  (Used for lazy rewriting)
+  /// The variable environment is shared with the copy, so this is cheap;
+  /// see PersistentStack.
   ScopeFrame* clone() { return new ScopeFrame(*this); }
 
   /// Default constructor.
-  ScopeFrame() : Subst(1) {
-    VarDeclMap.push_back(nullptr);  // deBruin index 0 is reserved
+  ScopeFrame() : Subst(1), NullDecls(1) {  // deBruin index 0 is reserved
   }
 
   /// Create a new scope from a substitution.
-  ScopeFrame(Substitution<Attr>&& S) : Subst(std::move(S)) {
-    for (unsigned i = 0, n = Subst.size(); i < n; ++i)
-      VarDeclMap.push_back(nullptr);
-  }
+  ScopeFrame(Substitution<Attr>&& S)
+      : Subst(std::move(S)), NullDecls(Subst.size()) { }
 
   virtual ~ScopeFrame() { }
 
@@ -271,9 +440,11 @@ protected:
   ScopeFrame(const ScopeFrame &F) = default;
   ScopeFrame(ScopeFrame &&F)      = default;
 
-  Substitution<Attr>     Subst;
-  std::vector<VarDecl*>  VarDeclMap;      ///< map indices to VarDecls
-  std::vector<Attr>      InstructionMap;  ///< map instrs to attributes
+  Substitution<Attr>         Subst;
+  unsigned                   NullDecls;   ///< VarDecls for the first
+                                          ///< NullDecls indices are null.
+  PersistentStack<VarDecl*>  VarDeclMap;  ///< map indices to VarDecls
+  std::vector<Attr>          InstructionMap;  ///< map instrs to attributes
 };
 
 
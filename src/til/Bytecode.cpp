@@ -10,13 +10,24 @@
 
 #include "Bytecode.h"
 
+#include "base/Stats.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace ohmu {
 namespace til {
 
 
+OHMU_STAT(NumBytecodeBytesWritten, "Bytes of bytecode serialized.");
+
 void ByteStreamWriterBase::flush() {
-  if (Pos > 0)
+  if (Pos > 0) {
+    OHMU_STAT_ADD(NumBytecodeBytesWritten, Pos);
     writeData(Buffer.data(), Pos);
+  }
   Pos = 0;
 }
 
@@ -104,6 +115,22 @@ void ByteStreamReaderBase::readBytes(void *Data, int64_t Size) {
 }
 
 
+void ByteStreamReaderBase::skipBytes(int64_t Size) {
+  while (Size > length()) {
+    if (Eof) {
+      Error = true;
+      return;
+    }
+    Size -= length();
+    Pos = BufferLen;
+    refill();
+  }
+  Pos += Size;
+  if (length() < BytecodeBase::MaxAtomSize)
+    refill();
+}
+
+
 void ByteStreamWriterBase::writeBits32(uint32_t V, int Nbits) {
   while (Nbits > 0) {
     Buffer[Pos++] = V & 0xFF;
@@ -206,6 +233,80 @@ uint64_t ByteStreamReaderBase::readUInt64_Vbr() {
 }
 
 
+// A group of four values occupies at most one tag byte plus 16 data
+// bytes; the decoder additionally reads up to 3 bytes past the last
+// field with an unaligned load.
+static const int GroupMaxBytes = 17 + 3;
+
+static const uint32_t GroupMask[5] = {
+  0, 0xFFu, 0xFFFFu, 0xFFFFFFu, 0xFFFFFFFFu
+};
+
+
+void ByteStreamWriterBase::writeUInt32Group(const uint32_t *Vals,
+                                            uint32_t Count) {
+  writeUInt32_Vbr(Count);
+  for (uint32_t i = 0; i < Count; i += 4) {
+    uint8_t  Grp[17];
+    unsigned GPos = 1;
+    uint8_t  Tag  = 0;
+    unsigned N = (Count - i < 4) ? (Count - i) : 4;
+    for (unsigned j = 0; j < N; ++j) {
+      uint32_t V = Vals[i + j];
+      unsigned Len = 1 + (V > 0xFFu) + (V > 0xFFFFu) + (V > 0xFFFFFFu);
+      Tag = static_cast<uint8_t>(Tag | ((Len - 1) << (2*j)));
+      for (unsigned k = 0; k < Len; ++k) {
+        Grp[GPos++] = static_cast<uint8_t>(V & 0xFF);
+        V = V >> 8;
+      }
+    }
+    Grp[0] = Tag;
+    writeBytes(Grp, GPos);
+  }
+}
+
+
+uint32_t ByteStreamReaderBase::readUInt32Group(uint32_t *Vals,
+                                               uint32_t MaxCount) {
+  uint32_t Count = readUInt32_Vbr();
+  if (Count > MaxCount) {
+    Error = true;
+    return 0;
+  }
+  uint32_t i = 0;
+  while (i < Count) {
+    unsigned N = (Count - i < 4) ? (Count - i) : 4;
+    if (length() < GroupMaxBytes)
+      refill();
+    if (length() >= GroupMaxBytes) {
+      // Fast path: decode the whole group with unaligned little-endian
+      // loads and masks, one branch per value instead of one per byte.
+      const uint8_t *P   = Buffer.data() + Pos;
+      uint8_t        Tag = *P++;
+      for (unsigned j = 0; j < N; ++j) {
+        unsigned Len = ((Tag >> (2*j)) & 3) + 1;
+        uint32_t V;
+        memcpy(&V, P, sizeof(V));
+        Vals[i + j] = V & GroupMask[Len];
+        P += Len;
+      }
+      Pos += static_cast<int>(P - (Buffer.data() + Pos));
+    }
+    else {
+      // Near the end of the stream there may be too little slack for the
+      // unaligned loads; fall back to byte-at-a-time decoding.
+      uint8_t Tag = static_cast<uint8_t>(readBits32(8));
+      for (unsigned j = 0; j < N; ++j) {
+        unsigned Len = ((Tag >> (2*j)) & 3) + 1;
+        Vals[i + j] = readBits32(Len * 8);
+      }
+    }
+    i += N;
+  }
+  return Count;
+}
+
+
 void ByteStreamWriterBase::writeFloat(float f) {
   // TODO: works only on machines which use in-memory IEEE format.
   union { float Fnum; uint32_t Inum; } U;
@@ -256,6 +357,149 @@ StringRef ByteStreamReaderBase::readString() {
 }
 
 
+/** BytecodeFileWriter **/
+
+BytecodeFileWriter::BytecodeFileWriter(const std::string &Name)
+    : HasPending(false), Done(false) {
+  Fd = open(Name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if (Fd >= 0)
+    Writer = std::thread(&BytecodeFileWriter::writerLoop, this);
+}
+
+
+BytecodeFileWriter::~BytecodeFileWriter() {
+  flush();
+  {
+    std::unique_lock<std::mutex> Lock(Mutex);
+    Done = true;
+    DataReady.notify_one();
+  }
+  if (Writer.joinable())
+    Writer.join();
+  if (Fd >= 0) {
+    fdatasync(Fd);
+    close(Fd);
+  }
+}
+
+
+void BytecodeFileWriter::writeData(const void *Buf, int64_t Size) {
+  if (Fd < 0 || Size <= 0)
+    return;
+  std::unique_lock<std::mutex> Lock(Mutex);
+  while (HasPending)
+    BufferFree.wait(Lock);
+  const char *P = static_cast<const char*>(Buf);
+  Pending.assign(P, P + Size);
+  HasPending = true;
+  DataReady.notify_one();
+}
+
+
+void BytecodeFileWriter::writerLoop() {
+  std::vector<char> Local;
+  for (;;) {
+    {
+      std::unique_lock<std::mutex> Lock(Mutex);
+      while (!HasPending && !Done)
+        DataReady.wait(Lock);
+      if (!HasPending)
+        return;    // Done, and nothing left to drain.
+      Local.swap(Pending);
+      HasPending = false;
+      BufferFree.notify_one();
+    }
+    const char *P = Local.data();
+    int64_t N = Local.size();
+    while (N > 0) {
+      ssize_t W = write(Fd, P, N);
+      if (W < 0)
+        break;     // Write error; drop the rest of this buffer.
+      P += W;
+      N -= W;
+    }
+    Local.clear();
+  }
+}
+
+
+/** BytecodeChunkReader **/
+
+void BytecodeChunkReader::readAll(const char* Buf, int64_t Size) {
+  Results.clear();
+  Regions.clear();
+
+  // Index pass: slice the chunk table out of the container.
+  MappedMemoryReader Index(Buf, Size);
+  uint32_t NChunks = Index.readUInt32();
+  std::vector<StringRef> Chunks;
+  Chunks.reserve(NChunks);
+  for (uint32_t i = 0; i < NChunks; ++i) {
+    StringRef C = Index.readString();
+    if (Index.error() || C.data() + C.size() > Buf + Size) {
+      Success.store(false);
+      return;
+    }
+    Chunks.push_back(C);
+  }
+  Results.assign(NChunks, nullptr);
+
+  unsigned NTasks = Pool.numThreads();
+  if (NTasks > NChunks)
+    NTasks = NChunks;
+
+  // Decode chunks on the pool; the atomic cursor balances chunks of
+  // uneven size across tasks.  Each task allocates into its own region,
+  // so workers do not contend on the allocator.  The locals captured by
+  // reference are safe because we block until the pool drains.
+  std::atomic<uint32_t> Next(0);
+  for (unsigned t = 0; t < NTasks; ++t) {
+    Regions.emplace_back(new MemRegion());
+    MemRegionRef Arena(Regions.back().get());
+    Pool.submit([this, &Chunks, &Next, Arena]() {
+      for (;;) {
+        uint32_t i = Next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= Chunks.size())
+          return;
+        CFGBuilder Builder(Arena);
+        MappedMemoryReader Stream(Chunks[i].data(),
+                                  static_cast<int64_t>(Chunks[i].size()));
+        BytecodeReader Reader(Builder, &Stream);
+        Results[i] = Reader.read();
+        if (!Reader.success())
+          Success.store(false);
+      }
+    });
+  }
+  Pool.waitForAll();
+}
+
+
+/** BytecodeFileMap **/
+
+BytecodeFileMap::BytecodeFileMap(const std::string &FileName)
+    : Data(nullptr), Size(0) {
+  int Fd = open(FileName.c_str(), O_RDONLY);
+  if (Fd < 0)
+    return;
+  struct stat St;
+  if (fstat(Fd, &St) == 0 && St.st_size > 0) {
+    void* M = mmap(nullptr, St.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    if (M != MAP_FAILED) {
+      Data = static_cast<const char*>(M);
+      Size = St.st_size;
+    }
+  }
+  close(Fd);   // The mapping persists after the descriptor is closed.
+}
+
+
+BytecodeFileMap::~BytecodeFileMap() {
+  if (Data)
+    munmap(const_cast<char*>(Data), Size);
+}
+
+
 /** BytecodeWriter and BytecodeReader **/
 
 VarDecl *BytecodeReader::getVarDecl(unsigned Vidx) {
@@ -456,17 +700,46 @@ void BytecodeReader::readBBInstruction() {
 }
 
 
+// Write an identifier string, deduplicated against the stream's string
+// table.  A new string is emitted as a zero marker followed by the string
+// itself; a repeat is emitted as the 1-based index of its first occurrence.
+void BytecodeWriter::writeIdentString(StringRef S) {
+  uint32_t &Idx = StringTable[S.str()];
+  if (Idx == 0) {
+    Idx = StringTable.size();
+    Writer->writeUInt32(0);
+    Writer->writeString(S);
+    return;
+  }
+  Writer->writeUInt32(Idx);
+}
+
+StringRef BytecodeReader::readIdentString() {
+  uint32_t Idx = Reader->readUInt32();
+  if (Idx == 0) {
+    StringRef S = Reader->readString();
+    Strings.push_back(S);
+    return S;
+  }
+  if (Idx > Strings.size()) {
+    fail("Invalid string table index.");
+    return StringRef("", 0);
+  }
+  return Strings[Idx - 1];
+}
+
+
 void BytecodeWriter::reduceVarDecl(VarDecl* E) {
   writeOpcode(COP_VarDecl);
   writeFlag(E->kind());
   Writer->writeUInt32(E->varIndex());
-  Writer->writeString(E->varName());
+  writeIdentString(E->varName());
 }
 
 void BytecodeReader::readVarDecl() {
   auto K = readFlag<VarDecl::VariableKind>();
   unsigned Id = Reader->readUInt32();
-  StringRef Nm = Reader->readString();
+  StringRef Nm = readIdentString();
   auto *E = Builder.newVarDecl(K, Nm, arg(0));  // TODO: enter Scope?
   E->setVarIndex(Id);
   drop(1);
@@ -513,12 +786,12 @@ void BytecodeReader::readField() {
 void BytecodeWriter::reduceSlot(Slot *E) {
   writeOpcode(COP_Slot);
   Writer->writeUInt16(E->modifiers());
-  Writer->writeString(E->slotName());
+  writeIdentString(E->slotName());
 }
 
 void BytecodeReader::readSlot() {
   uint16_t Mods = Reader->readUInt16();
-  StringRef S = Reader->readString();
+  StringRef S = readIdentString();
   auto *E = Builder.newSlot(S, arg(0));
   E->setModifiers(Mods);
   drop(1);
@@ -634,11 +907,11 @@ void BytecodeReader::readApply() {
 
 void BytecodeWriter::reduceProject(Project *E) {
   writeOpcode(COP_Project);
-  Writer->writeString(E->slotName());
+  writeIdentString(E->slotName());
 }
 
 void BytecodeReader::readProject() {
-  StringRef Nm = Reader->readString();
+  StringRef Nm = readIdentString();
   auto *E = Builder.newProject(arg(0), Nm);
   drop(1);
   push(E);
@@ -875,11 +1148,11 @@ void BytecodeReader::readWildcard() {
 
 void BytecodeWriter::reduceIdentifier(Identifier *E) {
   writeOpcode(COP_Identifier);
-  Writer->writeString(E->idString());
+  writeIdentString(E->idString());
 }
 
 void BytecodeReader::readIdentifier() {
-  StringRef S = Reader->readString();
+  StringRef S = readIdentString();
   auto *E = Builder.newIdentifier(S);
   push(E);
 }
@@ -972,6 +1245,528 @@ SExpr* BytecodeReader::read() {
 }
 
 
+/** CFGNativeWriter and CFGNativeReader **/
+
+namespace {
+
+/// Discards everything written to it; used by canEncode() to dry-run the
+/// native encoder without producing output.
+class NullStreamWriter : public ByteStreamWriterBase {
+public:
+  virtual ~NullStreamWriter() { flush(); }
+  virtual void writeData(const void *Buf, int64_t Size) override { }
+};
+
+}  // end anonymous namespace
+
+
+bool CFGNativeWriter::embeddable(const SExpr *E, int Depth) {
+  if (!E)
+    return true;
+  if (Depth <= 0)
+    return false;
+  // Embedded subtrees are decoded with a fresh reader, so they must not
+  // reference CFG instructions, variables, or blocks.
+  if (auto *I = dyn_cast<Instruction>(E))
+    if (I->block())
+      return false;
+  switch (E->opcode()) {
+  case COP_Literal:
+  case COP_ScalarType:
+  case COP_Undefined:
+  case COP_Wildcard:
+    return true;
+  case COP_Field: {
+    auto *F = cast<Field>(E);
+    return embeddable(F->range(), Depth - 1) &&
+           embeddable(F->body(),  Depth - 1);
+  }
+  default:
+    return false;
+  }
+}
+
+
+void CFGNativeWriter::writeEmbedded(SExpr *E) {
+  BytecodeStringWriter SubStream;
+  BytecodeWriter SubWriter(&SubStream);
+  SubWriter.write(E);
+  std::string Bytes = SubStream.str();
+  getWriter()->writeString(StringRef(Bytes.data(), Bytes.size()));
+}
+
+
+static unsigned countAnnotations(const SExpr *E) {
+  unsigned N = 0;
+  for (const Annotation *A = E->annotations(); A; A = A->next())
+    ++N;
+  return N;
+}
+
+
+// Annotations use the traversal-based encoding: any subexpressions, then
+// the annotation record.  Subexpression atoms may reference CFG
+// instructions, which resolve through the shared instruction array.
+void CFGNativeWriter::writeAnnotations(SExpr *E) {
+  auto *W = getWriter();
+  W->writeUInt32(countAnnotations(E));
+  W->endAtom();
+  for (Annotation *A = E->annotations(); A; A = A->next()) {
+    traverseAnnotation(A);
+    W->endAtom();
+  }
+}
+
+
+void CFGNativeWriter::writeOperand(SExpr *E) {
+  auto *W = getWriter();
+  if (!E) {
+    W->writeUInt32(0);
+    return;
+  }
+  if (auto *I = dyn_cast<Instruction>(E)) {
+    if (I->block()) {
+      W->writeUInt32(I->instrID() + 2);
+      return;
+    }
+  }
+  if (!embeddable(E, MaxEmbedDepth))
+    Ok = false;
+  W->writeUInt32(1);
+  writeEmbedded(E);
+}
+
+
+void CFGNativeWriter::writeInstrRecord(Instruction *I) {
+  auto *W = getWriter();
+  switch (I->opcode()) {
+  case COP_Call: {
+    W->writeUInt8(COP_Call);
+    writeBaseType(I->baseType());
+    writeOperand(cast<Call>(I)->target());
+    break;
+  }
+  case COP_Alloc: {
+    W->writeUInt8(COP_Alloc);
+    writeFlag(cast<Alloc>(I)->allocKind());
+    writeOperand(cast<Alloc>(I)->initializer());
+    break;
+  }
+  case COP_Load: {
+    W->writeUInt8(COP_Load);
+    writeBaseType(I->baseType());
+    writeOperand(cast<Load>(I)->pointer());
+    break;
+  }
+  case COP_Store: {
+    W->writeUInt8(COP_Store);
+    writeOperand(cast<Store>(I)->destination());
+    writeOperand(cast<Store>(I)->source());
+    break;
+  }
+  case COP_ArrayIndex: {
+    W->writeUInt8(COP_ArrayIndex);
+    writeOperand(cast<ArrayIndex>(I)->array());
+    writeOperand(cast<ArrayIndex>(I)->index());
+    break;
+  }
+  case COP_ArrayAdd: {
+    W->writeUInt8(COP_ArrayAdd);
+    writeOperand(cast<ArrayAdd>(I)->array());
+    writeOperand(cast<ArrayAdd>(I)->index());
+    break;
+  }
+  case COP_UnaryOp: {
+    W->writeUInt8(COP_UnaryOp);
+    writeFlag(cast<UnaryOp>(I)->unaryOpcode());
+    writeBaseType(I->baseType());
+    writeOperand(cast<UnaryOp>(I)->expr());
+    break;
+  }
+  case COP_BinaryOp: {
+    W->writeUInt8(COP_BinaryOp);
+    writeFlag(cast<BinaryOp>(I)->binaryOpcode());
+    writeBaseType(I->baseType());
+    writeOperand(cast<BinaryOp>(I)->expr0());
+    writeOperand(cast<BinaryOp>(I)->expr1());
+    break;
+  }
+  default:
+    // Scheduled instructions are built by CFGBuilder::addInstr, so other
+    // opcodes should not occur; reject the CFG rather than lose them.
+    // The embedded stream carries its own annotations.
+    Ok = false;
+    W->writeUInt8(NREC_Embedded);
+    writeEmbedded(I);
+    W->endAtom();
+    W->writeUInt32(0);
+    W->endAtom();
+    return;
+  }
+  W->endAtom();
+  writeAnnotations(I);
+}
+
+
+void CFGNativeWriter::writeTerminatorRecord(Terminator *T) {
+  auto *W = getWriter();
+  if (!T) {
+    W->writeUInt8(NREC_NoTerminator);
+    W->endAtom();
+    W->writeUInt32(0);
+    W->endAtom();
+    return;
+  }
+  switch (T->opcode()) {
+  case COP_Goto: {
+    auto *G  = cast<Goto>(T);
+    auto *Tb = G->targetBlock();
+    W->writeUInt8(COP_Goto);
+    W->writeUInt32(Tb->blockID());
+    unsigned Nargs = Tb->numArguments();
+    W->writeUInt32(Nargs);
+    // The phi argument table: the value this edge contributes to each
+    // of the target's arguments.
+    for (unsigned i = 0; i < Nargs; ++i)
+      writeOperand(Tb->arguments()[i]->values()[G->phiIndex()].get());
+    break;
+  }
+  case COP_Branch: {
+    auto *B = cast<Branch>(T);
+    W->writeUInt8(COP_Branch);
+    writeOperand(B->condition());
+    W->writeUInt32(B->thenBlock() ?
+        B->thenBlock()->blockID() : BasicBlock::InvalidBlockID);
+    W->writeUInt32(B->elseBlock() ?
+        B->elseBlock()->blockID() : BasicBlock::InvalidBlockID);
+    break;
+  }
+  case COP_Switch: {
+    auto *S = cast<Switch>(T);
+    W->writeUInt8(COP_Switch);
+    writeOperand(S->condition());
+    int Nc = S->numCases();
+    W->writeUInt32(Nc);
+    for (int i = 0; i < Nc; ++i) {
+      writeOperand(S->label(i));
+      W->writeUInt32(S->caseBlock(i) ?
+          S->caseBlock(i)->blockID() : BasicBlock::InvalidBlockID);
+    }
+    break;
+  }
+  case COP_Return: {
+    W->writeUInt8(COP_Return);
+    writeOperand(cast<Return>(T)->returnValue());
+    break;
+  }
+  default:
+    Ok = false;
+    W->writeUInt8(NREC_NoTerminator);
+    break;
+  }
+  W->endAtom();
+  writeAnnotations(T);
+}
+
+
+bool CFGNativeWriter::writeCFG(SCFG *Cfg) {
+  auto *W = getWriter();
+  W->writeUInt32(Cfg->numBlocks());
+  W->writeUInt32(Cfg->numInstructions());
+  W->writeUInt32(Cfg->entry()->blockID());
+  W->writeUInt32(Cfg->exit()->blockID());
+  W->endAtom();
+
+  // Block table: enough to create every block and phi node up front, so
+  // that instruction records resolve operands with one array index.
+  // Deleted instructions leave null entries in the block arrays; only the
+  // live ones are counted and written.
+  for (auto &BE : Cfg->blocks()) {
+    BasicBlock *B = BE.get();
+    unsigned Nins = 0;
+    for (auto *I : B->instructions())
+      if (I) ++Nins;
+    W->writeUInt32(B->firstInstrID());
+    W->writeUInt32(B->numArguments());
+    W->writeUInt32(Nins);
+    for (auto *A : B->arguments())
+      writeBaseType(A->baseType());
+    W->endAtom();
+  }
+
+  // Instruction records, in schedule order.  Block arguments were
+  // created from the block table; only their annotations remain.
+  for (auto &BE : Cfg->blocks()) {
+    BasicBlock *B = BE.get();
+    for (auto *A : B->arguments())
+      writeAnnotations(A);
+    for (auto *I : B->instructions())
+      if (I)
+        writeInstrRecord(I);
+    writeTerminatorRecord(B->terminator());
+  }
+  W->flush();
+  return Ok;
+}
+
+
+bool CFGNativeWriter::canEncode(SCFG *Cfg) {
+  if (Cfg->numBlocks() == 0 || !Cfg->valid())
+    return false;
+  NullStreamWriter NullStream;
+  CFGNativeWriter W(&NullStream);
+  return W.writeCFG(Cfg);
+}
+
+
+SExpr* CFGNativeReader::readEmbedded() {
+  StringRef Bytes = Reader->readString();
+  InMemoryReader SubStream(Bytes.data(), Bytes.size(), Builder.arena());
+  BytecodeReader SubReader(Builder, &SubStream);
+  SExpr *E = SubReader.read();
+  if (!SubReader.success())
+    fail("Invalid embedded expression.");
+  return E;
+}
+
+
+void CFGNativeReader::readAnnotations(SExpr *E) {
+  unsigned N = Reader->readUInt32();
+  Reader->endAtom();
+  if (N == 0)
+    return;
+  if (!E) {
+    fail("Annotations without a host expression.");
+    return;
+  }
+  // Each annotation is a run of subexpression atoms followed by an
+  // annotation record, which attaches to the top of the stack.
+  push(E);
+  while (success() && countAnnotations(E) < N)
+    readSExpr();
+  drop(1);
+}
+
+
+SExpr* CFGNativeReader::readOperand() {
+  uint32_t V = Reader->readUInt32();
+  if (V == 0)
+    return nullptr;
+  if (V == 1)
+    return readEmbedded();
+  unsigned Idx = V - 2;
+  if (Idx >= Instrs.size() || !Instrs[Idx]) {
+    fail("Invalid operand reference.");
+    return nullptr;
+  }
+  return Instrs[Idx];
+}
+
+
+void CFGNativeReader::readInstrRecord() {
+  uint8_t Op = Reader->readUInt8();
+  Instruction *I = nullptr;
+  switch (Op) {
+  case COP_Call: {
+    auto Bt = readBaseType();
+    auto *E = Builder.newCall(readOperand());
+    E->setBaseType(Bt);
+    I = E;
+    break;
+  }
+  case COP_Alloc: {
+    auto Ak = readFlag<Alloc::AllocKind>();
+    I = Builder.newAlloc(readOperand(), Ak);
+    break;
+  }
+  case COP_Load: {
+    auto Bt = readBaseType();
+    auto *E = Builder.newLoad(readOperand());
+    E->setBaseType(Bt);
+    I = E;
+    break;
+  }
+  case COP_Store: {
+    SExpr *D = readOperand();
+    SExpr *S = readOperand();
+    I = Builder.newStore(D, S);
+    break;
+  }
+  case COP_ArrayIndex: {
+    SExpr *A = readOperand();
+    SExpr *Ix = readOperand();
+    I = Builder.newArrayIndex(A, Ix);
+    break;
+  }
+  case COP_ArrayAdd: {
+    SExpr *A = readOperand();
+    SExpr *Ix = readOperand();
+    I = Builder.newArrayAdd(A, Ix);
+    break;
+  }
+  case COP_UnaryOp: {
+    auto Uop = readFlag<TIL_UnaryOpcode>();
+    auto Bt  = readBaseType();
+    auto *E = Builder.newUnaryOp(Uop, readOperand());
+    E->setBaseType(Bt);
+    I = E;
+    break;
+  }
+  case COP_BinaryOp: {
+    auto Bop = readFlag<TIL_BinaryOpcode>();
+    auto Bt  = readBaseType();
+    SExpr *E0 = readOperand();
+    SExpr *E1 = readOperand();
+    auto *E = Builder.newBinaryOp(Bop, E0, E1);
+    E->setBaseType(Bt);
+    I = E;
+    break;
+  }
+  case CFGNativeWriter::NREC_Embedded: {
+    SExpr *E = readEmbedded();
+    I = dyn_cast_or_null<Instruction>(E);
+    if (E && !I) {
+      fail("Expected instruction.");
+      return;
+    }
+    break;
+  }
+  default:
+    fail("Invalid instruction record.");
+    return;
+  }
+  Reader->endAtom();
+  readAnnotations(I);
+  if (CurrentInstrID >= Instrs.size()) {
+    fail("Too many instructions.");
+    return;
+  }
+  Instrs[CurrentInstrID++] = I;
+}
+
+
+void CFGNativeReader::readTerminatorRecord() {
+  uint8_t Op = Reader->readUInt8();
+  Terminator *T = nullptr;
+  switch (Op) {
+  case CFGNativeWriter::NREC_NoTerminator:
+    break;
+  case COP_Goto: {
+    unsigned Bid   = Reader->readUInt32();
+    unsigned Nargs = Reader->readUInt32();
+    std::vector<SExpr*> Args(Nargs);
+    for (unsigned i = 0; i < Nargs; ++i)
+      Args[i] = readOperand();
+    BasicBlock *Bb = getBlock(Bid, Nargs);
+    if (Bb)
+      T = Builder.newGoto(Bb, ArrayRef<SExpr*>(Args.data(), Nargs));
+    break;
+  }
+  case COP_Branch: {
+    SExpr *C = readOperand();
+    unsigned ThenBid = Reader->readUInt32();
+    unsigned ElseBid = Reader->readUInt32();
+    BasicBlock *Bbt = getBlock(ThenBid, 0);
+    BasicBlock *Bbe = getBlock(ElseBid, 0);
+    T = Builder.newBranch(C, Bbt, Bbe);
+    break;
+  }
+  case COP_Switch: {
+    SExpr *C = readOperand();
+    int Nc = Reader->readUInt32();
+    Switch *S = Builder.newSwitch(C, Nc);
+    for (int i = 0; i < Nc; ++i) {
+      SExpr *Lab = readOperand();
+      BasicBlock *Bb = getBlock(Reader->readUInt32(), 0);
+      Builder.addSwitchCase(S, Lab, Bb);
+    }
+    T = S;
+    break;
+  }
+  case COP_Return: {
+    T = Builder.newReturn(readOperand());
+    break;
+  }
+  default:
+    fail("Invalid terminator record.");
+    return;
+  }
+  Reader->endAtom();
+  readAnnotations(T);
+}
+
+
+SCFG* CFGNativeReader::readCFG() {
+  unsigned Nb  = Reader->readUInt32();
+  unsigned Ni  = Reader->readUInt32();
+  unsigned Eid = Reader->readUInt32();
+  unsigned Xid = Reader->readUInt32();
+  Reader->endAtom();
+
+  Builder.beginCFG(nullptr);
+  auto *Cfg = Builder.currentCFG();
+  Blocks.resize(Nb, nullptr);
+  Instrs.resize(Ni, nullptr);
+  if (Eid >= Nb || Xid >= Nb) {
+    fail("Invalid entry or exit block.");
+    return nullptr;
+  }
+  Blocks[Eid] = Cfg->entry();
+  Blocks[Xid] = Cfg->exit();
+
+  // Create every block and its phi nodes from the block table, so that
+  // operand references never run ahead of the instruction array.
+  std::vector<unsigned> FirstID(Nb), NumInstrs(Nb);
+  for (unsigned b = 0; b < Nb && success(); ++b) {
+    FirstID[b]     = Reader->readUInt32();
+    unsigned Nargs = Reader->readUInt32();
+    NumInstrs[b]   = Reader->readUInt32();
+    BasicBlock *Bb = getBlock(b, Nargs);
+    if (!Bb)
+      return nullptr;
+    for (unsigned i = 0; i < Nargs; ++i) {
+      BaseType Bt = readBaseType();
+      if (FirstID[b] + i >= Ni) {
+        fail("Invalid argument ID.");
+        return nullptr;
+      }
+      auto *A = Bb->arguments()[i];
+      A->setBaseType(Bt);
+      Instrs[FirstID[b] + i] = A;
+    }
+    Reader->endAtom();
+  }
+
+  // Materialize the instruction records block by block.
+  for (unsigned b = 0; b < Nb && success(); ++b) {
+    Builder.beginBlock(Blocks[b]);
+    CurrentInstrID = FirstID[b] + Blocks[b]->numArguments();
+    for (auto *A : Blocks[b]->arguments())
+      readAnnotations(A);
+    for (unsigned i = 0; i < NumInstrs[b] && success(); ++i)
+      readInstrRecord();
+    if (success())
+      readTerminatorRecord();
+    if (Builder.currentBB())
+      Builder.endBlock(nullptr);
+  }
+
+  if (!success())
+    return nullptr;
+
+  // Restore the original block order; see also readSCFG().
+  for (unsigned i = 0; i < Nb; ++i) {
+    auto *B = Blocks[i];
+    Cfg->blocks()[i].reset(B);
+    B->setBlockID(i);
+  }
+  Builder.endCFG();
+  Blocks.clear();
+  Instrs.clear();
+  return Cfg;
+}
+
+
 void BytecodeStringWriter::dump() {
   std::string Str = Buffer.str();
   int Sz  = Str.size();
@@ -14,10 +14,20 @@
 #include "CFGBuilder.h"
 #include "TIL.h"
 #include "TILTraverse.h"
+#include "base/ThreadPool.h"
+#include "base/Trace.h"
 
+#include <atomic>
+#include <condition_variable>
 #include <iostream>
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 namespace ohmu {
 namespace til {
@@ -100,6 +110,12 @@ public:
   /// Emit a 64-bit unsigned int in a variable number of bytes.
   void writeUInt64_Vbr(uint64_t V);
 
+  /// Emit Count 32-bit values with group varint encoding: the count,
+  /// then groups of four values, each group prefixed by one tag byte
+  /// holding four 2-bit byte lengths.  Unlike the VBR format, the
+  /// decoder has no branch per byte; use this for long runs of integers.
+  void writeUInt32Group(const uint32_t *Vals, uint32_t Count);
+
   void writeBool(bool V) { writeBits32(V, 1); }
 
   void writeUInt8 (uint8_t  V) { writeBits32(V, 8);  }
@@ -170,6 +186,11 @@ public:
   /// Read a 64-bit unsigned int in a variable number of bytes.
   uint64_t readUInt64_Vbr();
 
+  /// Read values written by writeUInt32Group into Vals, which must have
+  /// room for MaxCount values.  Returns the number of values read; a
+  /// count larger than MaxCount is an error and reads nothing.
+  uint32_t readUInt32Group(uint32_t *Vals, uint32_t MaxCount);
+
   bool     readBool()   { return readBits32(1); }
 
   uint8_t  readUInt8()  { return static_cast<uint8_t> ( readBits32(8) ); }
@@ -184,14 +205,25 @@ public:
 
   float     readFloat();
   double    readDouble();
-  StringRef readString();
+
+  /// Read a length-prefixed string.  The default implementation copies
+  /// the string data into memory from allocStringData; readers backed by
+  /// persistent memory may override it to return a zero-copy reference.
+  virtual StringRef readString();
 
   bool empty() { return Eof && length() <= 0; }
 
-private:
+  /// Return true if a read has overrun or corrupted the stream.
+  bool error() { return Error; }
+
+protected:
   /// Return the remaining data in the buffer.
   int length() { return BufferLen - Pos; }
 
+  /// Skip over Size bytes without interpreting them.
+  void skipBytes(int64_t Size);
+
+private:
   /// Size of the buffer.  Default is 64k.
   static const int BufferSize = BytecodeBase::MaxAtomSize << 4;
 
@@ -336,13 +368,23 @@ public:
 
   ByteStreamWriterBase *getWriter() { return Writer; }
 
+  /// Write an identifier string (a variable, slot, or instruction name).
+  /// Each distinct string is written inline once, on first use; later
+  /// occurrences become a varint reference to it, so names that repeat
+  /// throughout a stream are stored only once.  The matching table is
+  /// maintained by BytecodeReader::readIdentString.  The table is
+  /// per-stream: chunks of a chunked container are independent.
+  void writeIdentString(StringRef S);
+
   void write(SExpr* E) {
+    OHMU_TRACE_SCOPE("bytecode-write");
     traverseAll(E);
     Writer->flush();
   }
 
 private:
   ByteStreamWriterBase *Writer;
+  std::unordered_map<std::string, uint32_t> StringTable;
 };
 
 
@@ -485,9 +527,12 @@ public:
 
   ByteStreamReaderBase *getReader() { return Reader; }
 
+  /// Read an identifier string written by writeIdentString.
+  StringRef readIdentString();
+
   CFGBuilder& getBuilder() { return Builder; }
 
-private:
+protected:
   CFGBuilder&            Builder;
   ByteStreamReaderBase*  Reader;
   bool                   Success;
@@ -500,10 +545,81 @@ private:
   std::vector<VarDecl*>     Vars;
   std::vector<BasicBlock*>  Blocks;
   std::vector<Instruction*> Instrs;
+  std::vector<StringRef>    Strings;  // interned identifier strings.
 };
 
 
 
+/// Serializes a normalized SCFG in a CFG-native form: a block table, then
+/// flat instruction records in schedule order, with operands encoded as
+/// instruction IDs and phi argument tables stored with each goto.  Unlike
+/// the traversal-based form, the reader (CFGNativeReader) materializes
+/// blocks and instructions by direct indexing, with no postfix stack
+/// interpretation; analysis consumers that read far more IR than they
+/// write should prefer this form for function bodies.
+///
+/// Operands that are not CFG instructions (e.g. an alloc initializer or a
+/// literal argument) are embedded as length-prefixed bytecode subtrees.
+/// Only simple subtrees can be embedded; canEncode() reports whether a
+/// CFG fits the native form, and callers fall back to BytecodeWriter when
+/// it does not.
+class CFGNativeWriter : public BytecodeWriter {
+public:
+  enum NativeRecord : uint8_t {
+    NREC_Embedded     = 0xFF,  ///< Record is a length-prefixed subtree.
+    NREC_NoTerminator = 0xFE,  ///< Block has no terminator (exit block).
+  };
+
+  /// Maximum depth of an embedded operand subtree.
+  static const int MaxEmbedDepth = 8;
+
+  explicit CFGNativeWriter(ByteStreamWriterBase *W)
+      : BytecodeWriter(W), Ok(true) { }
+
+  /// Return true if Cfg can be written in CFG-native form.
+  /// Cfg must be normalized; see SCFG::computeNormalForm().
+  static bool canEncode(SCFG *Cfg);
+
+  /// Write Cfg to the stream and flush.  Returns false if some part of
+  /// the CFG does not fit the native form; the stream contents are then
+  /// unusable and the CFG should be written with BytecodeWriter instead.
+  bool writeCFG(SCFG *Cfg);
+
+private:
+  void writeOperand(SExpr *E);
+  void writeEmbedded(SExpr *E);
+  void writeAnnotations(SExpr *E);
+  void writeInstrRecord(Instruction *I);
+  void writeTerminatorRecord(Terminator *T);
+
+  static bool embeddable(const SExpr *E, int Depth);
+
+  bool Ok;
+};
+
+
+/// Materializes a CFG written by CFGNativeWriter.  Blocks and phi nodes
+/// are created up front from the block table, so instruction operands
+/// resolve with one array index; there is no reconstruction traversal,
+/// and phi wiring is copied directly from the goto argument tables
+/// rather than re-derived.
+class CFGNativeReader : public BytecodeReader {
+public:
+  CFGNativeReader(CFGBuilder &B, ByteStreamReaderBase *R)
+      : BytecodeReader(B, R) { }
+
+  /// Read one CFG from the stream, or return null on failure.
+  SCFG* readCFG();
+
+private:
+  SExpr* readOperand();
+  SExpr* readEmbedded();
+  void   readAnnotations(SExpr *E);
+  void   readInstrRecord();
+  void   readTerminatorRecord();
+};
+
+
 /// Simple writer that serializes to a string.
 class BytecodeStringWriter : public ByteStreamWriterBase {
 public:
@@ -555,25 +671,169 @@ private:
 };
 
 
-/// Simple writer that serializes to a file.
-class BytecodeFileWriter : public ByteStreamWriterBase {
+/// Read-only memory mapping of a bytecode file.  Readers built on top of
+/// the mapping reference its bytes directly, so the map must outlive any
+/// strings or IR constructed from it.
+class BytecodeFileMap {
 public:
-  virtual ~BytecodeFileWriter() {
-    flush();
-    FileStream.close();
+  BytecodeFileMap(const std::string &FileName);
+  ~BytecodeFileMap();
+
+  BytecodeFileMap(const BytecodeFileMap&) = delete;
+  void operator=(const BytecodeFileMap&) = delete;
+
+  /// Return true if the file was successfully mapped.
+  bool valid() const { return Data != nullptr; }
+
+  const char* data() const { return Data; }
+  int64_t     size() const { return Size; }
+
+private:
+  const char* Data;
+  int64_t     Size;
+};
+
+
+/// Reader that deserializes from persistent memory, e.g. a BytecodeFileMap.
+/// Unlike InMemoryReader, strings are not copied into an arena: the
+/// StringRefs handed out point directly into the source buffer, which must
+/// outlive anything built from the stream.
+class MappedMemoryReader : public ByteStreamReaderBase {
+public:
+  MappedMemoryReader(const char* Buf, int64_t Sz)
+      : SourcePos(0), SourceSize(Sz), SourceBuffer(Buf) {
+    refill();
+  }
+  explicit MappedMemoryReader(const BytecodeFileMap &Map)
+      : SourcePos(0), SourceSize(Map.size()), SourceBuffer(Map.data()) {
+    refill();
   }
 
-  BytecodeFileWriter(const std::string &Name) {
-    FileStream.open(Name);
+  /// Read a block of data from the mapping.
+  virtual int64_t readData(void *Buf, int64_t Sz) override {
+    if (Sz > totalLength())
+      Sz = totalLength();
+    memcpy(Buf, SourceBuffer + SourcePos, Sz);
+    SourcePos += Sz;
+    return Sz;
   }
 
-  /// Write a block of data to the file.
-  virtual void writeData(const void *Buf, int64_t Size) override {
-    FileStream.write(static_cast<const char *>(Buf), Size);
+  /// Never called; see readString().
+  virtual char* allocStringData(uint32_t Sz) override { return nullptr; }
+
+  /// Return a reference into the source buffer, without copying.
+  virtual StringRef readString() override {
+    uint32_t Sz = readUInt32();
+    // The stream is byte aligned, so the string data starts at the
+    // current logical position in the source.
+    StringRef S(SourceBuffer + (SourcePos - length()), Sz);
+    skipBytes(Sz);
+    return S;
+  }
+
+private:
+  int64_t totalLength() { return SourceSize - SourcePos; }
+
+  int64_t SourcePos;
+  int64_t SourceSize;
+  const char* SourceBuffer;
+};
+
+
+/// Writes a module as a chunked container: a count, then one
+/// length-prefixed chunk per definition.  Each chunk is an independent
+/// bytecode stream, so a reader can decode chunks in parallel, or skip
+/// the ones it does not need.
+class BytecodeChunkWriter {
+public:
+  explicit BytecodeChunkWriter(ByteStreamWriterBase *W) : Writer(W) { }
+
+  /// Serialize E as the next chunk.
+  void addChunk(SExpr *E) {
+    BytecodeStringWriter ChunkStream;
+    BytecodeWriter W(&ChunkStream);
+    W.write(E);
+    Chunks.emplace_back(ChunkStream.str());
+  }
+
+  /// Write the container header and all chunks.
+  void write() {
+    Writer->writeUInt32(Chunks.size());
+    for (auto &C : Chunks)
+      Writer->writeString(StringRef(C.data(), C.size()));
+    Writer->flush();
+  }
+
+private:
+  ByteStreamWriterBase*    Writer;
+  std::vector<std::string> Chunks;
+};
+
+
+/// Decodes the chunks of a chunked container in parallel on a thread
+/// pool.  The source must be persistent memory (e.g. a BytecodeFileMap),
+/// since chunk payloads and strings are referenced in place.  Each
+/// worker decodes into its own MemRegion; the caller takes ownership of
+/// the regions along with the results (see Global::adoptRegion).
+class BytecodeChunkReader {
+public:
+  explicit BytecodeChunkReader(ThreadPool &P)
+      : Pool(P), Success(true) { }
+
+  /// Decode every chunk in the container at Buf.  Results are in chunk
+  /// order; a failed chunk leaves a null entry and clears success().
+  void readAll(const char* Buf, int64_t Size);
+
+  void readAll(const BytecodeFileMap &Map) {
+    readAll(Map.data(), Map.size());
+  }
+
+  bool success() { return Success.load(); }
+
+  std::vector<SExpr*>& results() { return Results; }
+
+  /// Transfer ownership of the regions holding the decoded IR.
+  std::vector<std::unique_ptr<MemRegion>> takeRegions() {
+    return std::move(Regions);
   }
 
 private:
-  std::ofstream FileStream;
+  ThreadPool&                             Pool;
+  std::atomic<bool>                       Success;
+  std::vector<SExpr*>                     Results;
+  std::vector<std::unique_ptr<MemRegion>> Regions;
+};
+
+
+/// Simple writer that serializes to a file.
+/// Writer that streams to a file.  File I/O runs on a background thread
+/// with double buffering: the serializer fills the stream buffer while
+/// the thread drains the previously flushed one, so traversal and disk
+/// writes overlap.  The destructor drains outstanding writes and calls
+/// fdatasync before closing, so a destroyed writer is durable on disk.
+class BytecodeFileWriter : public ByteStreamWriterBase {
+public:
+  BytecodeFileWriter(const std::string &Name);
+  virtual ~BytecodeFileWriter();
+
+  /// Return true if the output file was opened successfully.
+  bool valid() { return Fd >= 0; }
+
+  /// Hand the filled buffer to the writer thread.  Blocks only if the
+  /// thread is still draining the previous buffer.
+  virtual void writeData(const void *Buf, int64_t Size) override;
+
+private:
+  void writerLoop();
+
+  int                     Fd;
+  std::vector<char>       Pending;     ///< Buffer awaiting the writer thread.
+  bool                    HasPending;
+  bool                    Done;
+  std::mutex              Mutex;
+  std::condition_variable DataReady;
+  std::condition_variable BufferFree;
+  std::thread             Writer;
 };
 
 /// Simple reader that reads from a file.
@@ -41,21 +41,27 @@ void CFGBuilder::exitScope() {
 
 
 
-SCFG* CFGBuilder::beginCFG(SCFG *Cfg, bool createEntryExit) {
+SCFG* CFGBuilder::beginCFG(SCFG *Cfg, bool createEntryExit,
+                           const SCFG *SizeHint, unsigned NBlocksHint) {
   assert(!CurrentCFG && !CurrentBB && "Already inside a CFG");
 
   CurrentState.EmitInstrs = true;
+  SSABlocks.clear();
+  LocalVarNames.clear();
   if (Cfg) {
     CurrentCFG = Cfg;
+    NextBlockID = Cfg->numBlocks();
     return Cfg;
   }
 
-  CurrentCFG = new (Arena) SCFG(Arena, 0);
+  if (SizeHint)
+    NBlocksHint = SizeHint->numBlocks();
+  CurrentCFG = new (Arena) SCFG(Arena, NBlocksHint);
 
   if (createEntryExit) {
-    auto* Entry = new (Arena) BasicBlock(Arena);
-    auto* Exit  = new (Arena) BasicBlock(Arena);
-    auto *V     = new (Arena) Phi();
+    auto* Entry = allocBlock();
+    auto* Exit  = allocBlock();
+    auto *V     = allocPhi(0);
     auto *Ret   = new (Arena) Return(V);
 
     Exit->addArgument(V);
@@ -68,6 +74,7 @@ SCFG* CFGBuilder::beginCFG(SCFG *Cfg, bool createEntryExit) {
     CurrentCFG->setEntry(Entry);
     CurrentCFG->setExit(Exit);
   }
+  NextBlockID = CurrentCFG->numBlocks();
 
   return CurrentCFG;
 }
@@ -80,6 +87,8 @@ void CFGBuilder::endCFG() {
   CurrentCFG->renumber();
   CurrentState.EmitInstrs = false;
   CurrentCFG = nullptr;
+  SSABlocks.clear();
+  LocalVarNames.clear();
 }
 
 
@@ -150,21 +159,49 @@ void CFGBuilder::endBlock(Terminator *Term) {
 
 
 
-BasicBlock* CFGBuilder::newBlock(unsigned Nargs, unsigned Npreds) {
-  BasicBlock *B = new (Arena) BasicBlock(Arena);
-  if (Nargs > 0) {
+BasicBlock* CFGBuilder::newBlock(unsigned Nargs, unsigned Npreds,
+                                 unsigned NInstrs) {
+  BasicBlock *B = allocBlock();
+  // Assign a temporary ID, so that new blocks can be used as keys into
+  // side tables during construction.  Blocks are renumbered in endCFG().
+  B->setBlockID(static_cast<int>(NextBlockID++));
+  if (Npreds > 0)
     B->predecessors().reserve(Arena, Npreds);
+  if (Nargs > 0) {
     B->arguments().reserve(Arena, Nargs);
-    for (unsigned i = 0; i < Nargs; ++i) {
-      auto *Ph = new (Arena) Phi();
-      Ph->values().reserve(Arena, Npreds);
-      B->addArgument(Ph);
-    }
+    for (unsigned i = 0; i < Nargs; ++i)
+      B->addArgument(allocPhi(Npreds));
   }
+  if (NInstrs > 0)
+    B->reserveInstructions(NInstrs);
   return B;
 }
 
 
+void CFGBuilder::recycleCFG(SCFG *Cfg) {
+  assert(Cfg != CurrentCFG && "Cannot recycle the CFG being built.");
+  for (auto &B : Cfg->blocks()) {
+    if (!B.get())
+      continue;
+    for (auto &A : B->arguments()) {
+      if (!A)
+        continue;
+      A->values().clear();
+      A->setStatus(Phi::PH_MultiVal);
+      A->setBlock(nullptr);
+      A->setInstrID(0);
+      A->setStackID(0);
+      A->setBaseType(BaseType::getBaseType<void>());
+      A->clearAnnotations();
+      FreePhis.push_back(A);
+    }
+    B->reset();
+    FreeBlocks.push_back(B.get());
+  }
+  Cfg->blocks().clear();
+}
+
+
 void CFGBuilder::setPhiArgument(Phi* Ph, SExpr* E, unsigned Idx) {
   if (!E)
     return;
@@ -175,7 +212,9 @@ void CFGBuilder::setPhiArgument(Phi* Ph, SExpr* E, unsigned Idx) {
     return;
   }
 
+  Ph->invalidateHashCode();
   Ph->values().resize(Arena, Idx+1, nullptr);  // Make room if we need to.
+  Instruction::transferUse(Ph->values()[Idx].get(), I);
   Ph->values()[Idx].reset(I);
 
   // Futures don't yet have types...
@@ -242,6 +281,7 @@ Branch* CFGBuilder::newBranch(SExpr *Cond, BasicBlock *B0, BasicBlock *B1) {
 
   // Terminate current basic block with a branch
   auto *Nt = new (Arena) Branch(Cond, B0, B1);
+  Nt->recordOperandUses();
   endBlock(Nt);
   return Nt;
 }
@@ -252,6 +292,7 @@ Switch* CFGBuilder::newSwitch(SExpr *Cond, int numCases) {
 
   // Terminate current basic block with a branch
   auto *Nt = new (Arena) Switch(Cond, Arena, numCases);
+  Nt->recordOperandUses();
   endBlock(Nt);
   return Nt;
 }
@@ -262,11 +303,170 @@ void CFGBuilder::addSwitchCase(Switch* S, SExpr* Lab, BasicBlock *B) {
     assert(B->numArguments() == 0 && "Cannot branch to a block with args.");
     B->addPredecessor(S->block());
   }
+  Instruction::registerUse(Lab);
   S->addCase(Lab, B);
 }
 
 
 
+unsigned CFGBuilder::newLocalVar(StringRef Name) {
+  LocalVarNames.push_back(Name);
+  return LocalVarNames.size() - 1;
+}
+
+
+CFGBuilder::SSABlockState* CFGBuilder::ssaState(BasicBlock *B) {
+  unsigned Id = static_cast<unsigned>(B->blockID());
+  if (Id >= SSABlocks.size())
+    SSABlocks.resize(Id + 1);
+  if (!SSABlocks[Id])
+    SSABlocks[Id].reset(new SSABlockState());
+  auto* S = SSABlocks[Id].get();
+  if (S->VarDefs.size() < LocalVarNames.size())
+    S->VarDefs.resize(LocalVarNames.size(), nullptr);
+  return S;
+}
+
+
+// A definition in the cache may be a phi node that was later eliminated
+// as trivial; if so, chase it to the real value.  Phi nodes may refer to
+// other phi nodes.
+Instruction* CFGBuilder::collapseSSADef(Instruction *E) {
+  while (auto *Ph = dyn_cast_or_null<Phi>(E)) {
+    if (Ph->status() != Phi::PH_SingleVal)
+      break;
+    E = dyn_cast_or_null<Instruction>(Ph->values()[0].get());
+  }
+  return E;
+}
+
+
+void CFGBuilder::writeLocalVar(unsigned Vid, Instruction *E) {
+  assert(CurrentBB && "No current block.");
+  assert(Vid < LocalVarNames.size() && "Invalid local variable ID.");
+  ssaState(CurrentBB)->VarDefs[Vid] = E;
+}
+
+
+Instruction* CFGBuilder::readLocalVar(unsigned Vid) {
+  assert(CurrentBB && "No current block.");
+  assert(Vid < LocalVarNames.size() && "Invalid local variable ID.");
+  return readLocalVar(Vid, CurrentBB);
+}
+
+
+Instruction* CFGBuilder::readLocalVar(unsigned Vid, BasicBlock *B) {
+  auto* S = ssaState(B);
+  if (auto* E = S->VarDefs[Vid]) {
+    E = collapseSSADef(E);
+    S->VarDefs[Vid] = E;
+    return E;
+  }
+
+  Instruction* E;
+  if (!S->Sealed) {
+    // Not all predecessors are known yet (e.g. a loop header that has not
+    // seen its back-edge).  Make an incomplete phi node; its values are
+    // filled in when B is sealed.
+    auto* Ph = allocPhi(B->numPredecessors());
+    S->IncompletePhis.push_back(std::make_pair(Ph, Vid));
+    S->VarDefs[Vid] = Ph;
+    return Ph;
+  }
+  else if (B->numPredecessors() == 1) {
+    E = readLocalVar(Vid, B->predecessors()[0].get());
+  }
+  else if (B->numPredecessors() == 0) {
+    // The variable is not defined on this path.
+    E = newUndefined();
+  }
+  else {
+    // Cache a new phi node before looking up the variable in the
+    // predecessors, to break cycles.
+    auto* Ph = allocPhi(B->numPredecessors());
+    S->VarDefs[Vid] = Ph;
+    E = addPhiOperands(Ph, Vid, B);
+  }
+  S->VarDefs[Vid] = E;
+  return E;
+}
+
+
+Instruction* CFGBuilder::addPhiOperands(Phi *Ph, unsigned Vid, BasicBlock *B) {
+  // One value per predecessor, in predecessor order.
+  for (auto &P : B->predecessors()) {
+    auto* E = readLocalVar(Vid, P.get());
+    Ph->values().emplace_back(Arena, E);
+  }
+  return tryRemoveTrivialPhi(Ph, Vid, B);
+}
+
+
+Instruction* CFGBuilder::tryRemoveTrivialPhi(Phi *Ph, unsigned Vid,
+                                             BasicBlock *B) {
+  Instruction* Same = nullptr;
+  bool Trivial = true;
+  for (auto &V : Ph->values()) {
+    auto* E = collapseSSADef(dyn_cast_or_null<Instruction>(V.get()));
+    if (E == Ph || E == Same)
+      continue;   // The phi refers to itself, or repeats a value.
+    if (Same) {
+      Trivial = false;
+      break;
+    }
+    Same = E;
+  }
+
+  if (!Trivial) {
+    // The phi merges at least two distinct values; add it to the block.
+    // All phi values must have the same type.
+    for (auto &V : Ph->values()) {
+      if (auto* I = dyn_cast_or_null<Instruction>(V.get())) {
+        if (I != Ph && !isa<Undefined>(I)) {
+          Ph->setBaseType(I->baseType());
+          break;
+        }
+      }
+    }
+    StringRef Nm = LocalVarNames[Vid];
+    if (Nm.size() > 0)
+      Ph->setInstrName(*this, Nm);
+    B->addArgument(Ph);
+    return Ph;
+  }
+
+  if (!Same)
+    Same = newUndefined();   // The phi had no values other than itself.
+
+  // The phi is trivial.  It may have been cached, or used as a value of
+  // another phi, before we discovered that; mark it as single-val so
+  // that readers chase it to the real value via collapseSSADef().
+  if (Ph->values().size() > 0)
+    Ph->values()[0].reset(Same);
+  else
+    Ph->values().emplace_back(Arena, Same);
+  Ph->setStatus(Phi::PH_SingleVal);
+  return Same;
+}
+
+
+void CFGBuilder::sealBlock(BasicBlock *B) {
+  auto* S = ssaState(B);
+  assert(!S->Sealed && "Block is already sealed.");
+  S->Sealed = true;
+
+  // Complete phi nodes that were made before the predecessor list was
+  // final.  addPhiOperands() may recurse back into this block; reads
+  // will now see it as sealed, and find the phis in the cache.
+  for (unsigned i = 0; i < S->IncompletePhis.size(); ++i) {
+    auto& IP = S->IncompletePhis[i];
+    addPhiOperands(IP.first, IP.second, B);
+  }
+  S->IncompletePhis.clear();
+}
+
+
+
 }  // end namespace til
 }  // end namespace ohmu
 
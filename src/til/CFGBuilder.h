@@ -12,6 +12,8 @@
 #include "TILTraverse.h"
 #include "TILPrettyPrint.h"
 
+#include <memory>
+#include <unordered_map>
 #include <vector>
 
 
@@ -37,7 +39,15 @@ public:
     bool     EmitInstrs;  // Do we have a current CFG?
   };
 
-  void setArena(MemRegionRef A) { Arena = A; }
+  void setArena(MemRegionRef A) {
+    Arena = A;
+    // Interned and recycled nodes live in the old arena; don't hand
+    // them out from the new one.
+    TypeInternTable.clear();
+    LiteralInternTable.clear();
+    FreeBlocks.clear();
+    FreePhis.clear();
+  }
 
   /// Return the memory pool used by this builder to create new instructions.
   MemRegionRef& arena() { return Arena; }
@@ -97,7 +107,12 @@ public:
   /// If Cfg is not null, then start building Cfg.
   /// If Cfg is null, then create a new one, and if createEntryExit,
   /// then initialize the new CFG with entry and exit blocks.
-  SCFG* beginCFG(SCFG *Cfg, bool createEntryExit = true);
+  /// If SizeHint is given (usually the CFG a pass is rewriting), block
+  /// storage is reserved up front to match it.  NBlocksHint reserves
+  /// block storage from a numeric count instead, for translators whose
+  /// source graph knows its dimensions but is not an SCFG.
+  SCFG* beginCFG(SCFG *Cfg, bool createEntryExit = true,
+                 const SCFG *SizeHint = nullptr, unsigned NBlocksHint = 0);
 
   /// Finish working on the current CFG.
   void endCFG();
@@ -137,8 +152,15 @@ public:
     return new (Arena) Array(Typ, newLiteralT<uint64_t>(Ne), Arena);
   }
 
+  /// Scalar type nodes are immutable, so they are uniquified: requesting
+  /// the same base type twice returns the same node, and two scalar types
+  /// are equal iff the pointers are equal.  (Shared nodes must not be
+  /// annotated.)
   ScalarType* newScalarType(BaseType Bt) {
-    return new (Arena) ScalarType(Bt);
+    ScalarType *&Ty = TypeInternTable[typeKey(Bt)];
+    if (!Ty)
+      Ty = new (Arena) ScalarType(Bt);
+    return Ty;
   }
   Literal* newLiteralVoid() {
     return new (Arena) Literal(BaseType::getBaseType<void>());
@@ -147,6 +169,21 @@ public:
   LiteralT<T>* newLiteralT(T Val) {
     return new (Arena) LiteralT<T>(Val);
   }
+  /// Return a uniquified literal for Val.  Booleans and small integers
+  /// are interned; other values fall back to a fresh node.  Interned
+  /// literals are shared, so callers must not annotate them; use
+  /// newLiteralT to get a private node.
+  template<class T>
+  LiteralT<T>* internLiteralT(T Val) {
+    uint64_t K;
+    if (!internKey(Val, &K))
+      return newLiteralT(Val);
+    K = (K << 32) | typeKey(BaseType::getBaseType<T>());
+    Literal *&L = LiteralInternTable[K];
+    if (!L)
+      L = new (Arena) LiteralT<T>(Val);
+    return static_cast<LiteralT<T>*>(L);
+  }
   Variable* newVariable(VarDecl* Vd) {
     return new (Arena) Variable(Vd);
   }
@@ -189,7 +226,7 @@ public:
   /// Create a new Phi node. This should only be used in special circumstances;
   /// Phi nodes are normally handled at block creation time.
   Phi* newPhi(int numPreds, bool addAsArgument = true) {
-    auto* Ph = new (arena()) Phi(arena(), numPreds);
+    auto* Ph = allocPhi(numPreds);
     if (addAsArgument)
       addArg(Ph);
     return Ph;
@@ -215,6 +252,7 @@ public:
   /// Terminate the current block with a Return instruction.
   Return* newReturn(SExpr* E) {
     auto* Res = new (Arena) Return(E);
+    Res->recordOperandUses();
     endBlock(Res);
     return Res;
   }
@@ -243,7 +281,17 @@ public:
   /// Create a new basic block in the current cfg.
   /// If Nargs > 0, will create new Phi nodes for arguments.
   /// If NPreds > 0, will reserve space for predecessors.
-  BasicBlock* newBlock(unsigned Nargs = 0, unsigned NPreds = 0);
+  /// If NInstrs > 0, will reserve space for instructions; rewriting
+  /// passes pass the size of the source block as a hint.
+  BasicBlock* newBlock(unsigned Nargs = 0, unsigned NPreds = 0,
+                       unsigned NInstrs = 0);
+
+  /// Return the block and phi-node shells of an abandoned CFG to the
+  /// builder's free pools, from which newBlock() and newPhi() draw.
+  /// The shells keep the capacity of their arrays, so rewrite-heavy
+  /// runs stop growing fresh arrays in the arena for every pass.
+  /// Cfg, its blocks, and its phi nodes must not be used afterwards.
+  void recycleCFG(SCFG *Cfg);
 
   /// Add I to the current basic basic block.
   template<class T> inline T* addInstr(T* I);
@@ -257,23 +305,142 @@ public:
   void setPhiArgument(Phi* Ph, SExpr* E, unsigned Idx);
 
 
+  /// --- On-the-fly SSA construction ---
+  /// These methods let a front end build a CFG that is born in SSA form,
+  /// rather than emitting Alloc/Load/Store instructions for mutable local
+  /// variables and cleaning up with SSAPass afterwards.  Local variables
+  /// are identified by IDs from newLocalVar().  writeLocalVar() records
+  /// the current definition in the current block; readLocalVar() returns
+  /// the reaching definition, inserting phi nodes at join points on
+  /// demand.  Phi nodes whose values all coincide are elided.
+  ///
+  /// A block must be sealed with sealBlock() once all of its predecessors
+  /// have been added.  Reads in unsealed blocks (e.g. loop headers)
+  /// create incomplete phi nodes, which are completed when the block is
+  /// sealed.
+
+  /// Create a new local variable, and return its ID.
+  unsigned newLocalVar(StringRef Name = StringRef(nullptr, 0));
+
+  /// Set the definition of variable Vid in the current block.
+  void writeLocalVar(unsigned Vid, Instruction *E);
+
+  /// Return the reaching definition of variable Vid in the current block,
+  /// or Undefined if the variable has not been written on some path.
+  Instruction* readLocalVar(unsigned Vid);
+
+  /// Declare that all predecessors of B have been added.
+  void sealBlock(BasicBlock *B);
+
+
   CFGBuilder()
     : CurrentCFG(nullptr), CurrentBB(nullptr), OverwriteCurrentBB(false),
-      OldCfgState(0, false)
+      NextBlockID(0), OldCfgState(0, false)
   { }
   CFGBuilder(MemRegionRef A, bool Inplace = false)
     : Arena(A), CurrentCFG(nullptr), CurrentBB(nullptr),
-      OverwriteCurrentBB(false), OldCfgState(0, false)
+      OverwriteCurrentBB(false), NextBlockID(0), OldCfgState(0, false)
   { }
   virtual ~CFGBuilder() { }
 
 protected:
+  // Per-block state for on-the-fly SSA construction.
+  struct SSABlockState {
+    std::vector<Instruction*> VarDefs;  ///< current def for each local var.
+    std::vector<std::pair<Phi*, unsigned>> IncompletePhis;  ///< phi, var ID.
+    bool Sealed;
+
+    SSABlockState() : Sealed(false) { }
+  };
+
+  /// Return a block shell, drawing from the free pool when possible.
+  BasicBlock* allocBlock() {
+    if (!FreeBlocks.empty()) {
+      BasicBlock *B = FreeBlocks.back();
+      FreeBlocks.pop_back();
+      return B;
+    }
+    return new (Arena) BasicBlock(Arena);
+  }
+
+  /// Return a Phi node with room for Npreds values, drawing from the
+  /// free pool when possible.
+  Phi* allocPhi(unsigned Npreds) {
+    if (!FreePhis.empty()) {
+      Phi *Ph = FreePhis.back();
+      FreePhis.pop_back();
+      Ph->values().reserve(Arena, Npreds);
+      return Ph;
+    }
+    return new (Arena) Phi(Arena, Npreds);
+  }
+
+  /// Return the SSA construction state for B, creating it if necessary.
+  SSABlockState* ssaState(BasicBlock *B);
+
+  /// Return the reaching definition of variable Vid at the end of B.
+  Instruction* readLocalVar(unsigned Vid, BasicBlock *B);
+
+  /// Fill in the values of Ph from the predecessors of B.
+  Instruction* addPhiOperands(Phi *Ph, unsigned Vid, BasicBlock *B);
+
+  /// If all values of Ph coincide, mark it as trivial and return the
+  /// single value; otherwise add Ph to B as an argument and return it.
+  Instruction* tryRemoveTrivialPhi(Phi *Ph, unsigned Vid, BasicBlock *B);
+
+  /// Chase definitions that are phi nodes eliminated as trivial.
+  static Instruction* collapseSSADef(Instruction *E);
+
+  /// Encode Bt as an interning table key.
+  /// (BaseType::asUInt16() drops the vector size.)
+  static uint32_t typeKey(BaseType Bt) {
+    return static_cast<uint32_t>(Bt.Base) | (Bt.Size << 8) |
+           (static_cast<uint32_t>(Bt.VectSize) << 16);
+  }
+
+  /// Set *K and return true if Val is worth interning.  Only booleans and
+  /// small non-negative integers are; floats compare unreliably and
+  /// strings would need a deep hash.
+  static bool internKey(bool     Val, uint64_t *K) { *K = Val; return true; }
+  static bool internKey(int8_t   Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(uint8_t  Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(int16_t  Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(uint16_t Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(int32_t  Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(uint32_t Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(int64_t  Val, uint64_t *K) { return intKey(Val, K); }
+  static bool internKey(uint64_t Val, uint64_t *K) {
+    if (Val > MaxInternedInt) return false;
+    *K = Val;
+    return true;
+  }
+  template<class T>
+  static bool internKey(T, uint64_t *) { return false; }
+
+  static bool intKey(int64_t Val, uint64_t *K) {
+    if (Val < 0 || Val > MaxInternedInt) return false;
+    *K = static_cast<uint64_t>(Val);
+    return true;
+  }
+
+  static const int64_t MaxInternedInt = 255;
+
   MemRegionRef               Arena;          ///< pool to create new instrs
   SCFG*                      CurrentCFG;     ///< current CFG
   BasicBlock*                CurrentBB;      ///< current basic block
   std::vector<Phi*>          CurrentArgs;    ///< arguments in CurrentBB.
   std::vector<Instruction*>  CurrentInstrs;  ///< instructions in CurrentBB.
   bool                       OverwriteCurrentBB;
+  unsigned                   NextBlockID;    ///< construction-time block IDs.
+
+  std::vector<std::unique_ptr<SSABlockState>> SSABlocks;  ///< by block ID.
+  std::vector<StringRef>     LocalVarNames;  ///< names of local variables.
+
+  std::unordered_map<uint32_t, ScalarType*> TypeInternTable;
+  std::unordered_map<uint64_t, Literal*>    LiteralInternTable;
+
+  std::vector<BasicBlock*>   FreeBlocks;     ///< recycled block shells.
+  std::vector<Phi*>          FreePhis;       ///< recycled phi shells.
 
   BuilderState               CurrentState;   ///< state at current location.
   BuilderState               OldCfgState;    ///< state at old CFG location.
@@ -289,6 +456,7 @@ inline T* CFGBuilder::addInstr(T* I) {
   assert(!I->block() && "Instruction was already added to a block.");
   assert(!isa<Phi>(I) && "Phi nodes should be arguments.");
   I->setBlock(CurrentBB);        // Mark I as having been added.
+  I->recordOperandUses();
   CurrentInstrs.push_back(I);
   return I;
 }
@@ -114,8 +114,8 @@ public:
 
   void enterCFG(SCFG *Cfg) {
     if (Cfg) {
-      // We are rewriting a CFG to a CFG.
-      Builder.beginCFG(nullptr);
+      // We are rewriting a CFG to a CFG; size the copy like the source.
+      Builder.beginCFG(nullptr, true, Cfg);
       this->scope()->enterCFG(Cfg, Builder.currentCFG());
     }
     else {
@@ -146,9 +146,10 @@ public:
 
     auto *B2 = this->scope()->lookupBlock(Orig);
     if (!B2) {
-      // Create new blocks on demand.
+      // Create new blocks on demand, sized like the originals.
       unsigned Nargs = Orig->arguments().size();
-      B2 = Builder.newBlock(Nargs, Orig->numPredecessors());
+      B2 = Builder.newBlock(Nargs, Orig->numPredecessors(),
+                            Orig->numInstructions());
       this->scope()->insertBlockMap(Orig, B2);
     }
     return B2;
@@ -245,7 +246,11 @@ public:
 
   template<class T>
   void reduceLiteralT(LiteralT<T> *Orig) {
-    this->resultAttr().Exp = Builder.newLiteralT<T>(Orig->value());
+    // Common values share one node; annotated literals get a private copy,
+    // since the annotations are copied onto the result.
+    this->resultAttr().Exp = Orig->annotations()
+        ? Builder.newLiteralT<T>(Orig->value())
+        : Builder.internLiteralT<T>(Orig->value());
   }
 
   void reduceVariable(Variable *Orig) {
@@ -447,26 +452,35 @@ public:
   { }
   virtual ~LazyCopyFuture() { }
 
+  /// Reducer used by the current thread to force futures.  When set, a
+  /// future evaluates on that reducer instead of the one that created
+  /// it, so pool workers can force futures with their own reducer and
+  /// arena rather than racing on a shared one.  The captured scope and
+  /// builder state are self-contained, so any reducer of the right type
+  /// can perform the traversal.
+  static thread_local Visitor* ThreadReducer;
+
   /// Traverse PendingExpr and return the result.
   virtual SExpr* evaluate() override {
-    auto* S  = Reducer->switchScope(ScopePtr);
-    auto  Bs = Reducer->Builder.switchState(BState);
+    Visitor* R = ThreadReducer ? ThreadReducer : Reducer;
+    auto* S  = R->switchScope(ScopePtr);
+    auto  Bs = R->Builder.switchState(BState);
 
     if (CreateCfg) {
-      Reducer->enterCFG(nullptr);
+      R->enterCFG(nullptr);
     }
 
-    Reducer->traverse(PendingExpr, TRV_Tail);
-    SExpr* Res = Reducer->lastAttr().Exp;
-    Reducer->popAttr();
+    R->traverse(PendingExpr, TRV_Tail);
+    SExpr* Res = R->lastAttr().Exp;
+    R->popAttr();
 
     if (CreateCfg) {
-      Res = Reducer->Builder.currentCFG();
-      Reducer->exitCFG(nullptr);
+      Res = R->Builder.currentCFG();
+      R->exitCFG(nullptr);
     }
 
-    Reducer->Builder.restoreState(Bs);
-    Reducer->restoreScope(S);
+    R->Builder.restoreState(Bs);
+    R->restoreScope(S);
     finish();
     return Res;
   }
@@ -486,6 +500,9 @@ protected:
   bool         CreateCfg;    // Evaluate in a new CFG?
 };
 
+template<class Visitor, class ScopeT>
+thread_local Visitor* LazyCopyFuture<Visitor, ScopeT>::ThreadReducer = nullptr;
+
 
 
 /// Base class for non-destructive, lazy traversals.
@@ -67,53 +67,136 @@ DEFINE_BINARY_OP_CLASS(LogicOr,  ||,  Ty1)
 #undef DEFINE_BINARY_OP_CLASS
 
 
-#define ARGS(OP) opclass::OP, Literal*, MemRegionRef, Literal*, Literal*
+/// A specialized constant-folding kernel: the op class templates above,
+/// instantiated at a concrete literal type.
+typedef Literal* (*BinaryFoldFn)(MemRegionRef A, Literal* E0, Literal* E1);
+
+template< template<typename> class OpC, typename Ty >
+static Literal* foldFwd(MemRegionRef A, Literal* E0, Literal* E1) {
+  return OpC<Ty>::action(A, E0, E1);
+}
+
+/// Folds with the operands exchanged; Gt and Geq reuse the Lt and Leq
+/// op classes this way.
+template< template<typename> class OpC, typename Ty >
+static Literal* foldRev(MemRegionRef A, Literal* E0, Literal* E1) {
+  return OpC<Ty>::action(A, E1, E0);
+}
+
+
+/// Dense index over the base types a folding kernel can be specialized
+/// at.  FT_None marks (Base, Size) combinations with no kernels.
+enum FoldTypeIndex : unsigned char {
+  FT_None = 0,
+  FT_Bool,
+  FT_Int8,  FT_Int16,  FT_Int32,  FT_Int64,
+  FT_UInt8, FT_UInt16, FT_UInt32, FT_UInt64,
+  FT_Float, FT_Double,
+  FT_String, FT_Pointer,
+  FT_Count
+};
+
+/// Maps (BaseCode, SizeCode) to a FoldTypeIndex.  Bool, String and
+/// Pointer ignore the size code, as the BtBr branches do.
+static const unsigned char FoldTypeTable[BaseType::BT_Pointer + 1]
+                                        [BaseType::ST_128 + 1] = {
+  // ST_0     ST_1     ST_8      ST_16      ST_32      ST_64      ST_128
+  { FT_None,  FT_None, FT_None,  FT_None,   FT_None,   FT_None,   FT_None },
+  { FT_Bool,  FT_Bool, FT_Bool,  FT_Bool,   FT_Bool,   FT_Bool,   FT_Bool },
+  { FT_None,  FT_None, FT_Int8,  FT_Int16,  FT_Int32,  FT_Int64,  FT_None },
+  { FT_None,  FT_None, FT_UInt8, FT_UInt16, FT_UInt32, FT_UInt64, FT_None },
+  { FT_None,  FT_None, FT_None,  FT_None,   FT_Float,  FT_Double, FT_None },
+  { FT_String,  FT_String,  FT_String,  FT_String,
+    FT_String,  FT_String,  FT_String },
+  { FT_Pointer, FT_Pointer, FT_Pointer, FT_Pointer,
+    FT_Pointer, FT_Pointer, FT_Pointer }
+};
+
+// One table row per opcode, one column per FoldTypeIndex.  Arithmetic
+// ops fold only at promoted numeric types, bitwise ops only at promoted
+// integral types, and comparisons at every literal type, matching the
+// branchOnNumeric / branchOnIntegral / branch dispatch this table
+// replaces.  The logical ops always use the bool kernel, whatever the
+// declared type.
+#define FOLD_ROW_NUMERIC(OP)                                                  \
+  { nullptr, nullptr, nullptr, nullptr,                                       \
+    foldFwd<opclass::OP, int32_t>,  foldFwd<opclass::OP, int64_t>,            \
+    nullptr, nullptr,                                                         \
+    foldFwd<opclass::OP, uint32_t>, foldFwd<opclass::OP, uint64_t>,           \
+    foldFwd<opclass::OP, float>,    foldFwd<opclass::OP, double>,             \
+    nullptr, nullptr }
+
+#define FOLD_ROW_NUMERIC_REV(OP)                                              \
+  { nullptr, nullptr, nullptr, nullptr,                                       \
+    foldRev<opclass::OP, int32_t>,  foldRev<opclass::OP, int64_t>,            \
+    nullptr, nullptr,                                                         \
+    foldRev<opclass::OP, uint32_t>, foldRev<opclass::OP, uint64_t>,           \
+    foldRev<opclass::OP, float>,    foldRev<opclass::OP, double>,             \
+    nullptr, nullptr }
+
+#define FOLD_ROW_INTEGRAL(OP)                                                 \
+  { nullptr, nullptr, nullptr, nullptr,                                       \
+    foldFwd<opclass::OP, int32_t>,  foldFwd<opclass::OP, int64_t>,            \
+    nullptr, nullptr,                                                         \
+    foldFwd<opclass::OP, uint32_t>, foldFwd<opclass::OP, uint64_t>,           \
+    nullptr, nullptr, nullptr, nullptr }
+
+#define FOLD_ROW_ALL(OP)                                                      \
+  { nullptr,                                                                  \
+    foldFwd<opclass::OP, bool>,                                               \
+    foldFwd<opclass::OP, int8_t>,   foldFwd<opclass::OP, int16_t>,            \
+    foldFwd<opclass::OP, int32_t>,  foldFwd<opclass::OP, int64_t>,            \
+    foldFwd<opclass::OP, uint8_t>,  foldFwd<opclass::OP, uint16_t>,           \
+    foldFwd<opclass::OP, uint32_t>, foldFwd<opclass::OP, uint64_t>,           \
+    foldFwd<opclass::OP, float>,    foldFwd<opclass::OP, double>,             \
+    foldFwd<opclass::OP, StringRef>, foldFwd<opclass::OP, void*>  }
+
+#define FOLD_ROW_LOGICAL(OP)                                                  \
+  { foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>,                   \
+    foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>,                   \
+    foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>,                   \
+    foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>,                   \
+    foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>,                   \
+    foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>,                   \
+    foldFwd<opclass::OP, bool>, foldFwd<opclass::OP, bool>  }
+
+static const BinaryFoldFn FoldTable[BOP_Max + 1][FT_Count] = {
+  FOLD_ROW_NUMERIC(Add),          // BOP_Add
+  FOLD_ROW_NUMERIC(Sub),          // BOP_Sub
+  FOLD_ROW_NUMERIC(Mul),          // BOP_Mul
+  FOLD_ROW_NUMERIC(Div),          // BOP_Div
+  FOLD_ROW_INTEGRAL(Rem),         // BOP_Rem
+  FOLD_ROW_INTEGRAL(Shl),         // BOP_Shl
+  FOLD_ROW_INTEGRAL(Shr),         // BOP_Shr
+  FOLD_ROW_INTEGRAL(BitAnd),      // BOP_BitAnd
+  FOLD_ROW_INTEGRAL(BitXor),      // BOP_BitXor
+  FOLD_ROW_INTEGRAL(BitOr),       // BOP_BitOr
+  FOLD_ROW_ALL(Eq),               // BOP_Eq
+  FOLD_ROW_ALL(Neq),              // BOP_Neq
+  FOLD_ROW_NUMERIC(Lt),           // BOP_Lt
+  FOLD_ROW_NUMERIC(Leq),          // BOP_Leq
+  FOLD_ROW_NUMERIC_REV(Lt),       // BOP_Gt
+  FOLD_ROW_NUMERIC_REV(Leq),      // BOP_Geq
+  FOLD_ROW_LOGICAL(LogicAnd),     // BOP_LogicAnd
+  FOLD_ROW_LOGICAL(LogicOr)       // BOP_LogicOr
+};
+
+#undef FOLD_ROW_NUMERIC
+#undef FOLD_ROW_NUMERIC_REV
+#undef FOLD_ROW_INTEGRAL
+#undef FOLD_ROW_ALL
+#undef FOLD_ROW_LOGICAL
+
 
 Literal* evaluateBinaryOp(TIL_BinaryOpcode Op, BaseType Bt, MemRegionRef A,
                           Literal* E0, Literal* E1) {
-  switch (Op) {
-    case BOP_Add:
-      return BtBr<opclass::Add>::branchOnNumeric(Bt, A, E0, E1);
-    case BOP_Sub:
-      return BtBr<opclass::Sub>::branchOnNumeric(Bt, A, E0, E1);
-    case BOP_Mul:
-      return BtBr<opclass::Mul>::branchOnNumeric(Bt, A, E0, E1);
-    case BOP_Div:
-      return BtBr<opclass::Div>::branchOnNumeric(Bt, A, E0, E1);
-    case BOP_Rem:
-      return BtBr<opclass::Rem>::branchOnIntegral(Bt, A, E0, E1);
-    case BOP_Shl:
-      return BtBr<opclass::Shl>::branchOnIntegral(Bt, A, E0, E1);
-    case BOP_Shr:
-      return BtBr<opclass::Shr>::branchOnIntegral(Bt, A, E0, E1);
-    case BOP_BitAnd:
-      return BtBr<opclass::BitAnd>::branchOnIntegral(Bt, A, E0, E1);
-    case BOP_BitXor:
-      return BtBr<opclass::BitXor>::branchOnIntegral(Bt, A, E0, E1);
-    case BOP_BitOr:
-      return BtBr<opclass::BitOr>::branchOnIntegral(Bt, A, E0, E1);
-    case BOP_Eq:
-      return BtBr<opclass::Eq>::branch(Bt, A, E0, E1);
-    case BOP_Neq:
-      return BtBr<opclass::Neq>::branch(Bt, A, E0, E1);
-    case BOP_Lt:
-      return BtBr<opclass::Lt>::branchOnNumeric(Bt, A, E0, E1);
-    case BOP_Leq:
-      return BtBr<opclass::Leq>::branchOnNumeric(Bt, A, E0, E1);
-    case BOP_Gt:
-      return BtBr<opclass::Lt>::branchOnNumeric(Bt, A, E1, E0);
-    case BOP_Geq:
-      return BtBr<opclass::Leq>::branchOnNumeric(Bt, A, E1, E0);
-    case BOP_LogicAnd:
-      return opclass::LogicAnd<bool>::action(A, E0, E1);
-    case BOP_LogicOr:
-      return opclass::LogicOr<bool>::action(A, E0, E1);
-  }
-  return nullptr;
+  if (Op > BOP_Max || Bt.Base > BaseType::BT_Pointer ||
+      Bt.Size > BaseType::ST_128)
+    return nullptr;
+  BinaryFoldFn F = FoldTable[Op][FoldTypeTable[Bt.Base][Bt.Size]];
+  return F ? F(A, E0, E1) : nullptr;
 }
 
-#undef ARGS
-
 
 }  // endif namespace til
 }  // endif namespace ohmu
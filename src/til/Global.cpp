@@ -15,8 +15,12 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "CopyReducer.h"
 #include "Global.h"
 #include "TypedEvaluator.h"
+#include "base/ThreadPool.h"
+
+#include <vector>
 
 namespace ohmu {
 namespace til  {
@@ -51,8 +55,16 @@ void Global::createPrelude() {
 }
 
 
-void Global::addDefinitions(std::vector<SExpr*>& Defs) {
-  assert(GlobalRec == nullptr && "FIXME: support multiple calls.");
+void Global::addDefinitions(MutArrayRef<SExpr*> Defs) {
+  if (GlobalRec) {
+    // Append to the existing global record.  findSlot's index picks up
+    // the new slots on the next lookup (see Record::updateSlotIndex).
+    for (auto *E : Defs) {
+      if (auto *Slt = dyn_cast_or_null<Slot>(E))
+        GlobalRec->addSlot(ParseArena, Slt);
+    }
+    return;
+  }
 
   if (PreludeDefs.empty())
     createPrelude();
@@ -74,6 +86,14 @@ void Global::addDefinitions(std::vector<SExpr*>& Defs) {
 }
 
 
+SExpr* Global::findDefinition(StringRef Name) {
+  if (!GlobalRec)
+    return nullptr;
+  Slot* S = GlobalRec->findSlot(Name);
+  return S ? S->definition() : nullptr;
+}
+
+
 void Global::lower() {
   TypedEvaluator eval(DefArena);
   SExpr* E = eval.traverseAll(GlobalSFun);
@@ -87,6 +107,72 @@ void Global::lower() {
 }
 
 
+void Global::lowerParallel(ThreadPool &Pool) {
+  TypedEvaluator eval(DefArena);
+  std::vector<std::unique_ptr<MemRegion>> Regions;
+  SExpr* E = eval.traverseAllParallel(GlobalSFun, Pool, Regions);
+  for (auto &R : Regions)
+    adoptRegion(R.release());
+
+  // Replace the global definitions with lowered versions.
+  GlobalSFun = dyn_cast<Function>(E);
+  if (GlobalSFun)
+    GlobalRec = dyn_cast<Record>(GlobalSFun->body());
+  else
+    GlobalRec = nullptr;
+}
+
+
+void Global::capture() {
+  LangSnap.capture(LangRegion);
+  StringSnap.capture(StringRegion);
+  ParseSnap.capture(ParseRegion);
+  DefSnap.capture(DefRegion);
+  SavedRec = GlobalRec;
+  SavedSFun = GlobalSFun;
+  SavedPreludeDefs = PreludeDefs.size();
+  SavedAdoptedRegions = AdoptedRegions.size();
+}
+
+
+void Global::restore() {
+  assert(LangSnap.captured() && "No capture to restore.");
+  LangSnap.restore();
+  StringSnap.restore();
+  ParseSnap.restore();
+  DefSnap.restore();
+  GlobalRec = SavedRec;
+  GlobalSFun = SavedSFun;
+  PreludeDefs.resize(SavedPreludeDefs);
+  AdoptedRegions.resize(SavedAdoptedRegions);
+}
+
+
+void Global::compact() {
+  if (!GlobalSFun)
+    return;
+
+  // Clone the live IR into a fresh region.  The copier allocates nodes
+  // as it traverses, so the new layout follows the instruction stream.
+  MemRegion* NewRegion = new MemRegion();
+  SExpr* E = SExprCopier::copy(GlobalSFun, MemRegionRef(NewRegion));
+
+  GlobalSFun = dyn_cast<Function>(E);
+  if (GlobalSFun)
+    GlobalRec = dyn_cast<Record>(GlobalSFun->body());
+  else
+    GlobalRec = nullptr;
+
+  // Everything reachable has been copied, so the old nodes are dead.
+  // PreludeDefs points into the freed regions; clear it so that it
+  // cannot be reused.
+  PreludeDefs.clear();
+  ParseRegion.deallocateAll();
+  DefRegion.deallocateAll();
+  adoptRegion(NewRegion);
+}
+
+
 void Global::print(std::ostream &SS) {
   TILDebugPrinter::print(GlobalSFun, SS);
 }
@@ -18,11 +18,17 @@
 #ifndef OHMU_TIL_GLOBAL_H
 #define OHMU_TIL_GLOBAL_H
 
+#include "base/MemRegion.h"
+#include "base/MutArrayRef.h"
 #include "TIL.h"
 
+#include <memory>
 #include <ostream>
 
 namespace ohmu {
+
+class ThreadPool;
+
 namespace til  {
 
 
@@ -39,11 +45,49 @@ public:
   void createPrelude();
 
   // Add Defs to the set of global, newly parsed definitions.
-  void addDefinitions(std::vector<SExpr*> &Defs);
+  void addDefinitions(MutArrayRef<SExpr*> Defs);
+
+  // Take ownership of a region whose objects are referenced from the
+  // global namespace, e.g. definitions built in a worker thread's region.
+  void adoptRegion(MemRegion *R) { AdoptedRegions.emplace_back(R); }
+
+  // Look up a top-level definition by name, or return null.  Lookups go
+  // through the global record's slot index (see Record::findSlot), so
+  // resolution is O(1) even with tens of thousands of globals; the index
+  // is bulk-built on the first lookup and extended as definitions are
+  // added.
+  SExpr* findDefinition(StringRef Name);
 
   // Lower the parsed definitions.
   void lower();
 
+  // Lower the parsed definitions, forcing the lazily rewritten function
+  // bodies on Pool.  The worker regions are adopted by the global
+  // namespace.
+  void lowerParallel(ThreadPool &Pool);
+
+  // Capture the contents of every region.  Each later restore() rolls
+  // the namespace back to this point, discarding definitions added and
+  // rewrites made since.  The definitions present at capture time stay
+  // valid across a restore, because snapshots put the original bytes
+  // back in place (see MemRegion::Snapshot); a compile server uses this
+  // to keep a warm namespace resident across requests.
+  void capture();
+
+  // Roll back to the last capture().
+  void restore();
+
+  // Return true if capture() has been called.
+  bool captured() const { return LangSnap.captured(); }
+
+  // Re-lay out the surviving definitions in traversal order.  Rewriting
+  // passes leave live nodes scattered among dead ones across the parse
+  // and definition regions; compact() clones the live IR into a fresh
+  // region and releases the old ones, so later passes traverse
+  // contiguous memory.  Strings are not copied; the string arenas are
+  // left intact.
+  void compact();
+
   // Dump outputs to the given stream
   void print(std::ostream &SS);
 
@@ -56,6 +100,17 @@ private:
   Record   *GlobalRec;
   Function *GlobalSFun;
   std::vector<Slot*> PreludeDefs;
+  std::vector<std::unique_ptr<MemRegion>> AdoptedRegions;
+
+  // State saved by capture(); see restore().
+  MemRegion::Snapshot LangSnap;
+  MemRegion::Snapshot StringSnap;
+  MemRegion::Snapshot ParseSnap;
+  MemRegion::Snapshot DefSnap;
+  Record   *SavedRec = nullptr;
+  Function *SavedSFun = nullptr;
+  size_t    SavedPreludeDefs = 0;
+  size_t    SavedAdoptedRegions = 0;
 
 public:
   MemRegionRef LangArena;
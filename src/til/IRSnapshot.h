@@ -0,0 +1,86 @@
+//===- IRSnapshot.h --------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// IRSnapshot supports speculative rewriting: try an aggressive
+// transformation, and cheaply abandon it if the result is worse.
+//
+// Construction clones the live IR of a term into a private region with
+// SExprCopier, which relocates every reachable node and fixes up the
+// pointers between them; this structural pass is paid once.  The byte
+// contents of the region are then captured (MemRegion::Snapshot), and
+// restore() backs out all in-place mutations and discards everything
+// allocated in the region since, by rolling the region back and copying
+// the saved bytes over the original addresses.  Each attempt in an
+// optimization search loop therefore costs a memcpy, not a traversal.
+//
+// Rewrites to be backed out must allocate in arena(); nodes created in
+// other regions will survive a restore (but nothing in this region will
+// point to them afterwards).  Strings are not copied or saved; they live
+// in the string arenas and are immutable.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_TIL_IRSNAPSHOT_H
+#define OHMU_TIL_IRSNAPSHOT_H
+
+#include "CopyReducer.h"
+
+namespace ohmu {
+namespace til  {
+
+
+class IRSnapshot {
+public:
+  // Clone the live IR reachable from E into a private region, and capture
+  // a byte-level snapshot of the clone.  E is not modified.
+  explicit IRSnapshot(SExpr* E) {
+    Expr = SExprCopier::copy(E, MemRegionRef(&Region));
+    Snap.capture(Region);
+  }
+
+  // The working copy.  Speculative passes mutate and extend this term.
+  SExpr* expr() { return Expr; }
+
+  // The region holding the working copy.  Speculative rewrites must
+  // allocate here so that restore() reclaims them.
+  MemRegionRef arena() { return MemRegionRef(&Region); }
+
+  // Back out every mutation and allocation made since the snapshot was
+  // taken, returning expr() to its captured state.  May be called once
+  // per attempt.
+  void restore() { Snap.restore(); }
+
+  // Re-capture the current state, e.g. after committing to a successful
+  // rewrite, so that further speculation restores to the new state.
+  void recapture(SExpr* E) {
+    Expr = E;
+    Snap.capture(Region);
+  }
+
+  size_t savedBytes() const { return Snap.savedBytes(); }
+
+private:
+  MemRegion           Region;
+  SExpr*              Expr;
+  MemRegion::Snapshot Snap;
+};
+
+
+}  // end namespace til
+}  // end namespace ohmu
+
+#endif  // OHMU_TIL_IRSNAPSHOT_H
@@ -170,7 +170,9 @@ public:
   void reduceVariable(Variable *Orig) {
     unsigned Idx = Orig->variableDecl()->varIndex();
     if (this->scope()->isNull(Idx)) {
-      // Null substitution: just copy the variable.
+      // Null substitution: just copy the variable.  Its declaration may
+      // have been rewritten in place.
+      Orig->invalidateHashCode();
       this->resultAttr() = Attr( Orig );
     }
     else {
@@ -297,10 +299,14 @@ public:
   }
 
   void reduceBasicBlock(BasicBlock *Orig) {
+    // The instructions in the block may have been rewritten in place
+    // without touching the block node itself.
+    Orig->invalidateHashCode();
     this->resultAttr().Exp = Orig;
   }
 
   void reduceSCFG(SCFG *Orig) {
+    Orig->invalidateHashCode();
     this->resultAttr().Exp = Orig;
   }
 
@@ -0,0 +1,70 @@
+//===- PassManager.cpp -----------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+
+#include "PassManager.h"
+#include "SSAPass.h"
+#include "SimplifyCFG.h"
+#include "VisitCFG.h"
+#include "base/ThreadPool.h"
+
+#include <atomic>
+
+namespace ohmu {
+namespace til  {
+
+
+void ParallelPassDriver::run(SExpr *E, ThreadPool &Pool,
+                             std::vector<std::unique_ptr<MemRegion>> &Regions,
+                             unsigned NumVars) {
+  // Collect the CFGs in the module.  The collection order is fixed by
+  // the traversal, so task numbering is deterministic.
+  VisitCFG Visitor;
+  Visitor.traverseAll(E);
+  std::vector<SCFG*> &Cfgs = Visitor.cfgs();
+  if (Cfgs.empty())
+    return;
+
+  unsigned NTasks = Pool.numThreads();
+  if (NTasks > Cfgs.size())
+    NTasks = Cfgs.size();
+
+  // Process the CFGs on the pool, load-balanced with an atomic cursor.
+  // Each task rewrites with its own SSAPass and arena, so workers never
+  // share a builder.  The locals captured by reference are safe because
+  // we block below.
+  std::atomic<uint32_t> Next(0);
+  for (unsigned t = 0; t < NTasks; ++t) {
+    Regions.emplace_back(new MemRegion());
+    MemRegionRef Arena(Regions.back().get());
+    Pool.submit([&Cfgs, &Next, Arena, NumVars]() {
+      for (;;) {
+        uint32_t i = Next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= Cfgs.size())
+          break;
+        SSAPass Ssa(Arena);
+        Ssa.scope()->enterNullScope(NumVars);
+        Ssa.traverseAll(Cfgs[i]);
+        SimplifyCFG::simplify(Cfgs[i]);
+      }
+    });
+  }
+  Pool.waitForAll();
+}
+
+
+}  // end namespace til
+}  // end namespace ohmu
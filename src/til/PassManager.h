@@ -0,0 +1,240 @@
+//===- PassManager.h -------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// A pass manager that fuses several in-place rewriting passes into a
+// single traversal of the IR, so that per-node dispatch and traversal
+// overhead are paid once per pipeline instead of once per pass.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_TIL_PASSMANAGER_H
+#define OHMU_TIL_PASSMANAGER_H
+
+#include "InplaceReducer.h"
+
+#include <memory>
+#include <tuple>
+#include <vector>
+
+
+namespace ohmu {
+
+class ThreadPool;
+
+namespace til  {
+
+
+/// A micro pass for use with InplacePassPipeline.  Derive from it and
+/// override the hooks of interest; every hook is invoked from a single
+/// shared traversal.  For each node, the passes of a pipeline run in
+/// order, so the pipeline is equivalent to running the passes back to
+/// back, provided each pass only needs to see a node after its operands
+/// have been reduced.  Per-pass state lives in the pass object itself.
+class InplaceMicroPass {
+public:
+  void enterCFG  (SCFG *Cfg,      CFGBuilder &Builder) { }
+  void exitCFG   (SCFG *Cfg,      CFGBuilder &Builder) { }
+  void enterBlock(BasicBlock *B,  CFGBuilder &Builder) { }
+  void exitBlock (BasicBlock *B,  CFGBuilder &Builder) { }
+
+  /// Process an instruction whose operands have already been reduced,
+  /// before it is added to the current block.  Return either I, or a
+  /// replacement for it, which is handed to the next pass in the
+  /// pipeline.  Returning nullptr drops the instruction; a pass may
+  /// only do that once it has rewritten all uses.
+  Instruction* reduceInstruction(Instruction *I, CFGBuilder &Builder) {
+    return I;
+  }
+
+  /// Process a block terminator after the block has been completed.
+  void reduceTerminator(Terminator *T, CFGBuilder &Builder) { }
+};
+
+
+namespace pipeline_impl {
+
+/// Invokes a hook on the I^th through N^th passes of a pipeline tuple,
+/// in order.
+template<unsigned I, unsigned N>
+struct PassApplier {
+  template<class Tuple>
+  static Instruction* reduceInstruction(Tuple &Ps, Instruction *In,
+                                        CFGBuilder &B) {
+    if (!In)
+      return nullptr;
+    return PassApplier<I+1, N>::reduceInstruction(
+        Ps, std::get<I>(Ps).reduceInstruction(In, B), B);
+  }
+
+  template<class Tuple>
+  static void reduceTerminator(Tuple &Ps, Terminator *T, CFGBuilder &B) {
+    std::get<I>(Ps).reduceTerminator(T, B);
+    PassApplier<I+1, N>::reduceTerminator(Ps, T, B);
+  }
+
+  template<class Tuple>
+  static void enterCFG(Tuple &Ps, SCFG *C, CFGBuilder &B) {
+    std::get<I>(Ps).enterCFG(C, B);
+    PassApplier<I+1, N>::enterCFG(Ps, C, B);
+  }
+
+  template<class Tuple>
+  static void exitCFG(Tuple &Ps, SCFG *C, CFGBuilder &B) {
+    std::get<I>(Ps).exitCFG(C, B);
+    PassApplier<I+1, N>::exitCFG(Ps, C, B);
+  }
+
+  template<class Tuple>
+  static void enterBlock(Tuple &Ps, BasicBlock *Bb, CFGBuilder &B) {
+    std::get<I>(Ps).enterBlock(Bb, B);
+    PassApplier<I+1, N>::enterBlock(Ps, Bb, B);
+  }
+
+  template<class Tuple>
+  static void exitBlock(Tuple &Ps, BasicBlock *Bb, CFGBuilder &B) {
+    std::get<I>(Ps).exitBlock(Bb, B);
+    PassApplier<I+1, N>::exitBlock(Ps, Bb, B);
+  }
+};
+
+template<unsigned N>
+struct PassApplier<N, N> {
+  template<class Tuple>
+  static Instruction* reduceInstruction(Tuple &Ps, Instruction *In,
+                                        CFGBuilder &B) {
+    return In;
+  }
+  template<class Tuple>
+  static void reduceTerminator(Tuple &Ps, Terminator *T, CFGBuilder &B) { }
+  template<class Tuple>
+  static void enterCFG (Tuple &Ps, SCFG *C, CFGBuilder &B) { }
+  template<class Tuple>
+  static void exitCFG  (Tuple &Ps, SCFG *C, CFGBuilder &B) { }
+  template<class Tuple>
+  static void enterBlock(Tuple &Ps, BasicBlock *Bb, CFGBuilder &B) { }
+  template<class Tuple>
+  static void exitBlock (Tuple &Ps, BasicBlock *Bb, CFGBuilder &B) { }
+};
+
+}  // end namespace pipeline_impl
+
+
+/// InplacePassPipeline composes several micro passes into one in-place
+/// traversal.  It performs the default in-place reduction for every
+/// node, and gives each pass a chance to inspect or replace the result
+/// as it flows by.  Use it like any other pass:
+///
+///    InplacePassPipeline<SimplifyPass, CountPass> pipeline(arena);
+///    pipeline.traverseAll(cfg);
+///    pipeline.pass<1>().count();
+///
+template<class... Passes>
+class InplacePassPipeline
+    : public InplaceReducer<CopyAttr>,
+      public AGTraversal<InplacePassPipeline<Passes...>> {
+public:
+  typedef InplaceReducer<CopyAttr>                    Super;
+  typedef AGTraversal<InplacePassPipeline<Passes...>> SuperTv;
+  typedef pipeline_impl::PassApplier<0, sizeof...(Passes)> Applier;
+
+  /// Return the I^th pass in the pipeline.
+  template<unsigned I>
+  typename std::tuple_element<I, std::tuple<Passes...>>::type& pass() {
+    return std::get<I>(PassTuple);
+  }
+
+  void enterCFG(SCFG *Cfg) {
+    Super::enterCFG(Cfg);
+    Applier::enterCFG(PassTuple, Cfg, Builder);
+  }
+
+  void exitCFG(SCFG *Cfg) {
+    Applier::exitCFG(PassTuple, Cfg, Builder);
+    Super::exitCFG(Cfg);
+  }
+
+  void enterBlock(BasicBlock *B) {
+    Super::enterBlock(B);
+    Applier::enterBlock(PassTuple, B, Builder);
+  }
+
+  void exitBlock(BasicBlock *B) {
+    Applier::exitBlock(PassTuple, B, Builder);
+    Super::exitBlock(B);
+  }
+
+  void reduceBBInstruction(Instruction *I) {
+    if (auto *I2 = dyn_cast_or_null<Instruction>(this->lastAttr().Exp))
+      this->lastAttr().Exp = Applier::reduceInstruction(PassTuple, I2, Builder);
+    Super::reduceBBInstruction(I);
+  }
+
+  void reduceGoto(Goto *Orig) {
+    Super::reduceGoto(Orig);
+    Applier::reduceTerminator(PassTuple, Orig, Builder);
+  }
+
+  void reduceBranch(Branch *Orig) {
+    Super::reduceBranch(Orig);
+    Applier::reduceTerminator(PassTuple, Orig, Builder);
+  }
+
+  void reduceSwitch(Switch *Orig) {
+    Super::reduceSwitch(Orig);
+    Applier::reduceTerminator(PassTuple, Orig, Builder);
+  }
+
+  void reduceReturn(Return *Orig) {
+    Super::reduceReturn(Orig);
+    Applier::reduceTerminator(PassTuple, Orig, Builder);
+  }
+
+  InplacePassPipeline(MemRegionRef A) : Super(A) { }
+
+  InplacePassPipeline(MemRegionRef A, Passes... Ps)
+      : Super(A), PassTuple(std::move(Ps)...) { }
+
+private:
+  InplacePassPipeline() = delete;
+
+  std::tuple<Passes...> PassTuple;
+};
+
+
+/// Runs the per-function pass pipeline -- SSA conversion followed by
+/// CFG simplification -- over every CFG in a module.  Functions share
+/// no mutable state once they have been translated, so the CFGs are
+/// independent units of work and are processed in parallel on a thread
+/// pool.  Each worker rewrites with its own arena; the arenas are
+/// appended to Regions, and the caller must keep them alive for as
+/// long as the module (see Global::adoptRegion).  All rewriting is
+/// done in place, so the result does not depend on scheduling order.
+class ParallelPassDriver {
+public:
+  /// Run the pipeline over every CFG in E, scheduling on Pool.
+  /// NumVars is the number of enclosing variable bindings, as for
+  /// SSAPass (see TypedEvaluator::exitCFG).
+  static void run(SExpr *E, ThreadPool &Pool,
+                  std::vector<std::unique_ptr<MemRegion>> &Regions,
+                  unsigned NumVars = 0);
+};
+
+
+}  // end namespace til
+}  // end namespace ohmu
+
+#endif  // OHMU_TIL_PASSMANAGER_H
@@ -21,10 +21,16 @@
 
 #include "SSAPass.h"
 
+#include "base/Stats.h"
+#include "base/Trace.h"
+
 namespace ohmu {
 namespace til  {
 
+OHMU_STAT(NumPhisInserted, "Phi nodes inserted by SSA conversion.");
+
 void SSAPass::enterCFG(SCFG *Cfg) {
+  TraceStart = TraceLog::begin();
   InplaceReducer::enterCFG(Cfg);
   BInfoMap.resize(Builder.currentCFG()->numBlocks());
   NumUses.resize(Cfg->numInstructions(), 0);
@@ -39,6 +45,7 @@ void SSAPass::exitCFG(SCFG *Cfg) {
   NumUses.clear();
 
   InplaceReducer::exitCFG(Cfg);
+  TraceLog::complete("ssa", TraceStart);
 }
 
 
@@ -307,6 +314,7 @@ SExpr* SSAPass::lookupInCache(LocalVarMap *LvarMap, unsigned LvarID) {
 
 Phi* SSAPass::makeNewPhiNode(unsigned i, SExpr *E, unsigned numPreds) {
   // Values don't match, so make a new phi node.
+  OHMU_STAT_INC(NumPhisInserted);
   auto *Ph = new (arena()) Phi(arena(), numPreds);
   // Fill it with the original value E
   for (unsigned j = 0; j < i; ++j)
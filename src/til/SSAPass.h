@@ -136,6 +136,8 @@ private:
   std::vector<FutureLoad*>  PendingLoads;  ///< Loads that need to be forced.
 
   std::vector<int> NumUses;
+
+  uint64_t TraceStart = 0;  ///< Timestamp from the enterCFG trace event.
 };
 
 
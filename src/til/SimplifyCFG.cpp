@@ -0,0 +1,303 @@
+//===- SimplifyCFG.cpp -----------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+
+#include "SimplifyCFG.h"
+#include "TILVisitor.h"
+
+namespace ohmu {
+namespace til  {
+
+namespace {
+
+/// Counts weak references to CFG instructions.  Traversing a CFG visits
+/// every Phi argument, instruction operand, and terminator operand, so
+/// after a full traversal Uses holds the use count of each instruction.
+class UseCountVisitor : public Visitor<UseCountVisitor> {
+public:
+  void reduceWeak(Instruction *I) {
+    assert(I->instrID() < Uses->size() && "CFG is not in normal form.");
+    ++(*Uses)[I->instrID()];
+  }
+
+  std::vector<unsigned> *Uses;
+};
+
+
+/// Compact an array of pointers by removing null entries.
+/// Returns the number of entries removed.
+template<class ArrayT>
+unsigned compactNulls(ArrayT &Arr) {
+  unsigned j = 0;
+  unsigned n = Arr.size();
+  for (unsigned i = 0; i < n; ++i) {
+    if (Arr[i]) {
+      if (j != i)
+        Arr[j] = Arr[i];
+      ++j;
+    }
+  }
+  if (j == 0) {
+    if (n > 0)
+      Arr.clear();
+  } else if (j < n) {
+    Arr.drop(n - j);
+  }
+  return n - j;
+}
+
+}  // end anonymous namespace
+
+
+bool SimplifyCFG::isRemovable(const Instruction *I) {
+  // Only delete instructions that neither touch memory nor alter
+  // control flow.  Loads are kept; removing them can hide races.
+  switch (I->opcode()) {
+    case COP_Literal:
+    case COP_Phi:
+    case COP_UnaryOp:
+    case COP_BinaryOp:
+    case COP_Cast:
+    case COP_Project:
+      return true;
+    default:
+      return false;
+  }
+}
+
+
+void SimplifyCFG::countUses(std::vector<unsigned> &Uses) {
+  UseCountVisitor V;
+  V.Uses = &Uses;
+  V.traverseAll(Cfg);
+}
+
+
+bool SimplifyCFG::removeDeadInstructions() {
+  bool Changed = false;
+  bool Removed;
+  do {
+    Cfg->computeNormalForm();
+    std::vector<unsigned> Uses(Cfg->numInstructions(), 0);
+    countUses(Uses);
+
+    Removed = false;
+    for (auto &B : Cfg->blocks()) {
+      for (auto &A : B->arguments()) {
+        if (A && Uses[A->instrID()] == 0) {
+          A = nullptr;
+          Removed = true;
+        }
+      }
+      for (auto &I : B->instructions()) {
+        if (I && Uses[I->instrID()] == 0 && isRemovable(I)) {
+          I = nullptr;
+          Removed = true;
+        }
+      }
+      compactNulls(B->arguments());
+      compactNulls(B->instructions());
+    }
+    if (Removed) {
+      Cfg->markModified();
+      Changed = true;
+    }
+    // Deleting an instruction may leave its operands unused; repeat
+    // until no more instructions can be deleted.
+  } while (Removed);
+  return Changed;
+}
+
+
+bool SimplifyCFG::threadEmptyBlocks() {
+  bool Changed = false;
+  for (auto &BRef : Cfg->blocks()) {
+    BasicBlock *E = BRef.get();
+    if (E == Cfg->entry())
+      continue;
+    if (E->numArguments() > 0 || E->numInstructions() > 0)
+      continue;
+    auto *G = dyn_cast_or_null<Goto>(E->terminator());
+    if (!G)
+      continue;
+    BasicBlock *T = G->targetBlock();
+    if (T == E)
+      continue;
+    unsigned Je = G->phiIndex();
+
+    // Retarget each predecessor of E to jump directly to T.  Each
+    // redirected edge gets a fresh predecessor slot in T, whose Phi
+    // arguments are copies of the values E passed along.
+    unsigned NPreds = static_cast<unsigned>(E->numPredecessors());
+    for (unsigned pi = 0; pi < NPreds; ) {
+      BasicBlock *P  = E->predecessors()[pi].get();
+      Terminator *PT = P->terminator();
+      // Branch and Switch targets cannot have Phi nodes.
+      if (!isa<Goto>(PT) && T->numArguments() > 0) {
+        ++pi;
+        continue;
+      }
+      unsigned K = T->addPredecessor(P);
+      for (auto &A : T->arguments()) {
+        if (A)
+          A->values()[K].reset(A->values()[Je].get());
+      }
+      for (auto &Succ : PT->successors()) {
+        if (Succ.get() == E) {
+          Succ.reset(T);
+          break;
+        }
+      }
+      if (auto *PG = dyn_cast<Goto>(PT))
+        PG->setPhiIndex(K);
+      E->removePredecessor(pi);
+      --NPreds;
+      Changed = true;
+    }
+    // Once every predecessor has been redirected, E is unreachable and
+    // will be deleted by removeUnreachableBlocks().
+  }
+  if (Changed)
+    Cfg->markModified();
+  return Changed;
+}
+
+
+bool SimplifyCFG::mergeSinglePredBlocks() {
+  bool Changed = false;
+  for (auto &BRef : Cfg->blocks()) {
+    BasicBlock *B = BRef.get();
+    // Keep merging; the merged block may itself end in a mergeable Goto.
+    for (;;) {
+      auto *G = dyn_cast_or_null<Goto>(B->terminator());
+      if (!G)
+        break;
+      BasicBlock *T = G->targetBlock();
+      // In SSA form a single-predecessor block has no Phi nodes, but be
+      // defensive: merging away arguments would require rewriting uses.
+      if (T == B || T == Cfg->entry() ||
+          T->numPredecessors() != 1 || T->numArguments() > 0)
+        break;
+
+      // Move T's instructions into B, and take over its terminator.
+      for (auto *I : T->instructions()) {
+        if (I)
+          B->addInstruction(I);
+      }
+      B->setTerminator(T->terminator());
+      for (auto &Succ : B->terminator()->successors()) {
+        BasicBlock *S = Succ.get();
+        unsigned Idx = S->findPredecessorIndex(T);
+        if (Idx < static_cast<unsigned>(S->numPredecessors()))
+          S->predecessors()[Idx].reset(B);
+      }
+      if (T == Cfg->exit())
+        Cfg->setExit(B);
+
+      // Detach T; it is now unreachable and carries no instructions.
+      T->instructions().clearWithoutDestruct();
+      T->setTerminator(nullptr);
+      Changed = true;
+    }
+  }
+  if (Changed)
+    Cfg->markModified();
+  return Changed;
+}
+
+
+bool SimplifyCFG::removeUnreachableBlocks() {
+  auto &Blocks = Cfg->blocks();
+
+  // Find all blocks reachable from the entry.  Block IDs are stale
+  // after graph edits, but they are still unique, so they can index the
+  // visited set.  The exit block is always kept; the normal form
+  // computation sorts from both ends of the graph.
+  std::vector<bool> Reachable(Blocks.size(), false);
+  std::vector<BasicBlock*> Stack;
+  Reachable[Cfg->exit()->blockID()]  = true;
+  Reachable[Cfg->entry()->blockID()] = true;
+  Stack.push_back(Cfg->entry());
+  while (!Stack.empty()) {
+    BasicBlock *B = Stack.back();
+    Stack.pop_back();
+    for (auto &Succ : B->successors()) {
+      BasicBlock *S = Succ.get();
+      if (S && !Reachable[S->blockID()]) {
+        Reachable[S->blockID()] = true;
+        Stack.push_back(S);
+      }
+    }
+  }
+
+  // Unlink edges from unreachable blocks into reachable ones, so that
+  // no predecessor list refers to a deleted block.
+  for (auto &BRef : Blocks) {
+    BasicBlock *D = BRef.get();
+    if (Reachable[D->blockID()] || !D->terminator())
+      continue;
+    for (auto &Succ : D->terminator()->successors()) {
+      BasicBlock *S = Succ.get();
+      if (!S || !Reachable[S->blockID()])
+        continue;
+      unsigned Idx = S->findPredecessorIndex(D);
+      if (Idx < static_cast<unsigned>(S->numPredecessors()))
+        S->removePredecessor(Idx);
+    }
+  }
+
+  // Compact the block array.
+  unsigned j = 0;
+  unsigned n = Blocks.size();
+  for (unsigned i = 0; i < n; ++i) {
+    if (Reachable[Blocks[i]->blockID()]) {
+      if (j != i)
+        Blocks[j].reset(Blocks[i].get());
+      ++j;
+    }
+  }
+  if (j == n)
+    return false;
+  Blocks.drop(n - j);
+  Cfg->markModified();
+  return true;
+}
+
+
+bool SimplifyCFG::simplify(SCFG *Cfg) {
+  if (!Cfg || !Cfg->valid())
+    return false;
+
+  SimplifyCFG S(Cfg);
+  bool Changed = false;
+  bool Ch;
+  do {
+    // removeDeadInstructions() recomputes the normal form, which the
+    // use counts depend on.
+    Ch  = S.removeDeadInstructions();
+    Ch |= S.threadEmptyBlocks();
+    Ch |= S.mergeSinglePredBlocks();
+    Ch |= S.removeUnreachableBlocks();
+    Changed |= Ch;
+  } while (Ch);
+
+  Cfg->computeNormalForm();
+  return Changed;
+}
+
+
+}  // end namespace til
+}  // end namespace ohmu
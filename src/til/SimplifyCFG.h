@@ -0,0 +1,85 @@
+//===- SimplifyCFG.h -------------------------------------------*- C++ --*-===//
+// Copyright 2014  Google
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+//===----------------------------------------------------------------------===//
+//
+// Implements the CFG simplification and cleanup pass.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef OHMU_TIL_SIMPLIFYCFG_H
+#define OHMU_TIL_SIMPLIFYCFG_H
+
+#include "TIL.h"
+
+#include <vector>
+
+namespace ohmu {
+namespace til  {
+
+
+/// SimplifyCFG shrinks a CFG in place, without changing its meaning.
+/// It is intended to run after conversion to SSA, before the IR is
+/// handed to later passes or encoded as bytecode.  It performs:
+///
+///   * Dead code elimination: side-effect-free instructions and Phi
+///     nodes with no remaining uses are deleted.
+///   * Jump threading: a block with no arguments and no instructions,
+///     ending in a Goto, is cut out of the graph; its predecessors
+///     branch directly to its successor.
+///   * Block merging: a block with a single predecessor that ends in an
+///     unconditional Goto to it is folded into that predecessor.
+///   * Unreachable block removal: blocks that cannot be reached from
+///     the entry block are unlinked and dropped.
+///
+/// The passes are iterated to a fixpoint, since each can expose more
+/// work for the others.  The CFG is left in normal form.
+class SimplifyCFG {
+public:
+  /// Simplify Cfg in place.  Returns true if anything was changed.
+  static bool simplify(SCFG *Cfg);
+
+private:
+  SimplifyCFG(SCFG *Cfg) : Cfg(Cfg) { }
+  SimplifyCFG() = delete;
+
+  /// Return true if I can be deleted once it has no uses.
+  static bool isRemovable(const Instruction *I);
+
+  /// Count the uses of every instruction in the CFG.
+  /// Uses is indexed by instrID(); the CFG must be in normal form.
+  void countUses(std::vector<unsigned> &Uses);
+
+  /// Delete unused Phi nodes and pure instructions, iteratively, since
+  /// deleting an instruction may leave its operands unused.
+  bool removeDeadInstructions();
+
+  /// Retarget branches that jump through an empty block.
+  bool threadEmptyBlocks();
+
+  /// Merge single-predecessor blocks into their predecessor.
+  bool mergeSinglePredBlocks();
+
+  /// Unlink and delete blocks that are unreachable from the entry.
+  bool removeUnreachableBlocks();
+
+  SCFG *Cfg;
+};
+
+
+}  // end namespace til
+}  // end namespace ohmu
+
+#endif  // OHMU_TIL_SIMPLIFYCFG_H
@@ -11,6 +11,9 @@
 #include "AnnotationImpl.h"
 #include "CFGBuilder.h"
 
+#include <condition_variable>
+#include <mutex>
+
 namespace ohmu {
 namespace til  {
 
@@ -195,125 +198,229 @@ void SExpr::addAnnotation(Annotation *A) {
     Annotations = A;
 }
 
-SExpr* Future::addPosition(SExpr **Eptr) {
-  // If the future has already been forced, return the forced value.
-  if (Status == FS_done) {
-    // The result may be a future, in which case we recurse.
-    if (auto* Fut = dyn_cast_or_null<Future>(Result))
-      return Fut->addPosition(Eptr);
-    else
-      return Result;
-  }
-  // Otherwise connect Eptr to this future, and return this future.
-  Positions.push_back(Eptr);
-  return this;
+// All futures share one lock for position registration and the done
+// rendezvous.  Forcing threads rarely collide, and a mutex per future
+// would bloat every lazily rewritten node.
+static std::mutex              FutureMutex;
+static std::condition_variable FutureDone;
+
+
+SExpr* Future::addPosition(SExprRef *Ref) {
+  SExpr* Res;
+  {
+    std::unique_lock<std::mutex> Lock(FutureMutex);
+    if (Status.load(std::memory_order_relaxed) != FS_done) {
+      // Connect Ref to this future, and return this future.
+      Positions.push_back(Ref);
+      return this;
+    }
+    Res = Result;
+  }
+  // The future has already been forced; return the forced value.
+  // The result may be another future, in which case we recurse.
+  // (Recursion happens outside the lock, which is not reentrant.)
+  if (auto* Fut = dyn_cast_or_null<Future>(Res))
+    return Fut->addPosition(Ref);
+  return Res;
 }
 
 
 void Future::addInstrPosition(Instruction **Iptr) {
   assert(!IPos && "Future has already been added to a basic block.");
 
-  // If this future has already been forced, return the result;
-  if (Status == FS_done) {
-    if (auto* Fut = dyn_cast_or_null<Future>(Result)) {
-      Fut->addInstrPosition(Iptr);
-      return;
-    }
-    else {
-      auto *I = dyn_cast_or_null<Instruction>(Result);
-      if (I && I->block() == nullptr && !Result->isTrivial()) {
-        I->setBlock(this->block());
-        *Iptr = I;
-      }
-      else {
-        // If Result has already been added to a block, then it's a weak
-        // reference to a previously added instruction; ignore it.
-        *Iptr = nullptr;
-      }
+  SExpr* Res;
+  {
+    std::unique_lock<std::mutex> Lock(FutureMutex);
+    if (Status.load(std::memory_order_relaxed) != FS_done) {
+      IPos = Iptr;
       return;
     }
+    Res = Result;
+  }
+  // This future has already been forced; write back the result.
+  if (auto* Fut = dyn_cast_or_null<Future>(Res)) {
+    Fut->addInstrPosition(Iptr);
+    return;
+  }
+  auto *I = dyn_cast_or_null<Instruction>(Res);
+  if (I && I->block() == nullptr && !Res->isTrivial()) {
+    I->setBlock(this->block());
+    *Iptr = I;
+  }
+  else {
+    // If Result has already been added to a block, then it's a weak
+    // reference to a previously added instruction; ignore it.
+    *Iptr = nullptr;
   }
-  IPos = Iptr;
 }
 
 
 void Future::setResult(SExpr *Res) {
-  assert(Status != FS_done && "Future has already been forced.");
-
   auto *Fut = dyn_cast_or_null<Future>(Res);
+
+  // Publish the result and claim the position list.  Once FS_done is
+  // visible, concurrent readers take the Result path above rather than
+  // registering new positions, so the list cannot grow under us.  The
+  // writeback below runs outside the lock; it touches only positions in
+  // the output of the traversal that created this future.
+  std::vector<SExprRef*> Ps;
+  Instruction** Ip;
+  {
+    std::unique_lock<std::mutex> Lock(FutureMutex);
+    assert(Status.load(std::memory_order_relaxed) != FS_done &&
+           "Future has already been forced.");
+
+    // This future may be a temporary object, so we don't call
+    // Result = Fut->addPosition(&Result)
+    Result = Fut ? Fut : Res;
+
+    // Claim the position list.  Swapping with a local also releases the
+    // vector's memory, unlike shrink_to_fit(), which libstdc++ turns
+    // into a no-op when exceptions are disabled.
+    Ps.swap(Positions);
+    assert(Positions.capacity() == 0 && "Memory Leak.");
+    Ip   = IPos;
+    IPos = nullptr;
+
+    Status.store(FS_done, std::memory_order_release);
+  }
+  FutureDone.notify_all();
+
   if (Fut) {
     // Result is another future; register all of our positions with it.
-    if (IPos) {
-      Fut->addInstrPosition(IPos);
+    if (Ip) {
+      Fut->addInstrPosition(Ip);
     }
-    for (SExpr **Eptr : Positions) {
-      assert(*Eptr == this && "Invalid position for future.");
-      *Eptr = Fut->addPosition(Eptr);
+    for (SExprRef *Ref : Ps) {
+      assert(Ref->get() == this && "Invalid position for future.");
+      Ref->setRaw(Fut->addPosition(Ref));
     }
-
-    // This future may be a temporary object, so we don't call
-    // Result = Fut->addPosition(&Result)
-    Result = Fut;
   }
   else {
     // Write back result to basic block.
-    if (IPos) {
+    if (Ip) {
       auto *I = dyn_cast_or_null<Instruction>(Res);
       if (I && I->block() == nullptr && !Res->isTrivial()) {
         assert(!isa<Phi>(I) && "Phi nodes are arguments.");
         I->setBlock(this->block());
-        *IPos = I;
+        *Ip = I;
       }
       else {
         // If Result has already been added to a block, then it's a weak
         // reference to a previously added instruction; ignore it.
-        *IPos = nullptr;
+        *Ip = nullptr;
       }
-      IPos = nullptr;
     }
 
     // Write back result to all positions that use this future.
-    for (SExpr **Eptr : Positions) {
-      assert(*Eptr == this && "Invalid position for future.");
-      *Eptr = Res;
+    for (SExprRef *Ref : Ps) {
+      assert(Ref->get() == this && "Invalid position for future.");
+      Ref->setRaw(Res);
     }
-
-    Result = Res;
   }
-
-  Status = FS_done;
-
-  Positions.clear();
-  Positions.shrink_to_fit();
-  assert(Positions.capacity() == 0 && "Memory Leak.");
 }
 
 
 SExpr* Future::force() {
-  if (Status == Future::FS_done) {
+  FutureStatus Fs = Status.load(std::memory_order_acquire);
+  if (Fs == FS_done) {
     return Result;
   }
-  if (Status == Future::FS_evaluating) {
-    // TODO: print a useful diagnostic here.
-    assert(false && "Infinite loop!");
-    return nullptr;
+  if (Fs == FS_pending &&
+      Status.compare_exchange_strong(Fs, FS_evaluating,
+                                     std::memory_order_acq_rel)) {
+    Owner = std::this_thread::get_id();
+    auto *Res = evaluate();
+    setResult(Res);
+    return Result;
   }
 
-  Status = FS_evaluating;
-  auto *Res = evaluate();
-  setResult(Res);
+  // Re-entry from the thread that is already evaluating is a dependency
+  // cycle; a different thread has hit a genuine cross-thread dependency
+  // and blocks until the result is published.
+  // TODO: print a useful diagnostic for the cycle case.
+  assert(Owner != std::this_thread::get_id() && "Infinite loop!");
+
+  std::unique_lock<std::mutex> Lock(FutureMutex);
+  while (Status.load(std::memory_order_relaxed) != FS_done)
+    FutureDone.wait(Lock);
   return Result;
 }
 
 
 
+// Records smaller than this are searched linearly; a scan of a few
+// slots beats maintaining a hash table for them.
+static const unsigned SlotIndexThreshold = 16;
+
+static const uint32_t InvalidSlot = 0xFFFFFFFFu;
+
+// FNV-1a over the slot name.
+static unsigned hashSlotName(StringRef S) {
+  unsigned H = 2166136261u;
+  for (unsigned i = 0, n = static_cast<unsigned>(S.size()); i < n; ++i) {
+    H = H ^ static_cast<unsigned char>(S.data()[i]);
+    H = H * 16777619u;
+  }
+  return H;
+}
+
+
+void Record::updateSlotIndex() {
+  unsigned N = static_cast<unsigned>(Slots.size());
+  if (SlotIndex && IndexedSlots == N)
+    return;
+
+  // (Re)allocate when there is no table yet, or the load factor would
+  // exceed 3/4.  The old table stays in the arena; tables grow
+  // geometrically, so the waste is bounded.
+  if (!SlotIndex || N * 4 > IndexBuckets * 3) {
+    unsigned NBuckets = 32;
+    while (N * 4 > NBuckets * 3)
+      NBuckets *= 2;
+    SlotIndex = Arena.allocateT<uint32_t>(NBuckets);
+    IndexBuckets = NBuckets;
+    for (unsigned i = 0; i < NBuckets; ++i)
+      SlotIndex[i] = InvalidSlot;
+    IndexedSlots = 0;
+  }
+
+  // Insert the slots added since the last lookup.  On a duplicate name
+  // the first slot wins, matching the linear scan.
+  unsigned Mask = IndexBuckets - 1;
+  for (unsigned Id = IndexedSlots; Id < N; ++Id) {
+    StringRef Nm = Slots[Id]->slotName();
+    unsigned i = hashSlotName(Nm) & Mask;
+    while (SlotIndex[i] != InvalidSlot) {
+      if (Slots[SlotIndex[i]]->slotName() == Nm)
+        break;   // earlier slot with this name; keep it.
+      i = (i + 1) & Mask;
+    }
+    if (SlotIndex[i] == InvalidSlot)
+      SlotIndex[i] = Id;
+  }
+  IndexedSlots = N;
+}
+
+
 Slot* Record::findSlot(StringRef S) {
-  // FIXME -- look this up in a hash table, please.
-  for (auto &Slt : slots()) {
-    if (Slt->slotName() == S)
-      return Slt.get();
+  if (Slots.size() < SlotIndexThreshold && !SlotIndex) {
+    for (auto &Slt : slots()) {
+      if (Slt->slotName() == S)
+        return Slt.get();
+    }
+    return nullptr;
+  }
+
+  updateSlotIndex();
+  unsigned Mask = IndexBuckets - 1;
+  for (unsigned i = hashSlotName(S) & Mask;; i = (i + 1) & Mask) {
+    uint32_t Id = SlotIndex[i];
+    if (Id == InvalidSlot)
+      return nullptr;
+    if (Slots[Id]->slotName() == S)
+      return Slots[Id].get();
   }
-  return nullptr;
 }
 
 
@@ -358,14 +465,172 @@ void Instruction::setInstrName(CFGBuilder &Builder, StringRef Name) {
 }
 
 
-unsigned BasicBlock::findPredecessorIndex(const BasicBlock *BB) const {
-  unsigned i = 0;
-  for (auto &Pred : Predecessors) {
-    if (Pred.get() == BB)
-      return i;
-    ++i;
+// Record a use of E by the instruction with the given ID.
+// Non-instruction operands, and operands outside any CFG, are ignored.
+static void recordUseBy(SExpr *E, unsigned UserID) {
+  if (Instruction *I = dyn_cast_or_null<Instruction>(E)) {
+    if (I->block()) {
+      I->addUse();
+      I->setLastUseID(UserID);
+    }
+  }
+}
+
+
+/// Walk the operands of this instruction, incrementing their use counts
+/// and recording this instruction's ID as their last use.
+void Instruction::recordOperandUses() {
+  switch (opcode()) {
+  case COP_Call:
+    recordUseBy(cast<Call>(this)->target(), InstrID);
+    break;
+  case COP_Alloc:
+    recordUseBy(cast<Alloc>(this)->initializer(), InstrID);
+    break;
+  case COP_Load:
+    recordUseBy(cast<Load>(this)->pointer(), InstrID);
+    break;
+  case COP_Store: {
+    auto *S = cast<Store>(this);
+    recordUseBy(S->destination(), InstrID);
+    recordUseBy(S->source(), InstrID);
+    break;
+  }
+  case COP_ArrayIndex: {
+    auto *E = cast<ArrayIndex>(this);
+    recordUseBy(E->array(), InstrID);
+    recordUseBy(E->index(), InstrID);
+    break;
+  }
+  case COP_ArrayAdd: {
+    auto *E = cast<ArrayAdd>(this);
+    recordUseBy(E->array(), InstrID);
+    recordUseBy(E->index(), InstrID);
+    break;
+  }
+  case COP_UnaryOp:
+    recordUseBy(cast<UnaryOp>(this)->expr(), InstrID);
+    break;
+  case COP_BinaryOp: {
+    auto *E = cast<BinaryOp>(this);
+    recordUseBy(E->expr0(), InstrID);
+    recordUseBy(E->expr1(), InstrID);
+    break;
+  }
+  case COP_Cast:
+    recordUseBy(cast<Cast>(this)->expr(), InstrID);
+    break;
+  case COP_Goto: {
+    // Uses as phi arguments are attributed to the goto that passes them.
+    auto *G = cast<Goto>(this);
+    for (Phi *Ph : G->targetBlock()->arguments()) {
+      if (Ph)
+        recordUseBy(Ph->values()[G->phiIndex()].get(), InstrID);
+    }
+    break;
+  }
+  case COP_Branch:
+    recordUseBy(cast<Branch>(this)->condition(), InstrID);
+    break;
+  case COP_Switch: {
+    auto *S = cast<Switch>(this);
+    recordUseBy(S->condition(), InstrID);
+    for (int i = 0, n = S->numCases(); i < n; ++i)
+      recordUseBy(S->label(i), InstrID);
+    break;
+  }
+  case COP_Return:
+    recordUseBy(cast<Return>(this)->returnValue(), InstrID);
+    break;
+  default:
+    // Phi uses are counted at the gotos that pass the values; the
+    // remaining opcodes have no operands.
+    break;
+  }
+}
+
+
+// Blocks with fewer predecessors are searched linearly; a scan of a few
+// entries beats maintaining a hash table for them.
+static const unsigned PredIndexThreshold = 16;
+
+// Sentinel for IndexedPreds: an edge was removed, so the index must be
+// rebuilt in bulk rather than extended.
+static const uint32_t StalePredIndex = 0xFFFFFFFFu;
+
+static unsigned hashBlockPtr(const BasicBlock *B) {
+  uintptr_t V = reinterpret_cast<uintptr_t>(B);
+  return static_cast<unsigned>((V >> 4) * 2654435761u);
+}
+
+
+void BasicBlock::updatePredIndex() {
+  unsigned N = static_cast<unsigned>(Predecessors.size());
+  if (PredIndex && IndexedPreds == N)
+    return;
+  bool Rebuild = (IndexedPreds == StalePredIndex);
+
+  // (Re)allocate when there is no table yet, or the load factor would
+  // exceed 3/4; the old table stays in the arena, as with Record's slot
+  // index.
+  if (!PredIndex || N * 4 > PredIndexBuckets * 3) {
+    unsigned NBuckets = 32;
+    while (N * 4 > NBuckets * 3)
+      NBuckets *= 2;
+    PredIndex = Arena.allocateT<uint32_t>(NBuckets);
+    PredIndexBuckets = NBuckets;
+    Rebuild = true;
+  }
+  if (Rebuild) {
+    for (unsigned i = 0; i < PredIndexBuckets; ++i)
+      PredIndex[i] = InvalidSlot;
+    IndexedPreds = 0;
+  }
+
+  // Insert the slots added since the last lookup.  On a duplicate edge
+  // (e.g. both arms of a Branch targeting the same block) the first
+  // slot wins, matching the linear scan.
+  unsigned Mask = PredIndexBuckets - 1;
+  for (unsigned Id = IndexedPreds; Id < N; ++Id) {
+    const BasicBlock *P = Predecessors[Id].get();
+    unsigned i = hashBlockPtr(P) & Mask;
+    while (PredIndex[i] != InvalidSlot) {
+      if (Predecessors[PredIndex[i]].get() == P)
+        break;   // earlier edge from this block; keep it.
+      i = (i + 1) & Mask;
+    }
+    if (PredIndex[i] == InvalidSlot)
+      PredIndex[i] = Id;
+  }
+  IndexedPreds = N;
+}
+
+
+unsigned BasicBlock::findPredecessorIndex(const BasicBlock *BB) {
+  // An edge from a Goto carries its own slot; no search at all.
+  if (auto *G = dyn_cast_or_null<Goto>(BB->terminator())) {
+    if (G->targetBlock() == this)
+      return G->phiIndex();
+  }
+
+  unsigned N = static_cast<unsigned>(Predecessors.size());
+  if (N < PredIndexThreshold && !PredIndex) {
+    for (unsigned i = 0; i < N; ++i) {
+      if (Predecessors[i].get() == BB)
+        return i;
+    }
+    return N;
+  }
+
+  updatePredIndex();
+  unsigned Mask = PredIndexBuckets - 1;
+  for (unsigned i = hashBlockPtr(BB) & Mask;; i = (i + 1) & Mask) {
+    uint32_t Id = PredIndex[i];
+    if (Id == InvalidSlot)
+      return N;
+    if (Predecessors[Id].get() == BB)
+      return Id;
   }
-  return Predecessors.size();
 }
 
 
@@ -376,10 +641,54 @@ unsigned BasicBlock::addPredecessor(BasicBlock *Pred) {
     assert(Ph->values().size() == Idx && "Phi nodes not sized properly.");
     Ph->values().emplace_back(Arena, nullptr);
   }
+  // The index, if built, picks the new edge up on the next lookup.
+  // A new edge may change the dominator trees.
+  if (CFGPtr)
+    CFGPtr->markModified();
   return Idx;
 }
 
 
+void BasicBlock::removePredecessor(unsigned i) {
+  unsigned n = static_cast<unsigned>(Predecessors.size());
+  assert(i < n && "Invalid predecessor index.");
+  unsigned Last = n - 1;
+
+  // Move the last edge into slot i, keeping every Phi argument vector
+  // aligned with the predecessor array; no other slot moves.  The moved
+  // edge's Goto carries its slot, so exactly one index is repointed.
+  if (i != Last) {
+    Predecessors[i].reset(Predecessors[Last].get());
+    for (Phi *Ph : Args) {
+      if (Ph)
+        Ph->values()[i].reset(Ph->values()[Last].get());
+    }
+    if (auto *G = dyn_cast_or_null<Goto>(Predecessors[i]->terminator())) {
+      if (G->targetBlock() == this && G->phiIndex() == Last)
+        G->setPhiIndex(i);
+    }
+  }
+
+  if (n == 1)
+    Predecessors.clear();
+  else
+    Predecessors.drop(1);
+  for (Phi *Ph : Args) {
+    if (!Ph)
+      continue;
+    if (n == 1)
+      Ph->values().clear();
+    else
+      Ph->values().drop(1);
+  }
+
+  if (PredIndex)
+    IndexedPreds = StalePredIndex;
+  if (CFGPtr)
+    CFGPtr->markModified();
+}
+
+
 void BasicBlock::reservePredecessors(unsigned NumPreds) {
   Predecessors.reserve(Arena, NumPreds);
   for (SExpr *E : Args) {
@@ -392,33 +701,88 @@ void BasicBlock::reservePredecessors(unsigned NumPreds) {
 
 
 // Renumbers the arguments and instructions to have unique, sequential IDs.
-unsigned BasicBlock::renumber(unsigned ID) {
+unsigned BasicBlock::renumber(unsigned ID, SimpleArray<Instruction*> *Flat) {
   for (auto *Arg : Args) {
     if (!Arg)
       continue;
     Arg->setBlock(this);
     Arg->setInstrID(ID++);
+    if (Flat)
+      Flat->push_back(Arg);
   }
   for (auto *Instr : Instrs) {
     if (!Instr)
       continue;
     Instr->setBlock(this);
     Instr->setInstrID(ID++);
+    if (Flat)
+      Flat->push_back(Instr);
   }
-  if (TermInstr)
+  if (TermInstr) {
     TermInstr->setInstrID(ID++);
+    if (Flat)
+      Flat->push_back(TermInstr);
+  }
   return ID;
 }
 
-// Renumber instructions in all blocks
+// Renumber instructions in all blocks.
+// Each block is given a gap of unused IDs after its last instruction, so
+// that a local edit can be renumbered with renumberBlock() without
+// disturbing the rest of the CFG.  NumInstructions remains an upper bound
+// on every assigned ID, so side tables just carry the gaps as slack.
 void SCFG::renumber() {
+  // Size the flat schedule-order view exactly; its buffer is reused
+  // across renumberings once the CFG stops growing.
+  unsigned Total = 0;
+  for (auto &B : Blocks)
+    Total += B->numArguments() + B->numInstructions() +
+             (B->terminator() ? 1 : 0);
+  FlatInstrs.clear();
+  FlatInstrs.reserve(Total, Arena);
+  BlockOffsets.clear();
+  BlockOffsets.reserve(Blocks.size() + 1, Arena);
+
   unsigned InstrID = 1;    // ID of 0 means unnumbered.
   unsigned BlockID = 0;
   for (auto &B : Blocks) {
-    InstrID = B->renumber(InstrID);
+    B->InstrIDBase = InstrID;
+    BlockOffsets.push_back(FlatInstrs.size());
+    InstrID = B->renumber(InstrID, &FlatInstrs);
+    // Leave room for the block to grow by a quarter, and at least two
+    // instructions, before a full renumbering is needed.
+    InstrID += (InstrID - B->InstrIDBase) / 4 + 2;
+    B->InstrIDLimit = InstrID;
     B->setBlockID(BlockID++);
   }
+  BlockOffsets.push_back(FlatInstrs.size());
   NumInstructions = InstrID;
+
+  // Recompute the use metrics from scratch.  The incremental counts kept
+  // by CFGBuilder and the in-place rewrites are good enough for quick
+  // checks, but passes that edit blocks directly can leave them
+  // approximate, and last-use IDs need the fresh numbering anyway.
+  for (auto *I : FlatInstrs)
+    I->resetUses();
+  for (auto *I : FlatInstrs)
+    I->recordOperandUses();
+}
+
+
+// Renumber only B, after a local edit to its instruction stream.
+void SCFG::renumberBlock(BasicBlock *B) {
+  assert(B->cfg() == this && "Block is not in this CFG.");
+  if (B->InstrIDLimit > B->InstrIDBase &&
+      B->renumber(B->InstrIDBase) <= B->InstrIDLimit) {
+    // The flat view no longer matches the edited block; leave it empty
+    // until the next full renumbering.
+    FlatInstrs.clear();
+    BlockOffsets.clear();
+    return;
+  }
+  // The block outgrew its gap (or was never numbered); renumbering it
+  // may have overrun the next block's IDs, so renumber everything.
+  renumber();
 }
 
 
@@ -574,7 +938,13 @@ static inline void computeNodeID(BasicBlock *B,
 // 1) Removing unreachable blocks.
 // 2) Computing dominators and post-dominators
 // 3) Topologically sorting the blocks into the "Blocks" array.
+// The result is cached: if the CFG has not been modified since the last
+// call, this returns immediately.  Edits that change the graph (adding
+// blocks, edges, or instructions) clear the cache via markModified().
 void SCFG::computeNormalForm() {
+  if (Normal)
+    return;
+
   // Clear existing block IDs.
   for (auto &B : Blocks) {
     B->BlockID     = BasicBlock::InvalidBlockID;
@@ -641,6 +1011,8 @@ void SCFG::computeNormalForm() {
   for (auto &B : Blocks) {
     computeNodeID(B.get(), &BasicBlock::DominatorNode);
   }
+
+  Normal = true;
 }
 
 }  // end namespace til
@@ -62,8 +62,10 @@
 
 #include <stdint.h>
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -233,13 +235,33 @@ public:
 
   void addAnnotation(Annotation *A);
 
+  /// Drop all annotations.  The annotation objects themselves live in
+  /// the arena; this is used when recycling discarded nodes.
+  void clearAnnotations() { Annotations = nullptr; }
+
   Annotation *annotations() const { return Annotations; }
 
+  /// Return the cached structural hash of this expression, or 0 if none
+  /// has been computed.  Hashes are computed and cached on demand by
+  /// HashComparator::hashCode() in TILCompare.h.
+  uint32_t hashCode() const { return HashCode; }
+
+  /// Cache a structural hash for this expression.  H must be nonzero;
+  /// 0 is reserved to mean "not computed".
+  void setHashCode(uint32_t H) const { HashCode = H; }
+
+  /// Drop the cached structural hash.  The in-place rewrite() methods
+  /// call this automatically; a pass that mutates a node by other means
+  /// must invalidate it (and any enclosing nodes whose hashes include
+  /// it) itself.
+  void invalidateHashCode() const { HashCode = 0; }
+
 protected:
   SExpr(TIL_Opcode Op, unsigned char SubOp = 0)
-    : Opcode(Op), SubOpcode(SubOp), Flags(0), Annotations(nullptr) {}
+    : Opcode(Op), SubOpcode(SubOp), Flags(0), HashCode(0),
+      Annotations(nullptr) {}
   SExpr(const SExpr &E)
-    : Opcode(E.Opcode), SubOpcode(E.SubOpcode), Flags(E.Flags),
+    : Opcode(E.Opcode), SubOpcode(E.SubOpcode), Flags(E.Flags), HashCode(0),
       Annotations(nullptr) {}
 
   const unsigned char Opcode;
@@ -252,59 +274,100 @@ private:
   /// SExpr objects must be created in an arena.
   void *operator new(size_t) = delete;
 
+  /// Cached structural hash (0 = not computed).  Occupies the padding
+  /// between Flags and Annotations, so it does not grow the node.
+  mutable uint32_t HashCode;
+
   Annotation *Annotations = nullptr;
 };
 
 
 
-inline SExpr* maybeRegisterFuture(SExpr** Eptr, SExpr* P);
+template<class T> class SExprRefT;
+
+inline SExpr* maybeRegisterFuture(SExprRefT<SExpr>* Ref, SExpr* P);
 
 template<class T>
-inline T* maybeRegisterFuture(T** Eptr, T* P);
+inline T* maybeRegisterFuture(SExprRefT<T>* Ref, T* P);
 
 
 /// Owning reference to an SExpr.
 /// All SExprs should use this class to refer to subexpressions.
+///
+/// If OHMU_COMPACT_SEXPR_REFS is defined, a reference is stored as a
+/// 32-bit offset relative to its own address rather than a 64-bit pointer.
+/// References only occur inside arena-allocated nodes, and nodes that
+/// refer to each other are allocated from the same arena, so the offset
+/// does not overflow in practice (checked by assert).  This halves the
+/// size of every subexpression link, which matters for the cache
+/// footprint of traversals over large modules.
 template<class T>
 class SExprRefT {
 public:
-  SExprRefT() : Ptr(nullptr) { }
-  SExprRefT(std::nullptr_t) : Ptr(nullptr) { }
-  SExprRefT(T* P) : Ptr(maybeRegisterFuture(&Ptr, P)) { }
+  SExprRefT()               { setRaw(nullptr); }
+  SExprRefT(std::nullptr_t) { setRaw(nullptr); }
+  SExprRefT(T* P)           { setRaw(maybeRegisterFuture(this, P)); }
 
-  T&       operator*()        { return *Ptr; }
-  const T& operator*() const  { return *Ptr; }
-  T*       operator->()       { return Ptr; }
-  const T* operator->() const { return Ptr; }
+  T&       operator*()        { return *ptr(); }
+  const T& operator*() const  { return *ptr(); }
+  T*       operator->()       { return ptr(); }
+  const T* operator->() const { return ptr(); }
 
-  T*       get()       { return Ptr; }
-  const T* get() const { return Ptr; }
+  T*       get()       { return ptr(); }
+  const T* get() const { return ptr(); }
 
   void reset(std::nullptr_t) {
-    assert((!Ptr || (Ptr->opcode() != COP_Future)) && "Cannot reset future.");
-    Ptr = nullptr;
+    assert((!ptr() || (ptr()->opcode() != COP_Future)) &&
+           "Cannot reset future.");
+    setRaw(nullptr);
   }
 
   void reset(T* P) {
-    assert((!Ptr || (Ptr->opcode() != COP_Future)) && "Cannot reset future.");
-    Ptr = maybeRegisterFuture(&Ptr, P);
+    assert((!ptr() || (ptr()->opcode() != COP_Future)) &&
+           "Cannot reset future.");
+    setRaw(maybeRegisterFuture(this, P));
   }
 
-  bool operator==(const SExprRefT<T> &P) const { return Ptr == P.Ptr; }
-  bool operator==(const T* P)            const { return Ptr == P; }
-  bool operator==(std::nullptr_t)        const { return Ptr == nullptr; }
+  bool operator==(const SExprRefT<T> &P) const { return ptr() == P.ptr(); }
+  bool operator==(const T* P)            const { return ptr() == P; }
+  bool operator==(std::nullptr_t)        const { return ptr() == nullptr; }
 
-  bool operator!=(const SExprRefT<T> &P) const { return Ptr != P.Ptr; }
-  bool operator!=(const T* P)            const { return Ptr != P; }
-  bool operator!=(std::nullptr_t)        const { return Ptr != nullptr; }
+  bool operator!=(const SExprRefT<T> &P) const { return ptr() != P.ptr(); }
+  bool operator!=(const T* P)            const { return ptr() != P; }
+  bool operator!=(std::nullptr_t)        const { return ptr() != nullptr; }
 
 private:
   friend class Future;
 
-  SExprRefT(const SExprRefT<T> &P) : Ptr(P.Ptr) { }
+  SExprRefT(const SExprRefT<T> &P) { setRaw(P.ptr()); }
   void operator=(const SExprRefT<T> &P) { }
 
+#ifdef OHMU_COMPACT_SEXPR_REFS
+  T* ptr() const {
+    if (!Ofs)
+      return nullptr;
+    const char* Base = reinterpret_cast<const char*>(this);
+    return reinterpret_cast<T*>(const_cast<char*>(Base) + Ofs);
+  }
+
+  void setRaw(T* P) {
+    if (!P) {
+      Ofs = 0;   // A reference can never point to itself, so 0 is null.
+      return;
+    }
+    ptrdiff_t D = reinterpret_cast<const char*>(P) -
+                  reinterpret_cast<const char*>(this);
+    assert(D == static_cast<int32_t>(D) && "SExpr reference out of range.");
+    Ofs = static_cast<int32_t>(D);
+  }
+
+  int32_t Ofs;
+#else
+  T*   ptr() const    { return Ptr; }
+  void setRaw(T* P)   { Ptr = P; }
+
   T* Ptr;
+#endif
 };
 
 typedef SExprRefT<SExpr> SExprRef;
@@ -342,10 +405,10 @@ public:
 
   Instruction(TIL_Opcode Op, unsigned char SubOp = 0)
       : SExpr(Op, SubOp), BType(BaseType::getBaseType<void>()),
-        InstrID(0), StackID(0), Block(nullptr) { }
+        InstrID(0), StackID(0), NumUses(0), LastUseID(0), Block(nullptr) { }
   Instruction(const Instruction &E)
       : SExpr(E), BType(E.BType),
-        InstrID(0), StackID(0), Block(nullptr) { }
+        InstrID(0), StackID(0), NumUses(0), LastUseID(0), Block(nullptr) { }
 
   /// Return the simple scalar type (e.g. int/float/pointer) of this instr.
   BaseType baseType() const { return BType; }
@@ -366,6 +429,50 @@ public:
   /// Return the name (if any) of this instruction.
   StringRef instrName() const;
 
+  /// Return the number of uses of this instruction by other instructions
+  /// in the CFG.  Use counts are maintained incrementally as instructions
+  /// are emitted (CFGBuilder::addInstr) and rewritten in place, so
+  /// dead-code checks do not need a mark pass.  They are recomputed from
+  /// scratch by SCFG::renumber(), which makes them authoritative after
+  /// computeNormalForm(); passes that edit blocks by other means may
+  /// leave them approximate until then.
+  unsigned numUses() const { return NumUses; }
+
+  /// Return the ID of the last instruction, in schedule order, that uses
+  /// this one, or 0 if it is unused or IDs have not been assigned.
+  /// Computed by SCFG::renumber().  A use as a phi argument is attributed
+  /// to the Goto that passes the value.
+  unsigned lastUseID() const { return LastUseID; }
+
+  /// Return the distance, in schedule order, from this instruction to its
+  /// last use.  Spill heuristics prefer to evict values with large
+  /// distances.
+  unsigned useDistance() const {
+    return (LastUseID > InstrID) ? LastUseID - InstrID : 0;
+  }
+
+  void addUse()  { ++NumUses; }
+  void dropUse() { if (NumUses > 0) --NumUses; }
+
+  /// Clear the use metrics, prior to recomputing them.
+  void resetUses() { NumUses = 0; LastUseID = 0; }
+
+  /// Record a use at the instruction with the given ID.
+  void setLastUseID(unsigned ID) {
+    if (ID > LastUseID)
+      LastUseID = ID;
+  }
+
+  /// Walk the operands of this instruction, incrementing their use counts
+  /// and recording this instruction's ID as their last use.
+  void recordOperandUses();
+
+  /// Record a use of E, if E is an instruction in a CFG.
+  static void registerUse(SExpr *E);
+
+  /// Move one use from Old to New when a rewrite replaces an operand.
+  static void transferUse(SExpr *Old, SExpr *New);
+
   /// Set the basic block and instruction ID for this instruction.
   void setInstrID(unsigned id) { InstrID = id; }
 
@@ -385,6 +492,8 @@ protected:
   BaseType      BType;      ///< The scalar type (simple type) of this instr.
   unsigned      InstrID;    ///< An ID that is unique within the CFG.
   unsigned      StackID;    ///< An ID for stack machine interpretation.
+  unsigned      NumUses;    ///< Number of uses by other instructions.
+  unsigned      LastUseID;  ///< ID of the last use, in schedule order.
   BasicBlock*   Block;      ///< The basic block where this instruction occurs.
 };
 
@@ -397,6 +506,24 @@ inline Instruction* SExpr::asCFGInstruction() {
 }
 
 
+inline void Instruction::registerUse(SExpr *E) {
+  if (Instruction *I = dyn_cast_or_null<Instruction>(E)) {
+    if (I->block())
+      I->addUse();
+  }
+}
+
+inline void Instruction::transferUse(SExpr *Old, SExpr *New) {
+  if (Old == New)
+    return;
+  if (Instruction *I = dyn_cast_or_null<Instruction>(Old)) {
+    if (I->block())
+      I->dropUse();
+  }
+  registerUse(New);
+}
+
+
 
 /// Placeholder for an expression that has not yet been created.
 /// Used to implement lazy copy and rewriting strategies.
@@ -426,12 +553,16 @@ public:
 public:
   // Return the result of this future if it exists, otherwise return null.
   SExpr *maybeGetResult() const { return Result; }
-  FutureStatus status() const { return Status; }
-  void setStatus(FutureStatus FS) { Status = FS; }
+  FutureStatus status() const {
+    return Status.load(std::memory_order_acquire);
+  }
+  void setStatus(FutureStatus FS) {
+    Status.store(FS, std::memory_order_release);
+  }
 
   // Connect this future to the given position.
   // Forcing the future will overwrite the value at the position.
-  SExpr* addPosition(SExpr **Eptr);
+  SExpr* addPosition(SExprRef *Ref);
 
   // Connect this future to the given position in a basic block.
   void addInstrPosition(Instruction **Iptr);
@@ -440,6 +571,8 @@ public:
   virtual SExpr* evaluate() = 0;
 
   /// Return the result, calling evaluate() and setResult() if necessary.
+  /// Safe to call from multiple threads: exactly one caller evaluates,
+  /// and the others block until the result is published.
   SExpr* force();
 
   /// Set the result of this future, and overwrite occurrences with the result.
@@ -448,21 +581,22 @@ public:
   SExpr *getResult() const { return Result; }
 
 private:
-  FutureStatus Status;
+  std::atomic<FutureStatus> Status;
+  std::thread::id Owner;            ///< Thread that is evaluating this future.
   SExpr *Result;                    ///< Result of forcing this future.
   Instruction** IPos;               ///< Backpointer to CFG loc where F occurs.
-  std::vector<SExpr**> Positions;   ///< Backpointers to places where F occurs.
+  std::vector<SExprRef*> Positions; ///< Backpointers to places where F occurs.
 };
 
 
-inline SExpr* maybeRegisterFuture(SExpr** Eptr, SExpr* P) {
+inline SExpr* maybeRegisterFuture(SExprRefT<SExpr>* Ref, SExpr* P) {
   if (auto *Fut = dyn_cast_or_null<Future>(P))
-    return Fut->addPosition(Eptr);
+    return Fut->addPosition(Ref);
   return P;
 }
 
 template<class T>
-inline T* maybeRegisterFuture(T** Eptr, T* P) {
+inline T* maybeRegisterFuture(SExprRefT<T>* Ref, T* P) {
   // Futures can only be stored in places that can hold any SExpr.
   assert(!P || P->opcode() != COP_Future);
   return P;
@@ -510,7 +644,7 @@ public:
   VarDecl(VariableKind K, StringRef s, SExpr *D)
       : SExpr(COP_VarDecl, K), VarIndex(0), VarName(s), Definition(D) { }
 
-  void rewrite(SExpr *D) { Definition.reset(D); }
+  void rewrite(SExpr *D) { invalidateHashCode(); Definition.reset(D); }
 
   /// Return the kind of variable (let, function param, or self)
   VariableKind kind() const { return static_cast<VariableKind>(SubOpcode); }
@@ -557,6 +691,7 @@ public:
   }
 
   void rewrite(VarDecl *Vd, SExpr *Bd) {
+    invalidateHashCode();
     VDecl.reset(Vd);
     Body.reset(Bd);
   }
@@ -591,6 +726,7 @@ public:
   Code(SExpr *T, SExpr *B) : PValue(COP_Code), ReturnType(T), Body(B) {}
 
   void rewrite(SExpr *T, SExpr *B) {
+    invalidateHashCode();
     ReturnType.reset(T);
     Body.reset(B);
   }
@@ -624,6 +760,7 @@ public:
   Field(SExpr *R, SExpr *B) : PValue(COP_Field), Range(R), Body(B) {}
 
   void rewrite(SExpr *R, SExpr *B) {
+    invalidateHashCode();
     Range.reset(R);
     Body.reset(B);
   }
@@ -653,7 +790,7 @@ public:
 
   Slot(StringRef N, SExpr *D) : PValue(COP_Slot), SlotName(N), Definition(D) { }
 
-  void rewrite(SExpr *D) { Definition.reset(D); }
+  void rewrite(SExpr *D) { invalidateHashCode(); Definition.reset(D); }
 
   StringRef slotName() const { return SlotName; }
 
@@ -683,9 +820,10 @@ public:
   static bool classof(const SExpr *E) { return E->opcode() == COP_Record; }
 
   Record(MemRegionRef A, unsigned NSlots, SExpr* P = nullptr)
-    : PValue(COP_Record), Parent(P), Slots(A, NSlots) {}
+    : PValue(COP_Record), Parent(P), Slots(A, NSlots), Arena(A),
+      SlotIndex(nullptr), IndexBuckets(0), IndexedSlots(0) {}
 
-  void rewrite(SExpr *P) { Parent.reset(P); }
+  void rewrite(SExpr *P) { invalidateHashCode(); Parent.reset(P); }
 
   SExpr* parent() { return Parent.get(); }
   const SExpr* parent() const { return Parent.get(); }
@@ -695,11 +833,24 @@ public:
 
   void addSlot(MemRegionRef A, Slot *S) { Slots.emplace_back(A, S); }
 
+  /// Find the slot named S, or return null.  Large records are looked
+  /// up through a hash index over the slot names; the index is built in
+  /// bulk on the first lookup (e.g. after deserialization, or for the
+  /// global namespace after parsing) and extended incrementally as
+  /// slots are added.  Small records use a linear scan.
   Slot* findSlot(StringRef S);
 
 private:
+  /// Bring the slot index up to date with the slot array.
+  void updateSlotIndex();
+
   SExprRef  Parent;   ///< The record we inherit from
   SlotArray Slots;    ///< The slots in the record.
+
+  MemRegionRef Arena;      ///< Arena the slot index is allocated in.
+  uint32_t* SlotIndex;     ///< Open-addressed map from slot name to index.
+  uint32_t  IndexBuckets;  ///< Size of SlotIndex; a power of two.
+  uint32_t  IndexedSlots;  ///< Number of slots present in the index.
 };
 
 
@@ -756,6 +907,7 @@ public:
   { }
 
   void rewrite(SExpr *ETyp, SExpr *Sz) {
+    invalidateHashCode();
     ElemType.reset(ETyp);
     ArrSize.reset(Sz);
   }
@@ -798,7 +950,7 @@ public:
 
   Variable(VarDecl *VD) : Instruction(COP_Variable), VDecl(VD) { }
 
-  void rewrite(VarDecl *D) { VDecl.reset(D); }
+  void rewrite(VarDecl *D) { invalidateHashCode(); VDecl.reset(D); }
 
   const VarDecl* variableDecl() const { return VDecl.get(); }
   VarDecl* variableDecl() { return VDecl.get(); }
@@ -829,6 +981,7 @@ public:
   {}
 
   void rewrite(SExpr *F, SExpr *A) {
+    invalidateHashCode();
     Fun.reset(F);
     Arg.reset(A);
   }
@@ -865,7 +1018,7 @@ public:
       : Instruction(COP_Project), Rec(R), SlotName(Sd->slotName()),
         SlotDecl(Sd)  { }
 
-  void rewrite(SExpr *R) { Rec.reset(R); }
+  void rewrite(SExpr *R) { invalidateHashCode(); Rec.reset(R); }
 
   SExpr *record() { return Rec.get(); }
   const SExpr *record() const { return Rec.get(); }
@@ -916,7 +1069,11 @@ public:
     Flags = CCV;
   }
 
-  void rewrite(SExpr *T) { Target.reset(T); }
+  void rewrite(SExpr *T) {
+    invalidateHashCode();
+    transferUse(Target.get(), T);
+    Target.reset(T);
+  }
 
   SExpr *target() { return Target.get(); }
   const SExpr *target() const { return Target.get(); }
@@ -944,7 +1101,11 @@ public:
     setBaseType(BaseType::getBaseType<void*>());
   }
 
-  void rewrite(SExpr *I) { InitExpr.reset(I); }
+  void rewrite(SExpr *I) {
+    invalidateHashCode();
+    transferUse(InitExpr.get(), I);
+    InitExpr.reset(I);
+  }
 
   AllocKind allocKind() const { return static_cast<AllocKind>(SubOpcode); }
 
@@ -976,7 +1137,11 @@ public:
 
   Load(SExpr *P) : Instruction(COP_Load), Ptr(P) {}
 
-  void rewrite(SExpr *P) { Ptr.reset(P); }
+  void rewrite(SExpr *P) {
+    invalidateHashCode();
+    transferUse(Ptr.get(), P);
+    Ptr.reset(P);
+  }
 
   SExpr *pointer() { return Ptr.get(); }
   const SExpr *pointer() const { return Ptr.get(); }
@@ -996,6 +1161,9 @@ public:
       : Instruction(COP_Store), Dest(P), Source(V) {}
 
   void rewrite(SExpr *D, SExpr *S) {
+    invalidateHashCode();
+    transferUse(Dest.get(), D);
+    transferUse(Source.get(), S);
     Dest.reset(D);
     Source.reset(S);
   }
@@ -1022,6 +1190,9 @@ public:
       : Instruction(COP_ArrayIndex), Array(A), Index(N) {}
 
   void rewrite(SExpr *A, SExpr *I) {
+    invalidateHashCode();
+    transferUse(Array.get(), A);
+    transferUse(Index.get(), I);
     Array.reset(A);
     Index.reset(I);
   }
@@ -1049,6 +1220,9 @@ public:
       : Instruction(COP_ArrayAdd), Array(A), Index(N) {}
 
   void rewrite(SExpr *A, SExpr *I) {
+    invalidateHashCode();
+    transferUse(Array.get(), A);
+    transferUse(Index.get(), I);
     Array.reset(A);
     Index.reset(I);
   }
@@ -1074,7 +1248,11 @@ public:
   UnaryOp(TIL_UnaryOpcode Op, SExpr *E)
       : Instruction(COP_UnaryOp, Op), Expr0(E) { }
 
-  void rewrite(SExpr *E) { Expr0.reset(E); }
+  void rewrite(SExpr *E) {
+    invalidateHashCode();
+    transferUse(Expr0.get(), E);
+    Expr0.reset(E);
+  }
 
   TIL_UnaryOpcode unaryOpcode() const {
     return static_cast<TIL_UnaryOpcode>(SubOpcode);
@@ -1098,6 +1276,9 @@ public:
       : Instruction(COP_BinaryOp, Op), Expr0(E0), Expr1(E1) { }
 
   void rewrite(SExpr *E0, SExpr *E1) {
+    invalidateHashCode();
+    transferUse(Expr0.get(), E0);
+    transferUse(Expr1.get(), E1);
     Expr0.reset(E0);
     Expr1.reset(E1);
   }
@@ -1128,7 +1309,11 @@ public:
   Cast(TIL_CastOpcode Op, SExpr *E)
       : Instruction(COP_Cast, Op), Expr0(E) { }
 
-  void rewrite(SExpr *E) { Expr0.reset(E); }
+  void rewrite(SExpr *E) {
+    invalidateHashCode();
+    transferUse(Expr0.get(), E);
+    Expr0.reset(E);
+  }
 
   TIL_CastOpcode castOpcode() const {
     return static_cast<TIL_CastOpcode>(SubOpcode);
@@ -1222,6 +1407,11 @@ public:
   /// Returns the argument index into the Phi nodes for this branch.
   unsigned phiIndex() const { return Index; }
 
+  /// Set the argument index.  Used by passes that edit predecessor lists,
+  /// e.g. SimplifyCFG; the index must match the position of the source
+  /// block in the target's predecessor array.
+  void setPhiIndex(unsigned I) { Index = I; }
+
   bool isBackEdge() const;
 
   /// Return the list of basic blocks that this terminator can branch to.
@@ -1246,7 +1436,11 @@ public:
     Branches[1].reset(E);
   }
 
-  void rewrite(SExpr *C) { Condition.reset(C); }
+  void rewrite(SExpr *C) {
+    invalidateHashCode();
+    transferUse(Condition.get(), C);
+    Condition.reset(C);
+  }
 
   const SExpr *condition() const { return Condition.get(); }
   SExpr *condition() { return Condition.get(); }
@@ -1276,8 +1470,16 @@ public:
       : Terminator(COP_Switch), Condition(C), Labels(A, NumC), Cases(A, NumC)
   { }
 
-  void rewrite(SExpr *C) { Condition.reset(C); }
-  void rewriteLabel(int i, SExpr* Lab) { Labels[i].reset(Lab); }
+  void rewrite(SExpr *C) {
+    invalidateHashCode();
+    transferUse(Condition.get(), C);
+    Condition.reset(C);
+  }
+  void rewriteLabel(int i, SExpr* Lab) {
+    invalidateHashCode();
+    transferUse(Labels[i].get(), Lab);
+    Labels[i].reset(Lab);
+  }
 
   /// Return the number of cases.
   int numCases() const { return Cases.size(); }
@@ -1327,7 +1529,11 @@ public:
 
   Return(SExpr* Rval) : Terminator(COP_Return), Retval(Rval) {}
 
-  void rewrite(SExpr *R) { Retval.reset(R); }
+  void rewrite(SExpr *R) {
+    invalidateHashCode();
+    transferUse(Retval.get(), R);
+    Retval.reset(R);
+  }
 
   /// Return an empty list.
   BlockArray successors() { return BlockArray(); }
@@ -1400,7 +1606,7 @@ public:
   int numPredecessors() const { return Predecessors.size(); }
   int numSuccessors()   const { return successors().size(); }
 
-  int firstInstrID() {
+  unsigned firstInstrID() {
     if (Args.size() > 0)
       return Args[0]->instrID();
     for (auto *Instr : Instrs)
@@ -1454,28 +1660,24 @@ public:
   }
 
   /// Add a new argument.
-  void addArgument(Phi *E) {
-    E->setBlock(this);
-    Args.emplace_back(Arena, E);
-  }
+  inline void addArgument(Phi *E);
 
   /// Add a new instruction.
-  void addInstruction(Instruction *E) {
-    E->setBlock(this);
-    Instrs.emplace_back(Arena, E);
-    if (auto *F = dyn_cast<Future>(E))
-      F->addInstrPosition(&Instrs.back());
-  }
+  inline void addInstruction(Instruction *E);
 
   /// Set the terminator.
-  void setTerminator(Terminator *E) {
-    TermInstr = E;
-  }
+  inline void setTerminator(Terminator *E);
 
   // Add a new predecessor, and return the phi-node index for it.
   // Will add an argument to all phi-nodes, initialized to nullptr.
   unsigned addPredecessor(BasicBlock *Pred);
 
+  // Remove the predecessor in slot i, along with the corresponding Phi
+  // arguments.  The last edge is moved into slot i (and its Goto, which
+  // carries its slot, is repointed), so no other slots shift: removal
+  // costs one move per Phi node, not a shift of every argument vector.
+  void removePredecessor(unsigned i);
+
   // Reserve space for Nargs arguments.
   void reserveArguments(unsigned Nargs) { Args.reserve(Arena, Nargs); }
 
@@ -1485,19 +1687,54 @@ public:
   // Reserve space for NumPreds predecessors, including space in phi nodes.
   void reservePredecessors(unsigned NumPreds);
 
-  /// Return the index of BB, or Predecessors.size if BB is not a predecessor.
-  unsigned findPredecessorIndex(const BasicBlock *BB) const;
+  /// Return the index of BB, or Predecessors.size if BB is not a
+  /// predecessor.  An edge from a Goto is answered from the slot the
+  /// Goto itself carries (see Goto::phiIndex); other edges go through a
+  /// hash index over the predecessor array, built lazily and kept up to
+  /// date across edits, as Record::findSlot does for slot names.  Small
+  /// blocks use a linear scan.
+  unsigned findPredecessorIndex(const BasicBlock *BB);
+
+  /// Reset this block to a freshly-constructed state, keeping the
+  /// capacity of its arrays, so that CFGBuilder can recycle block
+  /// shells discarded by rewriting passes.
+  void reset() {
+    CFGPtr = nullptr;
+    BlockID = 0;
+    PostBlockID = 0;
+    Depth = 0;
+    LoopDepth = 0;
+    InstrIDBase = 0;
+    InstrIDLimit = 0;
+    Predecessors.clear();
+    PredIndex = nullptr;
+    PredIndexBuckets = 0;
+    IndexedPreds = 0;
+    Args.clear();
+    Instrs.clear();
+    TermInstr = nullptr;
+    DominatorNode = TopologyNode();
+    PostDominatorNode = TopologyNode();
+    clearAnnotations();
+  }
 
   explicit BasicBlock(MemRegionRef A)
       : SExpr(COP_BasicBlock), Arena(A), CFGPtr(nullptr),
         BlockID(0), PostBlockID(0), Depth(0), LoopDepth(0),
-        TermInstr(nullptr)
+        InstrIDBase(0), InstrIDLimit(0), TermInstr(nullptr),
+        PredIndex(nullptr), PredIndexBuckets(0), IndexedPreds(0)
   { }
 
 private:
   friend class SCFG;
 
-  unsigned renumber(unsigned id);   // assign unique ids to all instructions
+  // Assign unique ids to all instructions, appending them to the flat
+  // schedule-order view if one is given.
+  unsigned renumber(unsigned id, SimpleArray<Instruction*> *Flat = nullptr);
+
+  /// Bring the predecessor index up to date with the predecessor array.
+  void updatePredIndex();
+
   int  topologicalSort    (BasicBlock **Blocks, int ID);
   int  postTopologicalSort(BasicBlock **Blocks, int ID);
   void computeDominator();
@@ -1513,11 +1750,19 @@ private:
   int Depth;                 // The instruction Depth of the first instruction.
   int LoopDepth;             // The level of nesting within loops.
 
+  unsigned InstrIDBase;      // First instruction ID assigned to this block.
+  unsigned InstrIDLimit;     // End of this block's ID range, including the
+                             // gap left for local renumbering.
+
   PredArray   Predecessors;  // Predecessor blocks in the CFG.
   ArgArray    Args;          // Phi nodes.  One argument per predecessor.
   InstrArray  Instrs;        // Instructions (elements may be null).
   Terminator* TermInstr;     // Terminating instruction
 
+  uint32_t*   PredIndex;        // Open-addressed map from block to slot.
+  uint32_t    PredIndexBuckets; // Size of PredIndex; a power of two.
+  uint32_t    IndexedPreds;     // Predecessors present in the index.
+
   TopologyNode DominatorNode;       // The dominator tree
   TopologyNode PostDominatorNode;   // The post-dominator tree
 };
@@ -1539,10 +1784,18 @@ public:
   bool valid() const { return Entry && Exit && Blocks.size() > 0; }
 
   /// Return true if this CFG has been normalized.
-  /// After normalization, blocks are in topological order, and block and
-  /// instruction IDs have been assigned.
+  /// After normalization, blocks are in topological order, block and
+  /// instruction IDs have been assigned, and the dominator and
+  /// post-dominator trees are valid.
   bool normal() const { return Normal; }
 
+  /// Mark the CFG as modified.  Edits that change the graph structure or
+  /// the instruction stream invalidate the normal form, including the
+  /// cached dominator and post-dominator trees; the next call to
+  /// computeNormalForm() will rebuild them.  Edits made through
+  /// CFGBuilder call this automatically.
+  void markModified() { Normal = false; }
+
   const BlockArray& blocks() const { return Blocks; }
   BlockArray&       blocks()       { return Blocks; }
 
@@ -1560,16 +1813,42 @@ public:
   /// A call to SExpr::id() will return a number less than numInstructions().
   unsigned numInstructions() const { return NumInstructions; }
 
+  /// Return the instructions of the CFG as one contiguous array in
+  /// schedule order: for each block in order, its arguments, then its
+  /// instructions, then its terminator.  Passes that do not need the
+  /// block structure can iterate this linearly instead of chasing the
+  /// per-block arrays.  The view is rebuilt by renumber(); local edits
+  /// leave it empty until the CFG is renumbered again.
+  ArrayRef<Instruction*> instrs() const {
+    return ArrayRef<Instruction*>(
+        const_cast<Instruction**>(FlatInstrs.begin()), FlatInstrs.size());
+  }
+
+  /// Return the offset into instrs() of the first instruction of the
+  /// block with ID B.  The block's instructions end where the next
+  /// block's begin; blockOffset(numBlocks()) is the total size.
+  unsigned blockOffset(unsigned B) const { return BlockOffsets[B]; }
+
   inline void add(BasicBlock *BB) {
     assert(BB->CFGPtr == nullptr);
     BB->CFGPtr = this;
     Blocks.emplace_back(Arena, BB);
+    Normal = false;
   }
 
   void setEntry(BasicBlock *BB) { Entry = BB; }
   void setExit(BasicBlock *BB)  { Exit = BB;  }
 
   void renumber();         // assign unique ids to all instructions and blocks
+
+  /// Renumber only B, after a local edit to its instruction stream.
+  /// renumber() leaves a gap of unused IDs after each block, so the
+  /// block's instructions can usually be renumbered in place without
+  /// touching the rest of the CFG; if the block has outgrown its gap,
+  /// this falls back to a full renumbering.  Only the instruction-ID
+  /// invariant is restored, not the normal form.
+  void renumberBlock(BasicBlock *B);
+
   void computeNormalForm();
 
   SCFG(MemRegionRef A, unsigned Nblocks)
@@ -1583,9 +1862,38 @@ private:
   BasicBlock   *Exit;
   unsigned     NumInstructions;
   bool         Normal;
+
+  SimpleArray<Instruction*> FlatInstrs;   // schedule-order view
+  SimpleArray<unsigned>     BlockOffsets; // numBlocks()+1 entries
 };
 
 
+// These are defined out of line because they invalidate the normal form of
+// the containing CFG, and thus need the full definition of SCFG.
+
+inline void BasicBlock::addArgument(Phi *E) {
+  E->setBlock(this);
+  Args.emplace_back(Arena, E);
+  if (CFGPtr)
+    CFGPtr->markModified();
+}
+
+inline void BasicBlock::addInstruction(Instruction *E) {
+  E->setBlock(this);
+  Instrs.emplace_back(Arena, E);
+  if (auto *F = dyn_cast<Future>(E))
+    F->addInstrPosition(&Instrs.back());
+  if (CFGPtr)
+    CFGPtr->markModified();
+}
+
+inline void BasicBlock::setTerminator(Terminator *E) {
+  TermInstr = E;
+  if (CFGPtr)
+    CFGPtr->markModified();
+}
+
+
 
 /// Placeholder for expressions that cannot be represented in the TIL.
 class Undefined : public Instruction {
@@ -1631,6 +1939,7 @@ public:
   }
 
   void rewrite(VarDecl *Vd, SExpr *B) {
+    invalidateHashCode();
     VDecl.reset(Vd);
     Body.reset(B);
   }
@@ -1658,6 +1967,7 @@ public:
   { }
 
   void rewrite(SExpr *C, SExpr *E0, SExpr* E1) {
+    invalidateHashCode();
     Condition.reset(C);
     ThenExpr.reset(E0);
     ElseExpr.reset(E1);
@@ -616,6 +616,21 @@ public:
 
   void compareOpcodes  (TIL_Opcode O, TIL_Opcode P)   { if (O != P) fail(); }
 
+  /// Reject in O(1) when both sides carry cached structural hashes that
+  /// disagree.  Equal expressions always hash alike (see HashComparator),
+  /// so this never rejects a pair that would have compared equal.
+  void compareSExpr(const SExpr *E1, const SExpr *E2) {
+    if (E1 && E2 && E1 != E2) {
+      uint32_t H1 = E1->hashCode();
+      uint32_t H2 = E2->hashCode();
+      if (H1 != 0 && H2 != 0 && H1 != H2) {
+        fail();
+        return;
+      }
+    }
+    AlphaLetComparator<EqualsComparator, bool>::compareSExpr(E1, E2);
+  }
+
   static bool compareExprs(const SExpr *E1, const SExpr* E2) {
     EqualsComparator Eq;
     Eq.compare(E1, E2);
@@ -634,6 +649,142 @@ public:
 };
 
 
+/// HashComparator computes a structural hash of a single expression.
+/// It reuses the comparison traversal by comparing an expression against
+/// itself, with the pointer-equality shortcut disabled, and folds the
+/// scalar values that an equality comparison would inspect into the
+/// hash.  The hash is invariant under the relation that EqualsComparator
+/// decides: variables are hashed by binding order rather than by index
+/// (alpha-renaming), and let-bindings are hashed transparently
+/// (let-inlining).  Equal expressions therefore always hash alike, so a
+/// mismatch of cached hashes soundly rejects equality in O(1); a match
+/// must still be confirmed with EqualsComparator.
+class HashComparator : public Comparator<HashComparator, bool> {
+public:
+  void compareBaseTypes(BaseType b, BaseType c) {
+    combine(static_cast<uint32_t>(b.Base) | (b.Size << 8) |
+            (static_cast<uint32_t>(b.VectSize) << 16));
+  }
+
+  template <class Lit>
+  void compareScalarValues(Lit i, Lit j) { combineValue(i); }
+
+  void compareOpcodes(TIL_Opcode O, TIL_Opcode P) { combine(O); }
+
+  /// Bound variables hash by the order in which their bindings are
+  /// encountered, which makes the hash independent of variable indices.
+  void enterScope(const VarDecl *V1, const VarDecl *V2) {
+    bind(V1->varIndex());
+  }
+
+  void exitScope(const VarDecl *V1) { Cache.resize(V1->varIndex()); }
+
+  /// Free variables fold in their definition at first use, and are
+  /// referred to by first-use order afterwards.  The binding is recorded
+  /// before the definition is hashed, to cut self-referential cycles.
+  void compareWeakRefs(const VarDecl *V1, const VarDecl *V2) {
+    unsigned i = lookup(V1->varIndex());
+    if (i == 0) {
+      i = bind(V1->varIndex());
+      this->compare(V1->definition(), V1->definition());
+    }
+    combine(i);
+  }
+
+  /// Visit every node.  The expression is compared against itself, so
+  /// the pointer-equality shortcut would otherwise skip the whole tree.
+  /// Let-bindings are resolved the same way AlphaLetComparator resolves
+  /// them: the hash skips Let nodes, and hashes a let-bound variable as
+  /// its definition.
+  void compareSExpr(const SExpr *E1, const SExpr *E2) {
+    if (!E1) {
+      combine(0);
+      return;
+    }
+    if (E1->opcode() == COP_Let) {
+      const SExpr *B = cast<Let>(E1)->body();
+      compareSExpr(B, B);
+      return;
+    }
+    if (E1->opcode() == COP_Variable) {
+      const VarDecl *Vd = cast<Variable>(E1)->variableDecl();
+      if (Vd->kind() == VarDecl::VK_Let && Vd->definition()) {
+        compareSExpr(Vd->definition(), Vd->definition());
+        return;
+      }
+    }
+    combine(static_cast<uint64_t>(E1->opcode()) + 1);
+    this->compareByCase(E1, E2);
+  }
+
+  static uint64_t hash(const SExpr *E) {
+    HashComparator H;
+    H.compare(E, E);
+    return H.Hash;
+  }
+
+  /// Return the 32-bit structural hash of E, computing and caching it on
+  /// first use.  Never returns 0, which SExpr reserves for "no hash
+  /// computed"; see SExpr::hashCode().
+  static uint32_t hashCode(const SExpr *E) {
+    uint32_t H = E->hashCode();
+    if (H != 0)
+      return H;
+    uint64_t H64 = hash(E);
+    H = static_cast<uint32_t>(H64) ^ static_cast<uint32_t>(H64 >> 32);
+    if (H == 0)
+      H = 1;
+    E->setHashCode(H);
+    return H;
+  }
+
+public:
+  void fail() { }
+  bool success() { return true; }
+
+  HashComparator() : Hash(0xcbf29ce484222325ULL), NextVarID(1) { }
+
+private:
+  // FNV-1a style mixing.
+  void combine(uint64_t V) { Hash = (Hash ^ V) * 0x100000001b3ULL; }
+
+  void combineBits(const void *P, size_t Sz) {
+    const unsigned char *B = static_cast<const unsigned char*>(P);
+    for (size_t i = 0; i < Sz; ++i)
+      combine(B[i]);
+  }
+
+  // Fold one scalar value into the hash, by kind.
+  template <class T>
+  void combineValue(T V)   { combine(static_cast<uint64_t>(V)); }
+  template <class T>
+  void combineValue(T* P)  { combine(reinterpret_cast<uintptr_t>(P)); }
+  void combineValue(float f)     { combineBits(&f, sizeof(f)); }
+  void combineValue(double d)    { combineBits(&d, sizeof(d)); }
+  void combineValue(StringRef S) {
+    for (unsigned i = 0, n = S.size(); i < n; ++i)
+      combine(static_cast<unsigned char>(S.data()[i]));
+  }
+
+  unsigned lookup(unsigned i) {
+    if (Cache.size() <= i)
+      return 0;
+    return Cache[i];
+  }
+
+  unsigned bind(unsigned i) {
+    if (Cache.size() <= i)
+      Cache.resize(i + 1, 0);
+    Cache[i] = NextVarID;
+    return NextVarID++;
+  }
+
+  uint64_t Hash;
+  unsigned NextVarID;
+  std::vector<unsigned> Cache;
+};
+
+
 class MatchComparator : public AlphaLetComparator<EqualsComparator, bool> {
 public:
   void compareBaseTypes(BaseType b, BaseType c)       { if (b != c) fail(); }
@@ -20,7 +20,11 @@
 #include "TIL.h"
 #include "AnnotationImpl.h"
 
+#include <cstdio>
+#include <cstring>
 #include <ostream>
+#include <string>
+#include <utility>
 
 namespace ohmu {
 namespace til {
@@ -35,6 +39,165 @@ private:
 };
 
 
+/// A growable character buffer that can be used as the StreamType of a
+/// PrettyPrinter.  Formatting is done by hand into the buffer, and the
+/// whole dump is handed to the ostream in a single write, which is much
+/// faster than formatting each token through the ostream.
+class PrintBuffer {
+public:
+  PrintBuffer() : Size(0), Capacity(InitialCapacity) {
+    Buf = new char[Capacity];
+  }
+  ~PrintBuffer() { delete[] Buf; }
+
+  const char* data() const { return Buf; }
+  size_t      size() const { return Size; }
+
+  void clear() { Size = 0; }
+
+  /// Grow the buffer so that it can hold at least Cap characters.
+  void reserve(size_t Cap) {
+    if (Cap <= Capacity)
+      return;
+    while (Capacity < Cap)
+      Capacity = Capacity * 2;
+    char* NBuf = new char[Capacity];
+    memcpy(NBuf, Buf, Size);
+    delete[] Buf;
+    Buf = NBuf;
+  }
+
+  /// Write the contents of the buffer to SS in one call.
+  void writeTo(std::ostream &SS) const { SS.write(Buf, Size); }
+
+  std::string str() const { return std::string(Buf, Size); }
+
+  PrintBuffer& operator<<(char C) {
+    reserve(Size + 1);
+    Buf[Size++] = C;
+    return *this;
+  }
+  PrintBuffer& operator<<(signed char C)   { return *this << (char)C; }
+  PrintBuffer& operator<<(unsigned char C) { return *this << (char)C; }
+
+  PrintBuffer& operator<<(const char* S) { return write(S, strlen(S)); }
+  PrintBuffer& operator<<(StringRef S)   { return write(S.data(), S.size()); }
+  PrintBuffer& operator<<(const std::string &S) {
+    return write(S.data(), S.size());
+  }
+
+  PrintBuffer& operator<<(bool V)  { return *this << (char)('0' + V); }
+
+  PrintBuffer& operator<<(short V)          { return writeSInt(V); }
+  PrintBuffer& operator<<(unsigned short V) { return writeUInt(V); }
+  PrintBuffer& operator<<(int V)            { return writeSInt(V); }
+  PrintBuffer& operator<<(unsigned int V)   { return writeUInt(V); }
+  PrintBuffer& operator<<(long V)           { return writeSInt(V); }
+  PrintBuffer& operator<<(unsigned long V)  { return writeUInt(V); }
+  PrintBuffer& operator<<(long long V)      { return writeSInt(V); }
+  PrintBuffer& operator<<(unsigned long long V) { return writeUInt(V); }
+
+  PrintBuffer& operator<<(double V) {
+    char Tmp[32];
+    // %g matches the default ostream format for floating point.
+    return write(Tmp, snprintf(Tmp, sizeof(Tmp), "%g", V));
+  }
+  PrintBuffer& operator<<(float V) { return *this << (double)V; }
+
+  /// Re-wrap lines that are longer than MaxWidth.  Long lines are broken
+  /// at the last space before the limit, and the continuation is indented
+  /// four columns past the original line.  Intended for debug dumps; it
+  /// does not try to keep string literals intact.
+  inline void wrapLines(unsigned MaxWidth);
+
+private:
+  PrintBuffer& write(const char* S, size_t N) {
+    reserve(Size + N);
+    memcpy(Buf + Size, S, N);
+    Size += N;
+    return *this;
+  }
+
+  PrintBuffer& writeSInt(long long V) {
+    if (V < 0) {
+      *this << '-';
+      // Negate as unsigned to handle the minimum value.
+      return writeUInt(~static_cast<unsigned long long>(V) + 1);
+    }
+    return writeUInt(static_cast<unsigned long long>(V));
+  }
+
+  PrintBuffer& writeUInt(unsigned long long V) {
+    char Tmp[20];   // Enough digits for a 64 bit integer.
+    unsigned N = 0;
+    do {
+      Tmp[N++] = static_cast<char>('0' + V % 10);
+      V /= 10;
+    } while (V > 0);
+    reserve(Size + N);
+    while (N > 0)
+      Buf[Size++] = Tmp[--N];
+    return *this;
+  }
+
+  static const size_t InitialCapacity = 4096;
+
+  size_t Size;
+  size_t Capacity;
+  char*  Buf;
+};
+
+
+inline void PrintBuffer::wrapLines(unsigned MaxWidth) {
+  PrintBuffer Out;
+  Out.reserve(Size + Size / 8);
+
+  size_t LineStart = 0;
+  while (LineStart < Size) {
+    const char* Eol = static_cast<const char*>(
+        memchr(Buf + LineStart, '\n', Size - LineStart));
+    size_t LineEnd = Eol ? (Eol - Buf) : Size;
+    size_t Len     = LineEnd - LineStart;
+
+    // Continuations are indented past the original line's indentation.
+    size_t Indent = 0;
+    while (Indent < Len && Buf[LineStart + Indent] == ' ')
+      ++Indent;
+    size_t ContIndent = Indent + 4;
+
+    size_t Pos   = LineStart;
+    size_t Width = MaxWidth;
+    while (LineEnd - Pos > Width) {
+      // Find the last space that fits, skipping the indentation.
+      size_t Brk = 0;
+      for (size_t i = Pos + Width; i > Pos + Indent; --i) {
+        if (Buf[i] == ' ' && Buf[i-1] != ' ') {
+          Brk = i;
+          break;
+        }
+      }
+      if (Brk == 0)
+        break;   // No usable break point; emit the rest as one line.
+      Out.write(Buf + Pos, Brk - Pos);
+      Out << '\n';
+      for (size_t i = 0; i < ContIndent; ++i)
+        Out << ' ';
+      Pos    = Brk + 1;   // The space is replaced by the line break.
+      Indent = 0;         // Continuations start with their own indent.
+      Width  = (MaxWidth > ContIndent) ? MaxWidth - ContIndent : 1;
+    }
+    Out.write(Buf + Pos, LineEnd - Pos);
+    if (Eol)
+      Out << '\n';
+    LineStart = LineEnd + 1;
+  }
+
+  std::swap(Buf,      Out.Buf);
+  std::swap(Size,     Out.Size);
+  std::swap(Capacity, Out.Capacity);
+}
+
+
 /// Pretty printer for TIL expressions
 template <typename Self, typename StreamType>
 class PrettyPrinter {
@@ -731,6 +894,37 @@ public:
 };
 
 
+/// Buffered versions of the printers above.  They produce the same output,
+/// but format the whole expression into a PrintBuffer and hand it to the
+/// ostream in a single write.  Use these when dumps are large or frequent
+/// enough to show up in profiles.
+class StdBufferPrinter : public PrettyPrinter<StdBufferPrinter, PrintBuffer> {
+public:
+  using PrettyPrinter<StdBufferPrinter, PrintBuffer>::print;
+
+  static void print(const SExpr *E, std::ostream &SS, bool Sub = false) {
+    PrintBuffer Buf;
+    StdBufferPrinter Printer;
+    Printer.printSExpr(E, Buf, Prec_MAX, Sub);
+    Buf.writeTo(SS);
+  }
+};
+
+class TILBufferPrinter : public PrettyPrinter<TILBufferPrinter, PrintBuffer> {
+public:
+  TILBufferPrinter() : PrettyPrinter(true, false) { }
+
+  using PrettyPrinter<TILBufferPrinter, PrintBuffer>::print;
+
+  static void print(const SExpr *E, std::ostream &SS, bool Sub = false) {
+    PrintBuffer Buf;
+    TILBufferPrinter Printer;
+    Printer.printSExpr(E, Buf, Prec_MAX, Sub);
+    Buf.writeTo(SS);
+  }
+};
+
+
 #ifdef OHMU_STANDALONE
 inline DiagnosticStream& operator<<(DiagnosticStream& Ds, SExpr *E) {
   TILDebugPrinter::print(E, Ds.outputStream(), false);
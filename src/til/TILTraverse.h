@@ -15,6 +15,7 @@
 #ifndef OHMU_TIL_TILTRAVERSE_H
 #define OHMU_TIL_TILTRAVERSE_H
 
+#include "base/NestedStack.h"
 #include "TIL.h"
 #include "AnnotationImpl.h"
 
@@ -130,6 +131,20 @@ public:
     }
   }
 
+  /// Return true to traverse nested Let and Apply chains iteratively,
+  /// with an explicit stack, rather than through the C++ call stack.
+  /// Machine-generated code can nest such chains deeply enough to
+  /// overflow the call stack.  The iterative traversal makes the same
+  /// enterSubExpr/exitSubExpr, scope, and reduce calls in the same
+  /// order as the recursive one, but it bypasses traverse() for the
+  /// interior nodes of a chain; traversals that override traverse()
+  /// to do per-node work must leave this false.
+  bool flattenChains() { return false; }
+
+  /// Return false to stop the iterative chain traversals early,
+  /// e.g. after an error.  See Visitor::fail().
+  bool keepTraversing() { return true; }
+
 protected:
   /// For generic SExprs, do dynamic dispatch by type.
   void traverseByType(SExpr *E, TraversalKind K) {
@@ -149,6 +164,14 @@ protected:
     return self()->traverse##X(E);                                        \
   }
 #include "TILOps.def"
+
+  /// Traverse a chain of right-nested Let expressions with an explicit
+  /// stack.  See flattenChains().
+  void traverseLetChain(Let *E);
+
+  /// Traverse the spine of a curried application with an explicit stack.
+  /// See flattenChains().
+  void traverseApplyChain(Apply *E);
 };
 
 
@@ -320,6 +343,10 @@ void Traversal<S>::traverseVariable(Variable *E) {
 
 template <class S>
 void Traversal<S>::traverseApply(Apply *E) {
+  if (self()->flattenChains()) {
+    traverseApplyChain(E);
+    return;
+  }
   self()->traverseArg(E->fun(), TRV_Path);
   E->arg() ? self()->traverseArg(E->arg())
            : self()->traverseNull();
@@ -491,6 +518,10 @@ void Traversal<S>::traverseIdentifier(Identifier *E) {
 
 template <class S>
 void Traversal<S>::traverseLet(Let *E) {
+  if (self()->flattenChains()) {
+    traverseLetChain(E);
+    return;
+  }
   // E is a variable declaration, so traverse the definition.
   self()->traverseArg(E->variableDecl(), TRV_Decl);
   // Tell the rewriter to enter the scope of the let variable.
@@ -500,6 +531,82 @@ void Traversal<S>::traverseLet(Let *E) {
   self()->reduceLet(E);
 }
 
+
+// Traverses a chain of right-nested Let expressions (let a=1; let b=2; ...)
+// without consuming C++ stack for each link.  The stack holds the interior
+// nodes of the chain; the head E is handled by the caller's traverse().
+// The calls made here, and their order, mirror the recursive traversal
+// exactly: for each interior node, the enterSubExpr/exitSubExpr wrapper
+// is invoked in place of the full traverse().
+template <class S>
+void Traversal<S>::traverseLetChain(Let *E) {
+  NestedStack<std::pair<Let*, typename S::LocationState>> Chain;
+
+  // Walk down the chain of Let bodies.
+  Let* L = E;
+  for (;;) {
+    self()->traverseArg(L->variableDecl(), TRV_Decl);
+    self()->enterScope(L->variableDecl());
+    SExpr* B = L->body();
+    Let* Next = dyn_cast_or_null<Let>(B);
+    if (Next && !B->asCFGInstruction() && self()->keepTraversing()) {
+      Chain.push_back(std::make_pair(Next, self()->enterSubExpr(TRV_Arg)));
+      L = Next;
+      continue;
+    }
+    self()->traverseArg(B);   // The tail of the chain.
+    break;
+  }
+
+  // Walk back up, reducing each Let from the innermost out.
+  for (;;) {
+    self()->exitScope(L->variableDecl());
+    self()->reduceLet(L);
+    if (L == E)
+      break;
+    self()->traverseAllAnnotations(L->annotations());
+    self()->exitSubExpr(TRV_Arg, Chain.back().second);
+    Chain.pop_back();
+    L = Chain.empty() ? E : Chain.back().first;
+  }
+}
+
+
+// Traverses the spine of a curried application (f(a)(b)(c)...) without
+// consuming C++ stack for each argument.  Mirrors the recursive traversal
+// in the same way as traverseLetChain().
+template <class S>
+void Traversal<S>::traverseApplyChain(Apply *E) {
+  NestedStack<std::pair<Apply*, typename S::LocationState>> Chain;
+
+  // Walk down the spine.
+  Apply* A = E;
+  for (;;) {
+    SExpr* F = A->fun();
+    Apply* Next = dyn_cast_or_null<Apply>(F);
+    if (Next && !F->asCFGInstruction() && self()->keepTraversing()) {
+      Chain.push_back(std::make_pair(Next, self()->enterSubExpr(TRV_Path)));
+      A = Next;
+      continue;
+    }
+    self()->traverseArg(F, TRV_Path);   // The base of the spine.
+    break;
+  }
+
+  // Walk back up, reducing each Apply from the innermost out.
+  for (;;) {
+    A->arg() ? self()->traverseArg(A->arg())
+             : self()->traverseNull();
+    self()->reduceApply(A);
+    if (A == E)
+      break;
+    self()->traverseAllAnnotations(A->annotations());
+    self()->exitSubExpr(TRV_Path, Chain.back().second);
+    Chain.pop_back();
+    A = Chain.empty() ? E : Chain.back().first;
+  }
+}
+
 template <class S>
 void Traversal<S>::traverseIfThenElse(IfThenElse *E) {
   self()->traverseArg(E->condition());
@@ -50,6 +50,11 @@ public:
       SuperTv::traverse(E, K);
   }
 
+  /// Visitors keep no per-node state, so deeply nested Let and Apply
+  /// chains can be traversed with an explicit stack.
+  bool flattenChains() { return true; }
+  bool keepTraversing() { return Success; }
+
 protected:
   bool Success;
 };
@@ -18,8 +18,14 @@
 
 #include "Evaluator.h"
 #include "SSAPass.h"
+#include "TILCompare.h"
 #include "TypedEvaluator.h"
 
+#include "base/Stats.h"
+#include "base/ThreadPool.h"
+
+#include <atomic>
+
 
 namespace ohmu {
 namespace til  {
@@ -358,8 +364,22 @@ void TypedEvaluator::reduceCall(Call *Orig) {
   Res.Rel      = TypedCopyAttr::BT_Type;
   Res.stealSubstitution(Ca);
 
-  // TODO: FIXME!!  Res is not a stable reference; it may be invalidated.
-  evaluateTypeExpr(Res);
+  // Calls to the same code with equivalent arguments evaluate to the
+  // same return type, and generic-heavy inputs re-specialize identical
+  // instantiations many times over, so the evaluated result is memoized.
+  uint64_t Key = 0;
+  bool Cacheable = specializationKey(Res.Subst, &Key);
+  if (!Cacheable || !findSpecialization(C, Key, Res)) {
+    Substitution<TypedCopyAttr> Args;
+    if (Cacheable)
+      Args = Res.Subst;    // evaluateTypeExpr consumes the substitution.
+
+    // TODO: FIXME!!  Res is not a stable reference; it may be invalidated.
+    evaluateTypeExpr(Res);
+
+    if (Cacheable)
+      cacheSpecialization(C, Key, std::move(Args), Res);
+  }
 
   // Set the result residual.
   if (Ce) {
@@ -371,6 +391,79 @@ void TypedEvaluator::reduceCall(Call *Orig) {
 
 
 
+// Build the cache key for a specialization of a Code body.  Returns
+// false if the call is not cacheable: delayed substitutions have no
+// residual to compare, and residuals that are not values (e.g.
+// instructions) are context-dependent.
+bool TypedEvaluator::specializationKey(Substitution<TypedCopyAttr> &Subst,
+                                       uint64_t *K) {
+  uint64_t H = Subst.numNullVars();
+  for (unsigned i = 0, n = Subst.numSubstVars(); i < n; ++i) {
+    auto &At = Subst.varAttr(i);
+    if (!At.Exp || !At.Exp->isValue())
+      return false;
+    H = H * 31 + HashComparator::hashCode(At.Exp);
+  }
+  *K = H;
+  return true;
+}
+
+
+// Look up the specialization of C whose arguments are equivalent to
+// Res.Subst.  On a hit, set the evaluated return type in Res, exactly as
+// evaluateTypeExpr would have.  A hash match alone is not trusted; the
+// arguments are confirmed with EqualsComparator.
+bool TypedEvaluator::findSpecialization(Code *C, uint64_t K,
+                                        TypedCopyAttr &Res) {
+  auto It = SpecCache.find(C);
+  if (It == SpecCache.end())
+    return false;
+
+  for (auto &E : It->second) {
+    if (E.Hash != K)
+      continue;
+    if (E.Args.numNullVars()  != Res.Subst.numNullVars() ||
+        E.Args.numSubstVars() != Res.Subst.numSubstVars())
+      continue;
+
+    bool Match = true;
+    for (unsigned i = 0, n = E.Args.numSubstVars(); i < n; ++i) {
+      if (!EqualsComparator::compareExprs(E.Args.varAttr(i).Exp,
+                                          Res.Subst.varAttr(i).Exp)) {
+        Match = false;
+        break;
+      }
+    }
+    if (!Match)
+      continue;
+
+    Res.TypeExpr = E.Result.TypeExpr;
+    Res.Rel      = E.Result.Rel;
+    Res.Subst    = E.Result.Subst;
+    return true;
+  }
+  return false;
+}
+
+
+void TypedEvaluator::cacheSpecialization(Code *C, uint64_t K,
+                                         Substitution<TypedCopyAttr> &&Args,
+                                         const TypedCopyAttr &Res) {
+  auto It = SpecCache.find(C);
+  if (It == SpecCache.end()) {
+    SpecCache.insert(std::make_pair(C, std::vector<SpecEntry>()));
+    It = SpecCache.find(C);
+  }
+  SpecEntry E;
+  E.Hash            = K;
+  E.Args            = std::move(Args);
+  E.Result.TypeExpr = Res.TypeExpr;
+  E.Result.Rel      = Res.Rel;
+  E.Result.Subst    = Res.Subst;
+  It->second.push_back(std::move(E));
+}
+
+
 void TypedEvaluator::reduceAlloc(Alloc *Orig) {
   auto& Res = resultAttr();
   auto* Ve = attr(0).Exp;
@@ -807,7 +900,10 @@ void TypedEvaluator::traverseIfThenElse(IfThenElse *Orig) {
 }
 
 
+OHMU_STAT(NumFuturesForced, "Futures forced by the type evaluator.");
+
 void TypedEvaluator::traverseFuture(Future* Orig) {
+  OHMU_STAT_INC(NumFuturesForced);
   SExpr *Res = Orig->force();
   traverse(Res, TRV_Decl);
   resultAttr() = std::move( lastAttr() );
@@ -843,10 +939,13 @@ void TypedEvaluator::traverseNestedCode(Code* Orig) {
       continue;
     assert(Vd->kind() != VarDecl::VK_Let);
 
-    auto &At    = Ns->var(Vidx + i);
+    // Rebind through updateVar: the clone shares its environment with the
+    // enclosing scope, so writing through var() would corrupt it.
+    auto At     = Ns->var(Vidx + i);
     At.Exp      = Nb->arguments()[i];
     At.Rel      = TypedCopyAttr::BT_Equivalent;
     At.TypeExpr = Nb->arguments()[i];
+    Ns->updateVar(Vidx + i, std::move(At));
   }
 
   // Add pending block.
@@ -892,7 +991,8 @@ bool TypedEvaluator::reduceNestedCall(Call* Orig, Code* C) {
 
   // Insert a Goto to the new block.
   std::vector<SExpr*> Args;
-  for (auto& At : Ca.Subst.varAttrs()) {
+  for (unsigned i = 0, n = Ca.Subst.numSubstVars(); i < n; ++i) {
+    auto& At = Ca.Subst.varAttr(i);
     // TODO: (FIXME) Ugly hack to deal with self-arguments.
     if (isa<Function>(At.Exp)) {
       Args.push_back(nullptr);
@@ -931,6 +1031,62 @@ void TypedEvaluator::processPendingBlocks() {
 }
 
 
+SExpr* TypedEvaluator::traverseAllParallel(SExpr *E, ThreadPool &Pool,
+    std::vector<std::unique_ptr<MemRegion>> &Regions) {
+  assert(emptyAttrs() && "In the middle of a traversal.");
+
+  traverse(E, TRV_Tail);
+  SExpr *Result = attr(0).Exp;
+  popAttr();
+
+  // Claim the queued futures.  These are the lazily rewritten code
+  // bodies and type expressions; each one carries its own scope and
+  // builder state, so any evaluator can force it.
+  std::vector<Future*> Fs;
+  while (!FutureQueue.empty()) {
+    Fs.push_back(FutureQueue.front());
+    FutureQueue.pop();
+  }
+
+  unsigned NTasks = Pool.numThreads();
+  if (NTasks > Fs.size())
+    NTasks = Fs.size();
+
+  // Force the futures on the pool, load-balanced with an atomic cursor.
+  // Each task evaluates with its own TypedEvaluator over its own arena;
+  // futures created during forcing land on the worker's queue and are
+  // drained before the worker exits, since they hold a pointer to it.
+  // The locals captured by reference are safe because we block below.
+  std::atomic<uint32_t> Next(0);
+  for (unsigned t = 0; t < NTasks; ++t) {
+    Regions.emplace_back(new MemRegion());
+    MemRegionRef Arena(Regions.back().get());
+    Pool.submit([&Fs, &Next, Arena]() {
+      TypedEvaluator Ev(Arena);
+      TypedEvalFuture::ThreadReducer = &Ev;
+      for (;;) {
+        uint32_t i = Next.fetch_add(1, std::memory_order_relaxed);
+        if (i >= Fs.size())
+          break;
+        OHMU_STAT_INC(NumFuturesForced);
+        Fs[i]->force();
+        while (!Ev.FutureQueue.empty()) {
+          auto *F = Ev.FutureQueue.front();
+          Ev.FutureQueue.pop();
+          OHMU_STAT_INC(NumFuturesForced);
+          F->force();
+        }
+      }
+      TypedEvalFuture::ThreadReducer = nullptr;
+    });
+  }
+  Pool.waitForAll();
+
+  clearAttrFrames();
+  return Result;
+}
+
+
 
 }  // end namespace til
 }  // end namespace ohmu
@@ -23,10 +23,14 @@
 #include "AttributeGrammar.h"
 #include "CopyReducer.h"
 
+#include <memory>
 #include <queue>
 
 
 namespace ohmu {
+
+class ThreadPool;
+
 namespace til  {
 
 class ScopeCPS;
@@ -246,6 +250,12 @@ private:
   bool reduceNestedCall(Call* Orig, Code* C);
   void processPendingBlocks();
 
+  bool specializationKey (Substitution<TypedCopyAttr> &Subst, uint64_t *K);
+  bool findSpecialization(Code *C, uint64_t K, TypedCopyAttr &Res);
+  void cacheSpecialization(Code *C, uint64_t K,
+                           Substitution<TypedCopyAttr> &&Args,
+                           const TypedCopyAttr &Res);
+
   enum EvaluationMode {
     TEval_Copy,      ///< Do a deep copy of a term, traversing inside values
     TEval_WeakHead   ///< Evaluate to weak-head; do not traverse inside values
@@ -258,15 +268,34 @@ private:
   void restoreEvalMode(EvaluationMode M) { EvalMode = M; }
 
 public:
+  /// Like traverseAll, but force the queued futures on Pool.  Each
+  /// worker forces futures with its own TypedEvaluator and arena, so
+  /// independent function bodies evaluate in parallel; force() blocks
+  /// only on a genuine cross-thread dependency.  Blocks within a single
+  /// CFG are still built serially, since they extend one SCFG.  The
+  /// worker arenas are appended to Regions; the caller must keep them
+  /// alive (see Global::adoptRegion).
+  SExpr* traverseAllParallel(SExpr *E, ThreadPool &Pool,
+                             std::vector<std::unique_ptr<MemRegion>> &Regions);
+
   TypedEvaluator(MemRegionRef A)
     : Super(A), EvalMode(TEval_Copy)
   { }
 
+  /// A memoized specialization of a Code body: the arguments it was
+  /// applied to, and the evaluated return type.
+  struct SpecEntry {
+    uint64_t                    Hash;    ///< Hash of the argument residuals.
+    Substitution<TypedCopyAttr> Args;    ///< Arguments of the call.
+    TypedCopyAttr               Result;  ///< Evaluated return type.
+  };
+
 protected:
   EvaluationMode                             EvalMode;
   std::vector<std::unique_ptr<PendingBlock>> PendingBlks;
   std::queue<PendingBlock*>                  PendingBlockQueue;
   DenseMap<Code*, PendingBlock*>             CodeMap;
+  DenseMap<Code*, std::vector<SpecEntry>>    SpecCache;
 };
 
 
@@ -280,8 +309,10 @@ void TypedEvaluator::reduceLiteralT(LiteralT<T> *Orig) {
   LiteralT<T>* Re;
   if (EvalMode == TEval_WeakHead)
     Re = Orig;
-  else
+  else if (Orig->annotations())   // annotations are copied onto the result
     Re = Builder.newLiteralT<T>(Orig->value());
+  else
+    Re = Builder.internLiteralT<T>(Orig->value());
 
   auto& Res = resultAttr();
   Res.Exp      = Re;